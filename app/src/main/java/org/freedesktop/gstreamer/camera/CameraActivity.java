@@ -53,6 +53,15 @@ public class CameraActivity extends AppCompatActivity {
     private final Handler mHideHandler = new Handler();
     private SurfaceView surfaceView;
     private ImageButton playButton;
+    private volatile boolean playing;
+    /* Posted for every state change, allocated once */
+    private final Runnable updatePlayButton = new Runnable() {
+        @Override
+        public void run() {
+            playButton.setImageResource(playing ? android.R.drawable.ic_media_pause
+                    : android.R.drawable.ic_media_play);
+        }
+    };
     private final Runnable mHidePart2Runnable = new Runnable() {
         @SuppressLint("InlinedApi")
         @Override
@@ -160,21 +169,9 @@ public class CameraActivity extends AppCompatActivity {
 
         gstAhc.setStateChangedListener(new GstAhc.StateChangedListener(){
             @Override
-            public void stateChanged(GstAhc gstAhc, final GstAhc.State state) {
-                playButton = (ImageButton) findViewById(R.id.play_button);
-
-                CameraActivity.this.runOnUiThread(new Runnable() {
-                    @Override
-                    public void run() {
-                        if (state != GstAhc.State.PLAYING) {
-                            playButton.setImageResource(android.R.drawable.ic_media_play);
-                        }
-                        else {
-                            playButton.setImageResource(android.R.drawable.ic_media_pause);
-                        }
-                    }
-                });
-
+            public void stateChanged(GstAhc gstAhc, GstAhc.State state) {
+                playing = state == GstAhc.State.PLAYING;
+                CameraActivity.this.runOnUiThread(updatePlayButton);
             }
         });
 
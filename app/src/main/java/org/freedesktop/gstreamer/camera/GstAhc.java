@@ -9,13 +9,17 @@ import org.freedesktop.gstreamer.GStreamer;
 
 import java.io.Closeable;
 import java.io.IOException;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.charset.Charset;
 import java.util.Arrays;
 
 public class GstAhc implements Closeable, SurfaceHolder.Callback {
 
     private final static String TAG = GstAhc.class.getName();
 
-    private native void nativeInit();
+    private native void nativeInit(boolean standby, boolean sharedDispatcher,
+                                   ByteBuffer events, ByteBuffer stats);
 
     private native void nativeFinalize();
 
@@ -31,8 +35,57 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
 
     private native void nativeChangeResolution(int width, int height);
 
+    private native void nativeSetResolutionSwitchMode(int mode);
+
+    private native long nativeGetResolutionSwitchLatency();
+
+    private native long nativeGetStandbyMemory();
+
+    private native int nativeAddBranch(int type, String description);
+
+    private native boolean nativeRemoveBranch(int id);
+
+    private native int nativeStartRawCapture(String location, int maxFrames);
+
+    private native boolean nativeGetRawCaptureStats(int id, long[] counters);
+
+    private native boolean nativeSetFrameDelivery(boolean enabled);
+
+    private native void nativeSetMaxHeldFrames(int maxHeld, int policy);
+
+    private native void nativeReleaseFrame(int frameId);
+
+    private native void nativeGetFrameCounters(long[] counters);
+
     private native void nativeSetRotateMethod(int orientation);
 
+    private native void nativeGetBusCounters(long[] counters);
+
+    private native void nativeSetQueueConfig(int type, int maxBuffers, int leak);
+
+    private native long[] nativeGetQueueStats();
+
+    private native void nativeSetThreadConfig(int role, long cpus, int nice,
+                                              int rtPriority);
+
+    private native long[] nativeGetThreadStats();
+
+    private native String[] nativeGetTraceNames();
+
+    private native long[] nativeGetTraceStats();
+
+    private native String nativeDumpTrace();
+
+    private native void nativeMarkStartup(int mark, long nanoTime);
+
+    private native long[] nativeGetStartupTimeline();
+
+    private native String nativeDumpStartupTimeline();
+
+    private native void nativeStartRecording(int eventsPerThread);
+
+    private native boolean nativeStopRecording(String path);
+
     private native void nativeSetAutoFocus(boolean enabled);
 
     public enum Rotate {
@@ -47,6 +100,21 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
         AUTOMATIC
     }
 
+    public enum ResolutionSwitchMode {
+        RESTART,
+        RENEGOTIATE
+    }
+
+    private ResolutionSwitchMode resolutionSwitchMode = ResolutionSwitchMode.RENEGOTIATE;
+
+    private boolean standby;
+
+    public enum BranchType {
+        PREVIEW,
+        RECORD,
+        ANALYSIS
+    }
+
     private static final Rotate[] rotateMap = {
             Rotate.NONE,
             Rotate.CLOCKWISE,
@@ -73,28 +141,99 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
 
     private native void nativeSetWhiteBalance(int wb);
 
+    private native int nativeApplySettings(int set, int wb, boolean autoFocus,
+                                           int rotate, int width, int height);
+
+    private native int nativeGetAppliedSettings();
+
     private long native_custom_data;
 
     private String whiteBalanceMode;
     private Context context;
 
-    private GstAhc(Context context) {
-        nativeInit();
+    /* Event ring shared with native code, see gstahc.h for the layout */
+    private static final int EVENT_RING_SIZE = 4096;
+    private static final int EVENT_HEADER_SIZE = 16;
+    private static final int EVENT_RECORD_HEADER_SIZE = 12;
+    private static final int EVENT_PAD = 0;
+    private static final int EVENT_ERROR = 1;
+    private static final int EVENT_STATE_CHANGED = 2;
+    private static final int EVENT_INITIALIZED = 3;
+    private static final int EVENT_PROCESSOR_RESULT = 4;
+    private static final Charset UTF8 = Charset.forName("UTF-8");
+
+    private final ByteBuffer events =
+            ByteBuffer.allocateDirect(EVENT_RING_SIZE).order(ByteOrder.nativeOrder());
+    private final byte[] eventText = new byte[EVENT_RING_SIZE];
+
+    /**
+     * Counters in the stats block, in the order of GstAhcStat.
+     */
+    public enum Stat {
+        VERSION,
+        CAPTURED,
+        RENDERED,
+        DROPPED,
+        RENEGOTIATIONS,
+        FPS_MILLI,
+        PREVIEW_QUEUE_LEVEL,
+        BRANCH_QUEUE_LEVEL,
+        LATENCY_US
+    }
+
+    /* Stats block written by native code, see GstAhcStat */
+    private final ByteBuffer stats =
+            ByteBuffer.allocateDirect(Stat.values().length * 4)
+                    .order(ByteOrder.nativeOrder());
+
+    private GstAhc(Context context, boolean standby, boolean sharedDispatcher) {
+        nativeInit(standby, sharedDispatcher, events, stats);
         this.context = context;
+        this.standby = standby;
     }
 
     public static GstAhc init(Context context) throws Exception {
+        return init(context, false);
+    }
+
+    /**
+     * With standby enabled every preview resolution gets its own branch
+     * which is kept running, so changeResolutionTo() takes effect on the
+     * next frame at the cost of getStandbyMemory() bytes.
+     */
+    public static GstAhc init(Context context, boolean standby) throws Exception {
+        return init(context, standby, false);
+    }
+
+    /**
+     * With sharedDispatcher enabled the pipeline messages of this instance
+     * are handled on one native thread shared by all instances which enable
+     * it, instead of on a thread of its own.
+     */
+    public static GstAhc init(Context context, boolean standby,
+                              boolean sharedDispatcher) throws Exception {
+        long entered = System.nanoTime();
 
         System.loadLibrary("gstreamer_android");
         System.loadLibrary("android_camera");
+        long librariesLoaded = System.nanoTime();
 
         GStreamer.init(context);
+        long gstreamerInit = System.nanoTime();
 
         if (!nativeClassInit()) {
             throw new Exception("Failed to load application jni library.");
         }
-
-        return new GstAhc(context);
+        long classInit = System.nanoTime();
+
+        GstAhc gstAhc = new GstAhc(context, standby, sharedDispatcher);
+        gstAhc.nativeMarkStartup(StartupMark.INIT.ordinal(), entered);
+        gstAhc.nativeMarkStartup(StartupMark.LIBRARIES_LOADED.ordinal(),
+                librariesLoaded);
+        gstAhc.nativeMarkStartup(StartupMark.GSTREAMER_INIT.ordinal(),
+                gstreamerInit);
+        gstAhc.nativeMarkStartup(StartupMark.CLASS_INIT.ordinal(), classInit);
+        return gstAhc;
     }
 
     private static final State[] stateMap = {
@@ -164,25 +303,103 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
         nativeSetAutoFocus (enabled);
     }
 
-    public void setWhiteBalanceMode(String mode) {
-        Log.d(TAG, "WhiteBlanceMode: " + mode);
-
+    private static int whiteBalanceIndex(String mode) {
         int idx = Arrays.asList(whiteBalanceMap).indexOf(mode);
 
         if (idx == -1 || idx >= whiteBalanceMap.length) {
             Log.d(TAG, "Invalid white balance mode. Try to use 'auto'");
             idx = 0;
         }
+        return idx;
+    }
+
+    public void setWhiteBalanceMode(String mode) {
+        Log.d(TAG, "WhiteBlanceMode: " + mode);
 
-        nativeSetWhiteBalance(idx);
+        nativeSetWhiteBalance(whiteBalanceIndex(mode));
+    }
+
+    /**
+     * A batch of camera settings for applySettings(). Only the settings
+     * which were set are changed.
+     */
+    public static class Settings {
+        /* Must match GstAhcSettingFlags */
+        private static final int WHITE_BALANCE = 1 << 0;
+        private static final int AUTO_FOCUS = 1 << 1;
+        private static final int ROTATE_METHOD = 1 << 2;
+        private static final int RESOLUTION = 1 << 3;
+
+        private int set;
+        private int whiteBalance;
+        private boolean autoFocus;
+        private int rotate;
+        private int width;
+        private int height;
+
+        public Settings setWhiteBalanceMode(String mode) {
+            whiteBalance = whiteBalanceIndex(mode);
+            set |= WHITE_BALANCE;
+            return this;
+        }
+
+        public Settings setAutoFocus(boolean enabled) {
+            autoFocus = enabled;
+            set |= AUTO_FOCUS;
+            return this;
+        }
+
+        public Settings setRotateMethod(Rotate method) {
+            rotate = Arrays.asList(rotateMap).indexOf(method);
+            set |= ROTATE_METHOD;
+            return this;
+        }
+
+        public Settings setResolution(int width, int height) {
+            this.width = width;
+            this.height = height;
+            set |= RESOLUTION;
+            return this;
+        }
+    }
+
+    /**
+     * Applies all settings of the batch together, right before the next
+     * frame leaves the camera. The first frame captured after the camera
+     * acknowledged them carries the returned id in a GstAhcSettingsMeta for
+     * native consumers, and a rotation takes effect with that frame. When
+     * no frames flow, e.g. while paused, the batch is applied at once.
+     */
+    public int applySettings(Settings settings) {
+        return nativeApplySettings(settings.set, settings.whiteBalance,
+                settings.autoFocus, settings.rotate, settings.width,
+                settings.height);
+    }
+
+    /**
+     * Returns the id of the last settings batch the camera acknowledged.
+     */
+    public int getAppliedSettings() {
+        return nativeGetAppliedSettings();
     }
 
     public void setRotateMethod(Rotate rotate) {
         nativeSetRotateMethod(Arrays.asList(rotateMap).indexOf(rotate));
     }
 
+    public void setResolutionSwitchMode(ResolutionSwitchMode mode) {
+        resolutionSwitchMode = mode;
+        nativeSetResolutionSwitchMode(mode.ordinal());
+    }
+
     public void changeResolutionTo(int width, int height) {
         Log.d(TAG, "Trying to set resolution to (w: " + width + " h: " + height + ")");
+
+        if (standby || resolutionSwitchMode == ResolutionSwitchMode.RENEGOTIATE) {
+            nativeChangeResolution(width, height);
+            return;
+        }
+
         nativePause();
 
         nativeChangeResolution(width, height);
@@ -190,12 +407,456 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
         nativePlay();
     }
 
+    /**
+     * Bytes the inactive standby branches can hold, 0 without standby.
+     */
+    public long getStandbyMemory() {
+        return nativeGetStandbyMemory();
+    }
+
+    /**
+     * Time in nanoseconds the last resolution change took until its first
+     * frame was rendered, or -1 if it has not completed yet.
+     */
+    public long getResolutionSwitchLatency() {
+        return nativeGetResolutionSwitchLatency();
+    }
+
+    /**
+     * Attaches a consumer to the camera next to the preview. The branch gets
+     * its own leaky queue and thread, so it can not stall the preview.
+     *
+     * @param description gst-launch style description of the branch, e.g.
+     *                    "ahcconvert ! video/x-raw,format=I420 ! x264enc ! mp4mux !
+     *                    filesink location=..."
+     *                    May be null for ANALYSIS.
+     * @return branch id for removeBranch(), or -1 on failure
+     */
+    public int addBranch(BranchType type, String description) {
+        return nativeAddBranch(type.ordinal(), description);
+    }
+
+    /**
+     * Drains and detaches a branch added with addBranch(). Recordings are
+     * finalized before the branch goes away.
+     */
+    public boolean removeBranch(int id) {
+        return nativeRemoveBranch(id);
+    }
+
+    /**
+     * Records up to maxFrames raw camera frames into a file for replay with
+     * the ahcreplaysrc source. The file is allocated up front and written
+     * from a native thread of its own.
+     *
+     * @return branch id, stop the capture with removeBranch(), or -1 on
+     *         failure
+     */
+    public int startRawCapture(String location, int maxFrames) {
+        return nativeStartRawCapture(location, maxFrames);
+    }
+
+    public static class RawCaptureStats {
+        public long written;
+        /* Waiting for the writer */
+        public long pending;
+        /* Dropped because the storage did not keep up */
+        public long dropped;
+        /* Not recorded because the file was full or the caps changed */
+        public long skipped;
+    }
+
+    /**
+     * @return the progress of a capture started with startRawCapture(), or
+     *         null once its branch is removed
+     */
+    public RawCaptureStats getRawCaptureStats(int id) {
+        long[] values = new long[4];
+        RawCaptureStats stats = new RawCaptureStats();
+
+        if (!nativeGetRawCaptureStats(id, values)) {
+            return null;
+        }
+        stats.written = values[0];
+        stats.pending = values[1];
+        stats.dropped = values[2];
+        stats.skipped = values[3];
+        return stats;
+    }
+
+    public static interface FrameListener {
+        /**
+         * Called from a native thread for every delivered camera frame.
+         * The buffer wraps the native frame memory directly and must not be
+         * written to or used after releaseFrame(frameId).
+         */
+        abstract void frameAvailable(GstAhc gstAhc, ByteBuffer frame, int frameId,
+                                     int width, int height, int stride, long pts);
+    }
+
+    private FrameListener frameListener;
+
+    public void setFrameListener(FrameListener listener) {
+        frameListener = listener;
+        nativeSetFrameDelivery(listener != null);
+    }
+
+    /* What happens to new frames while the listener holds the maximum */
+    public enum FramePolicy {
+        /* New frames are dropped */
+        DROP,
+        /* The frame branch waits for a release */
+        BLOCK,
+        /* Only the newest frame is kept and delivered on the next release,
+         * so the listener is at most one frame behind */
+        LATEST,
+        /* Like LATEST, but frames are decimated to the rate the listener
+         * keeps up with before they are kept, which can leave it more than
+         * one frame behind */
+        LATEST_DECIMATED
+    }
+
+    /**
+     * Limits how many frames the listener may hold at once. The preview is
+     * not affected by any policy.
+     */
+    public void setMaxHeldFrames(int maxHeld, FramePolicy policy) {
+        nativeSetMaxHeldFrames(maxHeld, policy.ordinal());
+    }
+
+    /**
+     * Returns a frame passed to the FrameListener to its buffer pool.
+     */
+    public void releaseFrame(int frameId) {
+        nativeReleaseFrame(frameId);
+    }
+
+    public static class FrameCounters {
+        public long delivered;
+        /* Replaced by a newer frame before delivery */
+        public long superseded;
+        /* LATEST_DECIMATED: skipped because the listener is slower than the
+         * camera */
+        public long decimated;
+        public long dropped;
+    }
+
+    public FrameCounters getFrameCounters() {
+        long[] values = new long[4];
+        FrameCounters counters = new FrameCounters();
+
+        nativeGetFrameCounters(values);
+        counters.delivered = values[0];
+        counters.superseded = values[1];
+        counters.decimated = values[2];
+        counters.dropped = values[3];
+        return counters;
+    }
+
+    public static class BusCounters {
+        /* Every message posted on the pipeline bus */
+        public long received;
+        /* Messages handled, the rest is dropped where it is posted */
+        public long forwarded;
+    }
+
+    public BusCounters getBusCounters() {
+        long[] values = new long[2];
+        BusCounters counters = new BusCounters();
+
+        nativeGetBusCounters(values);
+        counters.received = values[0];
+        counters.forwarded = values[1];
+        return counters;
+    }
+
+    public enum QueueLeak {
+        /* A full queue blocks the camera */
+        NONE,
+        /* Drops the new frame */
+        UPSTREAM,
+        /* Drops the oldest queued frame */
+        DOWNSTREAM
+    }
+
+    /**
+     * Sets how many frames the queues of a kind of branch hold and what
+     * they do when full. Applies to running branches too.
+     */
+    public void setQueueConfig(BranchType type, int maxBuffers, QueueLeak leak) {
+        nativeSetQueueConfig(type.ordinal(), maxBuffers, leak.ordinal());
+    }
+
+    public static class QueueStats {
+        public BranchType type;
+        /* 0 for the preview queue */
+        public int branchId;
+        public int level;
+        public int maxBuffers;
+        public long pushed;
+        public long dropped;
+    }
+
+    public QueueStats[] getQueueStats() {
+        long[] values = nativeGetQueueStats();
+        QueueStats[] stats = new QueueStats[values.length / 6];
+
+        for (int i = 0; i < stats.length; i++) {
+            stats[i] = new QueueStats();
+            stats[i].type = BranchType.values()[(int) values[i * 6]];
+            stats[i].branchId = (int) values[i * 6 + 1];
+            stats[i].level = (int) values[i * 6 + 2];
+            stats[i].maxBuffers = (int) values[i * 6 + 3];
+            stats[i].pushed = values[i * 6 + 4];
+            stats[i].dropped = values[i * 6 + 5];
+        }
+        return stats;
+    }
+
+    public enum ThreadRole {
+        CAPTURE,
+        DISPLAY,
+        ENCODE,
+        OTHER
+    }
+
+    /**
+     * Pins the streaming threads of role to the CPUs set in the cpus mask
+     * (0 for all) and gives them a nice value, or SCHED_FIFO with
+     * rtPriority 1-99. Takes effect for threads started afterwards.
+     */
+    public void setThreadConfig(ThreadRole role, long cpus, int nice,
+                                int rtPriority) {
+        nativeSetThreadConfig(role.ordinal(), cpus, nice, rtPriority);
+    }
+
+    public static class ThreadStats {
+        public ThreadRole role;
+        public int tid;
+        public int cpu;
+        /* -1 if the kernel does not report it */
+        public long migrations;
+        public boolean configured;
+    }
+
+    public ThreadStats[] getThreadStats() {
+        long[] values = nativeGetThreadStats();
+        ThreadStats[] stats = new ThreadStats[values.length / 5];
+
+        for (int i = 0; i < stats.length; i++) {
+            stats[i] = new ThreadStats();
+            stats[i].role = ThreadRole.values()[(int) values[i * 5]];
+            stats[i].tid = (int) values[i * 5 + 1];
+            stats[i].cpu = (int) values[i * 5 + 2];
+            stats[i].migrations = values[i * 5 + 3];
+            stats[i].configured = values[i * 5 + 4] != 0;
+        }
+        return stats;
+    }
+
+    public enum TraceKind {
+        /* From a buffer entering an element to leaving it */
+        PROCESSING,
+        /* From capture to the preview sink */
+        LATENCY
+    }
+
+    public static class TraceStats {
+        public String name;
+        public TraceKind kind;
+        public long count;
+        /* Upper bounds of the histogram buckets, in microseconds */
+        public int p50;
+        public int p90;
+        public int p99;
+        public int max;
+    }
+
+    /**
+     * Histograms of the in-process tracer, one per element plus the end to
+     * end latency. Elements that saw no buffers have a count of 0.
+     */
+    public TraceStats[] getTraceStats() {
+        long[] values = nativeGetTraceStats();
+        /* Slots are only appended, so there are at least as many names */
+        String[] names = nativeGetTraceNames();
+        TraceStats[] stats = new TraceStats[values.length / 6];
+
+        for (int i = 0; i < stats.length; i++) {
+            stats[i] = new TraceStats();
+            stats[i].name = names[i];
+            stats[i].kind = TraceKind.values()[(int) values[i * 6]];
+            stats[i].count = values[i * 6 + 1];
+            stats[i].p50 = (int) values[i * 6 + 2];
+            stats[i].p90 = (int) values[i * 6 + 3];
+            stats[i].p99 = (int) values[i * 6 + 4];
+            stats[i].max = (int) values[i * 6 + 5];
+        }
+        return stats;
+    }
+
+    /**
+     * The tracer histograms as a table, e.g. for a bug report.
+     */
+    public String dumpTrace() {
+        return nativeDumpTrace();
+    }
+
+    /**
+     * Points between init() and the first frame, in the order of
+     * GstAhcStartupMark.
+     */
+    public enum StartupMark {
+        INIT,
+        LIBRARIES_LOADED,
+        GSTREAMER_INIT,
+        CLASS_INIT,
+        NATIVE_INIT,
+        START,
+        PIPELINE_ATTACHED,
+        SURFACE,
+        INITIALIZED,
+        PLAY,
+        PLAYING,
+        FIRST_FRAME
+    }
+
+    public static class StartupPhase {
+        public StartupMark mark;
+        /* Microseconds since init() was entered */
+        public long offset;
+        /* Microseconds since the mark before, the phase ending here */
+        public long duration;
+    }
+
+    /**
+     * The startup marks reached so far, in the order they were reached.
+     */
+    public StartupPhase[] getStartupTimeline() {
+        long[] values = nativeGetStartupTimeline();
+        StartupPhase[] phases = new StartupPhase[values.length / 3];
+
+        for (int i = 0; i < phases.length; i++) {
+            phases[i] = new StartupPhase();
+            phases[i].mark = StartupMark.values()[(int) values[i * 3]];
+            phases[i].offset = values[i * 3 + 1];
+            phases[i].duration = values[i * 3 + 2];
+        }
+        return phases;
+    }
+
+    /**
+     * The startup timeline as a table with the longest phase marked.
+     */
+    public String dumpStartupTimeline() {
+        return nativeDumpStartupTimeline();
+    }
+
+    /**
+     * Starts recording buffer flow, state changes, native calls and bus
+     * dispatch of all pipelines in the process. The last eventsPerThread
+     * events of each thread are kept, 0 for the default.
+     */
+    public void startTraceRecording(int eventsPerThread) {
+        nativeStartRecording(eventsPerThread);
+    }
+
+    /**
+     * Stops recording and writes the events to path as Chrome trace-event
+     * JSON, which Perfetto and chrome://tracing open.
+     */
+    public boolean stopTraceRecording(String path) {
+        return nativeStopRecording(path);
+    }
+
+    /* Called from native code */
+    private void onFrame(ByteBuffer frame, int frameId, int width, int height,
+                         int stride, long pts) {
+        FrameListener listener = frameListener;
+
+        if (listener == null) {
+            nativeReleaseFrame(frameId);
+            return;
+        }
+        listener.frameAvailable(this, frame, frameId, width, height, stride, pts);
+    }
+
     @Override
-    public void close() throws IOException {
+    /* Synchronized so the native side is torn down only once */
+    public synchronized void close() throws IOException {
         nativeFinalize();
     }
 
-    /* Called from native code */
+    /**
+     * Events the native side dropped because they were not drained in
+     * time.
+     */
+    public int getDroppedEvents() {
+        return events.getInt(8);
+    }
+
+    /**
+     * Current value of a counter in the stats block. Reads shared memory
+     * only, cheap enough to call every frame.
+     */
+    public int getStat(Stat stat) {
+        return stats.getInt(stat.ordinal() * 4);
+    }
+
+    /* Called from native code once per batch of events with the write
+     * offset sampled by the ring, reading the one in the buffer could see
+     * records which are not complete yet. State and initialization events
+     * are read without allocating, errors and processor results still
+     * allocate their String. */
+    private void onEvents(int write) {
+        int size = (events.capacity() - EVENT_HEADER_SIZE) & ~3;
+        int read = events.getInt(4);
+
+        while (read != write) {
+            if (size - read < EVENT_RECORD_HEADER_SIZE) {
+                read = 0;
+                continue;
+            }
+
+            int at = EVENT_HEADER_SIZE + read;
+            int type = events.getInt(at);
+            int arg = events.getInt(at + 4);
+            int length = events.getInt(at + 8);
+
+            if (type == EVENT_PAD) {
+                read = 0;
+                continue;
+            }
+
+            switch (type) {
+                case EVENT_ERROR:
+                    for (int i = 0; i < length; i++) {
+                        eventText[i] = events.get(at + EVENT_RECORD_HEADER_SIZE + i);
+                    }
+                    onError(new String(eventText, 0, length, UTF8));
+                    break;
+                case EVENT_STATE_CHANGED:
+                    onStateChanged(arg);
+                    break;
+                case EVENT_INITIALIZED:
+                    onGStreamerInitialized();
+                    break;
+                case EVENT_PROCESSOR_RESULT:
+                    for (int i = 0; i < length; i++) {
+                        eventText[i] = events.get(at + EVENT_RECORD_HEADER_SIZE + i);
+                    }
+                    onProcessorResult(new String(eventText, 0, length, UTF8));
+                    break;
+            }
+
+            read += EVENT_RECORD_HEADER_SIZE + ((length + 3) & ~3);
+            if (read == size) {
+                read = 0;
+            }
+        }
+        events.putInt(4, read);
+    }
+
     private void onGStreamerInitialized() {
         Log.d(TAG, "Playing Camera!");
         nativePlay();
@@ -216,4 +877,20 @@ public class GstAhc implements Closeable, SurfaceHolder.Callback {
             errorListener.error(this, errorMessage);
         }
     }
+
+    public static interface ProcessorResultListener {
+        abstract void result(GstAhc gstAhc, String result);
+    }
+
+    private ProcessorResultListener processorResultListener;
+
+    public void setProcessorResultListener(ProcessorResultListener listener) {
+        processorResultListener = listener;
+    }
+
+    private void onProcessorResult(String result) {
+        if (processorResultListener != null) {
+            processorResultListener.result(this, result);
+        }
+    }
 }
@@ -23,9 +23,26 @@ LOCAL_PATH := $(call my-dir)
 
 include $(CLEAR_VARS)
 
-LOCAL_CFLAGS := -DGST_USE_UNSTABLE_API
+# Raw capture files grow beyond 2 GB, also on 32 bit ABIs
+LOCAL_CFLAGS := -DGST_USE_UNSTABLE_API -D_FILE_OFFSET_BITS=64
 LOCAL_MODULE    := android_camera
-LOCAL_SRC_FILES := android_camera.c dummy.cpp
+LOCAL_SRC_FILES := android_camera.c gstahc.c gstahcbranch.c gstahcframes.c \
+                   gstahcprocessor.c gstahcscheduler.c gstahccontrol.c \
+                   gstahcsettings.c gstahcdispatcher.c \
+                   gstahcthreads.c gstahcevents.c gstahcstats.c gstahctrace.c \
+                   gstahcstartup.c gstahcrecorder.c gstahcfakesrc.c \
+                   gstahcreplaysrc.c gstahcrawsink.c gstahcconvert.c \
+                   gstahcconvert-x86.c gstahcpyramid.c \
+                   dummy.cpp
+# The NEON kernels of ahcconvert and ahcpyramid, only this file is built with NEON on
+# armeabi-v7a, the CPU is checked at runtime
+ifeq ($(TARGET_ARCH_ABI),armeabi-v7a)
+LOCAL_SRC_FILES += gstahcconvert-neon.c.neon
+LOCAL_CFLAGS += -DGST_AHC_HAVE_NEON
+else ifeq ($(TARGET_ARCH_ABI),arm64-v8a)
+LOCAL_SRC_FILES += gstahcconvert-neon.c
+LOCAL_CFLAGS += -DGST_AHC_HAVE_NEON
+endif
 LOCAL_SHARED_LIBRARIES := gstreamer_android
 LOCAL_LDLIBS := -llog -landroid
 include $(BUILD_SHARED_LIBRARY)
@@ -53,5 +70,5 @@ GSTREAMER_PLUGINS	:=  $(GSTREAMER_PLUGINS_CORE) \
 			    opengl
 
 # Needed for new versions of gstreamer
-GSTREAMER_EXTRA_DEPS      := gstreamer-video-1.0 gstreamer-photography-1.0
+GSTREAMER_EXTRA_DEPS      := gstreamer-video-1.0 gstreamer-app-1.0 gstreamer-photography-1.0
 include $(GSTREAMER_NDK_BUILD_PATH)/gstreamer-1.0.mk
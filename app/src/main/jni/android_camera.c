@@ -28,8 +28,8 @@
 #include <android/native_window_jni.h>
 #include <gst/gst.h>
 #include <pthread.h>
-#include <gst/video/videooverlay.h>
-#include <gst/interfaces/photography.h>
+
+#include "gstahc.h"
 
 GST_DEBUG_CATEGORY_STATIC (debug_category);
 #define GST_CAT_DEFAULT debug_category
@@ -46,26 +46,19 @@ GST_DEBUG_CATEGORY_STATIC (debug_category);
 # define SET_CUSTOM_DATA(env, thiz, fieldID, data) (*env)->SetLongField (env, thiz, fieldID, (jlong)(jint)data)
 #endif
 
-typedef struct _GstAhc
-{
-  jobject app;
-  GstElement *pipeline;
-  GMainLoop *main_loop;
-  ANativeWindow *native_window;
-  gboolean state;
-  GstElement *ahcsrc;
-  GstElement *filter;
-  GstElement *vsink;
-  gboolean initialized;
-} GstAhc;
-
-static pthread_t gst_app_thread;
 static pthread_key_t current_jni_env;
 static JavaVM *java_vm;
 static jfieldID native_android_camera_field_id;
-static jmethodID on_error_method_id;
-static jmethodID on_state_changed_method_id;
-static jmethodID on_gstreamer_initialized_method_id;
+static jmethodID on_events_method_id;
+static jmethodID on_frame_method_id;
+
+/* user_data of the GstAhc callbacks */
+typedef struct _CameraApp
+{
+  jobject object;
+  /* In the direct ByteBuffer passed to nativeInit() */
+  GstAhcEventRing *events;
+} CameraApp;
 
 /*
  * Private methods
@@ -109,230 +102,189 @@ get_jni_env (void)
   return env;
 }
 
+/* Error, state, initialization and processor result events go through the
+ * event ring, Java drains it with a single call per batch */
 static void
-on_error (GstBus * bus, GstMessage * message, GstAhc * ahc)
+on_error (GstAhc * ahc, const gchar * message, gpointer user_data)
 {
-  gchar *message_string;
-  GError *err;
-  gchar *debug_info;
-  jstring jmessage;
-  JNIEnv *env = get_jni_env ();
-
-  gst_message_parse_error (message, &err, &debug_info);
-  message_string =
-      g_strdup_printf ("Error received from element %s: %s",
-      GST_OBJECT_NAME (message->src), err->message);
+  CameraApp *app = user_data;
 
-  g_clear_error (&err);
-  g_free (debug_info);
-
-  jmessage = (*env)->NewStringUTF (env, message_string);
+  gst_ahc_event_ring_push (app->events, GST_AHC_EVENT_ERROR, 0, message);
+}
 
-  (*env)->CallVoidMethod (env, ahc->app, on_error_method_id, jmessage);
-  if ((*env)->ExceptionCheck (env)) {
-    GST_ERROR ("Failed to call Java method");
-    (*env)->ExceptionClear (env);
-  }
-  (*env)->DeleteLocalRef (env, jmessage);
+static void
+on_state_changed (GstAhc * ahc, GstState new_state, gpointer user_data)
+{
+  CameraApp *app = user_data;
 
-  g_free (message_string);
-  gst_element_set_state (ahc->pipeline, GST_STATE_NULL);
+  gst_ahc_event_ring_push (app->events, GST_AHC_EVENT_STATE_CHANGED,
+      new_state, NULL);
 }
 
-
 static void
-eos_cb (GstBus * bus, GstMessage * msg, GstAhc * data)
+on_initialized (GstAhc * ahc, gpointer user_data)
 {
-  gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
+  CameraApp *app = user_data;
+
+  gst_ahc_event_ring_push (app->events, GST_AHC_EVENT_INITIALIZED, 0, NULL);
 }
 
 static void
-state_changed_cb (GstBus * bus, GstMessage * msg, GstAhc * ahc)
+on_processor_result (GstAhc * ahc, const GstStructure * result,
+    gpointer user_data)
 {
-  JNIEnv *env = get_jni_env ();
-  GstState old_state, new_state, pending_state;
-
-  gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
-  /* Only pay attention to messages coming from the pipeline, not its children */
-  if (GST_MESSAGE_SRC (msg) == GST_OBJECT (ahc->pipeline)) {
-    ahc->state = new_state;
-    GST_DEBUG ("State changed to %s, notifying application",
-        gst_element_state_get_name (new_state));
-    (*env)->CallVoidMethod (env, ahc->app, on_state_changed_method_id,
-        new_state);
-    if ((*env)->ExceptionCheck (env)) {
-      (*env)->ExceptionDescribe (env);
-      GST_ERROR ("Failed to call Java method");
-      (*env)->ExceptionClear (env);
-    }
-  }
+  CameraApp *app = user_data;
+  gchar *text = gst_structure_to_string (result);
+
+  gst_ahc_event_ring_push (app->events, GST_AHC_EVENT_PROCESSOR_RESULT, 0,
+      text);
+  g_free (text);
 }
 
 static void
-check_initialization_complete (GstAhc * data)
+flush_events (GstAhcEventRing * ring, guint32 write, gpointer user_data)
 {
+  CameraApp *app = user_data;
   JNIEnv *env = get_jni_env ();
-  /* Check if all conditions are met to report GStreamer as initialized.
-   * These conditions will change depending on the application */
-  if (!data->initialized && data->native_window && data->main_loop) {
-    GST_DEBUG
-        ("Initialization complete, notifying application. native_window:%p main_loop:%p",
-        data->native_window, data->main_loop);
-    data->initialized = TRUE;
-    (*env)->CallVoidMethod (env, data->app, on_gstreamer_initialized_method_id);
-    if ((*env)->ExceptionCheck (env)) {
-      GST_ERROR ("Failed to call Java method");
-      (*env)->ExceptionClear (env);
-    }
+
+  (*env)->CallVoidMethod (env, app->object, on_events_method_id,
+      (jint) write);
+  if ((*env)->ExceptionCheck (env)) {
+    (*env)->ExceptionDescribe (env);
+    GST_ERROR ("Failed to call Java method");
+    (*env)->ExceptionClear (env);
   }
 }
 
-static void *
-app_function (void *userdata)
+static void
+on_frame (GstAhc * ahc, GstAhcFrame * frame, gpointer user_data)
 {
-  JavaVMAttachArgs args;
-  GstBus *bus;
-  GstMessage *msg;
-  GstAhc *ahc = (GstAhc *) userdata;
-  GSource *bus_source;
-  GMainContext *context;
-
-  GST_DEBUG ("Creating pipeline in GstAhc at %p", ahc);
-
-  /* create our own GLib Main Context, so we do not interfere with other libraries using GLib */
-  context = g_main_context_new ();
-
-  ahc->ahcsrc = gst_element_factory_make ("ahcsrc", "ahcsrc");
-  ahc->vsink = gst_element_factory_make ("glimagesink", "vsink");
-  ahc->filter = gst_element_factory_make ("capsfilter", NULL);
-
-  ahc->pipeline = gst_pipeline_new ("camera-pipeline");
-
-  gst_bin_add_many (GST_BIN (ahc->pipeline),
-    ahc->ahcsrc, 
-    ahc->filter, 
-    ahc->vsink, 
-    NULL);
-
-  gst_element_link_many (ahc->ahcsrc, ahc->filter, ahc->vsink, NULL);
+  CameraApp *app = user_data;
+  jobject jbuffer;
+  JNIEnv *env = get_jni_env ();
 
-  if (ahc->native_window) {
-    GST_DEBUG ("Native window already received, notifying the vsink about it.");
-    gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (ahc->vsink),
-        (guintptr) ahc->native_window);
+  /* Wraps the mapped buffer memory, nothing is copied */
+  jbuffer = (*env)->NewDirectByteBuffer (env, frame->map.data,
+      frame->map.size);
+  if (!jbuffer) {
+    GST_ERROR ("Failed to wrap frame %d", frame->id);
+    (*env)->ExceptionClear (env);
+    gst_ahc_release_frame (ahc, frame->id);
+    return;
   }
 
-  /* Instruct the bus to emit signals for each received message, and connect to the interesting signals */
-  bus = gst_element_get_bus (ahc->pipeline);
-  bus_source = gst_bus_create_watch (bus);
-  g_source_set_callback (bus_source, (GSourceFunc) gst_bus_async_signal_func,
-      NULL, NULL);
-  g_source_attach (bus_source, context);
-  g_source_unref (bus_source);
-  g_signal_connect (G_OBJECT (bus), "message::error", G_CALLBACK (on_error),
-      ahc);
-  g_signal_connect (G_OBJECT (bus), "message::eos", (GCallback) eos_cb, ahc);
-  g_signal_connect (G_OBJECT (bus), "message::state-changed",
-      (GCallback) state_changed_cb, ahc);
-  gst_object_unref (bus);
-
-  /* Create a GLib Main Loop and set it to run */
-  GST_DEBUG ("Entering main loop... (GstAhc:%p)", ahc);
-  ahc->main_loop = g_main_loop_new (context, FALSE);
-  check_initialization_complete (ahc);
-  g_main_loop_run (ahc->main_loop);
-  GST_DEBUG ("Exited main loop");
-  g_main_loop_unref (ahc->main_loop);
-  ahc->main_loop = NULL;
-
-  /* Free resources */
-  g_main_context_unref (context);
-  gst_element_set_state (ahc->pipeline, GST_STATE_NULL);
-  gst_object_unref (ahc->vsink);
-  gst_object_unref (ahc->filter);
-  gst_object_unref (ahc->ahcsrc);
-  gst_object_unref (ahc->pipeline);
-
-  return NULL;
+  (*env)->CallVoidMethod (env, app->object, on_frame_method_id, jbuffer,
+      frame->id,
+      GST_VIDEO_INFO_WIDTH (&frame->info), GST_VIDEO_INFO_HEIGHT (&frame->info),
+      GST_VIDEO_INFO_PLANE_STRIDE (&frame->info, 0),
+      (jlong) GST_BUFFER_PTS (frame->buffer));
+  if ((*env)->ExceptionCheck (env)) {
+    (*env)->ExceptionDescribe (env);
+    GST_ERROR ("Failed to call Java method");
+    (*env)->ExceptionClear (env);
+  }
+  (*env)->DeleteLocalRef (env, jbuffer);
 }
 
+static const GstAhcCallbacks app_callbacks = {
+  on_error,
+  on_state_changed,
+  on_initialized,
+  on_frame,
+  on_processor_result
+};
+
 /*
  * Java Bindings
  */
 void
-gst_native_init (JNIEnv * env, jobject thiz)
+gst_native_init (JNIEnv * env, jobject thiz, jboolean standby,
+    jboolean shared_dispatcher, jobject events, jobject stats)
 {
-  GstAhc *data = (GstAhc *) g_malloc0 (sizeof (GstAhc));
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  gint64 entered = g_get_monotonic_time ();
+  CameraApp *app = g_new0 (CameraApp, 1);
+  GstAhc *data;
+
+  app->object = (*env)->NewGlobalRef (env, thiz);
+  data = gst_ahc_new (GST_AHC_DEFAULT_SRC_FACTORY,
+      GST_AHC_DEFAULT_SINK_FACTORY, &app_callbacks, app);
+
+  gst_ahc_mark_startup (data, GST_AHC_STARTUP_NATIVE_INIT, entered);
+  gst_ahc_set_standby (data, standby);
+  gst_ahc_set_shared_dispatcher (data, shared_dispatcher);
+  app->events = gst_ahc_event_ring_new (data,
+      (*env)->GetDirectBufferAddress (env, events),
+      (*env)->GetDirectBufferCapacity (env, events), flush_events, app);
+  gst_ahc_set_stats_block (data, (*env)->GetDirectBufferAddress (env, stats),
+      (*env)->GetDirectBufferCapacity (env, stats));
 
   SET_CUSTOM_DATA (env, thiz, native_android_camera_field_id, data);
-  GST_DEBUG ("Created GstAhc at %p", data);
-  data->app = (*env)->NewGlobalRef (env, thiz);
-  GST_DEBUG ("Created GlobalRef for app object at %p", data->app);
-  pthread_create (&gst_app_thread, NULL, &app_function, data);
+  GST_DEBUG ("Created GlobalRef for app object at %p", app->object);
+  gst_ahc_start (data);
 }
 
 void
 gst_native_finalize (JNIEnv * env, jobject thiz)
 {
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
   GstAhc *data = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  CameraApp *app;
 
   if (!data)
     return;
-  GST_DEBUG ("Quitting main loop...");
-  g_main_loop_quit (data->main_loop);
-  GST_DEBUG ("Waiting for thread to finish...");
-  pthread_join (gst_app_thread, NULL);
-  GST_DEBUG ("Deleting GlobalRef at %p", data->app);
-  (*env)->DeleteGlobalRef (env, data->app);
-  GST_DEBUG ("Freeing GstAhc at %p", data);
-  g_free (data);
   SET_CUSTOM_DATA (env, thiz, native_android_camera_field_id, NULL);
+  app = data->user_data;
+  gst_ahc_stop (data);
+  gst_ahc_event_ring_free (app->events);
+  GST_DEBUG ("Deleting GlobalRef at %p", app->object);
+  (*env)->DeleteGlobalRef (env, app->object);
+  gst_ahc_free (data);
+  g_free (app);
   GST_DEBUG ("Done finalizing");
 }
 
 void
 gst_native_play (JNIEnv * env, jobject thiz)
 {
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
   GstAhc *data = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
 
   if (!data)
     return;
-  GST_DEBUG ("Setting state to PLAYING");
-  gst_element_set_state (data->pipeline, GST_STATE_PLAYING);
+  gst_ahc_play (data);
 }
 
 void
 gst_native_pause (JNIEnv * env, jobject thiz)
 {
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
   GstAhc *data = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
 
   if (!data)
     return;
-  GST_DEBUG ("Setting state to PAUSED");
-  gst_element_set_state (data->pipeline, GST_STATE_PAUSED);
+  gst_ahc_pause (data);
 }
 
 jboolean
 gst_class_init (JNIEnv * env, jclass klass)
 {
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+
   native_android_camera_field_id =
       (*env)->GetFieldID (env, klass, "native_custom_data", "J");
   GST_DEBUG ("The FieldID for the native_custom_data field is %p",
       native_android_camera_field_id);
-  on_error_method_id =
-      (*env)->GetMethodID (env, klass, "onError", "(Ljava/lang/String;)V");
-  GST_DEBUG ("The MethodID for the onError method is %p", on_error_method_id);
-  on_gstreamer_initialized_method_id =
-      (*env)->GetMethodID (env, klass, "onGStreamerInitialized", "()V");
-  GST_DEBUG ("The MethodID for the onGStreamerInitialized method is %p",
-      on_gstreamer_initialized_method_id);
-  on_state_changed_method_id =
-      (*env)->GetMethodID (env, klass, "onStateChanged", "(I)V");
-  GST_DEBUG ("The MethodID for the onStateChanged method is %p",
-      on_state_changed_method_id);
-
-  if (!native_android_camera_field_id || !on_error_method_id ||
-      !on_gstreamer_initialized_method_id || !on_state_changed_method_id) {
+  on_events_method_id = (*env)->GetMethodID (env, klass, "onEvents", "(I)V");
+  GST_DEBUG ("The MethodID for the onEvents method is %p",
+      on_events_method_id);
+  on_frame_method_id =
+      (*env)->GetMethodID (env, klass, "onFrame",
+      "(Ljava/nio/ByteBuffer;IIIIJ)V");
+  GST_DEBUG ("The MethodID for the onFrame method is %p", on_frame_method_id);
+
+  if (!native_android_camera_field_id || !on_events_method_id ||
+      !on_frame_method_id) {
     GST_ERROR
         ("The calling class does not implement all necessary interface methods");
     return JNI_FALSE;
@@ -340,116 +292,593 @@ gst_class_init (JNIEnv * env, jclass klass)
   return JNI_TRUE;
 }
 
+/* Called on the main context once the sink does not render to it anymore */
+static void
+release_native_window (gpointer window)
+{
+  GST_DEBUG ("Releasing Native Window %p", window);
+  ANativeWindow_release ((ANativeWindow *) window);
+}
+
 void
 gst_native_surface_init (JNIEnv * env, jobject thiz, jobject surface)
 {
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  ANativeWindow *native_window;
   GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
 
   if (!ahc)
     return;
 
   GST_DEBUG ("Received surface %p", surface);
-  if (ahc->native_window) {
-    GST_DEBUG ("Releasing previous native window %p", ahc->native_window);
-    ANativeWindow_release (ahc->native_window);
-  }
-  ahc->native_window = ANativeWindow_fromSurface (env, surface);
-  GST_DEBUG ("Got Native Window %p", ahc->native_window);
-
-  if (ahc->vsink) {
-    GST_DEBUG
-        ("Pipeline already created, notifying the vsink about the native window.");
-    gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (ahc->vsink),
-        (guintptr) ahc->native_window);
-  } else {
-    GST_DEBUG
-        ("Pipeline not created yet, vsink will later be notified about the native window.");
-  }
+  native_window = ANativeWindow_fromSurface (env, surface);
+  GST_DEBUG ("Got Native Window %p", native_window);
 
-  check_initialization_complete (ahc);
+  /* The previous window is released once the sink switched to this one */
+  gst_ahc_set_window_handle (ahc, (guintptr) native_window,
+      release_native_window);
 }
 
 void
 gst_native_surface_finalize (JNIEnv * env, jobject thiz)
 {
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
   GstAhc *data = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
 
   if (!data) {
     GST_WARNING ("Received surface finalize but there is no GstAhc. Ignoring.");
     return;
   }
-  GST_DEBUG ("Releasing Native Window %p", data->native_window);
-  ANativeWindow_release (data->native_window);
-  data->native_window = NULL;
-
-  gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (data->vsink),
-      (guintptr) NULL);
+  GST_DEBUG ("Surface finalized, releasing the native window");
+  gst_ahc_set_window_handle (data, (guintptr) NULL, NULL);
 }
 
 void
 gst_native_change_resolution (JNIEnv * env, jobject thiz, jint width, jint height)
 {
-  GstCaps *new_caps;
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
   GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
 
   if (!ahc)
     return;
 
-  gst_element_set_state (ahc->pipeline, GST_STATE_READY);
+  gst_ahc_change_resolution (ahc, width, height);
+}
 
-  new_caps = gst_caps_new_simple ("video/x-raw",
-      "width", G_TYPE_INT, width,
-      "height", G_TYPE_INT, height,
-      NULL);
+void
+gst_native_set_resolution_switch_mode (JNIEnv * env, jobject thiz, jint mode)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
 
-  g_object_set (ahc->filter,
-      "caps", new_caps,
-      NULL);
+  if (!ahc)
+    return;
 
-  gst_caps_unref (new_caps);
+  gst_ahc_set_resolution_switch_mode (ahc, mode);
+}
 
-  gst_element_set_state (ahc->pipeline, GST_STATE_PAUSED);
+jlong
+gst_native_get_standby_memory (JNIEnv * env, jobject thiz)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return 0;
+
+  return gst_ahc_get_standby_memory (ahc);
+}
+
+jlong
+gst_native_get_resolution_switch_latency (JNIEnv * env, jobject thiz)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstClockTime latency;
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return -1;
+
+  latency = gst_ahc_get_resolution_switch_latency (ahc);
+
+  return GST_CLOCK_TIME_IS_VALID (latency) ? (jlong) latency : -1;
+}
+
+jint
+gst_native_add_branch (JNIEnv * env, jobject thiz, jint type,
+    jstring description)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  const gchar *desc = NULL;
+  jint id;
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return -1;
+
+  if (description)
+    desc = (*env)->GetStringUTFChars (env, description, NULL);
+
+  id = gst_ahc_add_branch (ahc, type, desc);
+
+  if (description)
+    (*env)->ReleaseStringUTFChars (env, description, desc);
+
+  return id;
+}
+
+jboolean
+gst_native_remove_branch (JNIEnv * env, jobject thiz, jint id)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return JNI_FALSE;
+
+  return gst_ahc_remove_branch (ahc, id) ? JNI_TRUE : JNI_FALSE;
+}
+
+jint
+gst_native_start_raw_capture (JNIEnv * env, jobject thiz, jstring location,
+    jint max_frames)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  const gchar *path;
+  jint id;
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc || !location || max_frames <= 0)
+    return -1;
+
+  path = (*env)->GetStringUTFChars (env, location, NULL);
+  id = gst_ahc_start_raw_capture (ahc, path, max_frames);
+  (*env)->ReleaseStringUTFChars (env, location, path);
+
+  return id;
+}
+
+/* Four values: written, pending, dropped, skipped */
+jboolean
+gst_native_get_raw_capture_stats (JNIEnv * env, jobject thiz, jint id,
+    jlongArray counters)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  GstAhcRawCaptureStats stats;
+  jlong values[4];
+
+  if (!ahc || !gst_ahc_get_raw_capture_stats (ahc, id, &stats))
+    return JNI_FALSE;
+
+  values[0] = stats.written;
+  values[1] = stats.pending;
+  values[2] = stats.dropped;
+  values[3] = stats.skipped;
+  (*env)->SetLongArrayRegion (env, counters, 0, 4, values);
+
+  return JNI_TRUE;
+}
+
+jboolean
+gst_native_set_frame_delivery (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return JNI_FALSE;
+
+  return gst_ahc_set_frame_delivery (ahc, enabled) ? JNI_TRUE : JNI_FALSE;
 }
 
 void
-gst_native_set_white_balance (JNIEnv * env, jobject thiz, jint wb_mode)
+gst_native_set_max_held_frames (JNIEnv * env, jobject thiz, jint max_held,
+    jint policy)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  gst_ahc_set_max_held_frames (ahc, max_held, (GstAhcFramePolicy) policy);
+}
+
+void
+gst_native_release_frame (JNIEnv * env, jobject thiz, jint id)
 {
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
   GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
 
   if (!ahc)
     return;
 
-  GST_DEBUG ("Setting WB_MODE (%d)", wb_mode);
+  gst_ahc_release_frame (ahc, id);
+}
 
-  g_object_set (ahc->ahcsrc, GST_PHOTOGRAPHY_PROP_WB_MODE, wb_mode, NULL);
+/* Fills counters with delivered, superseded, decimated and dropped */
+void
+gst_native_get_frame_counters (JNIEnv * env, jobject thiz, jlongArray counters)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  GstAhcFrameCounters c;
+  jlong values[4];
+
+  if (!ahc)
+    return;
+
+  gst_ahc_get_frame_counters (ahc, &c);
+  values[0] = c.delivered;
+  values[1] = c.superseded;
+  values[2] = c.decimated;
+  values[3] = c.dropped;
+  (*env)->SetLongArrayRegion (env, counters, 0, 4, values);
 }
 
 void
-gst_native_set_auto_focus (JNIEnv * env, jobject thiz, jboolean enabled)
+gst_native_set_queue_config (JNIEnv * env, jobject thiz, jint type,
+    jint max_buffers, jint leak)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  GstAhcQueueConfig config;
+
+  if (!ahc)
+    return;
+
+  config.max_buffers = max_buffers;
+  config.leak = leak;
+  gst_ahc_set_queue_config (ahc, type, &config);
+}
+
+/* Six values per queue: type, branch id, level, max, pushed, dropped */
+jlongArray
+gst_native_get_queue_stats (JNIEnv * env, jobject thiz)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  jlongArray array;
+  GArray *stats;
+  jlong *values;
+  guint i;
+
+  if (!ahc)
+    return (*env)->NewLongArray (env, 0);
+
+  stats = gst_ahc_get_queue_stats (ahc);
+  values = g_new (jlong, stats->len * 6);
+  for (i = 0; i < stats->len; i++) {
+    GstAhcQueueStats *s = &g_array_index (stats, GstAhcQueueStats, i);
+
+    values[i * 6] = s->type;
+    values[i * 6 + 1] = s->branch_id;
+    values[i * 6 + 2] = s->level;
+    values[i * 6 + 3] = s->max_buffers;
+    values[i * 6 + 4] = s->pushed;
+    values[i * 6 + 5] = s->dropped;
+  }
+
+  array = (*env)->NewLongArray (env, stats->len * 6);
+  (*env)->SetLongArrayRegion (env, array, 0, stats->len * 6, values);
+  g_free (values);
+  g_array_unref (stats);
+
+  return array;
+}
+
+void
+gst_native_set_thread_config (JNIEnv * env, jobject thiz, jint role,
+    jlong cpus, jint nice, jint rt_priority)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  GstAhcThreadConfig config;
+
+  if (!ahc)
+    return;
+
+  config.cpus = cpus;
+  config.nice = nice;
+  config.rt_priority = rt_priority;
+  gst_ahc_set_thread_config (ahc, role, &config);
+}
+
+/* Five values per thread: role, tid, cpu, migrations, configured */
+jlongArray
+gst_native_get_thread_stats (JNIEnv * env, jobject thiz)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  jlongArray array;
+  GArray *stats;
+  jlong *values;
+  guint i;
+
+  if (!ahc)
+    return (*env)->NewLongArray (env, 0);
+
+  stats = gst_ahc_get_thread_stats (ahc);
+  values = g_new (jlong, stats->len * 5);
+  for (i = 0; i < stats->len; i++) {
+    GstAhcThreadStats *s = &g_array_index (stats, GstAhcThreadStats, i);
+
+    values[i * 5] = s->role;
+    values[i * 5 + 1] = s->tid;
+    values[i * 5 + 2] = s->cpu;
+    values[i * 5 + 3] = s->migrations;
+    values[i * 5 + 4] = s->configured;
+  }
+
+  array = (*env)->NewLongArray (env, stats->len * 5);
+  (*env)->SetLongArrayRegion (env, array, 0, stats->len * 5, values);
+  g_free (values);
+  g_array_unref (stats);
+
+  return array;
+}
+
+/* Six values per trace slot: kind, count, p50, p90, p99, max */
+jlongArray
+gst_native_get_trace_stats (JNIEnv * env, jobject thiz)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  jlongArray array;
+  GArray *stats;
+  jlong *values;
+  guint i;
+
+  if (!ahc)
+    return (*env)->NewLongArray (env, 0);
+
+  stats = gst_ahc_get_trace_stats (ahc);
+  values = g_new (jlong, stats->len * 6);
+  for (i = 0; i < stats->len; i++) {
+    GstAhcTraceStats *s = &g_array_index (stats, GstAhcTraceStats, i);
+
+    values[i * 6] = s->kind;
+    values[i * 6 + 1] = s->count;
+    values[i * 6 + 2] = s->p50_us;
+    values[i * 6 + 3] = s->p90_us;
+    values[i * 6 + 4] = s->p99_us;
+    values[i * 6 + 5] = s->max_us;
+  }
+
+  array = (*env)->NewLongArray (env, stats->len * 6);
+  (*env)->SetLongArrayRegion (env, array, 0, stats->len * 6, values);
+  g_free (values);
+  g_array_unref (stats);
+
+  return array;
+}
+
+/* Names of the trace slots, in the order of gst_native_get_trace_stats() */
+jobjectArray
+gst_native_get_trace_names (JNIEnv * env, jobject thiz)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  jclass string_class = (*env)->FindClass (env, "java/lang/String");
+  jobjectArray array;
+  GArray *stats;
+  guint i;
+
+  if (!ahc)
+    return (*env)->NewObjectArray (env, 0, string_class, NULL);
+
+  stats = gst_ahc_get_trace_stats (ahc);
+  array = (*env)->NewObjectArray (env, stats->len, string_class, NULL);
+  for (i = 0; i < stats->len; i++) {
+    jstring name = (*env)->NewStringUTF (env,
+        g_array_index (stats, GstAhcTraceStats, i).name);
+
+    (*env)->SetObjectArrayElement (env, array, i, name);
+    (*env)->DeleteLocalRef (env, name);
+  }
+  g_array_unref (stats);
+
+  return array;
+}
+
+jstring
+gst_native_dump_trace (JNIEnv * env, jobject thiz)
 {
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  gchar *dump;
+  jstring ret;
+
+  if (!ahc)
+    return NULL;
+
+  dump = gst_ahc_dump_trace (ahc);
+  ret = (*env)->NewStringUTF (env, dump);
+  g_free (dump);
+
+  return ret;
+}
+
+/* time is from System.nanoTime(), which uses the same clock */
+void
+gst_native_mark_startup (JNIEnv * env, jobject thiz, jint mark, jlong time)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
   GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
 
   if (!ahc)
     return;
+  gst_ahc_mark_startup (ahc, mark, time / 1000);
+}
+
+/* Three values per mark reached: mark, offset, duration */
+jlongArray
+gst_native_get_startup_timeline (JNIEnv * env, jobject thiz)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  jlongArray array;
+  GArray *timeline;
+  jlong *values;
+  guint i;
 
-  GST_DEBUG ("Setting Autofocus (%d)", enabled);
+  if (!ahc)
+    return (*env)->NewLongArray (env, 0);
+
+  timeline = gst_ahc_get_startup_timeline (ahc);
+  values = g_new (jlong, timeline->len * 3);
+  for (i = 0; i < timeline->len; i++) {
+    GstAhcStartupPhase *p = &g_array_index (timeline, GstAhcStartupPhase, i);
+
+    values[i * 3] = p->mark;
+    values[i * 3 + 1] = p->offset;
+    values[i * 3 + 2] = p->duration;
+  }
+
+  array = (*env)->NewLongArray (env, timeline->len * 3);
+  (*env)->SetLongArrayRegion (env, array, 0, timeline->len * 3, values);
+  g_free (values);
+  g_array_unref (timeline);
+
+  return array;
+}
+
+jstring
+gst_native_dump_startup_timeline (JNIEnv * env, jobject thiz)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  gchar *dump;
+  jstring ret;
+
+  if (!ahc)
+    return NULL;
+
+  dump = gst_ahc_dump_startup_timeline (ahc);
+  ret = (*env)->NewStringUTF (env, dump);
+  g_free (dump);
+
+  return ret;
+}
+
+/* The recorder is process-wide, see gstahcrecorder.c */
+void
+gst_native_start_recording (JNIEnv * env, jobject thiz, jint events_per_thread)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+
+  gst_ahc_recorder_start (events_per_thread);
+}
+
+jboolean
+gst_native_stop_recording (JNIEnv * env, jobject thiz, jstring path)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  const gchar *path_str = (*env)->GetStringUTFChars (env, path, NULL);
+  GError *error = NULL;
+  gboolean ret;
+
+  ret = gst_ahc_recorder_stop (path_str, &error);
+  if (!ret) {
+    GST_WARNING ("Failed to write trace to %s: %s", path_str,
+        error->message);
+    g_error_free (error);
+  }
+  (*env)->ReleaseStringUTFChars (env, path, path_str);
+
+  return ret;
+}
+
+void
+gst_native_get_bus_counters (JNIEnv * env, jobject thiz, jlongArray counters)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  GstAhcBusCounters c;
+  jlong values[2];
+
+  if (!ahc)
+    return;
+
+  gst_ahc_get_bus_counters (ahc, &c);
+  values[0] = c.received;
+  values[1] = c.forwarded;
+  (*env)->SetLongArrayRegion (env, counters, 0, 2, values);
+}
+
+jint
+gst_native_apply_settings (JNIEnv * env, jobject thiz, jint set, jint wb_mode,
+    jboolean auto_focus, jint rotate_method, jint width, jint height)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+  GstAhcSettings settings;
+
+  if (!ahc)
+    return 0;
+
+  settings.set = set;
+  settings.wb_mode = wb_mode;
+  settings.auto_focus = auto_focus;
+  settings.rotate_method = rotate_method;
+  settings.resolution.width = width;
+  settings.resolution.height = height;
+
+  return gst_ahc_apply_settings (ahc, &settings);
+}
+
+jint
+gst_native_get_applied_settings (JNIEnv * env, jobject thiz)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return 0;
+
+  return gst_ahc_get_applied_settings (ahc);
+}
+
+void
+gst_native_set_white_balance (JNIEnv * env, jobject thiz, jint wb_mode)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
+
+  gst_ahc_set_white_balance (ahc, wb_mode);
+}
+
+void
+gst_native_set_auto_focus (JNIEnv * env, jobject thiz, jboolean enabled)
+{
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
+  GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
+
+  if (!ahc)
+    return;
 
-  gst_photography_set_autofocus (GST_PHOTOGRAPHY (ahc->ahcsrc), enabled);
+  gst_ahc_set_auto_focus (ahc, enabled);
 }
 
 void
 gst_native_set_rotate_method (JNIEnv * env, jobject thiz, jint method)
 {
+  GST_AHC_RECORD_SCOPE (G_STRFUNC, "jni");
   GstAhc *ahc = GET_CUSTOM_DATA (env, thiz, native_android_camera_field_id);
 
   if (!ahc)
     return;
 
-  g_object_set (ahc->vsink, "rotate-method", method, NULL);
+  gst_ahc_set_rotate_method (ahc, method);
 }
 
 static JNINativeMethod native_methods[] = {
-  {"nativeInit", "()V", (void *) gst_native_init},
+  {"nativeInit", "(ZZLjava/nio/ByteBuffer;Ljava/nio/ByteBuffer;)V",
+      (void *) gst_native_init},
   {"nativeFinalize", "()V", (void *) gst_native_finalize},
   {"nativePlay", "()V", (void *) gst_native_play},
   {"nativePause", "()V", (void *) gst_native_pause},
@@ -460,8 +889,57 @@ static JNINativeMethod native_methods[] = {
       (void *) gst_native_surface_finalize},
   {"nativeChangeResolution", "(II)V",
       (void *) gst_native_change_resolution},
+  {"nativeSetResolutionSwitchMode", "(I)V",
+      (void *) gst_native_set_resolution_switch_mode},
+  {"nativeGetResolutionSwitchLatency", "()J",
+      (void *) gst_native_get_resolution_switch_latency},
+  {"nativeGetStandbyMemory", "()J",
+      (void *) gst_native_get_standby_memory},
+  {"nativeAddBranch", "(ILjava/lang/String;)I",
+      (void *) gst_native_add_branch},
+  {"nativeRemoveBranch", "(I)Z",
+      (void *) gst_native_remove_branch},
+  {"nativeStartRawCapture", "(Ljava/lang/String;I)I",
+      (void *) gst_native_start_raw_capture},
+  {"nativeGetRawCaptureStats", "(I[J)Z",
+      (void *) gst_native_get_raw_capture_stats},
+  {"nativeSetFrameDelivery", "(Z)Z",
+      (void *) gst_native_set_frame_delivery},
+  {"nativeSetMaxHeldFrames", "(II)V",
+      (void *) gst_native_set_max_held_frames},
+  {"nativeReleaseFrame", "(I)V",
+      (void *) gst_native_release_frame},
+  {"nativeGetFrameCounters", "([J)V",
+      (void *) gst_native_get_frame_counters},
   {"nativeSetRotateMethod", "(I)V",
       (void *) gst_native_set_rotate_method},
+  {"nativeGetBusCounters", "([J)V",
+      (void *) gst_native_get_bus_counters},
+  {"nativeSetQueueConfig", "(III)V",
+      (void *) gst_native_set_queue_config},
+  {"nativeGetQueueStats", "()[J",
+      (void *) gst_native_get_queue_stats},
+  {"nativeSetThreadConfig", "(IJII)V",
+      (void *) gst_native_set_thread_config},
+  {"nativeGetThreadStats", "()[J",
+      (void *) gst_native_get_thread_stats},
+  {"nativeGetTraceStats", "()[J", (void *) gst_native_get_trace_stats},
+  {"nativeGetTraceNames", "()[Ljava/lang/String;",
+      (void *) gst_native_get_trace_names},
+  {"nativeDumpTrace", "()Ljava/lang/String;",
+      (void *) gst_native_dump_trace},
+  {"nativeMarkStartup", "(IJ)V", (void *) gst_native_mark_startup},
+  {"nativeStartRecording", "(I)V", (void *) gst_native_start_recording},
+  {"nativeStopRecording", "(Ljava/lang/String;)Z",
+      (void *) gst_native_stop_recording},
+  {"nativeGetStartupTimeline", "()[J",
+      (void *) gst_native_get_startup_timeline},
+  {"nativeDumpStartupTimeline", "()Ljava/lang/String;",
+      (void *) gst_native_dump_startup_timeline},
+  {"nativeApplySettings", "(IIZIII)I",
+      (void *) gst_native_apply_settings},
+  {"nativeGetAppliedSettings", "()I",
+      (void *) gst_native_get_applied_settings},
   {"nativeSetWhiteBalance", "(I)V",
       (void *) gst_native_set_white_balance},
   {"nativeSetAutoFocus", "(Z)V",
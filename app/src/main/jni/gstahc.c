@@ -0,0 +1,1121 @@
+/*
+ * Copyright (C) 2012, Collabora Ltd.
+ *   Author: Youness Alaoui
+ *
+ * Copyright (C) 2016-2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/videooverlay.h>
+#include <gst/interfaces/photography.h>
+
+#include "gstahc.h"
+#include "gstahcprocessor.h"
+
+GST_DEBUG_CATEGORY (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+const GstAhcResolution gst_ahc_preview_resolutions[] = {
+  {320, 240},
+  {640, 480},
+};
+
+const guint gst_ahc_n_preview_resolutions =
+    G_N_ELEMENTS (gst_ahc_preview_resolutions);
+
+/* Frames a standby branch queues before dropping the oldest one */
+#define STANDBY_QUEUE_BUFFERS 2
+
+struct _GstAhcStandbyBranch
+{
+  GstAhcResolution res;
+  GstElement *filter;
+  GstPad *selector_pad;
+};
+
+static void
+standby_branch_free (GstAhcStandbyBranch * branch)
+{
+  gst_object_unref (branch->filter);
+  gst_object_unref (branch->selector_pad);
+  g_free (branch);
+}
+
+static gboolean
+has_property (GstElement * element, const gchar * name)
+{
+  return g_object_class_find_property (G_OBJECT_GET_CLASS (element),
+      name) != NULL;
+}
+
+/* src_factory is a factory name, or a single element with properties,
+ * e.g. "ahcreplaysrc location=capture.raw" */
+static GstElement *
+make_source (GstAhc * ahc)
+{
+  GstElement *src;
+  GError *err = NULL;
+
+  if (!strchr (ahc->src_factory, ' '))
+    return gst_element_factory_make (ahc->src_factory, "ahcsrc");
+
+  src = gst_parse_launch (ahc->src_factory, &err);
+  if (err || !src || GST_IS_BIN (src)) {
+    GST_ERROR ("Invalid source description '%s': %s", ahc->src_factory,
+        err ? err->message : "not a single element");
+    g_clear_error (&err);
+    if (src)
+      gst_object_unref (gst_object_ref_sink (src));
+    return NULL;
+  }
+  gst_object_set_name (GST_OBJECT (src), "ahcsrc");
+
+  return src;
+}
+
+static void
+on_error (GstAhc * ahc, GstMessage * message)
+{
+  gchar *message_string;
+  GError *err;
+  gchar *debug_info;
+
+  gst_message_parse_error (message, &err, &debug_info);
+  message_string =
+      g_strdup_printf ("Error received from element %s: %s",
+      GST_OBJECT_NAME (message->src), err->message);
+
+  g_clear_error (&err);
+  g_free (debug_info);
+
+  if (ahc->callbacks.error)
+    ahc->callbacks.error (ahc, message_string, ahc->user_data);
+
+  g_free (message_string);
+  gst_element_set_state (ahc->pipeline, GST_STATE_NULL);
+}
+
+static void
+on_eos (GstAhc * ahc)
+{
+  gst_element_set_state (ahc->pipeline, GST_STATE_PAUSED);
+}
+
+/* Only called for the pipeline itself, bus_sync_handler() drops the
+ * state changes of its children */
+static void
+on_state_changed (GstAhc * ahc, GstMessage * msg)
+{
+  GstState old_state, new_state, pending_state;
+
+  gst_message_parse_state_changed (msg, &old_state, &new_state, &pending_state);
+  ahc->state = new_state;
+  /* A batch staged while the pipeline was going down */
+  gst_ahc_settings_apply_staged (ahc);
+  if (new_state == GST_STATE_PLAYING)
+    gst_ahc_mark_startup (ahc, GST_AHC_STARTUP_PLAYING,
+        g_get_monotonic_time ());
+  GST_DEBUG ("State changed to %s, notifying application",
+      gst_element_state_get_name (new_state));
+  if (ahc->callbacks.state_changed)
+    ahc->callbacks.state_changed (ahc, new_state, ahc->user_data);
+}
+
+/* Measures the time from a resolution change request until the first
+ * buffer with the new size reaches the sink */
+static GstPadProbeReturn
+switch_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+
+  if (!g_atomic_int_get (&ahc->switch_pending))
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&ahc->lock);
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT (info);
+
+    if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+      GstCaps *caps;
+      GstStructure *s;
+      gint width = 0, height = 0;
+
+      gst_event_parse_caps (event, &caps);
+      s = gst_caps_get_structure (caps, 0);
+      gst_structure_get_int (s, "width", &width);
+      gst_structure_get_int (s, "height", &height);
+      ahc->switch_caps_seen = width == ahc->switch_target.width &&
+          height == ahc->switch_target.height;
+    }
+  } else if (ahc->switch_caps_seen) {
+    ahc->switch_latency = gst_util_get_timestamp () - ahc->switch_start;
+    g_atomic_int_set (&ahc->switch_pending, FALSE);
+    GST_INFO ("Switched to %dx%d in %" GST_TIME_FORMAT,
+        ahc->switch_target.width, ahc->switch_target.height,
+        GST_TIME_ARGS (ahc->switch_latency));
+  }
+  g_mutex_unlock (&ahc->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* upstream ! tee ! N x (queue ! videoscale ! capsfilter) ! input-selector ! vsink
+ *
+ * Every preview resolution is scaled from the single camera stream all the
+ * time, so a switch is only a change of the selector's active pad. */
+static gboolean
+build_standby_branches (GstAhc * ahc, GstElement * upstream)
+{
+  GstElement *tee;
+  GstCaps *caps;
+  const GstAhcResolution *largest = &gst_ahc_preview_resolutions[0];
+  guint i;
+
+  tee = gst_element_factory_make ("tee", NULL);
+  ahc->selector = gst_element_factory_make ("input-selector", "selector");
+  if (!tee || !ahc->selector)
+    return FALSE;
+
+  /* Inactive branches drop their frames instead of waiting for the active
+   * one */
+  g_object_set (ahc->selector, "sync-streams", FALSE, NULL);
+  gst_object_ref (ahc->selector);
+  gst_bin_add_many (GST_BIN (ahc->pipeline), tee, ahc->selector, NULL);
+
+  ahc->standby_branches =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) standby_branch_free);
+
+  for (i = 0; i < gst_ahc_n_preview_resolutions; i++) {
+    const GstAhcResolution *res = &gst_ahc_preview_resolutions[i];
+    GstAhcStandbyBranch *branch;
+    GstElement *queue, *scaler, *filter;
+    GstPad *pad;
+
+    if (res->width * res->height > largest->width * largest->height)
+      largest = res;
+
+    queue = gst_element_factory_make ("queue", NULL);
+    scaler = gst_element_factory_make ("videoscale", NULL);
+    filter = gst_element_factory_make ("capsfilter", NULL);
+    if (!queue || !scaler || !filter)
+      return FALSE;
+
+    g_object_set (queue, "max-size-buffers", STANDBY_QUEUE_BUFFERS,
+        "max-size-bytes", 0, "max-size-time", (guint64) 0,
+        "leaky", 2 /* downstream */ , NULL);
+    caps = gst_caps_new_simple ("video/x-raw",
+        "width", G_TYPE_INT, res->width,
+        "height", G_TYPE_INT, res->height,
+        NULL);
+    g_object_set (filter, "caps", caps, NULL);
+    gst_caps_unref (caps);
+
+    gst_bin_add_many (GST_BIN (ahc->pipeline), queue, scaler, filter, NULL);
+    if (!gst_element_link_many (tee, queue, scaler, filter, ahc->selector,
+            NULL))
+      return FALSE;
+
+    branch = g_new0 (GstAhcStandbyBranch, 1);
+    branch->res = *res;
+    branch->filter = gst_object_ref (filter);
+    pad = gst_element_get_static_pad (filter, "src");
+    branch->selector_pad = gst_pad_get_peer (pad);
+    gst_object_unref (pad);
+    g_ptr_array_add (ahc->standby_branches, branch);
+  }
+
+  /* The camera runs at the largest preview size, the branches scale down */
+  caps = gst_caps_new_simple ("video/x-raw",
+      "width", G_TYPE_INT, largest->width,
+      "height", G_TYPE_INT, largest->height,
+      NULL);
+  g_object_set (ahc->filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+
+  return gst_element_link (upstream, tee)
+      && gst_element_link (ahc->selector, ahc->vsink);
+}
+
+static gboolean
+build_pipeline (GstAhc * ahc)
+{
+  GstElement *preview_queue;
+  GstPad *pad;
+
+  ahc->ahcsrc = make_source (ahc);
+  ahc->vsink = gst_element_factory_make (ahc->sink_factory, "vsink");
+  ahc->scaler = gst_element_factory_make ("videoscale", "scaler");
+  ahc->filter = gst_element_factory_make ("capsfilter", NULL);
+
+  ahc->pipeline = gst_pipeline_new ("camera-pipeline");
+
+  if (!ahc->ahcsrc || !ahc->vsink || !ahc->scaler || !ahc->filter) {
+    GST_ERROR ("Failed to create %s ! videoscale ! capsfilter ! %s",
+        ahc->src_factory, ahc->sink_factory);
+    return FALSE;
+  }
+
+  /* Stand-in sources like videotestsrc have to behave like a camera */
+  if (has_property (ahc->ahcsrc, "is-live"))
+    g_object_set (ahc->ahcsrc, "is-live", TRUE, NULL);
+
+  /* The pipeline takes the floating references, keep our own ones */
+  gst_object_ref (ahc->ahcsrc);
+  gst_object_ref (ahc->scaler);
+  gst_object_ref (ahc->filter);
+  gst_object_ref (ahc->vsink);
+
+  /* Before anything is added, so the tracer and the recorder see every
+   * element */
+  gst_ahc_trace_attach (ahc);
+  gst_ahc_recorder_attach (ahc);
+
+  /* The scaler stays in passthrough as long as the camera delivers the
+   * requested size, so it costs nothing in the common case */
+  gst_bin_add_many (GST_BIN (ahc->pipeline),
+    ahc->ahcsrc,
+    ahc->scaler,
+    ahc->filter,
+    ahc->vsink,
+    NULL);
+
+  pad = gst_element_get_static_pad (ahc->vsink, "sink");
+  gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      switch_probe, ahc, NULL);
+  gst_object_unref (pad);
+
+  gst_ahc_settings_attach (ahc);
+  gst_ahc_stats_attach (ahc);
+  gst_ahc_startup_attach (ahc);
+
+  /* Every branch hangs off the tee with its own queue, and so its own
+   * streaming thread. The tee pushes the same buffer to all of them. */
+  ahc->tee = gst_element_factory_make ("tee", "split");
+  preview_queue = gst_ahc_branch_queue_new (ahc, GST_AHC_BRANCH_PREVIEW, 0);
+  if (!ahc->tee || !preview_queue)
+    return FALSE;
+
+  g_object_set (ahc->tee, "allow-not-linked", TRUE, NULL);
+  gst_object_ref (ahc->tee);
+  gst_bin_add_many (GST_BIN (ahc->pipeline), ahc->tee, preview_queue, NULL);
+
+  if (!gst_element_link_many (ahc->ahcsrc, ahc->scaler, ahc->filter, ahc->tee,
+          preview_queue, NULL))
+    return FALSE;
+
+  if (ahc->standby)
+    return build_standby_branches (ahc, preview_queue);
+
+  return gst_element_link (preview_queue, ahc->vsink);
+}
+
+/*
+ * Public methods
+ */
+GstAhc *
+gst_ahc_new (const gchar * src_factory, const gchar * sink_factory,
+    const GstAhcCallbacks * callbacks, gpointer user_data)
+{
+  static gsize initialized = 0;
+  GstAhc *ahc = g_new0 (GstAhc, 1);
+
+  if (g_once_init_enter (&initialized)) {
+    GST_DEBUG_CATEGORY_INIT (gst_ahc_debug, "camera-test", 0,
+        "Android Gstreamer Camera test");
+    gst_ahc_processor_element_register ();
+    gst_ahc_fake_src_register ();
+    gst_ahc_replay_src_register ();
+    gst_ahc_raw_sink_register ();
+    gst_ahc_convert_register ();
+    gst_ahc_pyramid_register ();
+    g_once_init_leave (&initialized, 1);
+  }
+
+  ahc->src_factory = g_strdup (src_factory ? src_factory :
+      GST_AHC_DEFAULT_SRC_FACTORY);
+  ahc->sink_factory = g_strdup (sink_factory ? sink_factory :
+      GST_AHC_DEFAULT_SINK_FACTORY);
+  if (callbacks)
+    ahc->callbacks = *callbacks;
+  ahc->user_data = user_data;
+  ahc->switch_mode = GST_AHC_RESOLUTION_SWITCH_RENEGOTIATE;
+  ahc->switch_latency = GST_CLOCK_TIME_NONE;
+  g_mutex_init (&ahc->lock);
+  g_cond_init (&ahc->cond);
+  /* create our own GLib Main Context, so we do not interfere with other libraries using GLib */
+  ahc->context = g_main_context_new ();
+  gst_ahc_branches_init (ahc);
+  gst_ahc_frames_init (ahc);
+  gst_ahc_threads_init (ahc);
+  gst_ahc_stats_init (ahc);
+  gst_ahc_trace_init (ahc);
+
+  GST_DEBUG ("Created GstAhc at %p (%s ! %s)", ahc, ahc->src_factory,
+      ahc->sink_factory);
+
+  return ahc;
+}
+
+void
+gst_ahc_free (GstAhc * ahc)
+{
+  if (!ahc)
+    return;
+  g_return_if_fail (!gst_ahc_frames_in_callback (ahc));
+
+  GST_DEBUG ("Freeing GstAhc at %p", ahc);
+  gst_ahc_stop (ahc);
+  gst_ahc_control_clear (ahc);
+  if (ahc->window_handle && ahc->window_release)
+    ahc->window_release ((gpointer) ahc->window_handle);
+  gst_ahc_frames_free (ahc);
+  gst_ahc_threads_free (ahc);
+  gst_ahc_trace_free (ahc);
+  g_hash_table_unref (ahc->branches);
+  g_main_context_unref (ahc->context);
+  if (ahc->shared_dispatcher)
+    gst_ahc_dispatcher_unref ();
+  g_cond_clear (&ahc->cond);
+  g_mutex_clear (&ahc->lock);
+  g_free (ahc->src_factory);
+  g_free (ahc->sink_factory);
+  g_free (ahc);
+}
+
+/* Element messages posted by ahcprocess carry processor results */
+static gboolean
+is_processor_result (GstMessage * msg)
+{
+  GstElementFactory *factory;
+
+  if (!GST_IS_ELEMENT (GST_MESSAGE_SRC (msg)))
+    return FALSE;
+
+  factory = gst_element_get_factory (GST_ELEMENT (GST_MESSAGE_SRC (msg)));
+
+  return factory && g_str_equal (GST_OBJECT_NAME (factory),
+      GST_AHC_PROCESSOR_ELEMENT);
+}
+
+/* Called from the thread posting the message, for every message of the
+ * pipeline. Only the few the application acts on are queued for the main
+ * context, everything else, e.g. QoS and the state changes of every
+ * element, is dropped right here. */
+static GstBusSyncReply
+bus_sync_handler (GstBus * bus, GstMessage * msg, gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+
+  __atomic_fetch_add (&ahc->bus_received, 1, __ATOMIC_RELAXED);
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_STREAM_STATUS:
+      gst_ahc_threads_handle_stream_status (ahc, msg);
+      return GST_BUS_DROP;
+    case GST_MESSAGE_STATE_CHANGED:
+      gst_ahc_recorder_state_changed (msg);
+      if (!GST_IS_PIPELINE (GST_MESSAGE_SRC (msg)))
+        return GST_BUS_DROP;
+      break;
+    case GST_MESSAGE_ELEMENT:
+      /* Acknowledges an autofocus change, see gstahcsettings.c */
+      if (GST_MESSAGE_SRC (msg) == GST_OBJECT (ahc->ahcsrc) &&
+          gst_message_has_name (msg, GST_PHOTOGRAPHY_AUTOFOCUS_DONE))
+        gst_ahc_settings_focus_done (ahc);
+      if (!ahc->callbacks.processor_result || !is_processor_result (msg))
+        return GST_BUS_DROP;
+      break;
+    case GST_MESSAGE_ERROR:
+    case GST_MESSAGE_EOS:
+    case GST_MESSAGE_APPLICATION:
+      break;
+    default:
+      return GST_BUS_DROP;
+  }
+
+  __atomic_fetch_add (&ahc->bus_forwarded, 1, __ATOMIC_RELAXED);
+
+  return GST_BUS_PASS;
+}
+
+/* Called on the main context for the messages bus_sync_handler() let
+ * through */
+static gboolean
+bus_cb (GstBus * bus, GstMessage * msg, gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+  GST_AHC_RECORD_SCOPE (GST_MESSAGE_TYPE_NAME (msg), "bus");
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ERROR:
+      on_error (ahc, msg);
+      break;
+    case GST_MESSAGE_EOS:
+      on_eos (ahc);
+      break;
+    case GST_MESSAGE_STATE_CHANGED:
+      on_state_changed (ahc, msg);
+      break;
+    case GST_MESSAGE_APPLICATION:
+      gst_ahc_dispatch_record (ahc, msg);
+      break;
+    case GST_MESSAGE_ELEMENT:
+      ahc->callbacks.processor_result (ahc, gst_message_get_structure (msg),
+          ahc->user_data);
+      break;
+    default:
+      break;
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Messages seen on the bus and those handed to the main context */
+void
+gst_ahc_get_bus_counters (GstAhc * ahc, GstAhcBusCounters * counters)
+{
+  counters->received = __atomic_load_n (&ahc->bus_received, __ATOMIC_RELAXED);
+  counters->forwarded = __atomic_load_n (&ahc->bus_forwarded,
+      __ATOMIC_RELAXED);
+}
+
+static void
+set_overlay_window (GstAhc * ahc, guintptr handle)
+{
+  /* fakesink and friends have nothing to render to */
+  if (GST_IS_VIDEO_OVERLAY (ahc->vsink))
+    gst_video_overlay_set_window_handle (GST_VIDEO_OVERLAY (ahc->vsink),
+        handle);
+}
+
+/* Builds the pipeline and attaches its sources to the main context of ahc.
+ * Called on that context. */
+static gboolean
+attach_pipeline (GstAhc * ahc)
+{
+  GstBus *bus;
+
+  GST_DEBUG ("Creating pipeline in GstAhc at %p", ahc);
+
+  if (!build_pipeline (ahc)) {
+    if (ahc->callbacks.error)
+      ahc->callbacks.error (ahc, "Failed to create the camera pipeline",
+          ahc->user_data);
+    return FALSE;
+  }
+
+  /* Kept from before a restart, only the main context writes it */
+  if (ahc->window_handle) {
+    GST_DEBUG ("Native window already received, notifying the vsink about it.");
+    set_overlay_window (ahc, ahc->window_handle);
+  }
+
+  /* Filter messages where they are posted and handle the rest directly on
+   * the main context, without a signal emission per message */
+  bus = gst_element_get_bus (ahc->pipeline);
+  gst_bus_set_sync_handler (bus, bus_sync_handler, ahc, NULL);
+  ahc->bus_source = gst_bus_create_watch (bus);
+  g_source_set_callback (ahc->bus_source, (GSourceFunc) bus_cb, ahc, NULL);
+  g_source_attach (ahc->bus_source, ahc->context);
+  gst_object_unref (bus);
+
+  /* Apply the settings requested so far and from now on */
+  ahc->control_source = gst_ahc_control_attach (ahc);
+  gst_ahc_stats_start (ahc);
+
+  g_mutex_lock (&ahc->lock);
+  ahc->attached = TRUE;
+  g_mutex_unlock (&ahc->lock);
+  gst_ahc_mark_startup (ahc, GST_AHC_STARTUP_PIPELINE_ATTACHED,
+      g_get_monotonic_time ());
+  gst_ahc_frames_attach (ahc);
+  gst_ahc_check_initialization_complete (ahc);
+
+  return TRUE;
+}
+
+/* Undoes attach_pipeline(), also after it failed. Called on the main
+ * context of ahc. */
+static void
+detach_pipeline (GstAhc * ahc)
+{
+  g_mutex_lock (&ahc->lock);
+  ahc->attached = FALSE;
+  g_mutex_unlock (&ahc->lock);
+
+  /* Free resources, the context outlives the pipeline */
+  gst_ahc_stats_stop (ahc);
+  if (ahc->control_source) {
+    g_source_destroy (ahc->control_source);
+    g_clear_pointer (&ahc->control_source, g_source_unref);
+  }
+  if (ahc->bus_source) {
+    g_source_destroy (ahc->bus_source);
+    g_clear_pointer (&ahc->bus_source, g_source_unref);
+  }
+  gst_ahc_frames_flush (ahc);
+  if (ahc->pipeline)
+    gst_element_set_state (ahc->pipeline, GST_STATE_NULL);
+  gst_ahc_branches_clear (ahc);
+  g_clear_pointer (&ahc->standby_branches, g_ptr_array_unref);
+  gst_clear_object (&ahc->selector);
+  gst_clear_object (&ahc->vsink);
+  gst_clear_object (&ahc->tee);
+  gst_clear_object (&ahc->filter);
+  gst_clear_object (&ahc->scaler);
+  gst_clear_object (&ahc->ahcsrc);
+  gst_clear_object (&ahc->pipeline);
+}
+
+/* Runs the pipeline and its main loop until gst_ahc_quit() is called.
+ * The calling thread owns the pipeline for the whole lifetime. */
+void
+gst_ahc_run (GstAhc * ahc)
+{
+  g_return_if_fail (!ahc->shared_dispatcher);
+
+  /* Create a GLib Main Loop and set it to run */
+  g_mutex_lock (&ahc->lock);
+  ahc->main_loop = g_main_loop_new (ahc->context, FALSE);
+  g_mutex_unlock (&ahc->lock);
+
+  if (attach_pipeline (ahc)) {
+    GST_DEBUG ("Entering main loop... (GstAhc:%p)", ahc);
+    g_main_loop_run (ahc->main_loop);
+    GST_DEBUG ("Exited main loop");
+  }
+
+  detach_pipeline (ahc);
+
+  g_mutex_lock (&ahc->lock);
+  g_clear_pointer (&ahc->main_loop, g_main_loop_unref);
+  g_mutex_unlock (&ahc->lock);
+}
+
+static gboolean
+quit_cb (gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+
+  g_main_loop_quit (ahc->main_loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+invoke (GstAhc * ahc, GSourceFunc func)
+{
+  GSource *source;
+
+  source = g_idle_source_new ();
+  g_source_set_callback (source, func, ahc, NULL);
+  g_source_attach (source, ahc->context);
+  g_source_unref (source);
+}
+
+/* Makes gst_ahc_run() return. Can be called from any thread, also before
+ * the main loop runs: the request waits in the main context until it
+ * does. */
+void
+gst_ahc_quit (GstAhc * ahc)
+{
+  GST_DEBUG ("Quitting main loop...");
+  invoke (ahc, quit_cb);
+}
+
+static gpointer
+run_thread (gpointer user_data)
+{
+  gst_ahc_run (user_data);
+
+  return NULL;
+}
+
+static gboolean
+attach_cb (gpointer user_data)
+{
+  attach_pipeline (user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+detach_cb (gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+
+  detach_pipeline (ahc);
+
+  g_mutex_lock (&ahc->lock);
+  ahc->dispatching = FALSE;
+  g_cond_broadcast (&ahc->cond);
+  g_mutex_unlock (&ahc->lock);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Cleared by detach_cb() on the dispatcher thread */
+static gboolean
+is_dispatching (GstAhc * ahc)
+{
+  gboolean dispatching;
+
+  g_mutex_lock (&ahc->lock);
+  dispatching = ahc->dispatching;
+  g_mutex_unlock (&ahc->lock);
+
+  return dispatching;
+}
+
+/* Runs gst_ahc_run() on a thread owned by ahc, or builds the pipeline on
+ * the shared dispatcher thread */
+void
+gst_ahc_start (GstAhc * ahc)
+{
+  g_return_if_fail (ahc->thread == NULL && !is_dispatching (ahc));
+
+  gst_ahc_mark_startup (ahc, GST_AHC_STARTUP_START, g_get_monotonic_time ());
+
+  if (ahc->shared_dispatcher) {
+    g_mutex_lock (&ahc->lock);
+    ahc->dispatching = TRUE;
+    g_mutex_unlock (&ahc->lock);
+    invoke (ahc, attach_cb);
+    return;
+  }
+
+  ahc->thread = g_thread_new ("ahc-pipeline", run_thread, ahc);
+}
+
+/* Quits the thread started by gst_ahc_start(), or detaches from the shared
+ * dispatcher, and waits for the pipeline to be torn down */
+void
+gst_ahc_stop (GstAhc * ahc)
+{
+  if (ahc->shared_dispatcher) {
+    if (!is_dispatching (ahc))
+      return;
+
+    /* From a callback the dispatcher can not wait for itself */
+    if (g_main_context_is_owner (ahc->context)) {
+      detach_cb (ahc);
+      return;
+    }
+
+    invoke (ahc, detach_cb);
+    GST_DEBUG ("Waiting for the dispatcher to tear the pipeline down...");
+    g_mutex_lock (&ahc->lock);
+    while (ahc->dispatching)
+      g_cond_wait (&ahc->cond, &ahc->lock);
+    g_mutex_unlock (&ahc->lock);
+    return;
+  }
+
+  if (!ahc->thread)
+    return;
+
+  gst_ahc_quit (ahc);
+  GST_DEBUG ("Waiting for thread to finish...");
+  g_thread_join (ahc->thread);
+  ahc->thread = NULL;
+}
+
+/* Moves the instance onto the shared dispatcher thread, or back onto a
+ * thread of its own. Only before gst_ahc_start(). */
+void
+gst_ahc_set_shared_dispatcher (GstAhc * ahc, gboolean enabled)
+{
+  g_return_if_fail (ahc->thread == NULL && !is_dispatching (ahc));
+
+  if (enabled == ahc->shared_dispatcher)
+    return;
+
+  GST_DEBUG ("Shared dispatcher %s", enabled ? "enabled" : "disabled");
+  g_main_context_unref (ahc->context);
+  if (enabled) {
+    ahc->context = gst_ahc_dispatcher_ref ();
+  } else {
+    gst_ahc_dispatcher_unref ();
+    ahc->context = g_main_context_new ();
+  }
+  ahc->shared_dispatcher = enabled;
+}
+
+static void
+apply_state (GstAhc * ahc, GstState state)
+{
+  GST_DEBUG ("Setting state to %s", gst_element_state_get_name (state));
+  gst_element_set_state (ahc->pipeline, state);
+}
+
+void
+gst_ahc_play (GstAhc * ahc)
+{
+  gst_ahc_mark_startup (ahc, GST_AHC_STARTUP_PLAY, g_get_monotonic_time ());
+  gst_ahc_control_push (ahc, GST_AHC_COMMAND_STATE, GST_STATE_PLAYING, 0);
+}
+
+void
+gst_ahc_pause (GstAhc * ahc)
+{
+  gst_ahc_control_push (ahc, GST_AHC_COMMAND_STATE, GST_STATE_PAUSED, 0);
+}
+
+/* Hands the window the video is rendered to over to the pipeline, 0 when
+ * there is none anymore. release is called on the main context with the
+ * window once the sink switched away from it, or when ahc is freed. Like
+ * the other setters it is queued and does not wait for the pipeline. */
+void
+gst_ahc_set_window_handle (GstAhc * ahc, guintptr handle,
+    GDestroyNotify release)
+{
+  if (handle)
+    gst_ahc_mark_startup (ahc, GST_AHC_STARTUP_SURFACE,
+        g_get_monotonic_time ());
+
+  gst_ahc_control_push_window (ahc, handle, release);
+}
+
+static void
+apply_window (GstAhc * ahc, guintptr handle, GDestroyNotify release)
+{
+  guintptr old;
+  GDestroyNotify old_release;
+
+  g_mutex_lock (&ahc->lock);
+  old = ahc->window_handle;
+  old_release = ahc->window_release;
+  ahc->window_handle = handle;
+  ahc->window_release = release;
+  g_mutex_unlock (&ahc->lock);
+
+  GST_DEBUG ("Setting native window %p", (gpointer) handle);
+  set_overlay_window (ahc, handle);
+
+  /* The sink renders to the new one now */
+  if (old && old_release)
+    old_release ((gpointer) old);
+
+  gst_ahc_check_initialization_complete (ahc);
+}
+
+void
+gst_ahc_check_initialization_complete (GstAhc * ahc)
+{
+  gboolean complete = FALSE;
+
+  /* Check if all conditions are met to report GStreamer as initialized.
+   * A sink which does not render to a window does not need to wait for one.
+   * Called on the main context when the pipeline was attached or a window
+   * was set. The pipeline exists once it is attached. */
+  g_mutex_lock (&ahc->lock);
+  if (!ahc->initialized && ahc->attached && (ahc->window_handle ||
+          !GST_IS_VIDEO_OVERLAY (ahc->vsink))) {
+    GST_DEBUG
+        ("Initialization complete, notifying application. window:%p",
+        (gpointer) ahc->window_handle);
+    ahc->initialized = TRUE;
+    complete = TRUE;
+  }
+  g_mutex_unlock (&ahc->lock);
+
+  if (!complete)
+    return;
+
+  gst_ahc_mark_startup (ahc, GST_AHC_STARTUP_INITIALIZED,
+      g_get_monotonic_time ());
+  if (ahc->callbacks.initialized)
+    ahc->callbacks.initialized (ahc, ahc->user_data);
+}
+
+void
+gst_ahc_set_resolution_switch_mode (GstAhc * ahc,
+    GstAhcResolutionSwitchMode mode)
+{
+  gst_ahc_control_push (ahc, GST_AHC_COMMAND_SWITCH_MODE, mode, 0);
+}
+
+void
+gst_ahc_set_standby (GstAhc * ahc, gboolean enabled)
+{
+  g_return_if_fail (ahc->pipeline == NULL);
+
+  GST_DEBUG ("Hot standby branches %s", enabled ? "enabled" : "disabled");
+  ahc->standby = enabled;
+}
+
+static gboolean
+select_standby_branch (GstAhc * ahc, gint width, gint height)
+{
+  guint i;
+
+  for (i = 0; i < ahc->standby_branches->len; i++) {
+    GstAhcStandbyBranch *branch = g_ptr_array_index (ahc->standby_branches, i);
+
+    if (branch->res.width == width && branch->res.height == height) {
+      g_object_set (ahc->selector, "active-pad", branch->selector_pad, NULL);
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* Starts measuring a resolution switch from the request, including the
+ * time it waits to be applied */
+void
+gst_ahc_begin_resolution_switch (GstAhc * ahc, gint width, gint height)
+{
+  g_mutex_lock (&ahc->lock);
+  ahc->switch_target.width = width;
+  ahc->switch_target.height = height;
+  ahc->switch_caps_seen = FALSE;
+  ahc->switch_start = gst_util_get_timestamp ();
+  g_atomic_int_set (&ahc->switch_pending, TRUE);
+  g_mutex_unlock (&ahc->lock);
+}
+
+void
+gst_ahc_change_resolution (GstAhc * ahc, gint width, gint height)
+{
+  gst_ahc_begin_resolution_switch (ahc, width, height);
+  gst_ahc_control_push (ahc, GST_AHC_COMMAND_RESOLUTION, width, height);
+}
+
+static void
+set_filter_caps (GstAhc * ahc, gint width, gint height)
+{
+  GstCaps *new_caps;
+
+  new_caps = gst_caps_new_simple ("video/x-raw",
+      "width", G_TYPE_INT, width,
+      "height", G_TYPE_INT, height,
+      NULL);
+
+  g_object_set (ahc->filter,
+      "caps", new_caps,
+      NULL);
+
+  gst_caps_unref (new_caps);
+}
+
+/* Switches resolution without a state change, so it can also be called
+ * from a streaming thread */
+void
+gst_ahc_renegotiate (GstAhc * ahc, gint width, gint height)
+{
+  GstPad *pad;
+
+  if (ahc->standby_branches) {
+    if (!select_standby_branch (ahc, width, height)) {
+      GST_WARNING ("No standby branch for %dx%d", width, height);
+      g_atomic_int_set (&ahc->switch_pending, FALSE);
+    }
+    return;
+  }
+
+  set_filter_caps (ahc, width, height);
+
+  /* Ask upstream to renegotiate while running. capsfilter does the same on
+   * newer GStreamer versions, an extra reconfigure is harmless. */
+  pad = gst_element_get_static_pad (ahc->filter, "sink");
+  gst_pad_push_event (pad, gst_event_new_reconfigure ());
+  gst_object_unref (pad);
+}
+
+static void
+apply_resolution (GstAhc * ahc, gint width, gint height)
+{
+  GST_DEBUG ("Changing resolution to %dx%d", width, height);
+
+  if (ahc->standby_branches ||
+      ahc->switch_mode == GST_AHC_RESOLUTION_SWITCH_RENEGOTIATE) {
+    gst_ahc_renegotiate (ahc, width, height);
+    return;
+  }
+
+  gst_element_set_state (ahc->pipeline, GST_STATE_READY);
+  set_filter_caps (ahc, width, height);
+  gst_element_set_state (ahc->pipeline, GST_STATE_PAUSED);
+}
+
+/* Returns how many bytes the inactive standby branches can hold in their
+ * queues and in flight, or 0 if hot standby is disabled or the pipeline
+ * does not run */
+gsize
+gst_ahc_get_standby_memory (GstAhc * ahc)
+{
+  gsize total = 0;
+  GPtrArray *branches = NULL;
+  GstElement *selector = NULL;
+  GstPad *active = NULL;
+  guint i;
+
+  /* Called from application threads while the pipeline thread may be
+   * tearing the pipeline down */
+  g_mutex_lock (&ahc->lock);
+  if (ahc->attached && ahc->standby_branches) {
+    branches = g_ptr_array_ref (ahc->standby_branches);
+    selector = gst_object_ref (ahc->selector);
+  }
+  g_mutex_unlock (&ahc->lock);
+
+  if (!branches)
+    return 0;
+
+  g_object_get (selector, "active-pad", &active, NULL);
+
+  for (i = 0; i < branches->len; i++) {
+    GstAhcStandbyBranch *branch = g_ptr_array_index (branches, i);
+    GstVideoInfo info;
+    GstCaps *caps;
+    GstPad *pad;
+    /* NV21 until the branch has negotiated */
+    gsize size = (gsize) branch->res.width * branch->res.height * 3 / 2;
+
+    if (branch->selector_pad == active)
+      continue;
+
+    pad = gst_element_get_static_pad (branch->filter, "src");
+    caps = gst_pad_get_current_caps (pad);
+    if (caps && gst_video_info_from_caps (&info, caps))
+      size = GST_VIDEO_INFO_SIZE (&info);
+    if (caps)
+      gst_caps_unref (caps);
+    gst_object_unref (pad);
+
+    total += size * (STANDBY_QUEUE_BUFFERS + 1);
+  }
+
+  if (active)
+    gst_object_unref (active);
+  gst_object_unref (selector);
+  g_ptr_array_unref (branches);
+
+  return total;
+}
+
+/* Returns the time the last resolution change took until its first frame
+ * reached the sink, or GST_CLOCK_TIME_NONE while none has completed */
+GstClockTime
+gst_ahc_get_resolution_switch_latency (GstAhc * ahc)
+{
+  GstClockTime latency;
+
+  g_mutex_lock (&ahc->lock);
+  latency = ahc->switch_pending ? GST_CLOCK_TIME_NONE : ahc->switch_latency;
+  g_mutex_unlock (&ahc->lock);
+
+  return latency;
+}
+
+void
+gst_ahc_apply_white_balance (GstAhc * ahc, gint wb_mode)
+{
+  if (!GST_IS_PHOTOGRAPHY (ahc->ahcsrc)) {
+    GST_WARNING ("%s does not support photography settings",
+        ahc->src_factory);
+    return;
+  }
+
+  GST_DEBUG ("Setting WB_MODE (%d)", wb_mode);
+
+  g_object_set (ahc->ahcsrc, GST_PHOTOGRAPHY_PROP_WB_MODE, wb_mode, NULL);
+}
+
+void
+gst_ahc_apply_auto_focus (GstAhc * ahc, gboolean enabled)
+{
+  if (!GST_IS_PHOTOGRAPHY (ahc->ahcsrc)) {
+    GST_WARNING ("%s does not support photography settings",
+        ahc->src_factory);
+    return;
+  }
+
+  GST_DEBUG ("Setting Autofocus (%d)", enabled);
+
+  gst_photography_set_autofocus (GST_PHOTOGRAPHY (ahc->ahcsrc), enabled);
+}
+
+void
+gst_ahc_apply_rotate_method (GstAhc * ahc, gint method)
+{
+  if (!has_property (ahc->vsink, "rotate-method")) {
+    GST_WARNING ("%s can not rotate the video", ahc->sink_factory);
+    return;
+  }
+
+  g_object_set (ahc->vsink, "rotate-method", method, NULL);
+}
+
+void
+gst_ahc_set_white_balance (GstAhc * ahc, gint wb_mode)
+{
+  gst_ahc_control_push (ahc, GST_AHC_COMMAND_WHITE_BALANCE, wb_mode, 0);
+}
+
+void
+gst_ahc_set_auto_focus (GstAhc * ahc, gboolean enabled)
+{
+  gst_ahc_control_push (ahc, GST_AHC_COMMAND_AUTO_FOCUS, enabled, 0);
+}
+
+void
+gst_ahc_set_rotate_method (GstAhc * ahc, gint method)
+{
+  gst_ahc_control_push (ahc, GST_AHC_COMMAND_ROTATE_METHOD, method, 0);
+}
+
+/* Called on the main context once the pipeline exists */
+void
+gst_ahc_apply_command (GstAhc * ahc, const GstAhcCommand * cmd)
+{
+  switch (cmd->type) {
+    case GST_AHC_COMMAND_STATE:
+      apply_state (ahc, cmd->arg0);
+      break;
+    case GST_AHC_COMMAND_SWITCH_MODE:
+      GST_DEBUG ("Setting resolution switch mode (%d)", cmd->arg0);
+      ahc->switch_mode = cmd->arg0;
+      break;
+    case GST_AHC_COMMAND_RESOLUTION:
+      apply_resolution (ahc, cmd->arg0, cmd->arg1);
+      break;
+    case GST_AHC_COMMAND_WHITE_BALANCE:
+      gst_ahc_apply_white_balance (ahc, cmd->arg0);
+      break;
+    case GST_AHC_COMMAND_AUTO_FOCUS:
+      gst_ahc_apply_auto_focus (ahc, cmd->arg0);
+      break;
+    case GST_AHC_COMMAND_ROTATE_METHOD:
+      gst_ahc_apply_rotate_method (ahc, cmd->arg0);
+      break;
+    case GST_AHC_COMMAND_SETTINGS:
+      gst_ahc_settings_apply_staged (ahc);
+      break;
+    case GST_AHC_COMMAND_WINDOW:
+      apply_window (ahc, cmd->handle, cmd->release);
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+}
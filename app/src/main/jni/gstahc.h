@@ -0,0 +1,711 @@
+/*
+ * Copyright (C) 2016-2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_AHC_H__
+#define __GST_AHC_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Platform independent part of the camera application. It builds and
+ * controls the pipeline and does not know about JNI or ANativeWindow, so it
+ * can also be built on a Linux host with stand-in source and sink elements.
+ */
+
+#define GST_AHC_DEFAULT_SRC_FACTORY   "ahcsrc"
+#define GST_AHC_DEFAULT_SINK_FACTORY  "glimagesink"
+/* Deterministic stand-in for ahcsrc, see gstahcfakesrc.c */
+#define GST_AHC_FAKE_SRC_FACTORY      "ahcfakesrc"
+/* Replays raw capture files, see gstahcreplaysrc.c */
+#define GST_AHC_REPLAY_SRC_FACTORY    "ahcreplaysrc"
+/* Writes raw capture files, see gstahcrawsink.c */
+#define GST_AHC_RAW_SINK_FACTORY      "ahcrawsink"
+
+typedef struct _GstAhc GstAhc;
+
+/* How gst_ahc_change_resolution() applies new caps.
+ *
+ * RESTART drops the pipeline to READY, which reopens the camera.
+ * RENEGOTIATE changes the caps while the pipeline keeps running: the
+ * source renegotiates on the reconfigure event if the sensor supports the
+ * size, otherwise the in-pipeline scaler converts to it. */
+typedef enum
+{
+  GST_AHC_RESOLUTION_SWITCH_RESTART,
+  GST_AHC_RESOLUTION_SWITCH_RENEGOTIATE,
+} GstAhcResolutionSwitchMode;
+
+/* A mapped camera frame handed to the application. It stays valid until
+ * gst_ahc_release_frame() is called with its id. */
+typedef struct _GstAhcFrame
+{
+  gint id;
+  GstSample *sample;
+  GstBuffer *buffer;
+  GstMapInfo map;
+  GstVideoInfo info;
+} GstAhcFrame;
+
+/* What happens to new frames while the application holds the maximum */
+typedef enum
+{
+  GST_AHC_FRAME_DROP,
+  GST_AHC_FRAME_BLOCK,
+  GST_AHC_FRAME_LATEST,
+  GST_AHC_FRAME_LATEST_DECIMATED,
+} GstAhcFramePolicy;
+
+typedef struct _GstAhcFrameCounters
+{
+  guint64 delivered;
+  /* LATEST and LATEST_DECIMATED: replaced in the mailbox before delivery */
+  guint64 superseded;
+  /* LATEST_DECIMATED: skipped because the consumer is slower than the
+   * camera */
+  guint64 decimated;
+  guint64 dropped;
+} GstAhcFrameCounters;
+
+typedef struct _GstAhcFrameTap GstAhcFrameTap;
+
+typedef struct _GstAhcCallbacks
+{
+  void (*error) (GstAhc * ahc, const gchar * message, gpointer user_data);
+  void (*state_changed) (GstAhc * ahc, GstState state, gpointer user_data);
+  void (*initialized) (GstAhc * ahc, gpointer user_data);
+  /* Called from the frame branch streaming thread, or from the mailbox
+   * thread with GST_AHC_FRAME_LATEST and GST_AHC_FRAME_LATEST_DECIMATED.
+   * gst_ahc_free() must not be called from it. */
+  void (*frame) (GstAhc * ahc, GstAhcFrame * frame, gpointer user_data);
+  /* Called on the main context for every result a native frame processor
+   * posts with gst_ahc_processor_post_message() */
+  void (*processor_result) (GstAhc * ahc, const GstStructure * result,
+      gpointer user_data);
+} GstAhcCallbacks;
+
+typedef struct _GstAhcResolution
+{
+  gint width;
+  gint height;
+} GstAhcResolution;
+
+typedef struct _GstAhcStandbyBranch GstAhcStandbyBranch;
+
+typedef struct _GstAhcBusCounters
+{
+  /* Every message posted on the pipeline bus */
+  guint64 received;
+  /* Messages handed to the main context, the rest is dropped unhandled */
+  guint64 forwarded;
+} GstAhcBusCounters;
+
+/* Time from posting a ping on the bus to its dispatch, see gst_ahc_ping() */
+typedef struct _GstAhcDispatchStats
+{
+  guint64 n_pings;
+  GstClockTime mean_latency;
+  GstClockTime max_latency;
+} GstAhcDispatchStats;
+
+/* Which fields of a GstAhcSettings batch are set */
+typedef enum
+{
+  GST_AHC_SETTING_WHITE_BALANCE = (1 << 0),
+  GST_AHC_SETTING_AUTO_FOCUS = (1 << 1),
+  GST_AHC_SETTING_ROTATE_METHOD = (1 << 2),
+  GST_AHC_SETTING_RESOLUTION = (1 << 3),
+} GstAhcSettingFlags;
+
+/* Settings applied together by gst_ahc_apply_settings() */
+typedef struct _GstAhcSettings
+{
+  GstAhcSettingFlags set;
+  gint wb_mode;
+  gboolean auto_focus;
+  gint rotate_method;
+  GstAhcResolution resolution;
+} GstAhcSettings;
+
+/* Tags the first frame captured after the camera acknowledged a settings
+ * batch. The meta is copied along when the frame is scaled or converted. */
+typedef struct _GstAhcSettingsMeta
+{
+  GstMeta meta;
+  guint id;
+  /* Monotonic times of gst_ahc_apply_settings() and of the frame boundary
+   * at which the settings were acknowledged */
+  GstClockTime requested;
+  GstClockTime applied;
+} GstAhcSettingsMeta;
+
+GType gst_ahc_settings_meta_api_get_type (void);
+#define GST_AHC_SETTINGS_META_API_TYPE (gst_ahc_settings_meta_api_get_type ())
+#define gst_buffer_get_ahc_settings_meta(b) \
+    ((GstAhcSettingsMeta *) gst_buffer_get_meta ((b), \
+        GST_AHC_SETTINGS_META_API_TYPE))
+
+/* Slots of the stats block, 32 bit each in native byte order, written with
+ * atomic stores so they can be read at any time without locking. See
+ * gstahcstats.c. */
+typedef enum
+{
+  /* GST_AHC_STATS_VERSION, changes with the layout */
+  GST_AHC_STAT_VERSION,
+  GST_AHC_STAT_CAPTURED,
+  GST_AHC_STAT_RENDERED,
+  /* Frames dropped by the branch queues, the preview included */
+  GST_AHC_STAT_DROPPED,
+  /* Caps changes at the preview sink after the first caps */
+  GST_AHC_STAT_RENEGOTIATIONS,
+  /* Preview frame rate over the last second, in frames per 1000 s */
+  GST_AHC_STAT_FPS_MILLI,
+  GST_AHC_STAT_PREVIEW_QUEUE_LEVEL,
+  /* Level of the fullest runtime branch queue */
+  GST_AHC_STAT_BRANCH_QUEUE_LEVEL,
+  /* Capture to preview sink latency of the last frame */
+  GST_AHC_STAT_LATENCY_US,
+  GST_AHC_N_STATS
+} GstAhcStat;
+
+#define GST_AHC_STATS_VERSION 1
+#define GST_AHC_STATS_SIZE (GST_AHC_N_STATS * sizeof (gint32))
+
+/* Events batched for a consumer in another runtime, see gstahcevents.c.
+ *
+ * The ring lives in memory provided by the consumer, in native byte order:
+ *
+ *   0  write offset, advanced by the ring
+ *   4  read offset, advanced by the consumer
+ *   8  events dropped because the ring was full
+ *  16  records
+ *
+ * Offsets are relative to the first record. A record is three 32 bit
+ * values, type, argument and text length, followed by the text in UTF-8
+ * padded to 4 bytes. Reading wraps to offset 0 at a PAD record, or when
+ * fewer than 12 bytes are left before the end. */
+#define GST_AHC_EVENT_RING_HEADER_SIZE 16
+#define GST_AHC_EVENT_RECORD_HEADER_SIZE 12
+
+typedef enum
+{
+  GST_AHC_EVENT_PAD,
+  GST_AHC_EVENT_ERROR,
+  GST_AHC_EVENT_STATE_CHANGED,
+  GST_AHC_EVENT_INITIALIZED,
+  GST_AHC_EVENT_PROCESSOR_RESULT,
+} GstAhcEventType;
+
+typedef struct _GstAhcEventRing GstAhcEventRing;
+
+/* Called on the main context of the instance once for every batch, the
+ * consumer reads all records up to write. Unlike the published write offset
+ * in the header, it was sampled under the ring lock and the records before
+ * it are visible to the caller. */
+typedef void (*GstAhcEventFlushFunc) (GstAhcEventRing * ring, guint32 write,
+    gpointer user_data);
+
+/* Consumers which can be attached to the camera next to the preview */
+typedef enum
+{
+  GST_AHC_BRANCH_PREVIEW,
+  GST_AHC_BRANCH_RECORD,
+  GST_AHC_BRANCH_ANALYSIS,
+} GstAhcBranchType;
+
+typedef struct _GstAhcBranch GstAhcBranch;
+
+/* What a full branch queue does with the next frame, the values of the
+ * "leaky" property of queue */
+typedef enum
+{
+  /* Blocks the tee, and with it the camera */
+  GST_AHC_QUEUE_LEAK_NONE,
+  /* Drops the new frame */
+  GST_AHC_QUEUE_LEAK_UPSTREAM,
+  /* Drops the oldest queued frame */
+  GST_AHC_QUEUE_LEAK_DOWNSTREAM,
+} GstAhcQueueLeak;
+
+typedef struct _GstAhcQueueConfig
+{
+  guint max_buffers;
+  GstAhcQueueLeak leak;
+} GstAhcQueueConfig;
+
+typedef struct _GstAhcQueueStats
+{
+  GstAhcBranchType type;
+  /* 0 for the preview queue */
+  gint branch_id;
+  guint level;
+  guint max_buffers;
+  guint64 pushed;
+  guint64 dropped;
+} GstAhcQueueStats;
+
+/* Streaming threads by what they run, see gstahcthreads.c */
+typedef enum
+{
+  GST_AHC_THREAD_CAPTURE,
+  GST_AHC_THREAD_DISPLAY,
+  GST_AHC_THREAD_ENCODE,
+  GST_AHC_THREAD_OTHER,
+  GST_AHC_N_THREAD_ROLES
+} GstAhcThreadRole;
+
+typedef struct _GstAhcThreadConfig
+{
+  /* Bit n allows CPU n, 0 allows all of them */
+  guint64 cpus;
+  /* Nice value under SCHED_OTHER */
+  gint nice;
+  /* 1-99 runs the thread under SCHED_FIFO instead, 0 does not */
+  gint rt_priority;
+} GstAhcThreadConfig;
+
+typedef struct _GstAhcThreadStats
+{
+  GstAhcThreadRole role;
+  gint tid;
+  /* CPU the thread last ran on */
+  gint cpu;
+  /* Moves between CPUs so far, -1 if the kernel does not tell */
+  gint64 migrations;
+  /* The configuration of the role was applied without errors */
+  gboolean configured;
+} GstAhcThreadStats;
+
+/* Histograms of the in-process tracer, see gstahctrace.c */
+typedef enum
+{
+  /* Time an element takes from receiving a buffer to pushing it on */
+  GST_AHC_TRACE_PROCESSING,
+  /* Capture to preview sink latency of every frame */
+  GST_AHC_TRACE_LATENCY,
+} GstAhcTraceKind;
+
+typedef struct _GstAhcTraceSlot GstAhcTraceSlot;
+
+typedef struct _GstAhcTraceStats
+{
+  /* Element name, valid until gst_ahc_free() */
+  const gchar *name;
+  GstAhcTraceKind kind;
+  guint64 count;
+  /* Upper bounds of the histogram buckets holding the percentiles */
+  guint p50_us;
+  guint p90_us;
+  guint p99_us;
+  guint max_us;
+} GstAhcTraceStats;
+
+/* Points of the startup timeline, see gstahcstartup.c */
+typedef enum
+{
+  /* Taken by the Java side in GstAhc.init() and passed in */
+  GST_AHC_STARTUP_INIT,
+  GST_AHC_STARTUP_LIBRARIES_LOADED,
+  GST_AHC_STARTUP_GSTREAMER_INIT,
+  GST_AHC_STARTUP_CLASS_INIT,
+  /* gst_native_init() entered */
+  GST_AHC_STARTUP_NATIVE_INIT,
+  GST_AHC_STARTUP_START,
+  /* Pipeline built and attached to its main context */
+  GST_AHC_STARTUP_PIPELINE_ATTACHED,
+  GST_AHC_STARTUP_SURFACE,
+  /* Reported through the initialized callback */
+  GST_AHC_STARTUP_INITIALIZED,
+  GST_AHC_STARTUP_PLAY,
+  GST_AHC_STARTUP_PLAYING,
+  /* First buffer at the preview sink */
+  GST_AHC_STARTUP_FIRST_FRAME,
+  GST_AHC_N_STARTUP_MARKS
+} GstAhcStartupMark;
+
+typedef struct _GstAhcStartupPhase
+{
+  GstAhcStartupMark mark;
+  const gchar *name;
+  /* Microseconds since the first mark */
+  gint64 offset;
+  /* Microseconds since the mark before, the phase ending here */
+  gint64 duration;
+} GstAhcStartupPhase;
+
+/* A span recorded from where it is declared to the end of the enclosing
+ * block, see gstahcrecorder.c */
+typedef struct _GstAhcRecordScope
+{
+  const gchar *name;
+  const gchar *category;
+  /* 0 unless the recorder was running when the scope began */
+  gint64 start;
+} GstAhcRecordScope;
+
+#define GST_AHC_RECORD_SCOPE(name, category) \
+  GstAhcRecordScope G_PASTE (_ahc_record_scope_, __LINE__) G_GNUC_UNUSED \
+      __attribute__ ((cleanup (gst_ahc_record_scope_end))) = \
+      gst_ahc_record_scope_begin (name, category)
+
+/* Raw capture file, in native byte order:
+ *
+ *   GstAhcRawHeader
+ *   GstAhcRawIndexEntry[max_frames]
+ *   frames from data_offset on, aligned to GST_AHC_RAW_ALIGN, each
+ *   frame_size bytes in the default GstVideoInfo layout
+ *
+ * Only the first n_frames index entries are valid. Written by ahcrawsink,
+ * read by ahcreplaysrc. */
+#define GST_AHC_RAW_MAGIC "AHCRAW01"
+#define GST_AHC_RAW_ALIGN 4096
+
+typedef struct _GstAhcRawHeader
+{
+  gchar magic[8];
+  /* Video format as fourcc, NV21, NV12 or I420 */
+  guint32 fourcc;
+  guint32 width;
+  guint32 height;
+  guint32 fps_n;
+  guint32 fps_d;
+  guint32 frame_size;
+  guint32 max_frames;
+  guint32 n_frames;
+  guint64 data_offset;
+} GstAhcRawHeader;
+
+typedef struct _GstAhcRawIndexEntry
+{
+  /* Capture time of the frame */
+  guint64 pts;
+  /* Of the frame from the start of the file */
+  guint64 offset;
+} GstAhcRawIndexEntry;
+
+/* Progress of a raw capture branch, see gst_ahc_start_raw_capture() */
+typedef struct _GstAhcRawCaptureStats
+{
+  guint64 written;
+  /* Taken from the camera, waiting for the writer */
+  guint pending;
+  /* Dropped because the writer fell behind */
+  guint64 dropped;
+  /* Not recorded because the file was full or the caps changed */
+  guint64 skipped;
+} GstAhcRawCaptureStats;
+
+/* Settings queued by application threads, see gstahccontrol.c */
+typedef enum
+{
+  GST_AHC_COMMAND_STATE,
+  GST_AHC_COMMAND_SWITCH_MODE,
+  GST_AHC_COMMAND_RESOLUTION,
+  GST_AHC_COMMAND_WHITE_BALANCE,
+  GST_AHC_COMMAND_AUTO_FOCUS,
+  GST_AHC_COMMAND_ROTATE_METHOD,
+  GST_AHC_COMMAND_SETTINGS,
+  GST_AHC_COMMAND_WINDOW,
+  GST_AHC_N_COMMANDS
+} GstAhcCommandType;
+
+typedef struct _GstAhcCommand GstAhcCommand;
+struct _GstAhcCommand
+{
+  GstAhcCommand *next;
+  GstAhcCommandType type;
+  gint arg0;
+  gint arg1;
+  /* GST_AHC_COMMAND_WINDOW: the new window and how to let go of it */
+  guintptr handle;
+  GDestroyNotify release;
+};
+
+struct _GstAhc
+{
+  GstAhcCallbacks callbacks;
+  gpointer user_data;
+  gchar *src_factory;
+  gchar *sink_factory;
+  GstElement *pipeline;
+  /* Owned by the instance unless shared_dispatcher is set, then context
+   * is the one of the shared dispatcher thread and thread is NULL */
+  GThread *thread;
+  GMainContext *context;
+  gboolean shared_dispatcher;
+  /* Protected by lock, like initialized */
+  GMainLoop *main_loop;
+  /* Protected by lock: the pipeline is built and its sources are attached
+   * to context, and in shared mode, gst_ahc_stop() is still to come */
+  gboolean attached;
+  gboolean dispatching;
+  GCond cond;
+  GSource *bus_source;
+  GSource *control_source;
+  /* Stats block, the internal one unless gst_ahc_set_stats_block() was
+   * called. The fields below it belong to the sink streaming thread. */
+  gint32 *stats;
+  gint32 stats_storage[GST_AHC_N_STATS];
+  GSource *stats_source;
+  gboolean stats_caps_seen;
+  GstClockTime stats_window_start;
+  guint stats_window_frames;
+  /* Tracer histograms, see gstahctrace.c. Slots are only ever appended,
+   * under trace_lock, and written lock-free from the streaming threads. */
+  gboolean tracing;
+  GstAhcTraceSlot *trace_slots;
+  gint n_trace_slots;
+  GMutex trace_lock;
+
+  /* Bus messages, counted from the posting threads. 64 bit so a long
+   * session does not wrap, g_atomic_int only covers 32 bit. */
+  guint64 bus_received;
+  guint64 bus_forwarded;
+  /* Written on the main context, protected by lock. window_release lets go
+   * of window_handle once the sink does not render to it anymore. */
+  guintptr window_handle;
+  GDestroyNotify window_release;
+  GstState state;
+  GstElement *ahcsrc;
+  GstElement *scaler;
+  GstElement *filter;
+  GstElement *tee;
+  GstElement *vsink;
+  gboolean initialized;
+
+  /* Runtime branches on the tee by id, protected by lock */
+  GHashTable *branches;
+  gint next_branch_id;
+  /* Removed branches still draining, protected by lock */
+  GList *removals;
+  /* Queue of each kind of branch, protected by lock */
+  GstAhcQueueConfig queue_configs[GST_AHC_BRANCH_ANALYSIS + 1];
+
+  GstAhcFrameTap *frames;
+
+  /* Task pools by role, with the configuration and the live threads they
+   * started, protected by lock */
+  GstTaskPool *task_pools[GST_AHC_N_THREAD_ROLES];
+  GstAhcThreadConfig thread_configs[GST_AHC_N_THREAD_ROLES];
+  GList *streaming_threads;
+
+  /* Lock-free stack of commands for the main context, newest first */
+  GstAhcCommand *commands;
+
+  GstAhcResolutionSwitchMode switch_mode;
+
+  /* Hot standby: one pre-negotiated branch per preview resolution */
+  gboolean standby;
+  GstElement *selector;
+  GPtrArray *standby_branches;
+
+  /* Settings batches waiting for the next frame, protected by lock.
+   * settings_pending is read without the lock from the streaming thread
+   * first. */
+  gint settings_pending;
+  GstAhcSettings pending_settings;
+  GstClockTime settings_requested;
+  guint next_settings_id;
+  guint pending_settings_id;
+  guint applied_settings_id;
+  /* Batch applied on the camera and waiting for it to acknowledge,
+   * protected by lock like the pending one. focus_done is set from the bus
+   * sync handler when the source reports the end of an autofocus run. */
+  gint settings_awaiting;
+  /* The main context applies a batch without dataflow, frames wait for it
+   * on cond */
+  gint settings_applying;
+  GstAhcSettings awaiting_settings;
+  GstClockTime awaiting_requested;
+  guint awaiting_settings_id;
+  gint focus_done;
+  /* Rotation of the tagged frame, applied at the sink once it gets there,
+   * protected by lock. rotate_pending is read without the lock first. */
+  gint rotate_pending;
+  gint rotate_method;
+  GstClockTime rotate_pts;
+
+  /* Resolution switch bookkeeping, protected by lock. switch_pending is
+   * read without the lock from the streaming thread first. */
+  GMutex lock;
+  gint switch_pending;
+  GstAhcResolution switch_target;
+  gboolean switch_caps_seen;
+  GstClockTime switch_start;
+  GstClockTime switch_latency;
+
+  /* Monotonic time of each startup mark in microseconds, 0 while not
+   * reached, protected by lock */
+  gint64 startup[GST_AHC_N_STARTUP_MARKS];
+
+  /* Dispatch latency of pings, protected by lock */
+  guint64 n_pings;
+  GstClockTime ping_total;
+  GstClockTime ping_max;
+};
+
+/* Preview resolutions offered by the application */
+extern const GstAhcResolution gst_ahc_preview_resolutions[];
+extern const guint gst_ahc_n_preview_resolutions;
+
+GstAhc *gst_ahc_new (const gchar * src_factory, const gchar * sink_factory,
+    const GstAhcCallbacks * callbacks, gpointer user_data);
+void gst_ahc_free (GstAhc * ahc);
+
+void gst_ahc_run (GstAhc * ahc);
+void gst_ahc_quit (GstAhc * ahc);
+void gst_ahc_start (GstAhc * ahc);
+void gst_ahc_stop (GstAhc * ahc);
+void gst_ahc_set_shared_dispatcher (GstAhc * ahc, gboolean enabled);
+
+void gst_ahc_get_bus_counters (GstAhc * ahc, GstAhcBusCounters * counters);
+void gst_ahc_ping (GstAhc * ahc);
+void gst_ahc_get_dispatch_stats (GstAhc * ahc, GstAhcDispatchStats * stats);
+
+void gst_ahc_play (GstAhc * ahc);
+void gst_ahc_pause (GstAhc * ahc);
+
+void gst_ahc_set_window_handle (GstAhc * ahc, guintptr handle,
+    GDestroyNotify release);
+void gst_ahc_check_initialization_complete (GstAhc * ahc);
+
+void gst_ahc_set_resolution_switch_mode (GstAhc * ahc,
+    GstAhcResolutionSwitchMode mode);
+void gst_ahc_set_standby (GstAhc * ahc, gboolean enabled);
+gsize gst_ahc_get_standby_memory (GstAhc * ahc);
+void gst_ahc_change_resolution (GstAhc * ahc, gint width, gint height);
+GstClockTime gst_ahc_get_resolution_switch_latency (GstAhc * ahc);
+gint gst_ahc_add_branch (GstAhc * ahc, GstAhcBranchType type,
+    const gchar * description);
+gboolean gst_ahc_remove_branch (GstAhc * ahc, gint id);
+void gst_ahc_set_queue_config (GstAhc * ahc, GstAhcBranchType type,
+    const GstAhcQueueConfig * config);
+GArray *gst_ahc_get_queue_stats (GstAhc * ahc);
+gint gst_ahc_start_raw_capture (GstAhc * ahc, const gchar * location,
+    guint max_frames);
+gboolean gst_ahc_get_raw_capture_stats (GstAhc * ahc, gint id,
+    GstAhcRawCaptureStats * stats);
+
+gboolean gst_ahc_set_frame_delivery (GstAhc * ahc, gboolean enabled);
+void gst_ahc_set_max_held_frames (GstAhc * ahc, guint max_held,
+    GstAhcFramePolicy policy);
+void gst_ahc_release_frame (GstAhc * ahc, gint id);
+void gst_ahc_get_frame_counters (GstAhc * ahc,
+    GstAhcFrameCounters * counters);
+
+guint gst_ahc_apply_settings (GstAhc * ahc, const GstAhcSettings * settings);
+guint gst_ahc_get_applied_settings (GstAhc * ahc);
+
+void gst_ahc_set_thread_config (GstAhc * ahc, GstAhcThreadRole role,
+    const GstAhcThreadConfig * config);
+GArray *gst_ahc_get_thread_stats (GstAhc * ahc);
+
+gboolean gst_ahc_set_stats_block (GstAhc * ahc, gpointer memory, gsize size);
+const gint32 *gst_ahc_get_stats_block (GstAhc * ahc);
+
+void gst_ahc_set_tracing (GstAhc * ahc, gboolean enabled);
+GArray *gst_ahc_get_trace_stats (GstAhc * ahc);
+gchar *gst_ahc_dump_trace (GstAhc * ahc);
+
+void gst_ahc_mark_startup (GstAhc * ahc, GstAhcStartupMark mark,
+    gint64 time);
+GArray *gst_ahc_get_startup_timeline (GstAhc * ahc);
+gchar *gst_ahc_dump_startup_timeline (GstAhc * ahc);
+
+void gst_ahc_recorder_start (guint events_per_thread);
+gboolean gst_ahc_recorder_stop (const gchar * path, GError ** error);
+
+GstAhcEventRing *gst_ahc_event_ring_new (GstAhc * ahc, guint8 * memory,
+    gsize size, GstAhcEventFlushFunc flush, gpointer user_data);
+void gst_ahc_event_ring_free (GstAhcEventRing * ring);
+gboolean gst_ahc_event_ring_push (GstAhcEventRing * ring,
+    GstAhcEventType type, gint arg, const gchar * text);
+
+void gst_ahc_set_white_balance (GstAhc * ahc, gint wb_mode);
+void gst_ahc_set_auto_focus (GstAhc * ahc, gboolean enabled);
+void gst_ahc_set_rotate_method (GstAhc * ahc, gint method);
+
+/* Internal to the core */
+G_GNUC_INTERNAL GstElement *gst_ahc_branch_queue_new (GstAhc * ahc,
+    GstAhcBranchType type, gint branch_id);
+G_GNUC_INTERNAL void gst_ahc_branches_init (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_branches_clear (GstAhc * ahc);
+G_GNUC_INTERNAL gboolean gst_ahc_branch_type_of (GstElement * element,
+    GstAhcBranchType * type);
+G_GNUC_INTERNAL GstElement *gst_ahc_branch_get_element (GstAhc * ahc,
+    gint id, const gchar * name);
+G_GNUC_INTERNAL void gst_ahc_threads_init (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_threads_free (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_threads_handle_stream_status (GstAhc * ahc,
+    GstMessage * message);
+G_GNUC_INTERNAL void gst_ahc_frames_init (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_frames_attach (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_frames_flush (GstAhc * ahc);
+G_GNUC_INTERNAL gboolean gst_ahc_frames_in_callback (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_frames_free (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_control_push (GstAhc * ahc,
+    GstAhcCommandType type, gint arg0, gint arg1);
+G_GNUC_INTERNAL void gst_ahc_control_push_window (GstAhc * ahc,
+    guintptr handle, GDestroyNotify release);
+G_GNUC_INTERNAL GSource *gst_ahc_control_attach (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_control_clear (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_apply_command (GstAhc * ahc,
+    const GstAhcCommand * cmd);
+G_GNUC_INTERNAL void gst_ahc_apply_white_balance (GstAhc * ahc,
+    gint wb_mode);
+G_GNUC_INTERNAL void gst_ahc_apply_auto_focus (GstAhc * ahc,
+    gboolean enabled);
+G_GNUC_INTERNAL void gst_ahc_apply_rotate_method (GstAhc * ahc,
+    gint method);
+G_GNUC_INTERNAL void gst_ahc_begin_resolution_switch (GstAhc * ahc,
+    gint width, gint height);
+G_GNUC_INTERNAL void gst_ahc_renegotiate (GstAhc * ahc, gint width,
+    gint height);
+G_GNUC_INTERNAL void gst_ahc_settings_attach (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_settings_focus_done (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_settings_apply_staged (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_stats_init (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_stats_attach (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_stats_start (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_stats_stop (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_trace_init (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_trace_free (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_trace_attach (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_startup_attach (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_fake_src_register (void);
+G_GNUC_INTERNAL void gst_ahc_replay_src_register (void);
+G_GNUC_INTERNAL void gst_ahc_raw_sink_register (void);
+G_GNUC_INTERNAL void gst_ahc_convert_register (void);
+G_GNUC_INTERNAL void gst_ahc_pyramid_register (void);
+G_GNUC_INTERNAL void gst_ahc_recorder_attach (GstAhc * ahc);
+G_GNUC_INTERNAL void gst_ahc_recorder_state_changed (GstMessage * message);
+G_GNUC_INTERNAL GstAhcRecordScope gst_ahc_record_scope_begin (const gchar *
+    name, const gchar * category);
+G_GNUC_INTERNAL void gst_ahc_record_scope_end (GstAhcRecordScope * scope);
+G_GNUC_INTERNAL GMainContext *gst_ahc_dispatcher_ref (void);
+G_GNUC_INTERNAL void gst_ahc_dispatcher_unref (void);
+G_GNUC_INTERNAL void gst_ahc_dispatch_record (GstAhc * ahc,
+    GstMessage * message);
+
+G_END_DECLS
+
+#endif /* __GST_AHC_H__ */
@@ -0,0 +1,627 @@
+/*
+ * Copyright (C) 2016-2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Branches attached to the camera tee at runtime.
+ *
+ *   tee ! queue (leaky) ! <description>
+ *
+ * Each branch is a bin with its own leaky queue, so it runs in its own
+ * streaming thread and a slow consumer drops its oldest frames instead of
+ * stalling the tee and with it the preview. The tee hands the same buffer
+ * to every branch, nothing is copied unless a branch writes to it.
+ *
+ * Removal blocks the tee pad until it is idle, unlinks the branch and sends
+ * EOS through it so muxers can finalize their files. Once EOS has reached
+ * every sink of the branch it is shut down from the main context. Branches
+ * still draining when the pipeline is detached are shut down right away
+ * instead: the main context may be shared and outlive the instance, so the
+ * callbacks queued there only hold a reference to the branch.
+ *
+ * Depth and leak policy of the queue are set per kind of branch with
+ * gst_ahc_set_queue_config(), the preview queue included, and apply to
+ * running queues too. Probes on both sides of each queue count the frames
+ * it took and let through, the difference minus its fill level are the
+ * frames it dropped. The queues of hot standby branches are fixed.
+ */
+
+#include <gst/gst.h>
+
+#include "gstahc.h"
+#include "gstahcprocessor.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+/* Frames a branch queues before dropping the oldest one */
+#define BRANCH_QUEUE_BUFFERS 3
+#define BRANCH_QUEUE_LEAK GST_AHC_QUEUE_LEAK_DOWNSTREAM
+
+/* Runs the registered native frame processors on the frame and its
+ * pyramid */
+#define DEFAULT_ANALYSIS_DESCRIPTION \
+    GST_AHC_PYRAMID_ELEMENT " ! " GST_AHC_PROCESSOR_ELEMENT \
+    " ! fakesink sync=false async=false"
+
+struct _GstAhcBranch
+{
+  gint ref_count;
+  GstAhc *ahc;
+  gint id;
+  GstAhcBranchType type;
+  /* The pipeline and tee it was added to, which may already be detached
+   * from ahc */
+  GstBin *pipeline;
+  GstElement *tee;
+  GstElement *bin;
+  GstPad *tee_pad;
+  gint pending_eos;
+  /* Set by whoever shuts the branch down after its removal */
+  gint finished;
+};
+
+/* Attached to the queues made by gst_ahc_branch_queue_new() */
+typedef struct
+{
+  GstAhcBranchType type;
+  gint branch_id;
+  gint pushed;
+  gint passed;
+} QueueCounters;
+
+G_DEFINE_QUARK (gst-ahc-branch-type, branch_type);
+G_DEFINE_QUARK (gst-ahc-queue-counters, queue_counters);
+
+static GstAhcBranch *
+branch_ref (GstAhcBranch * branch)
+{
+  g_atomic_int_inc (&branch->ref_count);
+  return branch;
+}
+
+static void
+branch_unref (GstAhcBranch * branch)
+{
+  if (!g_atomic_int_dec_and_test (&branch->ref_count))
+    return;
+
+  gst_clear_object (&branch->tee_pad);
+  gst_clear_object (&branch->bin);
+  gst_object_unref (branch->tee);
+  gst_object_unref (branch->pipeline);
+  g_free (branch);
+}
+
+static GstPadProbeReturn
+count_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  g_atomic_int_inc ((gint *) user_data);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+apply_queue_config (GstElement * queue, const GstAhcQueueConfig * config)
+{
+  g_object_set (queue, "max-size-buffers", config->max_buffers,
+      "max-size-bytes", 0, "max-size-time", (guint64) 0,
+      "leaky", config->leak, NULL);
+}
+
+GstElement *
+gst_ahc_branch_queue_new (GstAhc * ahc, GstAhcBranchType type,
+    gint branch_id)
+{
+  GstElement *queue = gst_element_factory_make ("queue", NULL);
+  GstAhcQueueConfig config;
+  QueueCounters *counters;
+  GstPad *pad;
+
+  if (!queue)
+    return NULL;
+
+  g_mutex_lock (&ahc->lock);
+  config = ahc->queue_configs[type];
+  g_mutex_unlock (&ahc->lock);
+  apply_queue_config (queue, &config);
+
+  counters = g_new0 (QueueCounters, 1);
+  counters->type = type;
+  counters->branch_id = branch_id;
+  g_object_set_qdata_full (G_OBJECT (queue), queue_counters_quark (),
+      counters, g_free);
+
+  pad = gst_element_get_static_pad (queue, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, count_probe,
+      &counters->pushed, NULL);
+  gst_object_unref (pad);
+  pad = gst_element_get_static_pad (queue, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, count_probe,
+      &counters->passed, NULL);
+  gst_object_unref (pad);
+
+  return queue;
+}
+
+void
+gst_ahc_branches_init (GstAhc * ahc)
+{
+  guint i;
+
+  ahc->branches = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) branch_unref);
+  ahc->next_branch_id = 1;
+
+  for (i = 0; i < G_N_ELEMENTS (ahc->queue_configs); i++) {
+    ahc->queue_configs[i].max_buffers = BRANCH_QUEUE_BUFFERS;
+    ahc->queue_configs[i].leak = BRANCH_QUEUE_LEAK;
+  }
+}
+
+/* Stops a removed branch and takes it out of its pipeline, once */
+static void
+shut_down (GstAhcBranch * branch)
+{
+  if (!g_atomic_int_compare_and_exchange (&branch->finished, FALSE, TRUE))
+    return;
+
+  gst_element_set_state (branch->bin, GST_STATE_NULL);
+  gst_bin_remove (branch->pipeline, branch->bin);
+  gst_element_release_request_pad (branch->tee, branch->tee_pad);
+}
+
+/* The pipeline is in NULL state, the branches go away with it. Branches
+ * still draining are shut down now. */
+void
+gst_ahc_branches_clear (GstAhc * ahc)
+{
+  GList *removals, *l;
+
+  g_mutex_lock (&ahc->lock);
+  g_hash_table_remove_all (ahc->branches);
+  removals = ahc->removals;
+  ahc->removals = NULL;
+  g_mutex_unlock (&ahc->lock);
+
+  for (l = removals; l; l = l->next) {
+    GstAhcBranch *branch = l->data;
+
+    GST_DEBUG ("Branch %d still draining, removing it", branch->id);
+    shut_down (branch);
+    branch_unref (branch);
+  }
+  g_list_free (removals);
+}
+
+/* Runs on the main context, after the pipeline was possibly detached */
+static gboolean
+finish_removal (gpointer user_data)
+{
+  GstAhcBranch *branch = user_data;
+  GstAhc *ahc = branch->ahc;
+
+  /* Otherwise the detach, which runs on this same context, did not take
+   * the branch yet and ahc is still alive */
+  if (g_atomic_int_get (&branch->finished))
+    return G_SOURCE_REMOVE;
+
+  GST_DEBUG ("Branch %d drained, removing it", branch->id);
+
+  shut_down (branch);
+
+  g_mutex_lock (&ahc->lock);
+  ahc->removals = g_list_remove (ahc->removals, branch);
+  g_mutex_unlock (&ahc->lock);
+  branch_unref (branch);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+schedule_removal (GstAhcBranch * branch)
+{
+  g_main_context_invoke_full (branch->ahc->context, G_PRIORITY_DEFAULT,
+      finish_removal, branch_ref (branch), (GDestroyNotify) branch_unref);
+}
+
+static GstPadProbeReturn
+eos_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstAhcBranch *branch = user_data;
+
+  if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) != GST_EVENT_EOS)
+    return GST_PAD_PROBE_OK;
+
+  /* The rest of the pipeline keeps running, the EOS must not reach the bus */
+  if (g_atomic_int_dec_and_test (&branch->pending_eos))
+    schedule_removal (branch);
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static GstPadProbeReturn
+unlink_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstAhcBranch *branch = user_data;
+  GstPad *peer;
+
+  /* The detach shut the branch down first, the pad is released already */
+  if (g_atomic_int_get (&branch->finished))
+    return GST_PAD_PROBE_REMOVE;
+
+  peer = gst_pad_get_peer (pad);
+  if (!peer) {
+    schedule_removal (branch);
+    return GST_PAD_PROBE_REMOVE;
+  }
+
+  gst_pad_unlink (pad, peer);
+
+  if (g_atomic_int_get (&branch->pending_eos) > 0)
+    gst_pad_send_event (peer, gst_event_new_eos ());
+  else
+    schedule_removal (branch);
+
+  gst_object_unref (peer);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+static void
+add_eos_probe (const GValue * item, gpointer user_data)
+{
+  GstAhcBranch *branch = user_data;
+  GstElement *element = g_value_get_object (item);
+  GstPad *pad;
+
+  if (GST_IS_BIN (element) ||
+      !GST_OBJECT_FLAG_IS_SET (element, GST_ELEMENT_FLAG_SINK))
+    return;
+
+  pad = gst_element_get_static_pad (element, "sink");
+  if (!pad)
+    return;
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, eos_probe,
+      branch, NULL);
+  gst_object_unref (pad);
+  branch->pending_eos++;
+}
+
+static GstElement *
+branch_bin_new (GstAhc * ahc, GstAhcBranchType type, gint id,
+    const gchar * description)
+{
+  GstElement *bin, *queue, *body;
+  GstPad *pad;
+  GError *err = NULL;
+  gchar *name;
+
+  body = gst_parse_bin_from_description (description, TRUE, &err);
+  if (!body) {
+    GST_ERROR ("Invalid branch description '%s': %s", description,
+        err->message);
+    g_clear_error (&err);
+    return NULL;
+  }
+
+  name = g_strdup_printf ("branch%d", id);
+  bin = gst_bin_new (name);
+  g_free (name);
+
+  queue = gst_ahc_branch_queue_new (ahc, type, id);
+  if (!queue) {
+    gst_object_unref (body);
+    gst_object_unref (bin);
+    return NULL;
+  }
+  gst_bin_add_many (GST_BIN (bin), queue, body, NULL);
+  if (!gst_element_link (queue, body)) {
+    GST_ERROR ("Can not link branch '%s'", description);
+    gst_object_unref (bin);
+    return NULL;
+  }
+
+  pad = gst_element_get_static_pad (queue, "sink");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+  gst_object_unref (pad);
+
+  return bin;
+}
+
+/* Attaches a new consumer to the camera. description is a gst-launch style
+ * bin description, e.g. "ahcconvert ! video/x-raw,format=I420 ! x264enc !
+ * mp4mux ! filesink location=capture.mp4". Can be called from any thread
+ * while the pipeline is running. Returns the branch id, or -1 on failure. */
+gint
+gst_ahc_add_branch (GstAhc * ahc, GstAhcBranchType type,
+    const gchar * description)
+{
+  GstAhcBranch *branch;
+  GstBin *pipeline = NULL;
+  GstElement *tee = NULL;
+  GstIterator *it;
+  GstPad *pad;
+  gboolean attached;
+  gint id;
+
+  if (!description && type == GST_AHC_BRANCH_ANALYSIS)
+    description = DEFAULT_ANALYSIS_DESCRIPTION;
+
+  if (type == GST_AHC_BRANCH_PREVIEW || !description) {
+    GST_WARNING ("Can not add a branch of type %d without description", type);
+    return -1;
+  }
+
+  /* Called from application threads while the pipeline thread may be
+   * tearing the pipeline down */
+  g_mutex_lock (&ahc->lock);
+  if (ahc->attached) {
+    pipeline = GST_BIN (gst_object_ref (ahc->pipeline));
+    tee = gst_object_ref (ahc->tee);
+  }
+  id = ahc->next_branch_id++;
+  g_mutex_unlock (&ahc->lock);
+
+  if (!pipeline) {
+    GST_WARNING ("Pipeline not running, can not add a branch");
+    return -1;
+  }
+
+  branch = g_new0 (GstAhcBranch, 1);
+  branch->ref_count = 1;
+  branch->ahc = ahc;
+  branch->id = id;
+  branch->type = type;
+  branch->pipeline = pipeline;
+  branch->tee = tee;
+  branch->bin = branch_bin_new (ahc, type, id, description);
+  if (!branch->bin) {
+    branch_unref (branch);
+    return -1;
+  }
+  gst_object_ref_sink (branch->bin);
+  g_object_set_qdata (G_OBJECT (branch->bin), branch_type_quark (),
+      GINT_TO_POINTER (type + 1));
+
+  it = gst_bin_iterate_recurse (GST_BIN (branch->bin));
+  gst_iterator_foreach (it, add_eos_probe, branch);
+  gst_iterator_free (it);
+
+  gst_bin_add (pipeline, branch->bin);
+  gst_element_sync_state_with_parent (branch->bin);
+
+  branch->tee_pad = gst_element_get_request_pad (tee, "src_%u");
+  pad = gst_element_get_static_pad (branch->bin, "sink");
+  if (gst_pad_link (branch->tee_pad, pad) != GST_PAD_LINK_OK) {
+    GST_ERROR ("Failed to link branch %d to the tee", id);
+    gst_object_unref (pad);
+    goto failed;
+  }
+  gst_object_unref (pad);
+
+  /* A pipeline detached in the meantime already dropped its branches */
+  g_mutex_lock (&ahc->lock);
+  attached = ahc->attached && (GstBin *) ahc->pipeline == pipeline;
+  if (attached)
+    g_hash_table_insert (ahc->branches, GINT_TO_POINTER (id), branch);
+  g_mutex_unlock (&ahc->lock);
+
+  if (!attached) {
+    GST_WARNING ("Pipeline stopped while adding branch %d", id);
+    goto failed;
+  }
+
+  GST_DEBUG ("Added branch %d (type %d): %s", id, type, description);
+
+  return id;
+
+failed:
+  gst_element_set_state (branch->bin, GST_STATE_NULL);
+  gst_bin_remove (pipeline, branch->bin);
+  gst_element_release_request_pad (tee, branch->tee_pad);
+  branch_unref (branch);
+  return -1;
+}
+
+/* Finds the type of the branch element is part of. Can be called from any
+ * thread, also while the branch is being added. */
+gboolean
+gst_ahc_branch_type_of (GstElement * element, GstAhcBranchType * type)
+{
+  GstObject *object = gst_object_ref (element);
+  gboolean found = FALSE;
+
+  while (object && !found) {
+    GstObject *parent;
+    gint tag = GPOINTER_TO_INT (g_object_get_qdata (G_OBJECT (object),
+            branch_type_quark ()));
+
+    if (tag) {
+      *type = tag - 1;
+      found = TRUE;
+    }
+    parent = gst_object_get_parent (object);
+    gst_object_unref (object);
+    object = parent;
+  }
+  if (object)
+    gst_object_unref (object);
+
+  return found;
+}
+
+/* Returns a new reference to the element called name in a running branch,
+ * or NULL */
+GstElement *
+gst_ahc_branch_get_element (GstAhc * ahc, gint id, const gchar * name)
+{
+  GstAhcBranch *branch;
+  GstElement *bin = NULL;
+  GstElement *element;
+
+  g_mutex_lock (&ahc->lock);
+  branch = g_hash_table_lookup (ahc->branches, GINT_TO_POINTER (id));
+  if (branch)
+    bin = gst_object_ref (branch->bin);
+  g_mutex_unlock (&ahc->lock);
+
+  if (!bin)
+    return NULL;
+
+  element = gst_bin_get_by_name (GST_BIN (bin), name);
+  gst_object_unref (bin);
+
+  return element;
+}
+
+/* Detaches a branch added by gst_ahc_add_branch(). The branch is drained
+ * and released asynchronously from the main context. */
+gboolean
+gst_ahc_remove_branch (GstAhc * ahc, gint id)
+{
+  GstAhcBranch *branch;
+
+  g_mutex_lock (&ahc->lock);
+  branch = g_hash_table_lookup (ahc->branches, GINT_TO_POINTER (id));
+  if (branch) {
+    g_hash_table_steal (ahc->branches, GINT_TO_POINTER (id));
+    ahc->removals = g_list_prepend (ahc->removals, branch);
+    /* For the probe, a detach may drop the one of removals any time */
+    branch_ref (branch);
+  }
+  g_mutex_unlock (&ahc->lock);
+
+  if (!branch) {
+    GST_WARNING ("No branch with id %d", id);
+    return FALSE;
+  }
+
+  GST_DEBUG ("Removing branch %d", id);
+  gst_pad_add_probe (branch->tee_pad, GST_PAD_PROBE_TYPE_IDLE, unlink_probe,
+      branch, (GDestroyNotify) branch_unref);
+
+  return TRUE;
+}
+
+typedef struct
+{
+  GstAhcBranchType type;
+  const GstAhcQueueConfig *config;
+  GArray *stats;
+} QueueVisit;
+
+static GstBin *
+ref_pipeline (GstAhc * ahc)
+{
+  GstBin *pipeline = NULL;
+
+  g_mutex_lock (&ahc->lock);
+  if (ahc->attached)
+    pipeline = GST_BIN (gst_object_ref (ahc->pipeline));
+  g_mutex_unlock (&ahc->lock);
+
+  return pipeline;
+}
+
+static void
+visit_queue (const GValue * item, gpointer user_data)
+{
+  GstElement *queue = g_value_get_object (item);
+  QueueVisit *visit = user_data;
+  QueueCounters *counters;
+  GstAhcQueueStats s;
+  guint pushed, passed;
+
+  counters = g_object_get_qdata (G_OBJECT (queue), queue_counters_quark ());
+  if (!counters)
+    return;
+
+  if (visit->config) {
+    if (counters->type == visit->type)
+      apply_queue_config (queue, visit->config);
+    return;
+  }
+
+  /* Read passed first, so pushed never lags behind it */
+  passed = g_atomic_int_get (&counters->passed);
+  pushed = g_atomic_int_get (&counters->pushed);
+  s.type = counters->type;
+  s.branch_id = counters->branch_id;
+  g_object_get (queue, "current-level-buffers", &s.level,
+      "max-size-buffers", &s.max_buffers, NULL);
+  s.pushed = pushed;
+  s.dropped = pushed - passed > s.level ? pushed - passed - s.level : 0;
+  g_array_append_val (visit->stats, s);
+}
+
+static void
+visit_queues (GstAhc * ahc, QueueVisit * visit)
+{
+  GstBin *pipeline = ref_pipeline (ahc);
+  GstIterator *it;
+
+  if (!pipeline)
+    return;
+
+  it = gst_bin_iterate_recurse (pipeline);
+  while (gst_iterator_foreach (it, visit_queue, visit) ==
+      GST_ITERATOR_RESYNC) {
+    if (visit->stats)
+      g_array_set_size (visit->stats, 0);
+    gst_iterator_resync (it);
+  }
+  gst_iterator_free (it);
+  gst_object_unref (pipeline);
+}
+
+/* Sets depth and leak policy of the queues of a kind of branch, running
+ * and future ones. Can be called from any thread. */
+void
+gst_ahc_set_queue_config (GstAhc * ahc, GstAhcBranchType type,
+    const GstAhcQueueConfig * config)
+{
+  QueueVisit visit = { type, config, NULL };
+
+  g_return_if_fail (type < G_N_ELEMENTS (ahc->queue_configs));
+  g_return_if_fail (config->max_buffers > 0);
+
+  GST_DEBUG ("Queues of branch type %d: %u buffers, leak %d", type,
+      config->max_buffers, config->leak);
+
+  g_mutex_lock (&ahc->lock);
+  ahc->queue_configs[type] = *config;
+  g_mutex_unlock (&ahc->lock);
+
+  visit_queues (ahc, &visit);
+}
+
+/* Returns the fill level and counters of every branch queue as an array of
+ * GstAhcQueueStats, empty before the pipeline exists */
+GArray *
+gst_ahc_get_queue_stats (GstAhc * ahc)
+{
+  QueueVisit visit = { 0, NULL, NULL };
+
+  visit.stats = g_array_new (FALSE, TRUE, sizeof (GstAhcQueueStats));
+  visit_queues (ahc, &visit);
+
+  return visit.stats;
+}
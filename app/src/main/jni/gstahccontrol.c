@@ -0,0 +1,212 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Control commands from application threads.
+ *
+ * Setters like gst_ahc_set_white_balance() only push a command and wake up
+ * the main context of the instance, so the calling (UI) thread never waits
+ * for a GStreamer lock. The queue is a lock-free stack which the main
+ * context takes as a whole and reverses, any number of threads can push.
+ *
+ * Commands are applied by a GSource which is only attached once the
+ * pipeline exists, so early commands wait for it instead of racing with
+ * its creation. Commands are applied in the order they were pushed. When
+ * the same setting was pushed several times in a row since the last
+ * dispatch, e.g. while scrolling through a spinner, only the last value
+ * is applied. This only holds for plain setters: state changes, mode
+ * switches and resolution changes all have side effects and are always
+ * applied.
+ */
+
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+typedef struct
+{
+  GSource source;
+  GstAhc *ahc;
+} ControlSource;
+
+static void
+push (GstAhc * ahc, GstAhcCommand * cmd)
+{
+  GstAhcCommand *head;
+
+  do {
+    head = g_atomic_pointer_get (&ahc->commands);
+    cmd->next = head;
+  } while (!g_atomic_pointer_compare_and_exchange (&ahc->commands, head, cmd));
+
+  g_main_context_wakeup (ahc->context);
+}
+
+void
+gst_ahc_control_push (GstAhc * ahc, GstAhcCommandType type, gint arg0,
+    gint arg1)
+{
+  GstAhcCommand *cmd = g_new0 (GstAhcCommand, 1);
+
+  cmd->type = type;
+  cmd->arg0 = arg0;
+  cmd->arg1 = arg1;
+  push (ahc, cmd);
+}
+
+/* The command owns the window until it is applied */
+void
+gst_ahc_control_push_window (GstAhc * ahc, guintptr handle,
+    GDestroyNotify release)
+{
+  GstAhcCommand *cmd = g_new0 (GstAhcCommand, 1);
+
+  cmd->type = GST_AHC_COMMAND_WINDOW;
+  cmd->handle = handle;
+  cmd->release = release;
+  push (ahc, cmd);
+}
+
+/* Takes all queued commands, oldest first */
+static GstAhcCommand *
+take_commands (GstAhc * ahc)
+{
+  GstAhcCommand *head, *prev = NULL;
+
+  do {
+    head = g_atomic_pointer_get (&ahc->commands);
+  } while (head &&
+      !g_atomic_pointer_compare_and_exchange (&ahc->commands, head, NULL));
+
+  while (head) {
+    GstAhcCommand *next = head->next;
+
+    head->next = prev;
+    prev = head;
+    head = next;
+  }
+
+  return prev;
+}
+
+/* Whether applying cmd twice is the same as applying it once */
+static gboolean
+is_setter (GstAhcCommand * cmd)
+{
+  switch (cmd->type) {
+    case GST_AHC_COMMAND_WHITE_BALANCE:
+    case GST_AHC_COMMAND_AUTO_FOCUS:
+    case GST_AHC_COMMAND_ROTATE_METHOD:
+    case GST_AHC_COMMAND_SETTINGS:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static void
+drain (GstAhc * ahc)
+{
+  GstAhcCommand *cmds, *cmd;
+  guint coalesced = 0;
+
+  cmds = take_commands (ahc);
+
+  while (cmds) {
+    cmd = cmds;
+    cmds = cmd->next;
+    /* Overridden by the next command before it took effect */
+    if (cmds && cmds->type == cmd->type && is_setter (cmd))
+      coalesced++;
+    else
+      gst_ahc_apply_command (ahc, cmd);
+    g_free (cmd);
+  }
+
+  if (coalesced)
+    GST_DEBUG ("Coalesced %u control commands", coalesced);
+}
+
+static gboolean
+control_prepare (GSource * source, gint * timeout)
+{
+  ControlSource *control = (ControlSource *) source;
+
+  *timeout = -1;
+  return g_atomic_pointer_get (&control->ahc->commands) != NULL;
+}
+
+static gboolean
+control_check (GSource * source)
+{
+  ControlSource *control = (ControlSource *) source;
+
+  return g_atomic_pointer_get (&control->ahc->commands) != NULL;
+}
+
+static gboolean
+control_dispatch (GSource * source, GSourceFunc callback, gpointer user_data)
+{
+  ControlSource *control = (ControlSource *) source;
+
+  drain (control->ahc);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs control_funcs = {
+  control_prepare,
+  control_check,
+  control_dispatch,
+  NULL
+};
+
+/* Starts applying commands on the main context of ahc */
+GSource *
+gst_ahc_control_attach (GstAhc * ahc)
+{
+  GSource *source;
+
+  source = g_source_new (&control_funcs, sizeof (ControlSource));
+  ((ControlSource *) source)->ahc = ahc;
+  g_source_set_name (source, "GstAhc control");
+  g_source_attach (source, ahc->context);
+
+  return source;
+}
+
+/* Drops commands which were never applied, and lets go of their windows */
+void
+gst_ahc_control_clear (GstAhc * ahc)
+{
+  GstAhcCommand *cmds = take_commands (ahc);
+
+  while (cmds) {
+    GstAhcCommand *next = cmds->next;
+
+    if (cmds->handle && cmds->release)
+      cmds->release ((gpointer) cmds->handle);
+    g_free (cmds);
+    cmds = next;
+  }
+}
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * NEON kernels of ahcconvert, see gstahcconvert.h.
+ *
+ * Built for arm64-v8a, where NEON is always there, and for armeabi-v7a,
+ * where Android.mk compiles this file alone with NEON enabled and the CPU
+ * is checked at runtime. GST_AHC_HAVE_NEON is defined where it is built.
+ *
+ * vld2 splits the chroma pairs and vst4 interleaves RGBA, so no shuffles
+ * are needed. The saturating narrowing shift clamps to 0-255 like the C
+ * kernel. The halving kernels add pairs with vpaddl and vpadal, or, for
+ * chroma, split even and odd pairs with vld4, and round in the narrowing
+ * shift.
+ */
+
+#ifdef GST_AHC_HAVE_NEON
+
+#include <arm_neon.h>
+#include <glib.h>
+#ifndef __aarch64__
+#include <sys/auxv.h>
+#endif
+
+#include "gstahcconvert.h"
+
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+
+static gboolean
+neon_supported (void)
+{
+#ifdef __aarch64__
+  return TRUE;
+#else
+  return (getauxval (AT_HWCAP) & HWCAP_NEON) != 0;
+#endif
+}
+
+/* Luma terms of 16 pixels */
+static inline void
+luma_neon (const guint8 * y, int16x8_t offset, int16x8_t gain,
+    int16x8_t * lo, int16x8_t * hi)
+{
+  const int16x8_t round = vdupq_n_s16 (32);
+  uint8x16_t l = vld1q_u8 (y);
+
+  *lo = vmlaq_s16 (round, vsubq_s16 (vreinterpretq_s16_u16 (vmovl_u8
+              (vget_low_u8 (l))), offset), gain);
+  *hi = vmlaq_s16 (round, vsubq_s16 (vreinterpretq_s16_u16 (vmovl_u8
+              (vget_high_u8 (l))), offset), gain);
+}
+
+static inline void
+store_rgba_neon (guint8 * d, const guint8 * y, int16x8_t offset,
+    int16x8_t gain, int16x8x2_t r, int16x8x2_t g, int16x8x2_t b)
+{
+  int16x8_t lo, hi;
+  uint8x16x4_t px;
+
+  luma_neon (y, offset, gain, &lo, &hi);
+  px.val[0] = vcombine_u8 (vqshrun_n_s16 (vqaddq_s16 (lo, r.val[0]), 6),
+      vqshrun_n_s16 (vqaddq_s16 (hi, r.val[1]), 6));
+  px.val[1] = vcombine_u8 (vqshrun_n_s16 (vqaddq_s16 (lo, g.val[0]), 6),
+      vqshrun_n_s16 (vqaddq_s16 (hi, g.val[1]), 6));
+  px.val[2] = vcombine_u8 (vqshrun_n_s16 (vqaddq_s16 (lo, b.val[0]), 6),
+      vqshrun_n_s16 (vqaddq_s16 (hi, b.val[1]), 6));
+  px.val[3] = vdupq_n_u8 (255);
+  vst4q_u8 (d, px);
+}
+
+static gint
+rgba_neon (const guint8 * y0, const guint8 * y1, const guint8 * c,
+    guint8 * d0, guint8 * d1, gint width, const GstAhcConvertCoeffs * k)
+{
+  const uint8x8_t bias = vdup_n_u8 (128);
+  const int16x8_t offset = vdupq_n_s16 (k->y_offset);
+  const int16x8_t gain = vdupq_n_s16 (k->y_gain);
+  const int16x8_t kr0 = vdupq_n_s16 (k->r[0]), kr1 = vdupq_n_s16 (k->r[1]);
+  const int16x8_t kg0 = vdupq_n_s16 (k->g[0]), kg1 = vdupq_n_s16 (k->g[1]);
+  const int16x8_t kb0 = vdupq_n_s16 (k->b[0]), kb1 = vdupq_n_s16 (k->b[1]);
+  gint x;
+
+  for (x = 0; x + 16 <= width; x += 16) {
+    uint8x8x2_t cc = vld2_u8 (c + x);
+    int16x8_t c1 = vreinterpretq_s16_u16 (vsubl_u8 (cc.val[0], bias));
+    int16x8_t c2 = vreinterpretq_s16_u16 (vsubl_u8 (cc.val[1], bias));
+    int16x8_t r = vmlaq_s16 (vmulq_s16 (c1, kr0), c2, kr1);
+    int16x8_t g = vmlaq_s16 (vmulq_s16 (c1, kg0), c2, kg1);
+    int16x8_t b = vmlaq_s16 (vmulq_s16 (c1, kb0), c2, kb1);
+    /* Each pair for its two pixels, pixels 0-7 and 8-15 */
+    int16x8x2_t r2 = vzipq_s16 (r, r);
+    int16x8x2_t g2 = vzipq_s16 (g, g);
+    int16x8x2_t b2 = vzipq_s16 (b, b);
+
+    store_rgba_neon (d0 + 4 * x, y0 + x, offset, gain, r2, g2, b2);
+    store_rgba_neon (d1 + 4 * x, y1 + x, offset, gain, r2, g2, b2);
+  }
+
+  return x;
+}
+
+static gint
+split_neon (const guint8 * c, guint8 * first, guint8 * second, gint n)
+{
+  gint i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    uint8x16x2_t cc = vld2q_u8 (c + 2 * i);
+
+    vst1q_u8 (first + i, cc.val[0]);
+    vst1q_u8 (second + i, cc.val[1]);
+  }
+
+  return i;
+}
+
+/* Averages of 8 2x2 blocks, rounded by the narrowing shift */
+static inline uint8x8_t
+average_neon (uint8x16_t a, uint8x16_t b)
+{
+  return vrshrn_n_u16 (vpadalq_u8 (vpaddlq_u8 (a), b), 2);
+}
+
+static gint
+halve_neon (const guint8 * s0, const guint8 * s1, guint8 * d, gint width)
+{
+  gint i;
+
+  for (i = 0; i + 16 <= width; i += 16) {
+    uint8x8_t lo = average_neon (vld1q_u8 (s0 + 2 * i), vld1q_u8 (s1 + 2 * i));
+    uint8x8_t hi = average_neon (vld1q_u8 (s0 + 2 * i + 16),
+        vld1q_u8 (s1 + 2 * i + 16));
+
+    vst1q_u8 (d + i, vcombine_u8 (lo, hi));
+  }
+
+  return i;
+}
+
+static gint
+halve_pairs_neon (const guint8 * s0, const guint8 * s1, guint8 * d, gint n)
+{
+  gint i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    /* First and second bytes of even and odd pairs */
+    uint8x8x4_t a = vld4_u8 (s0 + 4 * i);
+    uint8x8x4_t b = vld4_u8 (s1 + 4 * i);
+    uint8x8x2_t out;
+
+    out.val[0] = vrshrn_n_u16 (vaddw_u8 (vaddw_u8 (vaddl_u8 (a.val[0],
+                    a.val[2]), b.val[0]), b.val[2]), 2);
+    out.val[1] = vrshrn_n_u16 (vaddw_u8 (vaddw_u8 (vaddl_u8 (a.val[1],
+                    a.val[3]), b.val[1]), b.val[3]), 2);
+    vst2_u8 (d + 2 * i, out);
+  }
+
+  return i;
+}
+
+const GstAhcConvertKernels gst_ahc_convert_neon = {
+  "neon", neon_supported, rgba_neon, split_neon, halve_neon, halve_pairs_neon
+};
+
+#endif
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * SSE4.1 and AVX2 kernels of ahcconvert, see gstahcconvert.h.
+ *
+ * The functions are compiled for their instruction set with the target
+ * attribute, so the library itself still runs on any x86 CPU. They are
+ * only called once the CPU reported support.
+ *
+ * Each chroma pair is loaded as one 16 bit lane, so the two bytes split
+ * with a mask and a shift. The chroma terms of R, G and B are computed
+ * once per pair and duplicated for the two pixels of both rows. Luma and
+ * chroma terms are added with saturation: a sum that saturates is far
+ * outside 0-255 and clamps to the same value as in the C kernel.
+ *
+ * The halving kernels sum horizontal byte pairs with maddubs against a
+ * vector of ones. Chroma pairs are first shuffled so that each U or V
+ * byte sits next to the one of the neighbouring pair.
+ */
+
+#if defined (__i386__) || defined (__x86_64__)
+
+#include <immintrin.h>
+#include <glib.h>
+
+#include "gstahcconvert.h"
+
+#define TARGET_SSE41 __attribute__ ((target ("sse4.1")))
+#define TARGET_AVX2 __attribute__ ((target ("avx2")))
+
+static gboolean
+sse41_supported (void)
+{
+  return __builtin_cpu_supports ("sse4.1");
+}
+
+/* 8 pixels of luma term l and chroma terms r, g, b to RGBA */
+static inline TARGET_SSE41 void
+store_rgba_sse41 (guint8 * d, __m128i l, __m128i r, __m128i g, __m128i b)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i max = _mm_set1_epi16 (255);
+  __m128i rg, ba;
+
+  r = _mm_min_epi16 (_mm_max_epi16 (_mm_srai_epi16 (_mm_adds_epi16 (l, r),
+              6), zero), max);
+  g = _mm_min_epi16 (_mm_max_epi16 (_mm_srai_epi16 (_mm_adds_epi16 (l, g),
+              6), zero), max);
+  b = _mm_min_epi16 (_mm_max_epi16 (_mm_srai_epi16 (_mm_adds_epi16 (l, b),
+              6), zero), max);
+
+  rg = _mm_or_si128 (r, _mm_slli_epi16 (g, 8));
+  ba = _mm_or_si128 (b, _mm_set1_epi16 ((gint16) 0xff00));
+  _mm_storeu_si128 ((__m128i *) d, _mm_unpacklo_epi16 (rg, ba));
+  _mm_storeu_si128 ((__m128i *) (d + 16), _mm_unpackhi_epi16 (rg, ba));
+}
+
+/* Luma term of 8 pixels */
+static inline TARGET_SSE41 __m128i
+luma_sse41 (const guint8 * y, __m128i offset, __m128i gain)
+{
+  __m128i l = _mm_cvtepu8_epi16 (_mm_loadl_epi64 ((const __m128i *) y));
+
+  return _mm_add_epi16 (_mm_mullo_epi16 (_mm_sub_epi16 (l, offset), gain),
+      _mm_set1_epi16 (32));
+}
+
+static TARGET_SSE41 gint
+rgba_sse41 (const guint8 * y0, const guint8 * y1, const guint8 * c,
+    guint8 * d0, guint8 * d1, gint width, const GstAhcConvertCoeffs * k)
+{
+  const __m128i mask = _mm_set1_epi16 (0xff);
+  const __m128i bias = _mm_set1_epi16 (128);
+  const __m128i offset = _mm_set1_epi16 (k->y_offset);
+  const __m128i gain = _mm_set1_epi16 (k->y_gain);
+  const __m128i kr0 = _mm_set1_epi16 (k->r[0]), kr1 = _mm_set1_epi16 (k->r[1]);
+  const __m128i kg0 = _mm_set1_epi16 (k->g[0]), kg1 = _mm_set1_epi16 (k->g[1]);
+  const __m128i kb0 = _mm_set1_epi16 (k->b[0]), kb1 = _mm_set1_epi16 (k->b[1]);
+  gint x;
+
+  for (x = 0; x + 16 <= width; x += 16) {
+    __m128i cc = _mm_loadu_si128 ((const __m128i *) (c + x));
+    __m128i c1 = _mm_sub_epi16 (_mm_and_si128 (cc, mask), bias);
+    __m128i c2 = _mm_sub_epi16 (_mm_srli_epi16 (cc, 8), bias);
+    __m128i r = _mm_add_epi16 (_mm_mullo_epi16 (c1, kr0),
+        _mm_mullo_epi16 (c2, kr1));
+    __m128i g = _mm_add_epi16 (_mm_mullo_epi16 (c1, kg0),
+        _mm_mullo_epi16 (c2, kg1));
+    __m128i b = _mm_add_epi16 (_mm_mullo_epi16 (c1, kb0),
+        _mm_mullo_epi16 (c2, kb1));
+    __m128i r_lo = _mm_unpacklo_epi16 (r, r), r_hi = _mm_unpackhi_epi16 (r, r);
+    __m128i g_lo = _mm_unpacklo_epi16 (g, g), g_hi = _mm_unpackhi_epi16 (g, g);
+    __m128i b_lo = _mm_unpacklo_epi16 (b, b), b_hi = _mm_unpackhi_epi16 (b, b);
+
+    store_rgba_sse41 (d0 + 4 * x, luma_sse41 (y0 + x, offset, gain),
+        r_lo, g_lo, b_lo);
+    store_rgba_sse41 (d0 + 4 * x + 32, luma_sse41 (y0 + x + 8, offset, gain),
+        r_hi, g_hi, b_hi);
+    store_rgba_sse41 (d1 + 4 * x, luma_sse41 (y1 + x, offset, gain),
+        r_lo, g_lo, b_lo);
+    store_rgba_sse41 (d1 + 4 * x + 32, luma_sse41 (y1 + x + 8, offset, gain),
+        r_hi, g_hi, b_hi);
+  }
+
+  return x;
+}
+
+static TARGET_SSE41 gint
+split_sse41 (const guint8 * c, guint8 * first, guint8 * second, gint n)
+{
+  const __m128i mask = _mm_set1_epi16 (0xff);
+  gint i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128 ((const __m128i *) (c + 2 * i));
+    __m128i b = _mm_loadu_si128 ((const __m128i *) (c + 2 * i + 16));
+
+    _mm_storeu_si128 ((__m128i *) (first + i),
+        _mm_packus_epi16 (_mm_and_si128 (a, mask), _mm_and_si128 (b, mask)));
+    _mm_storeu_si128 ((__m128i *) (second + i),
+        _mm_packus_epi16 (_mm_srli_epi16 (a, 8), _mm_srli_epi16 (b, 8)));
+  }
+
+  return i;
+}
+
+/* Sums of the horizontal byte pairs of both rows, rounded and halved
+ * twice: the averages of 8 2x2 blocks */
+static inline TARGET_SSE41 __m128i
+average_sse41 (__m128i a, __m128i b)
+{
+  const __m128i ones = _mm_set1_epi8 (1);
+  __m128i sum = _mm_add_epi16 (_mm_maddubs_epi16 (a, ones),
+      _mm_maddubs_epi16 (b, ones));
+
+  return _mm_srli_epi16 (_mm_add_epi16 (sum, _mm_set1_epi16 (2)), 2);
+}
+
+static TARGET_SSE41 gint
+halve_sse41 (const guint8 * s0, const guint8 * s1, guint8 * d, gint width)
+{
+  gint i;
+
+  for (i = 0; i + 16 <= width; i += 16) {
+    __m128i lo = average_sse41 (_mm_loadu_si128 ((const __m128i *) (s0 +
+                2 * i)), _mm_loadu_si128 ((const __m128i *) (s1 + 2 * i)));
+    __m128i hi = average_sse41 (_mm_loadu_si128 ((const __m128i *) (s0 +
+                2 * i + 16)), _mm_loadu_si128 ((const __m128i *) (s1 +
+                2 * i + 16)));
+
+    _mm_storeu_si128 ((__m128i *) (d + i), _mm_packus_epi16 (lo, hi));
+  }
+
+  return i;
+}
+
+static TARGET_SSE41 gint
+halve_pairs_sse41 (const guint8 * s0, const guint8 * s1, guint8 * d, gint n)
+{
+  /* Brings the same byte of neighbouring pairs next to each other */
+  const __m128i order = _mm_setr_epi8 (0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9, 11,
+      12, 14, 13, 15);
+  gint i;
+
+  for (i = 0; i + 8 <= n; i += 8) {
+    __m128i lo = average_sse41 (_mm_shuffle_epi8 (_mm_loadu_si128 ((const
+                    __m128i *) (s0 + 4 * i)), order),
+        _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (s1 + 4 * i)),
+            order));
+    __m128i hi = average_sse41 (_mm_shuffle_epi8 (_mm_loadu_si128 ((const
+                    __m128i *) (s0 + 4 * i + 16)), order),
+        _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) (s1 + 4 * i +
+                    16)), order));
+
+    _mm_storeu_si128 ((__m128i *) (d + 2 * i), _mm_packus_epi16 (lo, hi));
+  }
+
+  return i;
+}
+
+const GstAhcConvertKernels gst_ahc_convert_sse41 = {
+  "sse4.1", sse41_supported, rgba_sse41, split_sse41, halve_sse41,
+  halve_pairs_sse41
+};
+
+static gboolean
+avx2_supported (void)
+{
+  return __builtin_cpu_supports ("avx2");
+}
+
+/* 16 pixels, in order across both 128 bit lanes */
+static inline TARGET_AVX2 void
+store_rgba_avx2 (guint8 * d, __m256i l, __m256i r, __m256i g, __m256i b)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i max = _mm256_set1_epi16 (255);
+  __m256i rg, ba, lo, hi;
+
+  r = _mm256_min_epi16 (_mm256_max_epi16 (_mm256_srai_epi16
+          (_mm256_adds_epi16 (l, r), 6), zero), max);
+  g = _mm256_min_epi16 (_mm256_max_epi16 (_mm256_srai_epi16
+          (_mm256_adds_epi16 (l, g), 6), zero), max);
+  b = _mm256_min_epi16 (_mm256_max_epi16 (_mm256_srai_epi16
+          (_mm256_adds_epi16 (l, b), 6), zero), max);
+
+  rg = _mm256_or_si256 (r, _mm256_slli_epi16 (g, 8));
+  ba = _mm256_or_si256 (b, _mm256_set1_epi16 ((gint16) 0xff00));
+  /* Pixels 0-3 and 8-11, and 4-7 and 12-15 */
+  lo = _mm256_unpacklo_epi16 (rg, ba);
+  hi = _mm256_unpackhi_epi16 (rg, ba);
+  _mm256_storeu_si256 ((__m256i *) d, _mm256_permute2x128_si256 (lo, hi,
+          0x20));
+  _mm256_storeu_si256 ((__m256i *) (d + 32), _mm256_permute2x128_si256 (lo,
+          hi, 0x31));
+}
+
+static inline TARGET_AVX2 __m256i
+luma_avx2 (const guint8 * y, __m256i offset, __m256i gain)
+{
+  __m256i l = _mm256_cvtepu8_epi16 (_mm_loadu_si128 ((const __m128i *) y));
+
+  return _mm256_add_epi16 (_mm256_mullo_epi16 (_mm256_sub_epi16 (l, offset),
+          gain), _mm256_set1_epi16 (32));
+}
+
+static TARGET_AVX2 gint
+rgba_avx2 (const guint8 * y0, const guint8 * y1, const guint8 * c,
+    guint8 * d0, guint8 * d1, gint width, const GstAhcConvertCoeffs * k)
+{
+  const __m256i mask = _mm256_set1_epi16 (0xff);
+  const __m256i bias = _mm256_set1_epi16 (128);
+  const __m256i offset = _mm256_set1_epi16 (k->y_offset);
+  const __m256i gain = _mm256_set1_epi16 (k->y_gain);
+  const __m256i kr0 = _mm256_set1_epi16 (k->r[0]);
+  const __m256i kr1 = _mm256_set1_epi16 (k->r[1]);
+  const __m256i kg0 = _mm256_set1_epi16 (k->g[0]);
+  const __m256i kg1 = _mm256_set1_epi16 (k->g[1]);
+  const __m256i kb0 = _mm256_set1_epi16 (k->b[0]);
+  const __m256i kb1 = _mm256_set1_epi16 (k->b[1]);
+  gint x;
+
+  for (x = 0; x + 32 <= width; x += 32) {
+    __m256i cc = _mm256_loadu_si256 ((const __m256i *) (c + x));
+    __m256i c1 = _mm256_sub_epi16 (_mm256_and_si256 (cc, mask), bias);
+    __m256i c2 = _mm256_sub_epi16 (_mm256_srli_epi16 (cc, 8), bias);
+    __m256i t[3], a[3], b[3];
+    gint i;
+
+    t[0] = _mm256_add_epi16 (_mm256_mullo_epi16 (c1, kr0),
+        _mm256_mullo_epi16 (c2, kr1));
+    t[1] = _mm256_add_epi16 (_mm256_mullo_epi16 (c1, kg0),
+        _mm256_mullo_epi16 (c2, kg1));
+    t[2] = _mm256_add_epi16 (_mm256_mullo_epi16 (c1, kb0),
+        _mm256_mullo_epi16 (c2, kb1));
+
+    /* Duplicate each pair for its two pixels: pixels 0-15 and 16-31 */
+    for (i = 0; i < 3; i++) {
+      __m256i lo = _mm256_unpacklo_epi16 (t[i], t[i]);
+      __m256i hi = _mm256_unpackhi_epi16 (t[i], t[i]);
+
+      a[i] = _mm256_permute2x128_si256 (lo, hi, 0x20);
+      b[i] = _mm256_permute2x128_si256 (lo, hi, 0x31);
+    }
+
+    store_rgba_avx2 (d0 + 4 * x, luma_avx2 (y0 + x, offset, gain),
+        a[0], a[1], a[2]);
+    store_rgba_avx2 (d0 + 4 * x + 64, luma_avx2 (y0 + x + 16, offset, gain),
+        b[0], b[1], b[2]);
+    store_rgba_avx2 (d1 + 4 * x, luma_avx2 (y1 + x, offset, gain),
+        a[0], a[1], a[2]);
+    store_rgba_avx2 (d1 + 4 * x + 64, luma_avx2 (y1 + x + 16, offset, gain),
+        b[0], b[1], b[2]);
+  }
+
+  return x;
+}
+
+static TARGET_AVX2 gint
+split_avx2 (const guint8 * c, guint8 * first, guint8 * second, gint n)
+{
+  const __m256i mask = _mm256_set1_epi16 (0xff);
+  gint i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256 ((const __m256i *) (c + 2 * i));
+    __m256i b = _mm256_loadu_si256 ((const __m256i *) (c + 2 * i + 32));
+    __m256i f = _mm256_packus_epi16 (_mm256_and_si256 (a, mask),
+        _mm256_and_si256 (b, mask));
+    __m256i s = _mm256_packus_epi16 (_mm256_srli_epi16 (a, 8),
+        _mm256_srli_epi16 (b, 8));
+
+    /* packus works per 128 bit lane */
+    _mm256_storeu_si256 ((__m256i *) (first + i),
+        _mm256_permute4x64_epi64 (f, 0xd8));
+    _mm256_storeu_si256 ((__m256i *) (second + i),
+        _mm256_permute4x64_epi64 (s, 0xd8));
+  }
+
+  return i;
+}
+
+static inline TARGET_AVX2 __m256i
+average_avx2 (__m256i a, __m256i b)
+{
+  const __m256i ones = _mm256_set1_epi8 (1);
+  __m256i sum = _mm256_add_epi16 (_mm256_maddubs_epi16 (a, ones),
+      _mm256_maddubs_epi16 (b, ones));
+
+  return _mm256_srli_epi16 (_mm256_add_epi16 (sum, _mm256_set1_epi16 (2)),
+      2);
+}
+
+static TARGET_AVX2 gint
+halve_avx2 (const guint8 * s0, const guint8 * s1, guint8 * d, gint width)
+{
+  gint i;
+
+  for (i = 0; i + 32 <= width; i += 32) {
+    __m256i lo = average_avx2 (_mm256_loadu_si256 ((const __m256i *) (s0 +
+                2 * i)), _mm256_loadu_si256 ((const __m256i *) (s1 + 2 * i)));
+    __m256i hi = average_avx2 (_mm256_loadu_si256 ((const __m256i *) (s0 +
+                2 * i + 32)), _mm256_loadu_si256 ((const __m256i *) (s1 +
+                2 * i + 32)));
+
+    _mm256_storeu_si256 ((__m256i *) (d + i),
+        _mm256_permute4x64_epi64 (_mm256_packus_epi16 (lo, hi), 0xd8));
+  }
+
+  return i;
+}
+
+static TARGET_AVX2 gint
+halve_pairs_avx2 (const guint8 * s0, const guint8 * s1, guint8 * d, gint n)
+{
+  /* pshufb works per 128 bit lane */
+  const __m256i order = _mm256_setr_epi8 (0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9,
+      11, 12, 14, 13, 15, 0, 2, 1, 3, 4, 6, 5, 7, 8, 10, 9, 11, 12, 14, 13,
+      15);
+  gint i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m256i lo = average_avx2 (_mm256_shuffle_epi8 (_mm256_loadu_si256 ((const
+                    __m256i *) (s0 + 4 * i)), order),
+        _mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *) (s1 +
+                    4 * i)), order));
+    __m256i hi = average_avx2 (_mm256_shuffle_epi8 (_mm256_loadu_si256 ((const
+                    __m256i *) (s0 + 4 * i + 32)), order),
+        _mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *) (s1 +
+                    4 * i + 32)), order));
+
+    _mm256_storeu_si256 ((__m256i *) (d + 2 * i),
+        _mm256_permute4x64_epi64 (_mm256_packus_epi16 (lo, hi), 0xd8));
+  }
+
+  return i;
+}
+
+const GstAhcConvertKernels gst_ahc_convert_avx2 = {
+  "avx2", avx2_supported, rgba_avx2, split_avx2, halve_avx2, halve_pairs_avx2
+};
+
+#endif
@@ -0,0 +1,539 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * "ahcconvert", converts NV21 and NV12 camera frames to RGBA or I420 for
+ * consumers without GL, in place of a generic videoconvert.
+ *
+ * The frame is walked two luma rows at a time, which share one chroma
+ * row. The rows go to the kernels of the best instruction set the CPU
+ * supports, see gstahcconvert.h, and the plain C kernels convert whatever
+ * is left at the end of a row. The "kernel" property picks a set by name
+ * instead, to compare them. The row pairs are split into tiles over the
+ * default scheduler, see gstahcscheduler.h, unless "parallel" is off.
+ *
+ * RGBA uses the matrix and range of the input colorimetry, BT.601 unless
+ * the caps say BT.709, in 6 bit fixed point. The result can differ from
+ * videoconvert by a level or two. I420 is an exact copy of the planes.
+ */
+
+#include <math.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+
+#include "gstahc.h"
+#include "gstahcconvert.h"
+#include "gstahcscheduler.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define GST_TYPE_AHC_CONVERT (gst_ahc_convert_get_type ())
+#define GST_AHC_CONVERT(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_AHC_CONVERT, GstAhcConvert))
+
+#define DEFAULT_KERNEL "auto"
+#define DEFAULT_PARALLEL TRUE
+
+typedef struct _GstAhcConvert
+{
+  GstVideoFilter parent;
+
+  const GstAhcConvertKernels *kernels;
+  gboolean parallel;
+  /* Set up by set_info() */
+  GstAhcConvertCoeffs coeffs;
+  /* Plane the first byte of each chroma pair goes to for I420 */
+  guint first_plane;
+} GstAhcConvert;
+
+typedef struct _GstAhcConvertClass
+{
+  GstVideoFilterClass parent_class;
+} GstAhcConvertClass;
+
+enum
+{
+  PROP_0,
+  PROP_KERNEL,
+  PROP_PARALLEL,
+};
+
+#define SINK_FORMATS "{ NV21, NV12 }"
+#define SRC_FORMATS "{ RGBA, I420 }"
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (SINK_FORMATS)));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (SRC_FORMATS)));
+
+GType gst_ahc_convert_get_type (void);
+G_DEFINE_TYPE (GstAhcConvert, gst_ahc_convert, GST_TYPE_VIDEO_FILTER);
+
+static inline guint8
+clamp_pixel (gint value)
+{
+  value >>= 6;
+
+  return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static gint
+rgba_c (const guint8 * y0, const guint8 * y1, const guint8 * c, guint8 * d0,
+    guint8 * d1, gint width, const GstAhcConvertCoeffs * k)
+{
+  gint x;
+
+  for (x = 0; x < width; x++) {
+    gint c1 = c[x & ~1] - 128;
+    gint c2 = c[(x & ~1) + 1] - 128;
+    gint r = k->r[0] * c1 + k->r[1] * c2;
+    gint g = k->g[0] * c1 + k->g[1] * c2;
+    gint b = k->b[0] * c1 + k->b[1] * c2;
+    gint l0 = (y0[x] - k->y_offset) * k->y_gain + 32;
+    gint l1 = (y1[x] - k->y_offset) * k->y_gain + 32;
+
+    d0[4 * x] = clamp_pixel (l0 + r);
+    d0[4 * x + 1] = clamp_pixel (l0 + g);
+    d0[4 * x + 2] = clamp_pixel (l0 + b);
+    d0[4 * x + 3] = 255;
+    d1[4 * x] = clamp_pixel (l1 + r);
+    d1[4 * x + 1] = clamp_pixel (l1 + g);
+    d1[4 * x + 2] = clamp_pixel (l1 + b);
+    d1[4 * x + 3] = 255;
+  }
+
+  return width;
+}
+
+static gint
+split_c (const guint8 * c, guint8 * first, guint8 * second, gint n)
+{
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    first[i] = c[2 * i];
+    second[i] = c[2 * i + 1];
+  }
+
+  return n;
+}
+
+static gint
+halve_c (const guint8 * s0, const guint8 * s1, guint8 * d, gint width)
+{
+  gint i;
+
+  for (i = 0; i < width; i++)
+    d[i] = (s0[2 * i] + s0[2 * i + 1] + s1[2 * i] + s1[2 * i + 1] + 2) >> 2;
+
+  return width;
+}
+
+static gint
+halve_pairs_c (const guint8 * s0, const guint8 * s1, guint8 * d, gint n)
+{
+  gint i;
+
+  for (i = 0; i < 2 * n; i++) {
+    gint j = 4 * (i / 2) + (i & 1);
+
+    d[i] = (s0[j] + s0[j + 2] + s1[j] + s1[j + 2] + 2) >> 2;
+  }
+
+  return n;
+}
+
+static gboolean
+always_supported (void)
+{
+  return TRUE;
+}
+
+static const GstAhcConvertKernels convert_c = {
+  "c", always_supported, rgba_c, split_c, halve_c, halve_pairs_c
+};
+
+/* In order of preference */
+static const GstAhcConvertKernels *const all_kernels[] = {
+#if defined (__i386__) || defined (__x86_64__)
+  &gst_ahc_convert_avx2,
+  &gst_ahc_convert_sse41,
+#endif
+#ifdef GST_AHC_HAVE_NEON
+  &gst_ahc_convert_neon,
+#endif
+  &convert_c,
+  NULL
+};
+
+/* All kernel sets built in, supported by the CPU or not, NULL terminated */
+const GstAhcConvertKernels *const *
+gst_ahc_convert_list_kernels (void)
+{
+  return all_kernels;
+}
+
+/* Returns the named kernel set, or the best one for NULL or "auto". NULL
+ * if the CPU does not support the named set. */
+const GstAhcConvertKernels *
+gst_ahc_convert_get_kernels (const gchar * name)
+{
+  static const GstAhcConvertKernels *best = NULL;
+  guint i;
+
+  if (!name || g_str_equal (name, "auto")) {
+    if (g_once_init_enter (&best)) {
+      for (i = 0; !all_kernels[i]->supported (); i++);
+      GST_INFO ("Converting with the %s kernels", all_kernels[i]->name);
+      g_once_init_leave (&best, all_kernels[i]);
+    }
+    return best;
+  }
+
+  for (i = 0; all_kernels[i]; i++) {
+    if (g_str_equal (all_kernels[i]->name, name))
+      return all_kernels[i]->supported () ? all_kernels[i] : NULL;
+  }
+
+  return NULL;
+}
+
+static void
+gst_ahc_convert_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAhcConvert *self = GST_AHC_CONVERT (object);
+  const GstAhcConvertKernels *kernels;
+
+  switch (prop_id) {
+    case PROP_KERNEL:
+      kernels = gst_ahc_convert_get_kernels (g_value_get_string (value));
+      if (!kernels) {
+        GST_WARNING_OBJECT (self, "Kernels '%s' not available here",
+            g_value_get_string (value));
+        kernels = gst_ahc_convert_get_kernels (NULL);
+      }
+      GST_OBJECT_LOCK (self);
+      self->kernels = kernels;
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PARALLEL:
+      GST_OBJECT_LOCK (self);
+      self->parallel = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ahc_convert_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstAhcConvert *self = GST_AHC_CONVERT (object);
+
+  switch (prop_id) {
+    case PROP_KERNEL:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->kernels->name);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PARALLEL:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->parallel);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Same size and rate, in the formats of the other pad */
+static GstCaps *
+gst_ahc_convert_transform_caps (GstBaseTransform * trans,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter)
+{
+  GstCaps *result, *templ, *tmp;
+  GstStructure *s;
+  guint i;
+
+  result = gst_caps_new_empty ();
+  for (i = 0; i < gst_caps_get_size (caps); i++) {
+    s = gst_structure_copy (gst_caps_get_structure (caps, i));
+    gst_structure_remove_fields (s, "format", "colorimetry", "chroma-site",
+        NULL);
+    gst_caps_append_structure (result, s);
+  }
+
+  templ = gst_pad_get_pad_template_caps (direction == GST_PAD_SINK ?
+      GST_BASE_TRANSFORM_SRC_PAD (trans) : GST_BASE_TRANSFORM_SINK_PAD (trans));
+  tmp = gst_caps_intersect (result, templ);
+  gst_caps_unref (templ);
+  gst_caps_unref (result);
+  result = tmp;
+
+  if (filter) {
+    tmp = gst_caps_intersect_full (filter, result, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (result);
+    result = tmp;
+  }
+
+  GST_DEBUG_OBJECT (trans, "%" GST_PTR_FORMAT " -> %" GST_PTR_FORMAT, caps,
+      result);
+
+  return result;
+}
+
+static void
+setup_coeffs (GstAhcConvert * self, const GstVideoInfo * info)
+{
+  const GstVideoColorimetry *cinfo = &info->colorimetry;
+  GstAhcConvertCoeffs *k = &self->coeffs;
+  gdouble kr, kb, kg, y_gain, c_gain, cr, cb, cgu, cgv;
+  gint16 v_term[3], u_term[3];
+  gboolean nv12;
+
+  gst_video_color_matrix_get_Kr_Kb (cinfo->matrix ==
+      GST_VIDEO_COLOR_MATRIX_BT709 ? GST_VIDEO_COLOR_MATRIX_BT709 :
+      GST_VIDEO_COLOR_MATRIX_BT601, &kr, &kb);
+  kg = 1.0 - kr - kb;
+
+  if (cinfo->range == GST_VIDEO_COLOR_RANGE_0_255) {
+    k->y_offset = 0;
+    y_gain = c_gain = 1.0;
+  } else {
+    k->y_offset = 16;
+    y_gain = 255.0 / 219.0;
+    c_gain = 255.0 / 224.0;
+  }
+  k->y_gain = lround (y_gain * 64);
+
+  cr = 2 * (1 - kr) * c_gain;
+  cb = 2 * (1 - kb) * c_gain;
+  cgu = 2 * (1 - kb) * kb / kg * c_gain;
+  cgv = 2 * (1 - kr) * kr / kg * c_gain;
+
+  v_term[0] = lround (cr * 64);
+  v_term[1] = -lround (cgv * 64);
+  v_term[2] = 0;
+  u_term[0] = 0;
+  u_term[1] = -lround (cgu * 64);
+  u_term[2] = lround (cb * 64);
+
+  /* NV21 has V first, NV12 U */
+  nv12 = GST_VIDEO_INFO_FORMAT (info) == GST_VIDEO_FORMAT_NV12;
+  k->r[0] = nv12 ? u_term[0] : v_term[0];
+  k->r[1] = nv12 ? v_term[0] : u_term[0];
+  k->g[0] = nv12 ? u_term[1] : v_term[1];
+  k->g[1] = nv12 ? v_term[1] : u_term[1];
+  k->b[0] = nv12 ? u_term[2] : v_term[2];
+  k->b[1] = nv12 ? v_term[2] : u_term[2];
+  self->first_plane = nv12 ? 1 : 2;
+}
+
+static gboolean
+gst_ahc_convert_set_info (GstVideoFilter * filter, GstCaps * incaps,
+    GstVideoInfo * in_info, GstCaps * outcaps, GstVideoInfo * out_info)
+{
+  GstAhcConvert *self = GST_AHC_CONVERT (filter);
+
+  if (GST_VIDEO_INFO_WIDTH (in_info) != GST_VIDEO_INFO_WIDTH (out_info) ||
+      GST_VIDEO_INFO_HEIGHT (in_info) != GST_VIDEO_INFO_HEIGHT (out_info)) {
+    GST_ERROR_OBJECT (self, "Can not scale");
+    return FALSE;
+  }
+
+  setup_coeffs (self, in_info);
+  GST_DEBUG_OBJECT (self, "%s to %s", GST_VIDEO_INFO_NAME (in_info),
+      GST_VIDEO_INFO_NAME (out_info));
+
+  return TRUE;
+}
+
+/* One frame, split over the scheduler by luma row pairs */
+typedef struct
+{
+  const GstAhcConvertKernels *kernels;
+  const GstAhcConvertCoeffs *coeffs;
+  guint first_plane;
+  GstVideoFrame *in;
+  GstVideoFrame *out;
+} ConvertJob;
+
+static void
+convert_rgba (guint first_pair, guint n_pairs, gpointer user_data)
+{
+  ConvertJob *job = user_data;
+  GstVideoFrame *in = job->in;
+  GstVideoFrame *out = job->out;
+  gint width = GST_VIDEO_FRAME_WIDTH (in);
+  gint height = GST_VIDEO_FRAME_HEIGHT (in);
+  gint y_stride = GST_VIDEO_FRAME_PLANE_STRIDE (in, 0);
+  gint c_stride = GST_VIDEO_FRAME_PLANE_STRIDE (in, 1);
+  gint d_stride = GST_VIDEO_FRAME_PLANE_STRIDE (out, 0);
+  const guint8 *y = GST_VIDEO_FRAME_PLANE_DATA (in, 0);
+  const guint8 *c = GST_VIDEO_FRAME_PLANE_DATA (in, 1);
+  guint8 *d = GST_VIDEO_FRAME_PLANE_DATA (out, 0);
+  gint row, end, n;
+
+  end = MIN (2 * (first_pair + n_pairs), height);
+  for (row = 2 * first_pair; row < end; row += 2) {
+    const guint8 *y0 = y + row * y_stride;
+    const guint8 *c0 = c + (row / 2) * c_stride;
+    guint8 *d0 = d + row * d_stride;
+    /* The last row of an odd height is converted twice */
+    const guint8 *y1 = row + 1 < height ? y0 + y_stride : y0;
+    guint8 *d1 = row + 1 < height ? d0 + d_stride : d0;
+
+    n = job->kernels->rgba (y0, y1, c0, d0, d1, width, job->coeffs);
+    if (n < width)
+      rgba_c (y0 + n, y1 + n, c0 + n, d0 + 4 * n, d1 + 4 * n, width - n,
+          job->coeffs);
+  }
+}
+
+/* A row pair is two luma rows and the chroma row they share */
+static void
+convert_i420 (guint first_pair, guint n_pairs, gpointer user_data)
+{
+  ConvertJob *job = user_data;
+  GstVideoFrame *in = job->in;
+  GstVideoFrame *out = job->out;
+  gint width = GST_VIDEO_FRAME_WIDTH (in);
+  gint height = GST_VIDEO_FRAME_HEIGHT (in);
+  gint c_width = GST_VIDEO_FRAME_COMP_WIDTH (out, 1);
+  gint c_height = GST_VIDEO_FRAME_COMP_HEIGHT (out, 1);
+  guint first_plane = job->first_plane;
+  guint second_plane = first_plane == 1 ? 2 : 1;
+  gint row, end, n;
+
+  end = MIN (2 * (first_pair + n_pairs), height);
+  for (row = 2 * first_pair; row < end; row++)
+    memcpy (GST_VIDEO_FRAME_PLANE_DATA (out, 0) +
+        row * GST_VIDEO_FRAME_PLANE_STRIDE (out, 0),
+        GST_VIDEO_FRAME_PLANE_DATA (in, 0) +
+        row * GST_VIDEO_FRAME_PLANE_STRIDE (in, 0), width);
+
+  end = MIN (first_pair + n_pairs, c_height);
+  for (row = first_pair; row < end; row++) {
+    const guint8 *c = GST_VIDEO_FRAME_PLANE_DATA (in, 1) +
+        row * GST_VIDEO_FRAME_PLANE_STRIDE (in, 1);
+    guint8 *first = GST_VIDEO_FRAME_PLANE_DATA (out, first_plane) +
+        row * GST_VIDEO_FRAME_PLANE_STRIDE (out, first_plane);
+    guint8 *second = GST_VIDEO_FRAME_PLANE_DATA (out, second_plane) +
+        row * GST_VIDEO_FRAME_PLANE_STRIDE (out, second_plane);
+
+    n = job->kernels->split (c, first, second, c_width);
+    if (n < c_width)
+      split_c (c + 2 * n, first + n, second + n, c_width - n);
+  }
+}
+
+static GstFlowReturn
+gst_ahc_convert_transform_frame (GstVideoFilter * filter,
+    GstVideoFrame * in_frame, GstVideoFrame * out_frame)
+{
+  GstAhcConvert *self = GST_AHC_CONVERT (filter);
+  GstAhcRowsFunc func;
+  ConvertJob job;
+  gboolean parallel;
+  guint n_pairs;
+
+  GST_OBJECT_LOCK (self);
+  job.kernels = self->kernels;
+  parallel = self->parallel;
+  GST_OBJECT_UNLOCK (self);
+
+  job.coeffs = &self->coeffs;
+  job.first_plane = self->first_plane;
+  job.in = in_frame;
+  job.out = out_frame;
+
+  if (GST_VIDEO_FRAME_FORMAT (out_frame) == GST_VIDEO_FORMAT_RGBA)
+    func = convert_rgba;
+  else
+    func = convert_i420;
+
+  n_pairs = (GST_VIDEO_FRAME_HEIGHT (in_frame) + 1) / 2;
+  if (parallel)
+    gst_ahc_scheduler_run_rows (gst_ahc_scheduler_get_default (), n_pairs, 0,
+        func, &job);
+  else
+    func (0, n_pairs, &job);
+
+  return GST_FLOW_OK;
+}
+
+static void
+gst_ahc_convert_class_init (GstAhcConvertClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseTransformClass *trans_class = GST_BASE_TRANSFORM_CLASS (klass);
+  GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS (klass);
+
+  gobject_class->set_property = gst_ahc_convert_set_property;
+  gobject_class->get_property = gst_ahc_convert_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_KERNEL,
+      g_param_spec_string ("kernel", "Kernel",
+          "Instruction set to convert with, \"auto\" for the best one the "
+          "CPU supports", DEFAULT_KERNEL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PARALLEL,
+      g_param_spec_boolean ("parallel", "Parallel",
+          "Split the frame over the threads of the default scheduler",
+          DEFAULT_PARALLEL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  trans_class->transform_caps = gst_ahc_convert_transform_caps;
+  filter_class->set_info = gst_ahc_convert_set_info;
+  filter_class->transform_frame = gst_ahc_convert_transform_frame;
+
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class,
+      "Camera frame converter", "Filter/Converter/Video",
+      "Converts NV21 and NV12 to RGBA or I420 with SIMD kernels",
+      "Justin Kim <justin.kim@collabora.com>");
+}
+
+static void
+gst_ahc_convert_init (GstAhcConvert * self)
+{
+  self->kernels = gst_ahc_convert_get_kernels (NULL);
+  self->parallel = DEFAULT_PARALLEL;
+}
+
+void
+gst_ahc_convert_register (void)
+{
+  gst_element_register (NULL, GST_AHC_CONVERT_ELEMENT, GST_RANK_NONE,
+      GST_TYPE_AHC_CONVERT);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_AHC_CONVERT_H__
+#define __GST_AHC_CONVERT_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Row kernels of the ahcconvert element, which converts the semi-planar
+ * camera frames, NV21 or NV12, to RGBA or I420, and of the ahcpyramid
+ * element, which halves frames to 1/2, 1/4 and 1/8 of their size.
+ *
+ * Each set of kernels targets one instruction set and is picked at runtime
+ * from what the CPU supports, see gst_ahc_convert_get_kernels(). SIMD
+ * kernels convert as many pixels as their vectors fit and return how many
+ * they did, the plain C kernels finish the rest of the row. All sets give
+ * bit identical results.
+ */
+
+#define GST_AHC_CONVERT_ELEMENT "ahcconvert"
+
+/* Fixed point YUV to RGB with 6 fractional bits. c1 and c2 are the first
+ * and second byte of each chroma pair, minus 128:
+ *
+ *   y' = (y - y_offset) * y_gain + 32
+ *   R = clamp ((y' + r[0] * c1 + r[1] * c2) >> 6), G and B alike
+ */
+typedef struct _GstAhcConvertCoeffs
+{
+  gint16 y_offset;
+  gint16 y_gain;
+  gint16 r[2];
+  gint16 g[2];
+  gint16 b[2];
+} GstAhcConvertCoeffs;
+
+/* Converts two luma rows sharing one chroma row to RGBA, starting at
+ * pixel 0. Returns the number of pixels converted, always even. */
+typedef gint (*GstAhcConvertRgbaFunc) (const guint8 * y0, const guint8 * y1,
+    const guint8 * c, guint8 * d0, guint8 * d1, gint width,
+    const GstAhcConvertCoeffs * coeffs);
+/* Splits n interleaved chroma pairs into two planes. Returns the number of
+ * pairs split. */
+typedef gint (*GstAhcConvertSplitFunc) (const guint8 * c, guint8 * first,
+    guint8 * second, gint n);
+
+/* Averages 2x2 blocks of two rows into width samples, rounding to
+ * nearest. Returns the number of samples written. */
+typedef gint (*GstAhcConvertHalveFunc) (const guint8 * s0, const guint8 * s1,
+    guint8 * d, gint width);
+/* The same for n interleaved pairs, each byte of a pair averaged with the
+ * same byte of its neighbour. Returns the number of pairs written. */
+typedef gint (*GstAhcConvertHalvePairsFunc) (const guint8 * s0,
+    const guint8 * s1, guint8 * d, gint n);
+
+typedef struct _GstAhcConvertKernels
+{
+  const gchar *name;
+  gboolean (*supported) (void);
+  GstAhcConvertRgbaFunc rgba;
+  GstAhcConvertSplitFunc split;
+  GstAhcConvertHalveFunc halve;
+  GstAhcConvertHalvePairsFunc halve_pairs;
+} GstAhcConvertKernels;
+
+const GstAhcConvertKernels *gst_ahc_convert_get_kernels (const gchar * name);
+const GstAhcConvertKernels *const *gst_ahc_convert_list_kernels (void);
+
+/* Per instruction set, only built where the compiler targets it */
+G_GNUC_INTERNAL extern const GstAhcConvertKernels gst_ahc_convert_sse41;
+G_GNUC_INTERNAL extern const GstAhcConvertKernels gst_ahc_convert_avx2;
+G_GNUC_INTERNAL extern const GstAhcConvertKernels gst_ahc_convert_neon;
+
+G_END_DECLS
+
+#endif /* __GST_AHC_CONVERT_H__ */
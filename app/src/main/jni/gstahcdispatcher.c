@@ -0,0 +1,187 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * Shared dispatcher thread.
+ *
+ * By default every instance runs its own main loop on its own thread. With
+ * gst_ahc_set_shared_dispatcher() the instance attaches its bus watch and
+ * control source to one process-wide main context instead, run by a single
+ * "ahc-dispatcher" thread which exists while at least one instance uses it.
+ * This saves a thread and a context per pipeline, but a slow handler or a
+ * state change done on the dispatcher delays the messages of all of them.
+ *
+ * gst_ahc_ping() posts an application message on the bus of an instance and
+ * records how long it took to be dispatched, to compare both modes.
+ */
+
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define PING_NAME "ahc-ping"
+
+static GMutex dispatcher_lock;
+static guint dispatcher_refs;
+static GMainContext *dispatcher_context;
+static GMainLoop *dispatcher_loop;
+static GThread *dispatcher_thread;
+
+static gpointer
+dispatcher_run (gpointer user_data)
+{
+  GMainLoop *loop = user_data;
+
+  g_main_context_push_thread_default (g_main_loop_get_context (loop));
+  g_main_loop_run (loop);
+  g_main_context_pop_thread_default (g_main_loop_get_context (loop));
+  g_main_loop_unref (loop);
+
+  return NULL;
+}
+
+static gboolean
+dispatcher_quit (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Returns a new reference to the context of the shared dispatcher thread,
+ * which is started by the first user */
+GMainContext *
+gst_ahc_dispatcher_ref (void)
+{
+  GMainContext *context;
+
+  g_mutex_lock (&dispatcher_lock);
+  if (dispatcher_refs++ == 0) {
+    GST_DEBUG ("Starting shared dispatcher thread");
+    dispatcher_context = g_main_context_new ();
+    dispatcher_loop = g_main_loop_new (dispatcher_context, FALSE);
+    dispatcher_thread = g_thread_new ("ahc-dispatcher", dispatcher_run,
+        g_main_loop_ref (dispatcher_loop));
+  }
+  context = g_main_context_ref (dispatcher_context);
+  g_mutex_unlock (&dispatcher_lock);
+
+  return context;
+}
+
+/* Stops the shared dispatcher thread once its last user is gone. From the
+ * dispatcher thread itself, e.g. when the last instance is freed in one of
+ * its callbacks, the thread is detached and exits on its own. */
+void
+gst_ahc_dispatcher_unref (void)
+{
+  GMainContext *context = NULL;
+  GMainLoop *loop = NULL;
+  GThread *thread = NULL;
+  GSource *source;
+
+  g_mutex_lock (&dispatcher_lock);
+  g_assert (dispatcher_refs > 0);
+  if (--dispatcher_refs == 0) {
+    context = dispatcher_context;
+    loop = dispatcher_loop;
+    thread = dispatcher_thread;
+    dispatcher_context = NULL;
+    dispatcher_loop = NULL;
+    dispatcher_thread = NULL;
+  }
+  g_mutex_unlock (&dispatcher_lock);
+
+  if (!thread)
+    return;
+
+  GST_DEBUG ("Stopping shared dispatcher thread");
+  if (thread == g_thread_self ()) {
+    g_main_loop_quit (loop);
+    g_thread_unref (thread);
+  } else {
+    /* The loop might not run yet, quitting it directly would be lost */
+    source = g_idle_source_new ();
+    g_source_set_callback (source, dispatcher_quit, loop, NULL);
+    g_source_attach (source, context);
+    g_source_unref (source);
+    g_thread_join (thread);
+  }
+
+  g_main_loop_unref (loop);
+  g_main_context_unref (context);
+}
+
+/* Posts a ping on the bus. Its dispatch latency shows up in
+ * gst_ahc_get_dispatch_stats(). Does nothing before the pipeline exists. */
+void
+gst_ahc_ping (GstAhc * ahc)
+{
+  GstStructure *s;
+  GstBus *bus = NULL;
+
+  g_mutex_lock (&ahc->lock);
+  if (ahc->attached)
+    bus = gst_element_get_bus (ahc->pipeline);
+  g_mutex_unlock (&ahc->lock);
+
+  if (!bus)
+    return;
+
+  s = gst_structure_new (PING_NAME, "posted", G_TYPE_UINT64,
+      gst_util_get_timestamp (), NULL);
+  gst_bus_post (bus, gst_message_new_application (NULL, s));
+  gst_object_unref (bus);
+}
+
+/* Called for application messages on the main context of ahc */
+void
+gst_ahc_dispatch_record (GstAhc * ahc, GstMessage * message)
+{
+  const GstStructure *s = gst_message_get_structure (message);
+  GstClockTime latency;
+  guint64 posted;
+
+  if (!gst_structure_has_name (s, PING_NAME) ||
+      !gst_structure_get_uint64 (s, "posted", &posted))
+    return;
+
+  latency = gst_util_get_timestamp () - posted;
+
+  g_mutex_lock (&ahc->lock);
+  ahc->n_pings++;
+  ahc->ping_total += latency;
+  ahc->ping_max = MAX (ahc->ping_max, latency);
+  g_mutex_unlock (&ahc->lock);
+}
+
+void
+gst_ahc_get_dispatch_stats (GstAhc * ahc, GstAhcDispatchStats * stats)
+{
+  g_mutex_lock (&ahc->lock);
+  stats->n_pings = ahc->n_pings;
+  stats->mean_latency = ahc->n_pings ? ahc->ping_total / ahc->n_pings : 0;
+  stats->max_latency = ahc->ping_max;
+  g_mutex_unlock (&ahc->lock);
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * Batched event ring.
+ *
+ * Calling into another runtime for every callback is expensive, for JNI
+ * it is an env lookup and a method call each. Instead, the callbacks write
+ * compact records into a ring in memory shared with the consumer, from any
+ * thread and without allocating, and a low priority GSource on the main
+ * context of the instance calls the consumer once after a burst of events
+ * is over. The consumer reads everything up to the write offset handed to the
+ * flush and stores its read offset, the ring picks that up when the flush
+ * returns.
+ *
+ * When the ring is full, new events are dropped and counted in its header.
+ * Pushing after gst_ahc_event_ring_free() is not allowed.
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+typedef struct
+{
+  GSource source;
+  GstAhcEventRing *ring;
+} FlushSource;
+
+struct _GstAhcEventRing
+{
+  GMutex lock;
+  gint32 *header;
+  guint8 *records;
+  guint32 size;
+  /* Protected by lock, header[0] and header[2] are their published copies */
+  guint32 write;
+  guint32 read;
+  guint32 dropped;
+
+  gint pending;
+  /* Held while flushing, so the ring can be freed while a shared
+   * dispatcher keeps running */
+  GMutex flush_lock;
+  gboolean freed;
+  GSource *source;
+  GstAhcEventFlushFunc flush;
+  gpointer user_data;
+};
+
+static gboolean
+flush_prepare (GSource * source, gint * timeout)
+{
+  FlushSource *fs = (FlushSource *) source;
+
+  *timeout = -1;
+  return g_atomic_int_get (&fs->ring->pending);
+}
+
+static gboolean
+flush_check (GSource * source)
+{
+  FlushSource *fs = (FlushSource *) source;
+
+  return g_atomic_int_get (&fs->ring->pending);
+}
+
+static gboolean
+flush_dispatch (GSource * source, GSourceFunc callback, gpointer user_data)
+{
+  GstAhcEventRing *ring = ((FlushSource *) source)->ring;
+  guint32 write;
+
+  g_mutex_lock (&ring->flush_lock);
+  if (ring->freed) {
+    g_mutex_unlock (&ring->flush_lock);
+    return G_SOURCE_REMOVE;
+  }
+
+  g_atomic_int_set (&ring->pending, FALSE);
+
+  /* Records before this offset were written under the same lock, so they
+   * are visible here. The consumer must not read past it, the published
+   * copy in the header has no ordering on weakly ordered CPUs. */
+  g_mutex_lock (&ring->lock);
+  write = ring->write;
+  g_mutex_unlock (&ring->lock);
+
+  ring->flush (ring, write, ring->user_data);
+
+  g_mutex_lock (&ring->lock);
+  ring->read = (guint32) g_atomic_int_get (&ring->header[1]) % ring->size;
+  g_mutex_unlock (&ring->lock);
+  g_mutex_unlock (&ring->flush_lock);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* The source holds the last reference while it dispatches */
+static void
+flush_finalize (GSource * source)
+{
+  GstAhcEventRing *ring = ((FlushSource *) source)->ring;
+
+  g_mutex_clear (&ring->flush_lock);
+  g_mutex_clear (&ring->lock);
+  g_free (ring);
+}
+
+static GSourceFuncs flush_funcs = {
+  flush_prepare,
+  flush_check,
+  flush_dispatch,
+  flush_finalize
+};
+
+/* Sets up a ring in size bytes of memory and calls flush on the main
+ * context of ahc after events were pushed. Call it after
+ * gst_ahc_set_shared_dispatcher(). */
+GstAhcEventRing *
+gst_ahc_event_ring_new (GstAhc * ahc, guint8 * memory, gsize size,
+    GstAhcEventFlushFunc flush, gpointer user_data)
+{
+  GstAhcEventRing *ring;
+
+  g_return_val_if_fail (size >= GST_AHC_EVENT_RING_HEADER_SIZE +
+      4 * GST_AHC_EVENT_RECORD_HEADER_SIZE, NULL);
+
+  ring = g_new0 (GstAhcEventRing, 1);
+  g_mutex_init (&ring->lock);
+  g_mutex_init (&ring->flush_lock);
+  memset (memory, 0, GST_AHC_EVENT_RING_HEADER_SIZE);
+  ring->header = (gint32 *) memory;
+  ring->records = memory + GST_AHC_EVENT_RING_HEADER_SIZE;
+  ring->size = (size - GST_AHC_EVENT_RING_HEADER_SIZE) & ~3;
+  ring->flush = flush;
+  ring->user_data = user_data;
+
+  ring->source = g_source_new (&flush_funcs, sizeof (FlushSource));
+  ((FlushSource *) ring->source)->ring = ring;
+  g_source_set_name (ring->source, "GstAhc events");
+  /* Runs once the bus and control sources have nothing left to do, so a
+   * burst of events is delivered at once */
+  g_source_set_priority (ring->source, G_PRIORITY_DEFAULT_IDLE);
+  g_source_attach (ring->source, ahc->context);
+
+  return ring;
+}
+
+/* Waits for a running flush, no flush starts after it returns. Must not
+ * be called from the flush function. */
+void
+gst_ahc_event_ring_free (GstAhcEventRing * ring)
+{
+  GSource *source;
+
+  if (!ring)
+    return;
+
+  g_mutex_lock (&ring->flush_lock);
+  ring->freed = TRUE;
+  source = ring->source;
+  g_mutex_unlock (&ring->flush_lock);
+
+  g_source_destroy (source);
+  g_source_unref (source);
+}
+
+static void
+write_int (guint8 * at, gint32 value)
+{
+  memcpy (at, &value, sizeof (value));
+}
+
+/* Appends an event, text may be NULL. Can be called from any thread.
+ * Returns FALSE if the ring is full. */
+gboolean
+gst_ahc_event_ring_push (GstAhcEventRing * ring, GstAhcEventType type,
+    gint arg, const gchar * text)
+{
+  guint32 length = text ? strlen (text) : 0;
+  guint32 needed, tail, avail;
+  GMainContext *context;
+
+  /* Long texts are cut so that a record always fits */
+  length = MIN (length, ring->size / 2);
+  needed = GST_AHC_EVENT_RECORD_HEADER_SIZE + ((length + 3) & ~3);
+
+  g_mutex_lock (&ring->lock);
+  tail = ring->size - ring->write;
+  /* One word stays free to tell a full ring from an empty one */
+  avail = (ring->read + ring->size - ring->write - 4) % ring->size;
+
+  if ((needed <= tail && needed > avail) ||
+      (needed > tail && tail + needed > avail)) {
+    ring->dropped++;
+    g_atomic_int_set (&ring->header[2], ring->dropped);
+    g_mutex_unlock (&ring->lock);
+    GST_WARNING ("Event ring full, dropped event %d", type);
+    return FALSE;
+  }
+
+  if (needed > tail) {
+    if (tail >= GST_AHC_EVENT_RECORD_HEADER_SIZE)
+      write_int (ring->records + ring->write, GST_AHC_EVENT_PAD);
+    ring->write = 0;
+  }
+
+  write_int (ring->records + ring->write, type);
+  write_int (ring->records + ring->write + 4, arg);
+  write_int (ring->records + ring->write + 8, length);
+  if (length)
+    memcpy (ring->records + ring->write + GST_AHC_EVENT_RECORD_HEADER_SIZE,
+        text, length);
+  ring->write = (ring->write + needed) % ring->size;
+  g_atomic_int_set (&ring->header[0], ring->write);
+  g_mutex_unlock (&ring->lock);
+
+  g_atomic_int_set (&ring->pending, TRUE);
+  context = g_source_get_context (ring->source);
+  if (context)
+    g_main_context_wakeup (context);
+
+  return TRUE;
+}
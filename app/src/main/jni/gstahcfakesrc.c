@@ -0,0 +1,573 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * "ahcfakesrc", a deterministic stand-in for the camera source.
+ *
+ * Produces synthetic NV21, NV12 or I420 frames of the size and rate set
+ * by its properties, or whatever downstream fixes, and implements
+ * GstPhotography, so the white balance and autofocus paths of the core can
+ * be driven without a camera. Changes take effect after a settle time, as
+ * on a real camera: a white balance mode after wb-settle-ms, autofocus
+ * after af-settle-ms, which then posts the autofocus-done message.
+ *
+ * Settle times count in stream time from the next frame on, so the same
+ * requests always give the same frames. The applied settings are encoded
+ * in the frames, which lets a consumer see when a change arrived:
+ *
+ *  - U of every pixel is 64 + 8 * the white balance mode
+ *  - V is 96 while focusing and 128 otherwise
+ *  - luma is a diagonal ramp moving by 4 per frame, at half contrast
+ *    while focusing
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+#include <gst/video/video.h>
+#include <gst/interfaces/photography.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define GST_TYPE_AHC_FAKE_SRC (gst_ahc_fake_src_get_type ())
+#define GST_AHC_FAKE_SRC(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_AHC_FAKE_SRC, GstAhcFakeSrc))
+
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
+#define DEFAULT_FPS 30
+#define DEFAULT_FORMAT GST_VIDEO_FORMAT_NV21
+#define DEFAULT_WB_SETTLE_MS 300
+#define DEFAULT_AF_SETTLE_MS 600
+
+#define FOCUSING_V 96
+#define FOCUSED_V 128
+
+typedef struct _GstAhcFakeSrc
+{
+  GstPushSrc parent;
+
+  gint width;
+  gint height;
+  gint fps;
+  GstVideoFormat format;
+  gboolean is_live;
+  guint wb_settle_ms;
+  guint af_settle_ms;
+
+  GstVideoInfo info;
+  guint64 n_frames;
+
+  /* Protected by the object lock, set from the application and applied
+   * by the streaming thread. next_pts is the PTS of the next frame. */
+  GstClockTime next_pts;
+  GstPhotographyWhiteBalanceMode wb_mode;
+  GstPhotographyWhiteBalanceMode wb_pending;
+  GstClockTime wb_settle_at;
+  GstPhotographyFocusMode focus_mode;
+  gboolean focusing;
+  GstClockTime focus_done_at;
+} GstAhcFakeSrc;
+
+typedef struct _GstAhcFakeSrcClass
+{
+  GstPushSrcClass parent_class;
+} GstAhcFakeSrcClass;
+
+enum
+{
+  PROP_0,
+  PROP_WIDTH,
+  PROP_HEIGHT,
+  PROP_FPS,
+  PROP_FORMAT,
+  PROP_IS_LIVE,
+  PROP_WB_SETTLE_MS,
+  PROP_AF_SETTLE_MS,
+  /* The properties of GstPhotography follow, in the order the interface
+   * lists them */
+  PROP_PHOTOGRAPHY
+};
+
+static guint n_photography_props;
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ NV21, NV12, I420 }")));
+
+static void gst_ahc_fake_src_photography_init (GstPhotographyInterface *
+    iface);
+
+GType gst_ahc_fake_src_get_type (void);
+G_DEFINE_TYPE_WITH_CODE (GstAhcFakeSrc, gst_ahc_fake_src, GST_TYPE_PUSH_SRC,
+    G_IMPLEMENT_INTERFACE (GST_TYPE_PHOTOGRAPHY,
+        gst_ahc_fake_src_photography_init));
+
+static void
+set_white_balance (GstAhcFakeSrc * self, GstPhotographyWhiteBalanceMode mode)
+{
+  GST_OBJECT_LOCK (self);
+  self->wb_pending = mode;
+  self->wb_settle_at = self->next_pts + self->wb_settle_ms * GST_MSECOND;
+  GST_OBJECT_UNLOCK (self);
+}
+
+static gboolean
+gst_ahc_fake_src_get_white_balance_mode (GstPhotography * photo,
+    GstPhotographyWhiteBalanceMode * wb_mode)
+{
+  GstAhcFakeSrc *self = GST_AHC_FAKE_SRC (photo);
+
+  GST_OBJECT_LOCK (self);
+  *wb_mode = self->wb_mode;
+  GST_OBJECT_UNLOCK (self);
+
+  return TRUE;
+}
+
+static gboolean
+gst_ahc_fake_src_set_white_balance_mode (GstPhotography * photo,
+    GstPhotographyWhiteBalanceMode wb_mode)
+{
+  set_white_balance (GST_AHC_FAKE_SRC (photo), wb_mode);
+
+  return TRUE;
+}
+
+/* Turning it on starts a new focus run, turning it off keeps the focus
+ * where it is */
+static void
+gst_ahc_fake_src_set_autofocus (GstPhotography * photo, gboolean on)
+{
+  GstAhcFakeSrc *self = GST_AHC_FAKE_SRC (photo);
+
+  GST_OBJECT_LOCK (self);
+  self->focusing = on;
+  self->focus_done_at = self->next_pts + self->af_settle_ms * GST_MSECOND;
+  GST_OBJECT_UNLOCK (self);
+}
+
+static GstPhotographyCaps
+gst_ahc_fake_src_get_capabilities (GstPhotography * photo)
+{
+  return GST_PHOTOGRAPHY_CAPS_WB_MODE | GST_PHOTOGRAPHY_CAPS_FOCUS;
+}
+
+static void
+gst_ahc_fake_src_photography_init (GstPhotographyInterface * iface)
+{
+  iface->get_white_balance_mode = gst_ahc_fake_src_get_white_balance_mode;
+  iface->set_white_balance_mode = gst_ahc_fake_src_set_white_balance_mode;
+  iface->set_autofocus = gst_ahc_fake_src_set_autofocus;
+  iface->get_capabilities = gst_ahc_fake_src_get_capabilities;
+}
+
+/* Only white balance and focus mode are kept, the other photography
+ * properties read as their defaults */
+static void
+set_photography_property (GstAhcFakeSrc * self, GParamSpec * pspec,
+    const GValue * value)
+{
+  if (!strcmp (pspec->name, GST_PHOTOGRAPHY_PROP_WB_MODE)) {
+    set_white_balance (self, g_value_get_enum (value));
+  } else if (!strcmp (pspec->name, GST_PHOTOGRAPHY_PROP_FOCUS_MODE)) {
+    GST_OBJECT_LOCK (self);
+    self->focus_mode = g_value_get_enum (value);
+    GST_OBJECT_UNLOCK (self);
+  }
+}
+
+static void
+get_photography_property (GstAhcFakeSrc * self, GParamSpec * pspec,
+    GValue * value)
+{
+  if (!strcmp (pspec->name, GST_PHOTOGRAPHY_PROP_WB_MODE)) {
+    GST_OBJECT_LOCK (self);
+    g_value_set_enum (value, self->wb_mode);
+    GST_OBJECT_UNLOCK (self);
+  } else if (!strcmp (pspec->name, GST_PHOTOGRAPHY_PROP_FOCUS_MODE)) {
+    GST_OBJECT_LOCK (self);
+    g_value_set_enum (value, self->focus_mode);
+    GST_OBJECT_UNLOCK (self);
+  } else if (!strcmp (pspec->name, GST_PHOTOGRAPHY_PROP_CAPABILITIES)) {
+    g_value_set_ulong (value,
+        gst_ahc_fake_src_get_capabilities (GST_PHOTOGRAPHY (self)));
+  } else {
+    g_param_value_set_default (pspec, value);
+  }
+}
+
+static void
+gst_ahc_fake_src_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAhcFakeSrc *self = GST_AHC_FAKE_SRC (object);
+
+  switch (prop_id) {
+    case PROP_WIDTH:
+      self->width = g_value_get_int (value);
+      break;
+    case PROP_HEIGHT:
+      self->height = g_value_get_int (value);
+      break;
+    case PROP_FPS:
+      self->fps = g_value_get_int (value);
+      break;
+    case PROP_FORMAT:
+      self->format = g_value_get_enum (value);
+      break;
+    case PROP_IS_LIVE:
+      self->is_live = g_value_get_boolean (value);
+      gst_base_src_set_live (GST_BASE_SRC (self), self->is_live);
+      break;
+    case PROP_WB_SETTLE_MS:
+      self->wb_settle_ms = g_value_get_uint (value);
+      break;
+    case PROP_AF_SETTLE_MS:
+      self->af_settle_ms = g_value_get_uint (value);
+      break;
+    default:
+      if (prop_id >= PROP_PHOTOGRAPHY &&
+          prop_id < PROP_PHOTOGRAPHY + n_photography_props)
+        set_photography_property (self, pspec, value);
+      else
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ahc_fake_src_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstAhcFakeSrc *self = GST_AHC_FAKE_SRC (object);
+
+  switch (prop_id) {
+    case PROP_WIDTH:
+      g_value_set_int (value, self->width);
+      break;
+    case PROP_HEIGHT:
+      g_value_set_int (value, self->height);
+      break;
+    case PROP_FPS:
+      g_value_set_int (value, self->fps);
+      break;
+    case PROP_FORMAT:
+      g_value_set_enum (value, self->format);
+      break;
+    case PROP_IS_LIVE:
+      g_value_set_boolean (value, self->is_live);
+      break;
+    case PROP_WB_SETTLE_MS:
+      g_value_set_uint (value, self->wb_settle_ms);
+      break;
+    case PROP_AF_SETTLE_MS:
+      g_value_set_uint (value, self->af_settle_ms);
+      break;
+    default:
+      if (prop_id >= PROP_PHOTOGRAPHY &&
+          prop_id < PROP_PHOTOGRAPHY + n_photography_props)
+        get_photography_property (self, pspec, value);
+      else
+        G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static GstCaps *
+gst_ahc_fake_src_fixate (GstBaseSrc * bsrc, GstCaps * caps)
+{
+  GstAhcFakeSrc *self = GST_AHC_FAKE_SRC (bsrc);
+  GstStructure *s;
+
+  caps = gst_caps_make_writable (caps);
+  s = gst_caps_get_structure (caps, 0);
+
+  gst_structure_fixate_field_nearest_int (s, "width", self->width);
+  gst_structure_fixate_field_nearest_int (s, "height", self->height);
+  gst_structure_fixate_field_nearest_fraction (s, "framerate", self->fps, 1);
+  gst_structure_fixate_field_string (s, "format",
+      gst_video_format_to_string (self->format));
+
+  return GST_BASE_SRC_CLASS (gst_ahc_fake_src_parent_class)->fixate (bsrc,
+      caps);
+}
+
+static gboolean
+gst_ahc_fake_src_set_caps (GstBaseSrc * bsrc, GstCaps * caps)
+{
+  GstAhcFakeSrc *self = GST_AHC_FAKE_SRC (bsrc);
+  GstVideoInfo info;
+
+  if (!gst_video_info_from_caps (&info, caps) || info.fps_n <= 0)
+    return FALSE;
+
+  GST_DEBUG_OBJECT (self, "Producing %" GST_PTR_FORMAT, caps);
+  self->info = info;
+
+  return TRUE;
+}
+
+/* Buffers of the negotiated size with video meta, from downstream's pool
+ * if it offers one */
+static gboolean
+gst_ahc_fake_src_decide_allocation (GstBaseSrc * bsrc, GstQuery * query)
+{
+  GstAhcFakeSrc *self = GST_AHC_FAKE_SRC (bsrc);
+  GstBufferPool *pool = NULL;
+  GstStructure *config;
+  GstCaps *caps;
+  guint size = 0, min = 0, max = 0;
+  gboolean update = FALSE;
+
+  gst_query_parse_allocation (query, &caps, NULL);
+
+  if (gst_query_get_n_allocation_pools (query) > 0) {
+    gst_query_parse_nth_allocation_pool (query, 0, &pool, &size, &min, &max);
+    update = TRUE;
+  }
+  size = MAX (size, GST_VIDEO_INFO_SIZE (&self->info));
+  if (!pool)
+    pool = gst_video_buffer_pool_new ();
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_set_params (config, caps, size, min, max);
+  gst_buffer_pool_config_add_option (config,
+      GST_BUFFER_POOL_OPTION_VIDEO_META);
+  gst_buffer_pool_set_config (pool, config);
+
+  if (update)
+    gst_query_set_nth_allocation_pool (query, 0, pool, size, min, max);
+  else
+    gst_query_add_allocation_pool (query, pool, size, min, max);
+  gst_object_unref (pool);
+
+  return GST_BASE_SRC_CLASS (gst_ahc_fake_src_parent_class)->decide_allocation
+      (bsrc, query);
+}
+
+/* Live, it waits for the clock to reach each frame */
+static void
+gst_ahc_fake_src_get_times (GstBaseSrc * bsrc, GstBuffer * buffer,
+    GstClockTime * start, GstClockTime * end)
+{
+  *start = *end = GST_CLOCK_TIME_NONE;
+
+  if (gst_base_src_is_live (bsrc) && GST_BUFFER_PTS_IS_VALID (buffer)) {
+    *start = GST_BUFFER_PTS (buffer);
+    *end = *start + GST_BUFFER_DURATION (buffer);
+  }
+}
+
+static gboolean
+gst_ahc_fake_src_start (GstBaseSrc * bsrc)
+{
+  GstAhcFakeSrc *self = GST_AHC_FAKE_SRC (bsrc);
+
+  self->n_frames = 0;
+  GST_OBJECT_LOCK (self);
+  self->next_pts = 0;
+  /* Requests made before the start settle from the first frame on */
+  self->wb_settle_at = MIN (self->wb_settle_at, self->wb_settle_ms *
+      GST_MSECOND);
+  self->focus_done_at = MIN (self->focus_done_at, self->af_settle_ms *
+      GST_MSECOND);
+  GST_OBJECT_UNLOCK (self);
+
+  return TRUE;
+}
+
+static void
+draw_frame (GstVideoFrame * frame, guint64 n, guint8 u, guint8 v,
+    gboolean focusing)
+{
+  gint width = GST_VIDEO_FRAME_WIDTH (frame);
+  gint height = GST_VIDEO_FRAME_HEIGHT (frame);
+  gint cw = GST_VIDEO_FRAME_COMP_WIDTH (frame, 1);
+  gint ch = GST_VIDEO_FRAME_COMP_HEIGHT (frame, 1);
+  guint8 offset = (n * 4) & 0xff;
+  gint x, y;
+
+  for (y = 0; y < height; y++) {
+    guint8 *row = GST_VIDEO_FRAME_COMP_DATA (frame, 0) +
+        y * GST_VIDEO_FRAME_COMP_STRIDE (frame, 0);
+
+    for (x = 0; x < width; x++) {
+      guint8 ramp = x + y + offset;
+
+      row[x] = focusing ? 64 + (ramp >> 1) : ramp;
+    }
+  }
+
+  /* Works for the semi-planar formats too, where U and V share a plane
+   * and a pixel stride of 2 */
+  for (y = 0; y < ch; y++) {
+    guint8 *urow = GST_VIDEO_FRAME_COMP_DATA (frame, 1) +
+        y * GST_VIDEO_FRAME_COMP_STRIDE (frame, 1);
+    guint8 *vrow = GST_VIDEO_FRAME_COMP_DATA (frame, 2) +
+        y * GST_VIDEO_FRAME_COMP_STRIDE (frame, 2);
+
+    for (x = 0; x < cw; x++) {
+      urow[x * GST_VIDEO_FRAME_COMP_PSTRIDE (frame, 1)] = u;
+      vrow[x * GST_VIDEO_FRAME_COMP_PSTRIDE (frame, 2)] = v;
+    }
+  }
+}
+
+static GstFlowReturn
+gst_ahc_fake_src_fill (GstPushSrc * psrc, GstBuffer * buffer)
+{
+  GstAhcFakeSrc *self = GST_AHC_FAKE_SRC (psrc);
+  GstClockTime pts, duration;
+  GstPhotographyWhiteBalanceMode wb_mode;
+  gboolean focusing, focus_done = FALSE;
+  GstVideoFrame frame;
+
+  pts = gst_util_uint64_scale (self->n_frames,
+      self->info.fps_d * GST_SECOND, self->info.fps_n);
+  duration = gst_util_uint64_scale (self->n_frames + 1,
+      self->info.fps_d * GST_SECOND, self->info.fps_n) - pts;
+
+  GST_OBJECT_LOCK (self);
+  if (self->wb_mode != self->wb_pending && pts >= self->wb_settle_at)
+    self->wb_mode = self->wb_pending;
+  if (self->focusing && pts >= self->focus_done_at) {
+    self->focusing = FALSE;
+    focus_done = TRUE;
+  }
+  wb_mode = self->wb_mode;
+  focusing = self->focusing;
+  self->next_pts = pts + duration;
+  GST_OBJECT_UNLOCK (self);
+
+  if (!gst_video_frame_map (&frame, &self->info, buffer, GST_MAP_WRITE))
+    return GST_FLOW_ERROR;
+  draw_frame (&frame, self->n_frames, 64 + 8 * wb_mode,
+      focusing ? FOCUSING_V : FOCUSED_V, focusing);
+  gst_video_frame_unmap (&frame);
+
+  GST_BUFFER_PTS (buffer) = pts;
+  GST_BUFFER_DTS (buffer) = GST_CLOCK_TIME_NONE;
+  GST_BUFFER_DURATION (buffer) = duration;
+  GST_BUFFER_OFFSET (buffer) = self->n_frames;
+  GST_BUFFER_OFFSET_END (buffer) = self->n_frames + 1;
+  self->n_frames++;
+
+  if (focus_done)
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_element (GST_OBJECT (self),
+            gst_structure_new (GST_PHOTOGRAPHY_AUTOFOCUS_DONE,
+                "status", G_TYPE_INT, GST_PHOTOGRAPHY_FOCUS_STATUS_SUCCESS,
+                NULL)));
+
+  return GST_FLOW_OK;
+}
+
+static void
+gst_ahc_fake_src_class_init (GstAhcFakeSrcClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS (klass);
+  GstPushSrcClass *pushsrc_class = GST_PUSH_SRC_CLASS (klass);
+  GParamSpec **props;
+  gpointer iface;
+  guint i;
+
+  gobject_class->set_property = gst_ahc_fake_src_set_property;
+  gobject_class->get_property = gst_ahc_fake_src_get_property;
+
+  g_object_class_install_property (gobject_class, PROP_WIDTH,
+      g_param_spec_int ("width", "Width", "Preferred frame width",
+          1, G_MAXINT, DEFAULT_WIDTH,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_HEIGHT,
+      g_param_spec_int ("height", "Height", "Preferred frame height",
+          1, G_MAXINT, DEFAULT_HEIGHT,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_FPS,
+      g_param_spec_int ("fps", "Frame rate", "Preferred frames per second",
+          1, 120, DEFAULT_FPS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_FORMAT,
+      g_param_spec_enum ("format", "Format",
+          "Preferred format, NV21, NV12 or I420", GST_TYPE_VIDEO_FORMAT,
+          DEFAULT_FORMAT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IS_LIVE,
+      g_param_spec_boolean ("is-live", "Is live",
+          "Produce frames at the frame rate, like a camera", FALSE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_WB_SETTLE_MS,
+      g_param_spec_uint ("wb-settle-ms", "White balance settle time",
+          "Stream time until a new white balance mode shows", 0, G_MAXUINT,
+          DEFAULT_WB_SETTLE_MS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_AF_SETTLE_MS,
+      g_param_spec_uint ("af-settle-ms", "Autofocus settle time",
+          "Stream time an autofocus run takes", 0, G_MAXUINT,
+          DEFAULT_AF_SETTLE_MS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  /* Every property of the interface has to be implemented, and which
+   * ones it has depends on the GStreamer version */
+  iface = g_type_default_interface_ref (GST_TYPE_PHOTOGRAPHY);
+  props = g_object_interface_list_properties (iface, &n_photography_props);
+  for (i = 0; i < n_photography_props; i++)
+    g_object_class_override_property (gobject_class, PROP_PHOTOGRAPHY + i,
+        props[i]->name);
+  g_free (props);
+  g_type_default_interface_unref (iface);
+
+  basesrc_class->fixate = gst_ahc_fake_src_fixate;
+  basesrc_class->set_caps = gst_ahc_fake_src_set_caps;
+  basesrc_class->decide_allocation = gst_ahc_fake_src_decide_allocation;
+  basesrc_class->get_times = gst_ahc_fake_src_get_times;
+  basesrc_class->start = gst_ahc_fake_src_start;
+  pushsrc_class->fill = gst_ahc_fake_src_fill;
+
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class,
+      "Fake camera source", "Source/Video",
+      "Deterministic camera stand-in with emulated white balance and "
+      "autofocus", "Justin Kim <justin.kim@collabora.com>");
+}
+
+static void
+gst_ahc_fake_src_init (GstAhcFakeSrc * self)
+{
+  self->width = DEFAULT_WIDTH;
+  self->height = DEFAULT_HEIGHT;
+  self->fps = DEFAULT_FPS;
+  self->format = DEFAULT_FORMAT;
+  self->wb_settle_ms = DEFAULT_WB_SETTLE_MS;
+  self->af_settle_ms = DEFAULT_AF_SETTLE_MS;
+  self->wb_mode = self->wb_pending = GST_PHOTOGRAPHY_WB_MODE_AUTO;
+  self->focus_mode = GST_PHOTOGRAPHY_FOCUS_MODE_AUTO;
+
+  gst_base_src_set_format (GST_BASE_SRC (self), GST_FORMAT_TIME);
+}
+
+void
+gst_ahc_fake_src_register (void)
+{
+  gst_element_register (NULL, GST_AHC_FAKE_SRC_FACTORY, GST_RANK_NONE,
+      GST_TYPE_AHC_FAKE_SRC);
+}
@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2016-2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Frame delivery to the application.
+ *
+ * An analysis branch ending in an appsink maps every frame and passes the
+ * mapping to the frame callback. The frame stays mapped, and its buffer
+ * out of the pool, until the application releases it. At most
+ * max_held frames can be out at once; beyond that the policy decides:
+ *
+ *  - DROP: new frames are dropped
+ *  - BLOCK: the frame branch waits for a release, which makes its leaky
+ *    queue drop instead. The preview is never affected.
+ *  - LATEST: a one-slot mailbox always holds only the newest frame, a
+ *    newer frame supersedes an undelivered one. A delivery thread hands it
+ *    over as soon as the application is below max_held, so a slow consumer
+ *    is at most one frame behind the camera.
+ *  - LATEST_DECIMATED: the same mailbox, but frames are also decimated
+ *    before they reach it, based on how long the consumer held the
+ *    previous ones, so frames that would be superseded anyway are not even
+ *    queued. This saves the mailbox churn at the cost of the guarantee:
+ *    when the consumer gets done while a frame is skipped, it waits for the
+ *    next one that is let through, up to decimation - 1 frames.
+ */
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define DEFAULT_MAX_HELD_FRAMES 2
+
+#define FRAME_SINK_NAME "frame-sink"
+#define FRAME_BRANCH_DESCRIPTION \
+    "appsink name=" FRAME_SINK_NAME " sync=false async=false"
+
+struct _GstAhcFrameTap
+{
+  GMutex lock;
+  GCond cond;
+  /* Whether the application asked for frames, the branch is added again
+   * when a stopped pipeline starts */
+  gboolean enabled;
+  gint branch;
+  gboolean flushing;
+  GHashTable *held;
+  guint max_held;
+  GstAhcFramePolicy policy;
+  gint next_id;
+
+  GstAhcFrameCounters counters;
+
+  /* GST_AHC_FRAME_LATEST and GST_AHC_FRAME_LATEST_DECIMATED */
+  GThread *thread;
+  gboolean running;
+  GstSample *mailbox;
+  GstClockTime last_pts;
+  GstClockTime frame_interval;
+  GstClockTime consumer_time;
+  guint decimation;
+  guint skip;
+};
+
+typedef struct
+{
+  GstAhcFrame frame;
+  GstClockTime delivered_at;
+} FrameRecord;
+
+/* The frame is the first member of its record */
+static void
+frame_free (GstAhcFrame * frame)
+{
+  gst_buffer_unmap (frame->buffer, &frame->map);
+  gst_sample_unref (frame->sample);
+  g_free ((FrameRecord *) frame);
+}
+
+void
+gst_ahc_frames_init (GstAhc * ahc)
+{
+  GstAhcFrameTap *tap = g_new0 (GstAhcFrameTap, 1);
+
+  g_mutex_init (&tap->lock);
+  g_cond_init (&tap->cond);
+  tap->branch = -1;
+  tap->held = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) frame_free);
+  tap->max_held = DEFAULT_MAX_HELD_FRAMES;
+  tap->policy = GST_AHC_FRAME_DROP;
+  tap->next_id = 1;
+  tap->last_pts = GST_CLOCK_TIME_NONE;
+  tap->decimation = 1;
+
+  ahc->frames = tap;
+}
+
+/* The tap whose mailbox thread is the current thread */
+static GPrivate mailbox_tap;
+
+static void
+stop_mailbox (GstAhcFrameTap * tap)
+{
+  GThread *thread;
+
+  g_mutex_lock (&tap->lock);
+  thread = tap->thread;
+  tap->thread = NULL;
+  tap->running = FALSE;
+  g_cond_broadcast (&tap->cond);
+  g_mutex_unlock (&tap->lock);
+
+  /* From the frame callback the thread can not wait for itself, it leaves
+   * its loop once the callback returns */
+  if (thread && thread == g_thread_self ())
+    g_thread_unref (thread);
+  else if (thread)
+    g_thread_join (thread);
+
+  g_mutex_lock (&tap->lock);
+  if (tap->mailbox) {
+    gst_sample_unref (tap->mailbox);
+    tap->mailbox = NULL;
+  }
+  g_mutex_unlock (&tap->lock);
+}
+
+void
+gst_ahc_frames_free (GstAhc * ahc)
+{
+  GstAhcFrameTap *tap = ahc->frames;
+
+  stop_mailbox (tap);
+  g_hash_table_unref (tap->held);
+  g_mutex_clear (&tap->lock);
+  g_cond_clear (&tap->cond);
+  g_free (tap);
+  ahc->frames = NULL;
+}
+
+/* Whether the caller is the mailbox thread, also after it was detached */
+gboolean
+gst_ahc_frames_in_callback (GstAhc * ahc)
+{
+  return g_private_get (&mailbox_tap) == ahc->frames;
+}
+
+/* Wakes up a streaming thread waiting for a release, so the pipeline can
+ * shut down. The frame branch goes away with the pipeline. */
+void
+gst_ahc_frames_flush (GstAhc * ahc)
+{
+  GstAhcFrameTap *tap = ahc->frames;
+
+  g_mutex_lock (&tap->lock);
+  tap->flushing = TRUE;
+  tap->branch = -1;
+  if (tap->mailbox) {
+    gst_sample_unref (tap->mailbox);
+    tap->mailbox = NULL;
+  }
+  g_cond_broadcast (&tap->cond);
+  g_mutex_unlock (&tap->lock);
+}
+
+/* Maps sample and hands it to the application, takes ownership of
+ * sample. Called without the lock. */
+static void
+deliver_sample (GstAhc * ahc, GstSample * sample)
+{
+  GstAhcFrameTap *tap = ahc->frames;
+  FrameRecord *record = g_new0 (FrameRecord, 1);
+  GstAhcFrame *frame = &record->frame;
+  GstCaps *caps;
+
+  frame->sample = sample;
+  frame->buffer = gst_sample_get_buffer (sample);
+  caps = gst_sample_get_caps (sample);
+  if (!gst_video_info_from_caps (&frame->info, caps) ||
+      !gst_buffer_map (frame->buffer, &frame->map, GST_MAP_READ)) {
+    GST_WARNING ("Can not map frame %" GST_PTR_FORMAT, caps);
+    g_mutex_lock (&tap->lock);
+    tap->counters.dropped++;
+    g_mutex_unlock (&tap->lock);
+    gst_sample_unref (sample);
+    g_free (record);
+    return;
+  }
+
+  g_mutex_lock (&tap->lock);
+  frame->id = tap->next_id++;
+  record->delivered_at = gst_util_get_timestamp ();
+  g_hash_table_insert (tap->held, GINT_TO_POINTER (frame->id), frame);
+  tap->counters.delivered++;
+  g_mutex_unlock (&tap->lock);
+
+  /* From here on the application owns the frame until it releases it */
+  ahc->callbacks.frame (ahc, frame, ahc->user_data);
+}
+
+static gpointer
+mailbox_thread (gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+  GstAhcFrameTap *tap = ahc->frames;
+  GstSample *sample;
+
+  g_private_set (&mailbox_tap, tap);
+  g_mutex_lock (&tap->lock);
+  /* A detached thread must not pick up a mailbox restarted meanwhile */
+  while (tap->running && tap->thread == g_thread_self ()) {
+    if (!tap->mailbox || g_hash_table_size (tap->held) >= tap->max_held) {
+      g_cond_wait (&tap->cond, &tap->lock);
+      continue;
+    }
+
+    sample = tap->mailbox;
+    tap->mailbox = NULL;
+    g_mutex_unlock (&tap->lock);
+
+    deliver_sample (ahc, sample);
+
+    g_mutex_lock (&tap->lock);
+  }
+  g_mutex_unlock (&tap->lock);
+
+  return NULL;
+}
+
+static gboolean
+uses_mailbox (GstAhcFramePolicy policy)
+{
+  return policy == GST_AHC_FRAME_LATEST ||
+      policy == GST_AHC_FRAME_LATEST_DECIMATED;
+}
+
+/* Called with the lock */
+static void
+post_to_mailbox (GstAhcFrameTap * tap, GstSample * sample)
+{
+  GstBuffer *buffer = gst_sample_get_buffer (sample);
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  GstSample *old;
+
+  if (GST_CLOCK_TIME_IS_VALID (pts) && GST_CLOCK_TIME_IS_VALID (tap->last_pts)
+      && pts > tap->last_pts) {
+    GstClockTime interval = pts - tap->last_pts;
+
+    tap->frame_interval = tap->frame_interval ?
+        (tap->frame_interval * 7 + interval) / 8 : interval;
+  }
+  tap->last_pts = pts;
+
+  if (tap->policy == GST_AHC_FRAME_LATEST_DECIMATED) {
+    if (tap->skip > 0) {
+      tap->skip--;
+      tap->counters.decimated++;
+      gst_sample_unref (sample);
+      return;
+    }
+    tap->skip = tap->decimation - 1;
+  }
+
+  old = tap->mailbox;
+  tap->mailbox = sample;
+  if (old) {
+    tap->counters.superseded++;
+    gst_sample_unref (old);
+  }
+  g_cond_broadcast (&tap->cond);
+}
+
+static GstFlowReturn
+new_sample (GstAppSink * appsink, gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+  GstAhcFrameTap *tap = ahc->frames;
+  GstSample *sample;
+
+  sample = gst_app_sink_pull_sample (appsink);
+  if (!sample)
+    return GST_FLOW_FLUSHING;
+
+  g_mutex_lock (&tap->lock);
+  if (tap->flushing || !ahc->callbacks.frame) {
+    tap->counters.dropped++;
+    g_mutex_unlock (&tap->lock);
+    gst_sample_unref (sample);
+    return GST_FLOW_OK;
+  }
+
+  if (uses_mailbox (tap->policy)) {
+    post_to_mailbox (tap, sample);
+    g_mutex_unlock (&tap->lock);
+    return GST_FLOW_OK;
+  }
+
+  while (g_hash_table_size (tap->held) >= tap->max_held && !tap->flushing &&
+      tap->policy == GST_AHC_FRAME_BLOCK)
+    g_cond_wait (&tap->cond, &tap->lock);
+
+  if (tap->flushing || g_hash_table_size (tap->held) >= tap->max_held) {
+    tap->counters.dropped++;
+    g_mutex_unlock (&tap->lock);
+    gst_sample_unref (sample);
+    return GST_FLOW_OK;
+  }
+  g_mutex_unlock (&tap->lock);
+
+  deliver_sample (ahc, sample);
+
+  return GST_FLOW_OK;
+}
+
+/* Adds a frame branch and makes it the one delivering frames, unless
+ * delivery was turned off or another branch took over meanwhile */
+static gboolean
+add_frame_branch (GstAhc * ahc)
+{
+  GstAhcFrameTap *tap = ahc->frames;
+  GstAppSinkCallbacks callbacks = { NULL, };
+  GstElement *appsink;
+  gboolean installed = FALSE;
+  gint branch;
+
+  branch = gst_ahc_add_branch (ahc, GST_AHC_BRANCH_ANALYSIS,
+      FRAME_BRANCH_DESCRIPTION);
+  if (branch < 0)
+    return FALSE;
+
+  /* An old frame branch may still be draining in the pipeline, so look
+   * the appsink up in the new branch only */
+  appsink = gst_ahc_branch_get_element (ahc, branch, FRAME_SINK_NAME);
+  if (!appsink) {
+    gst_ahc_remove_branch (ahc, branch);
+    return FALSE;
+  }
+  callbacks.new_sample = new_sample;
+  gst_app_sink_set_callbacks (GST_APP_SINK (appsink), &callbacks, ahc, NULL);
+  gst_object_unref (appsink);
+
+  g_mutex_lock (&tap->lock);
+  if (tap->enabled && tap->branch < 0) {
+    tap->branch = branch;
+    tap->flushing = FALSE;
+    installed = TRUE;
+  }
+  g_mutex_unlock (&tap->lock);
+
+  if (!installed)
+    gst_ahc_remove_branch (ahc, branch);
+
+  return TRUE;
+}
+
+/* Starts or stops delivering frames to the frame callback. Delivery stays
+ * enabled over gst_ahc_stop() and gst_ahc_start(), and when the pipeline
+ * does not exist yet it starts with it. */
+gboolean
+gst_ahc_set_frame_delivery (GstAhc * ahc, gboolean enabled)
+{
+  GstAhcFrameTap *tap = ahc->frames;
+  gint branch;
+
+  g_mutex_lock (&tap->lock);
+  tap->enabled = enabled;
+  branch = tap->branch;
+  tap->branch = -1;
+  tap->flushing = TRUE;
+  g_cond_broadcast (&tap->cond);
+  g_mutex_unlock (&tap->lock);
+
+  if (branch >= 0)
+    gst_ahc_remove_branch (ahc, branch);
+
+  if (!enabled)
+    return TRUE;
+
+  return add_frame_branch (ahc);
+}
+
+/* Adds the frame branch back to a new pipeline. Called on the main
+ * context once it is attached. */
+void
+gst_ahc_frames_attach (GstAhc * ahc)
+{
+  GstAhcFrameTap *tap = ahc->frames;
+  gboolean wanted;
+
+  g_mutex_lock (&tap->lock);
+  wanted = tap->enabled && tap->branch < 0;
+  g_mutex_unlock (&tap->lock);
+
+  if (wanted && !add_frame_branch (ahc))
+    GST_WARNING ("Can not add the frame branch back");
+}
+
+/* Limits how many frames the application may hold and chooses what
+ * happens to new frames while it holds that many */
+void
+gst_ahc_set_max_held_frames (GstAhc * ahc, guint max_held,
+    GstAhcFramePolicy policy)
+{
+  GstAhcFrameTap *tap = ahc->frames;
+
+  if (!uses_mailbox (policy))
+    stop_mailbox (tap);
+
+  g_mutex_lock (&tap->lock);
+  tap->max_held = MAX (max_held, 1);
+  tap->policy = policy;
+  tap->skip = 0;
+  if (uses_mailbox (policy) && !tap->thread) {
+    tap->running = TRUE;
+    tap->decimation = 1;
+    tap->thread = g_thread_new ("frame-mailbox", mailbox_thread, ahc);
+  }
+  g_cond_broadcast (&tap->cond);
+  g_mutex_unlock (&tap->lock);
+}
+
+/* Unmaps a frame handed to the frame callback and returns its buffer to
+ * the pool */
+void
+gst_ahc_release_frame (GstAhc * ahc, gint id)
+{
+  GstAhcFrameTap *tap = ahc->frames;
+  FrameRecord *record;
+  GstClockTime held_for;
+
+  g_mutex_lock (&tap->lock);
+  record = g_hash_table_lookup (tap->held, GINT_TO_POINTER (id));
+  if (!record) {
+    GST_WARNING ("Frame %d is not held", id);
+    g_mutex_unlock (&tap->lock);
+    return;
+  }
+
+  /* Decimate so that the consumer gets a frame about when it is done with
+   * the previous one */
+  held_for = gst_util_get_timestamp () - record->delivered_at;
+  tap->consumer_time = tap->consumer_time ?
+      (tap->consumer_time * 7 + held_for) / 8 : held_for;
+  if (tap->frame_interval)
+    tap->decimation = MAX (1, tap->consumer_time / tap->frame_interval);
+
+  g_hash_table_remove (tap->held, GINT_TO_POINTER (id));
+  g_cond_broadcast (&tap->cond);
+  g_mutex_unlock (&tap->lock);
+}
+
+void
+gst_ahc_get_frame_counters (GstAhc * ahc, GstAhcFrameCounters * counters)
+{
+  GstAhcFrameTap *tap = ahc->frames;
+
+  g_mutex_lock (&tap->lock);
+  *counters = tap->counters;
+  g_mutex_unlock (&tap->lock);
+}
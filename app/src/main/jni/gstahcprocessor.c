@@ -0,0 +1,520 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Registry of native frame processors and the "ahcprocess" element running
+ * them. See gstahcprocessor.h.
+ */
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "gstahcprocessor.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+typedef struct
+{
+  gint ref_count;
+  gint id;
+  gchar *name;
+  GstAhcProcessFunc func;
+  gpointer user_data;
+  GDestroyNotify notify;
+  /* Serializes calls from different ahcprocess elements */
+  GMutex lock;
+} Processor;
+
+static GMutex registry_lock;
+static GPtrArray *registry;
+static gint next_processor_id = 1;
+
+static Processor *
+processor_ref (Processor * processor)
+{
+  g_atomic_int_inc (&processor->ref_count);
+  return processor;
+}
+
+static void
+processor_unref (Processor * processor)
+{
+  if (!g_atomic_int_dec_and_test (&processor->ref_count))
+    return;
+
+  if (processor->notify)
+    processor->notify (processor->user_data);
+  g_mutex_clear (&processor->lock);
+  g_free (processor->name);
+  g_free (processor);
+}
+
+/* Makes func run on every frame passing an ahcprocess element, including
+ * elements which already exist. Returns an id for
+ * gst_ahc_processor_unregister(). */
+gint
+gst_ahc_processor_register (const gchar * name, GstAhcProcessFunc func,
+    gpointer user_data, GDestroyNotify notify)
+{
+  Processor *processor;
+
+  g_return_val_if_fail (name != NULL, -1);
+  g_return_val_if_fail (func != NULL, -1);
+
+  processor = g_new0 (Processor, 1);
+  processor->ref_count = 1;
+  processor->name = g_strdup (name);
+  processor->func = func;
+  processor->user_data = user_data;
+  processor->notify = notify;
+  g_mutex_init (&processor->lock);
+
+  g_mutex_lock (&registry_lock);
+  if (!registry)
+    registry = g_ptr_array_new_with_free_func ((GDestroyNotify)
+        processor_unref);
+  processor->id = next_processor_id++;
+  g_ptr_array_add (registry, processor);
+  g_mutex_unlock (&registry_lock);
+
+  GST_DEBUG ("Registered frame processor %d '%s'", processor->id, name);
+
+  return processor->id;
+}
+
+/* Frames already being processed still finish, notify is called once the
+ * processor is not running anymore */
+void
+gst_ahc_processor_unregister (gint id)
+{
+  guint i;
+
+  g_mutex_lock (&registry_lock);
+  for (i = 0; registry && i < registry->len; i++) {
+    Processor *processor = g_ptr_array_index (registry, i);
+
+    if (processor->id == id) {
+      GST_DEBUG ("Unregistering frame processor %d '%s'", id,
+          processor->name);
+      g_ptr_array_remove_index (registry, i);
+      break;
+    }
+  }
+  g_mutex_unlock (&registry_lock);
+}
+
+static GPtrArray *
+registry_snapshot (void)
+{
+  GPtrArray *processors;
+  guint i;
+
+  processors = g_ptr_array_new_with_free_func ((GDestroyNotify)
+      processor_unref);
+
+  g_mutex_lock (&registry_lock);
+  for (i = 0; registry && i < registry->len; i++)
+    g_ptr_array_add (processors,
+        processor_ref (g_ptr_array_index (registry, i)));
+  g_mutex_unlock (&registry_lock);
+
+  return processors;
+}
+
+/* GstAhcResultMeta */
+
+static gboolean
+result_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  GstAhcResultMeta *rmeta = (GstAhcResultMeta *) meta;
+
+  rmeta->processor = NULL;
+  rmeta->result = NULL;
+
+  return TRUE;
+}
+
+static void
+result_meta_free (GstMeta * meta, GstBuffer * buffer)
+{
+  GstAhcResultMeta *rmeta = (GstAhcResultMeta *) meta;
+
+  g_free (rmeta->processor);
+  if (rmeta->result)
+    gst_structure_free (rmeta->result);
+}
+
+static const GstMetaInfo *result_meta_get_info (void);
+
+static GstAhcResultMeta *
+result_meta_add (GstBuffer * buffer, const gchar * processor,
+    GstStructure * result)
+{
+  GstAhcResultMeta *rmeta;
+
+  rmeta = (GstAhcResultMeta *) gst_buffer_add_meta (buffer,
+      result_meta_get_info (), NULL);
+  rmeta->processor = g_strdup (processor);
+  rmeta->result = result;
+
+  return rmeta;
+}
+
+static gboolean
+result_meta_transform (GstBuffer * dest, GstMeta * meta, GstBuffer * buffer,
+    GQuark type, gpointer data)
+{
+  GstAhcResultMeta *rmeta = (GstAhcResultMeta *) meta;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type))
+    return FALSE;
+
+  result_meta_add (dest, rmeta->processor, gst_structure_copy (rmeta->result));
+
+  return TRUE;
+}
+
+GType
+gst_ahc_result_meta_api_get_type (void)
+{
+  static volatile gsize type = 0;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("GstAhcResultMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+static const GstMetaInfo *
+result_meta_get_info (void)
+{
+  static const GstMetaInfo *info = NULL;
+
+  if (g_once_init_enter (&info)) {
+    const GstMetaInfo *meta = gst_meta_register (GST_AHC_RESULT_META_API_TYPE,
+        "GstAhcResultMeta", sizeof (GstAhcResultMeta), result_meta_init,
+        result_meta_free, result_meta_transform);
+    g_once_init_leave (&info, meta);
+  }
+
+  return info;
+}
+
+/* ahcprocess element */
+
+#define GST_TYPE_AHC_PROCESS (gst_ahc_process_get_type ())
+#define GST_AHC_PROCESS(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_AHC_PROCESS, GstAhcProcess))
+
+/* One worker thread per core */
+#define DEFAULT_N_THREADS 0
+
+typedef struct _GstAhcProcess
+{
+  GstElement element;
+
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  GstVideoInfo info;
+  gboolean have_info;
+
+  guint n_threads;
+  GThreadPool *pool;
+
+  /* Processors of the current frame still running */
+  GMutex lock;
+  GCond cond;
+  guint pending;
+} GstAhcProcess;
+
+typedef struct _GstAhcProcessClass
+{
+  GstElementClass parent_class;
+} GstAhcProcessClass;
+
+struct _GstAhcProcessorContext
+{
+  GstAhcProcess *self;
+  Processor *processor;
+  GstVideoFrame *frame;
+  GSList *metas;
+};
+
+enum
+{
+  PROP_0,
+  PROP_N_THREADS,
+};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS ("video/x-raw"));
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS ("video/x-raw"));
+
+GType gst_ahc_process_get_type (void);
+G_DEFINE_TYPE (GstAhcProcess, gst_ahc_process, GST_TYPE_ELEMENT);
+
+const gchar *
+gst_ahc_processor_get_name (GstAhcProcessorContext * ctx)
+{
+  return ctx->processor->name;
+}
+
+/* Takes ownership of result */
+void
+gst_ahc_processor_add_meta (GstAhcProcessorContext * ctx,
+    GstStructure * result)
+{
+  ctx->metas = g_slist_append (ctx->metas, result);
+}
+
+/* Takes ownership of result. "processor" and "timestamp" fields are added
+ * to identify the processor and the frame. */
+void
+gst_ahc_processor_post_message (GstAhcProcessorContext * ctx,
+    GstStructure * result)
+{
+  GstElement *element = GST_ELEMENT (ctx->self);
+
+  gst_structure_set (result, "processor", G_TYPE_STRING, ctx->processor->name,
+      "timestamp", G_TYPE_UINT64, GST_BUFFER_PTS (ctx->frame->buffer), NULL);
+  gst_element_post_message (element,
+      gst_message_new_element (GST_OBJECT (element), result));
+}
+
+static void
+run_processor (gpointer data, gpointer user_data)
+{
+  GstAhcProcessorContext *ctx = data;
+  GstAhcProcess *self = user_data;
+  Processor *processor = ctx->processor;
+
+  g_mutex_lock (&processor->lock);
+  processor->func (ctx, ctx->frame, processor->user_data);
+  g_mutex_unlock (&processor->lock);
+
+  g_mutex_lock (&self->lock);
+  if (--self->pending == 0)
+    g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+}
+
+static GstFlowReturn
+gst_ahc_process_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  GstAhcProcess *self = GST_AHC_PROCESS (parent);
+  GstAhcProcessorContext *contexts;
+  GPtrArray *processors;
+  GstVideoFrame frame;
+  guint i;
+
+  processors = registry_snapshot ();
+  if (processors->len == 0 || !self->have_info)
+    goto push;
+
+  if (!gst_video_frame_map (&frame, &self->info, buffer, GST_MAP_READ)) {
+    GST_WARNING_OBJECT (self, "Can not map frame");
+    goto push;
+  }
+
+  contexts = g_new0 (GstAhcProcessorContext, processors->len);
+  self->pending = processors->len;
+  for (i = 0; i < processors->len; i++) {
+    contexts[i].self = self;
+    contexts[i].processor = g_ptr_array_index (processors, i);
+    contexts[i].frame = &frame;
+    g_thread_pool_push (self->pool, &contexts[i], NULL);
+  }
+
+  g_mutex_lock (&self->lock);
+  while (self->pending > 0)
+    g_cond_wait (&self->cond, &self->lock);
+  g_mutex_unlock (&self->lock);
+
+  gst_video_frame_unmap (&frame);
+
+  for (i = 0; i < processors->len; i++) {
+    GSList *l;
+
+    for (l = contexts[i].metas; l; l = l->next) {
+      /* Shares the memory of the tee'd buffer, only the metadata is copied */
+      buffer = gst_buffer_make_writable (buffer);
+      result_meta_add (buffer, contexts[i].processor->name, l->data);
+    }
+    g_slist_free (contexts[i].metas);
+  }
+  g_free (contexts);
+
+push:
+  g_ptr_array_unref (processors);
+
+  return gst_pad_push (self->srcpad, buffer);
+}
+
+static gboolean
+gst_ahc_process_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstAhcProcess *self = GST_AHC_PROCESS (parent);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+    GstCaps *caps;
+
+    gst_event_parse_caps (event, &caps);
+    self->have_info = gst_video_info_from_caps (&self->info, caps);
+    if (!self->have_info)
+      GST_WARNING_OBJECT (self, "Can not process %" GST_PTR_FORMAT, caps);
+  }
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
+static GstStateChangeReturn
+gst_ahc_process_change_state (GstElement * element, GstStateChange transition)
+{
+  GstAhcProcess *self = GST_AHC_PROCESS (element);
+  GstStateChangeReturn ret;
+  GError *err = NULL;
+
+  if (transition == GST_STATE_CHANGE_NULL_TO_READY) {
+    guint n_threads = self->n_threads ? self->n_threads :
+        MAX (g_get_num_processors (), 1);
+
+    self->pool = g_thread_pool_new (run_processor, self, n_threads, TRUE,
+        &err);
+    if (!self->pool) {
+      GST_ERROR_OBJECT (self, "Can not start worker threads: %s",
+          err->message);
+      g_clear_error (&err);
+      return GST_STATE_CHANGE_FAILURE;
+    }
+  }
+
+  ret = GST_ELEMENT_CLASS (gst_ahc_process_parent_class)->change_state
+      (element, transition);
+
+  if (transition == GST_STATE_CHANGE_READY_TO_NULL) {
+    g_thread_pool_free (self->pool, FALSE, TRUE);
+    self->pool = NULL;
+    self->have_info = FALSE;
+  }
+
+  return ret;
+}
+
+static void
+gst_ahc_process_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAhcProcess *self = GST_AHC_PROCESS (object);
+
+  switch (prop_id) {
+    case PROP_N_THREADS:
+      self->n_threads = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ahc_process_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstAhcProcess *self = GST_AHC_PROCESS (object);
+
+  switch (prop_id) {
+    case PROP_N_THREADS:
+      g_value_set_uint (value, self->n_threads);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ahc_process_finalize (GObject * object)
+{
+  GstAhcProcess *self = GST_AHC_PROCESS (object);
+
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (gst_ahc_process_parent_class)->finalize (object);
+}
+
+static void
+gst_ahc_process_class_init (GstAhcProcessClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gobject_class->set_property = gst_ahc_process_set_property;
+  gobject_class->get_property = gst_ahc_process_get_property;
+  gobject_class->finalize = gst_ahc_process_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Threads",
+          "Worker threads running the processors, 0 for one per core "
+          "(set before READY)", 0, G_MAXUINT, DEFAULT_N_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  element_class->change_state = gst_ahc_process_change_state;
+
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class,
+      "Frame processors", "Filter/Analyzer/Video",
+      "Runs the registered native frame processors on every frame",
+      "Justin Kim <justin.kim@collabora.com>");
+}
+
+static void
+gst_ahc_process_init (GstAhcProcess * self)
+{
+  self->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (self->sinkpad, gst_ahc_process_chain);
+  gst_pad_set_event_function (self->sinkpad, gst_ahc_process_sink_event);
+  GST_PAD_SET_PROXY_CAPS (self->sinkpad);
+  GST_PAD_SET_PROXY_ALLOCATION (self->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
+
+  self->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  GST_PAD_SET_PROXY_CAPS (self->srcpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+
+  self->n_threads = DEFAULT_N_THREADS;
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+}
+
+void
+gst_ahc_processor_element_register (void)
+{
+  gst_element_register (NULL, GST_AHC_PROCESSOR_ELEMENT, GST_RANK_NONE,
+      GST_TYPE_AHC_PROCESS);
+}
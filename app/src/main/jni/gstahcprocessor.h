@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_AHC_PROCESSOR_H__
+#define __GST_AHC_PROCESSOR_H__
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Native frame processors.
+ *
+ * Another shared library linked against libandroid_camera.so registers
+ * processors with gst_ahc_processor_register(). Every "ahcprocess" element
+ * in a pipeline then runs all registered processors on each frame, in
+ * parallel on its own fixed pool of worker threads, and only pushes the
+ * frame on once all of them returned. An ANALYSIS branch added without a
+ * description contains one.
+ *
+ * The frame is mapped read-only without copying. It must not be written to
+ * or kept after the process function returns. Processors that need more
+ * than one core for a frame can split it with gst_ahc_scheduler_run_rows()
+ * on the default scheduler.
+ *
+ * Results are published with gst_ahc_processor_add_meta(), which attaches
+ * a GstAhcResultMeta to the frame for elements further down the branch,
+ * and with gst_ahc_processor_post_message(), which posts an element message
+ * on the pipeline bus.
+ *
+ * An ANALYSIS branch added without a description also has an "ahcpyramid"
+ * element in front of ahcprocess. It computes the frame at 1/2, 1/4 and
+ * 1/8 of its size once and attaches the levels as a GstAhcPyramidMeta, so
+ * processors working at a lower resolution do not each scale the frame:
+ *
+ *   GstAhcPyramidMeta *pyramid = gst_buffer_get_ahc_pyramid_meta
+ *       (frame->buffer);
+ */
+
+#define GST_AHC_PROCESSOR_ELEMENT "ahcprocess"
+
+typedef struct _GstAhcProcessorContext GstAhcProcessorContext;
+
+/* Called from a worker thread, concurrently for different processors but
+ * never concurrently for the same one */
+typedef void (*GstAhcProcessFunc) (GstAhcProcessorContext * ctx,
+    const GstVideoFrame * frame, gpointer user_data);
+
+gint gst_ahc_processor_register (const gchar * name, GstAhcProcessFunc func,
+    gpointer user_data, GDestroyNotify notify);
+void gst_ahc_processor_unregister (gint id);
+
+const gchar *gst_ahc_processor_get_name (GstAhcProcessorContext * ctx);
+void gst_ahc_processor_add_meta (GstAhcProcessorContext * ctx,
+    GstStructure * result);
+void gst_ahc_processor_post_message (GstAhcProcessorContext * ctx,
+    GstStructure * result);
+
+/* Result of a processor attached to the frame it was computed from */
+typedef struct _GstAhcResultMeta
+{
+  GstMeta meta;
+  gchar *processor;
+  GstStructure *result;
+} GstAhcResultMeta;
+
+GType gst_ahc_result_meta_api_get_type (void);
+#define GST_AHC_RESULT_META_API_TYPE (gst_ahc_result_meta_api_get_type ())
+
+#define GST_AHC_PYRAMID_ELEMENT "ahcpyramid"
+#define GST_AHC_PYRAMID_MAX_LEVELS 3
+
+/* The frame at 1/scale of its size. info is GRAY8, or the format of the
+ * frame when ahcpyramid has chroma=true, and gives the plane offsets from
+ * data and the strides. */
+typedef struct _GstAhcPyramidLevel
+{
+  guint scale;
+  GstVideoInfo info;
+  const guint8 *data;
+} GstAhcPyramidLevel;
+
+/* Levels of a frame, from the largest. n_levels is lower than asked when
+ * the frame is too small. The levels stay mapped as long as the meta. */
+typedef struct _GstAhcPyramidMeta
+{
+  GstMeta meta;
+  guint n_levels;
+  GstAhcPyramidLevel levels[GST_AHC_PYRAMID_MAX_LEVELS];
+
+  /* private */
+  GstBuffer *storage;
+  GstMapInfo map;
+} GstAhcPyramidMeta;
+
+GType gst_ahc_pyramid_meta_api_get_type (void);
+#define GST_AHC_PYRAMID_META_API_TYPE (gst_ahc_pyramid_meta_api_get_type ())
+#define gst_buffer_get_ahc_pyramid_meta(b) \
+    ((GstAhcPyramidMeta *) gst_buffer_get_meta ((b), \
+        GST_AHC_PYRAMID_META_API_TYPE))
+
+/* Internal to the core */
+G_GNUC_INTERNAL void gst_ahc_processor_element_register (void);
+
+G_END_DECLS
+
+#endif /* __GST_AHC_PROCESSOR_H__ */
@@ -0,0 +1,652 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * "ahcpyramid", computes the frame at 1/2, 1/4 and 1/8 of its size once for
+ * all processors of an analysis branch and attaches the levels to it as a
+ * GstAhcPyramidMeta, see gstahcprocessor.h.
+ *
+ * Each level averages 2x2 blocks of the one before, the first one of the
+ * frame, with the halving kernels of gstahcconvert.h. Level sizes are
+ * rounded down to even so every level can carry 4:2:0 chroma. Only luma
+ * is halved unless "chroma" is set.
+ *
+ * A level needs the whole one before it, so the levels are computed one
+ * after the other, but the rows of each are split into tiles over the
+ * default scheduler, see gstahcscheduler.h. Levels with few rows are
+ * halved on the streaming thread, waking the workers would cost more than
+ * they save. "parallel" turns the splitting off.
+ *
+ * The levels of a frame share one buffer from a pool, which stays mapped
+ * until the meta is freed and then goes back to the pool. The frame itself
+ * is not touched: on a tee'd buffer only the metadata is copied. Formats
+ * without an 8 bit luma plane pass through without a meta.
+ */
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "gstahc.h"
+#include "gstahcconvert.h"
+#include "gstahcprocessor.h"
+#include "gstahcscheduler.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define GST_TYPE_AHC_PYRAMID (gst_ahc_pyramid_get_type ())
+#define GST_AHC_PYRAMID(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_AHC_PYRAMID, GstAhcPyramid))
+
+#define DEFAULT_LEVELS GST_AHC_PYRAMID_MAX_LEVELS
+#define DEFAULT_CHROMA FALSE
+#define DEFAULT_KERNEL "auto"
+#define DEFAULT_PARALLEL TRUE
+
+/* Luma rows per tile, even so the chroma rows split at the same places */
+#define TILE_ROWS 16
+/* Levels with fewer luma rows are not split */
+#define MIN_PARALLEL_ROWS (4 * TILE_ROWS)
+
+/* Alignment of each level in the storage buffer */
+#define LEVEL_ALIGN 64
+
+typedef struct _GstAhcPyramid
+{
+  GstElement element;
+
+  GstPad *sinkpad;
+  GstPad *srcpad;
+
+  guint n_levels;
+  gboolean chroma;
+  const GstAhcConvertKernels *kernels;
+  gboolean parallel;
+
+  /* Set up from the caps, have_levels is 0 when frames pass through */
+  GstVideoInfo info;
+  guint have_levels;
+  GstAhcPyramidLevel levels[GST_AHC_PYRAMID_MAX_LEVELS];
+  gsize offsets[GST_AHC_PYRAMID_MAX_LEVELS];
+  GstBufferPool *pool;
+} GstAhcPyramid;
+
+typedef struct _GstAhcPyramidClass
+{
+  GstElementClass parent_class;
+} GstAhcPyramidClass;
+
+enum
+{
+  PROP_0,
+  PROP_LEVELS,
+  PROP_CHROMA,
+  PROP_KERNEL,
+  PROP_PARALLEL,
+};
+
+/* Planes of a frame or of a level */
+typedef struct
+{
+  const GstVideoInfo *info;
+  guint8 *data[GST_VIDEO_MAX_PLANES];
+  gint stride[GST_VIDEO_MAX_PLANES];
+} Image;
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS ("video/x-raw"));
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS ("video/x-raw"));
+
+GType gst_ahc_pyramid_get_type (void);
+G_DEFINE_TYPE (GstAhcPyramid, gst_ahc_pyramid, GST_TYPE_ELEMENT);
+
+/* GstAhcPyramidMeta */
+
+static gboolean
+pyramid_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  GstAhcPyramidMeta *pmeta = (GstAhcPyramidMeta *) meta;
+
+  pmeta->n_levels = 0;
+  pmeta->storage = NULL;
+
+  return TRUE;
+}
+
+static void
+pyramid_meta_free (GstMeta * meta, GstBuffer * buffer)
+{
+  GstAhcPyramidMeta *pmeta = (GstAhcPyramidMeta *) meta;
+
+  if (pmeta->storage) {
+    gst_buffer_unmap (pmeta->storage, &pmeta->map);
+    gst_buffer_unref (pmeta->storage);
+  }
+}
+
+static const GstMetaInfo *pyramid_meta_get_info (void);
+
+/* Takes ownership of storage. Level data is given as offsets into it. */
+static GstAhcPyramidMeta *
+pyramid_meta_add (GstBuffer * buffer, GstBuffer * storage,
+    const GstAhcPyramidLevel * levels, const gsize * offsets, guint n_levels)
+{
+  GstAhcPyramidMeta *pmeta;
+  GstMapInfo map;
+  guint i;
+
+  if (!gst_buffer_map (storage, &map, GST_MAP_READ)) {
+    gst_buffer_unref (storage);
+    return NULL;
+  }
+
+  pmeta = (GstAhcPyramidMeta *) gst_buffer_add_meta (buffer,
+      pyramid_meta_get_info (), NULL);
+  pmeta->storage = storage;
+  pmeta->map = map;
+  pmeta->n_levels = n_levels;
+  for (i = 0; i < n_levels; i++) {
+    pmeta->levels[i] = levels[i];
+    pmeta->levels[i].data = map.data + offsets[i];
+  }
+
+  return pmeta;
+}
+
+static gboolean
+pyramid_meta_transform (GstBuffer * dest, GstMeta * meta, GstBuffer * buffer,
+    GQuark type, gpointer data)
+{
+  GstAhcPyramidMeta *pmeta = (GstAhcPyramidMeta *) meta;
+  gsize offsets[GST_AHC_PYRAMID_MAX_LEVELS];
+  guint i;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type))
+    return FALSE;
+
+  /* The levels are never written once attached, copies share them */
+  for (i = 0; i < pmeta->n_levels; i++)
+    offsets[i] = pmeta->levels[i].data - pmeta->map.data;
+
+  return pyramid_meta_add (dest, gst_buffer_ref (pmeta->storage),
+      pmeta->levels, offsets, pmeta->n_levels) != NULL;
+}
+
+GType
+gst_ahc_pyramid_meta_api_get_type (void)
+{
+  static volatile gsize type = 0;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("GstAhcPyramidMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+static const GstMetaInfo *
+pyramid_meta_get_info (void)
+{
+  static const GstMetaInfo *info = NULL;
+
+  if (g_once_init_enter (&info)) {
+    const GstMetaInfo *meta =
+        gst_meta_register (GST_AHC_PYRAMID_META_API_TYPE,
+        "GstAhcPyramidMeta", sizeof (GstAhcPyramidMeta), pyramid_meta_init,
+        pyramid_meta_free, pyramid_meta_transform);
+    g_once_init_leave (&info, meta);
+  }
+
+  return info;
+}
+
+/* ahcpyramid element */
+
+static gboolean
+has_luma_plane (GstVideoFormat format)
+{
+  switch (format) {
+    case GST_VIDEO_FORMAT_NV21:
+    case GST_VIDEO_FORMAT_NV12:
+    case GST_VIDEO_FORMAT_I420:
+    case GST_VIDEO_FORMAT_YV12:
+    case GST_VIDEO_FORMAT_GRAY8:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+static void
+clear_pool (GstAhcPyramid * self)
+{
+  if (self->pool) {
+    gst_buffer_pool_set_active (self->pool, FALSE);
+    gst_object_unref (self->pool);
+    self->pool = NULL;
+  }
+}
+
+/* Sizes the levels for the negotiated frame and makes a pool holding all
+ * levels of one frame */
+static void
+setup_levels (GstAhcPyramid * self)
+{
+  GstVideoFormat format = GST_VIDEO_INFO_FORMAT (&self->info);
+  gint width = GST_VIDEO_INFO_WIDTH (&self->info);
+  gint height = GST_VIDEO_INFO_HEIGHT (&self->info);
+  GstStructure *config;
+  gsize size = 0;
+  guint n_levels;
+  gboolean chroma;
+  guint i;
+
+  clear_pool (self);
+  self->have_levels = 0;
+
+  if (!has_luma_plane (format)) {
+    GST_WARNING_OBJECT (self, "Passing %s frames through without a pyramid",
+        GST_VIDEO_INFO_NAME (&self->info));
+    return;
+  }
+
+  GST_OBJECT_LOCK (self);
+  n_levels = self->n_levels;
+  chroma = self->chroma;
+  GST_OBJECT_UNLOCK (self);
+
+  for (i = 0; i < n_levels; i++) {
+    GstAhcPyramidLevel *level = &self->levels[i];
+
+    width = (width / 2) & ~1;
+    height = (height / 2) & ~1;
+    if (width == 0 || height == 0)
+      break;
+
+    level->scale = 2 << i;
+    gst_video_info_set_format (&level->info,
+        chroma ? format : GST_VIDEO_FORMAT_GRAY8, width, height);
+    self->offsets[i] = size;
+    size += GST_ROUND_UP_N (GST_VIDEO_INFO_SIZE (&level->info), LEVEL_ALIGN);
+  }
+
+  if (i == 0) {
+    GST_WARNING_OBJECT (self, "%dx%d is too small for a pyramid",
+        GST_VIDEO_INFO_WIDTH (&self->info),
+        GST_VIDEO_INFO_HEIGHT (&self->info));
+    return;
+  }
+
+  self->pool = gst_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (self->pool);
+  gst_buffer_pool_config_set_params (config, NULL, size, 2, 0);
+  if (!gst_buffer_pool_set_config (self->pool, config) ||
+      !gst_buffer_pool_set_active (self->pool, TRUE)) {
+    GST_WARNING_OBJECT (self, "Can not allocate the pyramid levels");
+    clear_pool (self);
+    return;
+  }
+
+  self->have_levels = i;
+  GST_DEBUG_OBJECT (self, "%u levels down to %dx%d in %" G_GSIZE_FORMAT
+      " bytes", i, GST_VIDEO_INFO_WIDTH (&self->levels[i - 1].info),
+      GST_VIDEO_INFO_HEIGHT (&self->levels[i - 1].info), size);
+}
+
+static void
+halve_plane (const GstAhcConvertKernels * kernels, gboolean pairs,
+    const guint8 * s, gint s_stride, guint8 * d, gint d_stride, gint width,
+    gint height)
+{
+  const GstAhcConvertKernels *c = gst_ahc_convert_get_kernels ("c");
+  gint row, n;
+
+  for (row = 0; row < height; row++) {
+    const guint8 *s0 = s + 2 * row * s_stride;
+    const guint8 *s1 = s0 + s_stride;
+    guint8 *d0 = d + row * d_stride;
+
+    if (pairs) {
+      n = kernels->halve_pairs (s0, s1, d0, width);
+      if (n < width)
+        c->halve_pairs (s0 + 4 * n, s1 + 4 * n, d0 + 2 * n, width - n);
+    } else {
+      n = kernels->halve (s0, s1, d0, width);
+      if (n < width)
+        c->halve (s0 + 2 * n, s1 + 2 * n, d0 + n, width - n);
+    }
+  }
+}
+
+/* One level, split over the scheduler by luma rows */
+typedef struct
+{
+  const GstAhcConvertKernels *kernels;
+  const Image *src;
+  const Image *dst;
+} HalveJob;
+
+/* Fills the luma rows [first_row, first_row + n_rows) of the level and the
+ * chroma rows they cover */
+static void
+halve_rows (guint first_row, guint n_rows, gpointer user_data)
+{
+  HalveJob *job = user_data;
+  const GstVideoInfo *info = job->dst->info;
+  guint n_planes = GST_VIDEO_INFO_N_PLANES (info);
+  guint height = GST_VIDEO_INFO_HEIGHT (info);
+  guint p, first, end;
+
+  for (p = 0; p < n_planes; p++) {
+    guint plane_height = GST_VIDEO_INFO_COMP_HEIGHT (info, p);
+
+    first = first_row * plane_height / height;
+    end = (first_row + n_rows) * plane_height / height;
+    halve_plane (job->kernels, p == 1 && n_planes == 2,
+        job->src->data[p] + 2 * first * job->src->stride[p],
+        job->src->stride[p], job->dst->data[p] + first * job->dst->stride[p],
+        job->dst->stride[p], GST_VIDEO_INFO_COMP_WIDTH (info, p),
+        end - first);
+  }
+}
+
+/* Fills dst, which is at most half the size of src and has the same format
+ * or GRAY8 */
+static void
+halve_image (const GstAhcConvertKernels * kernels, gboolean parallel,
+    const Image * src, const Image * dst)
+{
+  guint height = GST_VIDEO_INFO_HEIGHT (dst->info);
+  HalveJob job;
+
+  job.kernels = kernels;
+  job.src = src;
+  job.dst = dst;
+
+  if (parallel && height >= MIN_PARALLEL_ROWS)
+    gst_ahc_scheduler_run_rows (gst_ahc_scheduler_get_default (), height,
+        TILE_ROWS, halve_rows, &job);
+  else
+    halve_rows (0, height, &job);
+}
+
+static void
+level_image (const GstAhcPyramidLevel * level, guint8 * data, Image * image)
+{
+  guint p;
+
+  image->info = &level->info;
+  for (p = 0; p < GST_VIDEO_INFO_N_PLANES (&level->info); p++) {
+    image->data[p] = data + GST_VIDEO_INFO_PLANE_OFFSET (&level->info, p);
+    image->stride[p] = GST_VIDEO_INFO_PLANE_STRIDE (&level->info, p);
+  }
+}
+
+static GstFlowReturn
+gst_ahc_pyramid_chain (GstPad * pad, GstObject * parent, GstBuffer * buffer)
+{
+  GstAhcPyramid *self = GST_AHC_PYRAMID (parent);
+  const GstAhcConvertKernels *kernels;
+  GstBuffer *storage = NULL;
+  GstVideoFrame frame;
+  GstMapInfo map;
+  Image src, dst;
+  gboolean parallel;
+  guint i, p;
+
+  if (self->have_levels == 0)
+    goto push;
+
+  if (gst_buffer_pool_acquire_buffer (self->pool, &storage,
+          NULL) != GST_FLOW_OK) {
+    GST_WARNING_OBJECT (self, "Can not get a buffer for the levels");
+    goto push;
+  }
+
+  if (!gst_video_frame_map (&frame, &self->info, buffer, GST_MAP_READ)) {
+    GST_WARNING_OBJECT (self, "Can not map frame");
+    goto push;
+  }
+
+  if (!gst_buffer_map (storage, &map, GST_MAP_WRITE)) {
+    GST_WARNING_OBJECT (self, "Can not map the levels");
+    gst_video_frame_unmap (&frame);
+    goto push;
+  }
+
+  GST_OBJECT_LOCK (self);
+  kernels = self->kernels;
+  parallel = self->parallel;
+  GST_OBJECT_UNLOCK (self);
+
+  src.info = &self->info;
+  for (p = 0; p < GST_VIDEO_FRAME_N_PLANES (&frame); p++) {
+    src.data[p] = GST_VIDEO_FRAME_PLANE_DATA (&frame, p);
+    src.stride[p] = GST_VIDEO_FRAME_PLANE_STRIDE (&frame, p);
+  }
+
+  /* Each level from the one before */
+  for (i = 0; i < self->have_levels; i++) {
+    level_image (&self->levels[i], map.data + self->offsets[i], &dst);
+    halve_image (kernels, parallel, &src, &dst);
+    src = dst;
+  }
+
+  gst_buffer_unmap (storage, &map);
+  gst_video_frame_unmap (&frame);
+
+  /* Shares the memory of the tee'd buffer, only the metadata is copied */
+  buffer = gst_buffer_make_writable (buffer);
+  pyramid_meta_add (buffer, storage, self->levels, self->offsets,
+      self->have_levels);
+  storage = NULL;
+
+push:
+  if (storage)
+    gst_buffer_unref (storage);
+
+  return gst_pad_push (self->srcpad, buffer);
+}
+
+static gboolean
+gst_ahc_pyramid_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstAhcPyramid *self = GST_AHC_PYRAMID (parent);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_CAPS) {
+    GstCaps *caps;
+
+    gst_event_parse_caps (event, &caps);
+    if (gst_video_info_from_caps (&self->info, caps)) {
+      setup_levels (self);
+    } else {
+      GST_WARNING_OBJECT (self, "Can not process %" GST_PTR_FORMAT, caps);
+      clear_pool (self);
+      self->have_levels = 0;
+    }
+  }
+
+  return gst_pad_event_default (pad, parent, event);
+}
+
+static GstStateChangeReturn
+gst_ahc_pyramid_change_state (GstElement * element, GstStateChange transition)
+{
+  GstAhcPyramid *self = GST_AHC_PYRAMID (element);
+  GstStateChangeReturn ret;
+
+  ret = GST_ELEMENT_CLASS (gst_ahc_pyramid_parent_class)->change_state
+      (element, transition);
+
+  if (transition == GST_STATE_CHANGE_PAUSED_TO_READY) {
+    clear_pool (self);
+    self->have_levels = 0;
+  }
+
+  return ret;
+}
+
+static void
+gst_ahc_pyramid_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAhcPyramid *self = GST_AHC_PYRAMID (object);
+  const GstAhcConvertKernels *kernels;
+
+  switch (prop_id) {
+    case PROP_LEVELS:
+      GST_OBJECT_LOCK (self);
+      self->n_levels = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_CHROMA:
+      GST_OBJECT_LOCK (self);
+      self->chroma = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_KERNEL:
+      kernels = gst_ahc_convert_get_kernels (g_value_get_string (value));
+      if (!kernels) {
+        GST_WARNING_OBJECT (self, "Kernels '%s' not available here",
+            g_value_get_string (value));
+        kernels = gst_ahc_convert_get_kernels (NULL);
+      }
+      GST_OBJECT_LOCK (self);
+      self->kernels = kernels;
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_PARALLEL:
+      GST_OBJECT_LOCK (self);
+      self->parallel = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ahc_pyramid_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstAhcPyramid *self = GST_AHC_PYRAMID (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_LEVELS:
+      g_value_set_uint (value, self->n_levels);
+      break;
+    case PROP_CHROMA:
+      g_value_set_boolean (value, self->chroma);
+      break;
+    case PROP_KERNEL:
+      g_value_set_string (value, self->kernels->name);
+      break;
+    case PROP_PARALLEL:
+      g_value_set_boolean (value, self->parallel);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_ahc_pyramid_finalize (GObject * object)
+{
+  clear_pool (GST_AHC_PYRAMID (object));
+
+  G_OBJECT_CLASS (gst_ahc_pyramid_parent_class)->finalize (object);
+}
+
+static void
+gst_ahc_pyramid_class_init (GstAhcPyramidClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gobject_class->set_property = gst_ahc_pyramid_set_property;
+  gobject_class->get_property = gst_ahc_pyramid_get_property;
+  gobject_class->finalize = gst_ahc_pyramid_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_LEVELS,
+      g_param_spec_uint ("levels", "Levels",
+          "Levels to compute, from 1/2 down to 1/8 of the frame size "
+          "(applied with the next caps)", 1, GST_AHC_PYRAMID_MAX_LEVELS,
+          DEFAULT_LEVELS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_CHROMA,
+      g_param_spec_boolean ("chroma", "Chroma",
+          "Halve the chroma planes too instead of only luma "
+          "(applied with the next caps)", DEFAULT_CHROMA,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KERNEL,
+      g_param_spec_string ("kernel", "Kernel",
+          "Instruction set to halve with, \"auto\" for the best one the "
+          "CPU supports", DEFAULT_KERNEL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PARALLEL,
+      g_param_spec_boolean ("parallel", "Parallel",
+          "Split the rows of each level over the threads of the default "
+          "scheduler", DEFAULT_PARALLEL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  element_class->change_state = gst_ahc_pyramid_change_state;
+
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class,
+      "Image pyramid", "Filter/Analyzer/Video",
+      "Attaches the frame at 1/2, 1/4 and 1/8 of its size for analysis",
+      "Justin Kim <justin.kim@collabora.com>");
+}
+
+static void
+gst_ahc_pyramid_init (GstAhcPyramid * self)
+{
+  self->sinkpad = gst_pad_new_from_static_template (&sink_template, "sink");
+  gst_pad_set_chain_function (self->sinkpad, gst_ahc_pyramid_chain);
+  gst_pad_set_event_function (self->sinkpad, gst_ahc_pyramid_sink_event);
+  GST_PAD_SET_PROXY_CAPS (self->sinkpad);
+  GST_PAD_SET_PROXY_ALLOCATION (self->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
+
+  self->srcpad = gst_pad_new_from_static_template (&src_template, "src");
+  GST_PAD_SET_PROXY_CAPS (self->srcpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+
+  self->n_levels = DEFAULT_LEVELS;
+  self->chroma = DEFAULT_CHROMA;
+  self->kernels = gst_ahc_convert_get_kernels (NULL);
+  self->parallel = DEFAULT_PARALLEL;
+}
+
+void
+gst_ahc_pyramid_register (void)
+{
+  gst_element_register (NULL, GST_AHC_PYRAMID_ELEMENT, GST_RANK_NONE,
+      GST_TYPE_AHC_PYRAMID);
+}
@@ -0,0 +1,548 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * "ahcrawsink", records camera frames into a raw capture file for
+ * ahcreplaysrc, see GstAhcRawHeader.
+ *
+ * The file is sized for max-frames when the caps are known, with the
+ * blocks allocated up front, and mapped. Storage is not allocated while
+ * recording, and a capture that does not fit fails before the first
+ * frame, not in the middle.
+ *
+ * render() only queues a reference to the frame for a writer thread,
+ * which copies it into its slot and then publishes it in the header.
+ * Page faults and writeback of the mapping therefore stall the writer,
+ * never the branch. When the writer falls more than max-pending frames
+ * behind, new frames are dropped and counted. The camera buffers it holds
+ * are not available to the camera in the meantime, so max-pending stays
+ * small.
+ *
+ * The header is updated after every frame, so a capture cut short by a
+ * crash can still be replayed up to the last complete frame. On stop the
+ * writer drains and the file is truncated to the frames it holds.
+ *
+ * Frames after the file is full, or after a caps change, are skipped.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+#include <gst/video/video.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define GST_TYPE_AHC_RAW_SINK (gst_ahc_raw_sink_get_type ())
+#define GST_AHC_RAW_SINK(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_AHC_RAW_SINK, \
+        GstAhcRawSink))
+#define GST_IS_AHC_RAW_SINK(obj) \
+    (G_TYPE_CHECK_INSTANCE_TYPE ((obj), GST_TYPE_AHC_RAW_SINK))
+
+#define DEFAULT_MAX_FRAMES 300
+#define DEFAULT_MAX_PENDING 4
+
+/* Name of the sink in the branches made by gst_ahc_start_raw_capture() */
+#define RAW_SINK_NAME "rawsink"
+
+typedef struct _GstAhcRawSink
+{
+  GstBaseSink parent;
+
+  gchar *location;
+  guint max_frames;
+  guint max_pending;
+
+  /* Valid between start and stop */
+  gint fd;
+  GThread *writer;
+
+  /* Set up by the first caps */
+  GstVideoInfo info;
+  guint8 *data;
+  gsize size;
+  gsize slot_size;
+  GstAhcRawHeader *header;
+  GstAhcRawIndexEntry *index;
+
+  /* Protects everything below */
+  GMutex lock;
+  GCond cond;
+  GQueue pending;
+  gboolean stopping;
+  /* Caps differ from those the file was made for */
+  gboolean caps_changed;
+  /* Frames handed to the writer */
+  guint accepted;
+  guint64 written;
+  guint64 dropped;
+  guint64 skipped;
+} GstAhcRawSink;
+
+typedef struct _GstAhcRawSinkClass
+{
+  GstBaseSinkClass parent_class;
+} GstAhcRawSinkClass;
+
+enum
+{
+  PROP_0,
+  PROP_LOCATION,
+  PROP_MAX_FRAMES,
+  PROP_MAX_PENDING,
+};
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ NV21, NV12, I420 }")));
+
+GType gst_ahc_raw_sink_get_type (void);
+G_DEFINE_TYPE (GstAhcRawSink, gst_ahc_raw_sink, GST_TYPE_BASE_SINK);
+
+static void
+gst_ahc_raw_sink_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAhcRawSink *self = GST_AHC_RAW_SINK (object);
+
+  switch (prop_id) {
+    case PROP_LOCATION:
+      g_free (self->location);
+      self->location = g_value_dup_string (value);
+      break;
+    case PROP_MAX_FRAMES:
+      self->max_frames = g_value_get_uint (value);
+      break;
+    case PROP_MAX_PENDING:
+      self->max_pending = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ahc_raw_sink_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstAhcRawSink *self = GST_AHC_RAW_SINK (object);
+
+  switch (prop_id) {
+    case PROP_LOCATION:
+      g_value_set_string (value, self->location);
+      break;
+    case PROP_MAX_FRAMES:
+      g_value_set_uint (value, self->max_frames);
+      break;
+    case PROP_MAX_PENDING:
+      g_value_set_uint (value, self->max_pending);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static gboolean
+write_frame (GstAhcRawSink * self, GstBuffer * buffer, guint n)
+{
+  GstVideoFrame src, dst;
+  GstBuffer *slot;
+  gboolean ok;
+
+  if (!gst_video_frame_map (&src, &self->info, buffer, GST_MAP_READ))
+    return FALSE;
+
+  slot = gst_buffer_new_wrapped_full (0, self->data + self->index[n].offset,
+      self->slot_size, 0, self->header->frame_size, NULL, NULL);
+  if (!gst_video_frame_map (&dst, &self->info, slot, GST_MAP_WRITE)) {
+    gst_video_frame_unmap (&src);
+    gst_buffer_unref (slot);
+    return FALSE;
+  }
+
+  ok = gst_video_frame_copy (&dst, &src);
+  gst_video_frame_unmap (&dst);
+  gst_video_frame_unmap (&src);
+  gst_buffer_unref (slot);
+
+  return ok;
+}
+
+static gpointer
+writer_thread (gpointer user_data)
+{
+  GstAhcRawSink *self = user_data;
+  GstBuffer *buffer;
+  guint n = 0;
+
+  while (TRUE) {
+    g_mutex_lock (&self->lock);
+    while (g_queue_is_empty (&self->pending) && !self->stopping)
+      g_cond_wait (&self->cond, &self->lock);
+    buffer = g_queue_pop_head (&self->pending);
+    g_mutex_unlock (&self->lock);
+
+    /* Drained after stop */
+    if (!buffer)
+      break;
+
+    if (GST_BUFFER_PTS_IS_VALID (buffer))
+      self->index[n].pts = GST_BUFFER_PTS (buffer);
+    else
+      self->index[n].pts = gst_util_uint64_scale (n * GST_SECOND,
+          self->header->fps_d, self->header->fps_n);
+    if (write_frame (self, buffer, n)) {
+      /* The frame is complete before it is counted in the header */
+      __atomic_store_n (&self->header->n_frames, ++n, __ATOMIC_RELEASE);
+      g_mutex_lock (&self->lock);
+      self->written++;
+      g_mutex_unlock (&self->lock);
+    } else {
+      GST_WARNING_OBJECT (self, "Could not copy frame %u", n);
+    }
+    gst_buffer_unref (buffer);
+  }
+
+  return NULL;
+}
+
+static gboolean
+gst_ahc_raw_sink_start (GstBaseSink * bsink)
+{
+  GstAhcRawSink *self = GST_AHC_RAW_SINK (bsink);
+
+  if (!self->location || !self->max_frames) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND, (NULL),
+        ("No file or no frames to record"));
+    return FALSE;
+  }
+
+  self->fd = open (self->location, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+      0644);
+  if (self->fd < 0) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_WRITE, (NULL),
+        ("Could not open %s: %s", self->location, g_strerror (errno)));
+    return FALSE;
+  }
+
+  self->stopping = FALSE;
+  self->caps_changed = FALSE;
+  self->accepted = 0;
+  self->written = self->dropped = self->skipped = 0;
+  self->writer = g_thread_new ("ahc-raw-writer", writer_thread, self);
+
+  return TRUE;
+}
+
+/* Sizes, allocates and maps the file for info */
+static gboolean
+prepare_file (GstAhcRawSink * self, const GstVideoInfo * info)
+{
+  GstAhcRawHeader header = { GST_AHC_RAW_MAGIC, };
+  guint64 index_end, size;
+  gpointer data;
+  guint i;
+  gint res;
+
+  header.fourcc = gst_video_format_to_fourcc (GST_VIDEO_INFO_FORMAT (info));
+  header.width = GST_VIDEO_INFO_WIDTH (info);
+  header.height = GST_VIDEO_INFO_HEIGHT (info);
+  /* Variable rate: the replay takes the durations from the index */
+  header.fps_n = GST_VIDEO_INFO_FPS_N (info) ? GST_VIDEO_INFO_FPS_N (info) : 30;
+  header.fps_d = GST_VIDEO_INFO_FPS_N (info) ? GST_VIDEO_INFO_FPS_D (info) : 1;
+  header.frame_size = GST_VIDEO_INFO_SIZE (info);
+  header.max_frames = self->max_frames;
+
+  index_end = sizeof (GstAhcRawHeader) +
+      (guint64) self->max_frames * sizeof (GstAhcRawIndexEntry);
+  header.data_offset = GST_ROUND_UP_N (index_end, GST_AHC_RAW_ALIGN);
+  self->slot_size = GST_ROUND_UP_N (header.frame_size, GST_AHC_RAW_ALIGN);
+  /* 32 bit ABIs wrap a gsize after a few thousand frames, and can not map
+   * more than half of their address space in one go */
+  size = header.data_offset + (guint64) self->max_frames * self->slot_size;
+  if (size > G_MAXSSIZE) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NO_SPACE_LEFT, (NULL),
+        ("%" G_GUINT64_FORMAT " bytes for %u frames can not be mapped "
+            "here, record fewer frames", size, self->max_frames));
+    return FALSE;
+  }
+  self->size = size;
+
+  if (ftruncate (self->fd, self->size) < 0) {
+    GST_ELEMENT_ERROR (self, RESOURCE, WRITE, (NULL),
+        ("Could not size %s: %s", self->location, g_strerror (errno)));
+    goto failed;
+  }
+  /* Filesystems without fallocate fill the blocks in when written */
+  res = posix_fallocate (self->fd, 0, self->size);
+  if (res == ENOSPC) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NO_SPACE_LEFT, (NULL),
+        ("%" G_GSIZE_FORMAT " bytes for %u frames do not fit on the "
+            "storage of %s", self->size, self->max_frames, self->location));
+    goto failed;
+  } else if (res) {
+    GST_DEBUG_OBJECT (self, "Could not preallocate: %s", g_strerror (res));
+  }
+
+  data = mmap (NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      self->fd, 0);
+  if (data == MAP_FAILED && errno == ENOMEM) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NO_SPACE_LEFT, (NULL),
+        ("No room to map %" G_GSIZE_FORMAT " bytes for %u frames, record "
+            "fewer frames", self->size, self->max_frames));
+    goto failed;
+  } else if (data == MAP_FAILED) {
+    GST_ELEMENT_ERROR (self, RESOURCE, WRITE, (NULL),
+        ("Could not map %s: %s", self->location, g_strerror (errno)));
+    goto failed;
+  }
+
+  self->data = data;
+  self->header = data;
+  self->index = (GstAhcRawIndexEntry *) (self->header + 1);
+  *self->header = header;
+  for (i = 0; i < self->max_frames; i++)
+    self->index[i].offset = header.data_offset + (guint64) i * self->slot_size;
+  self->info = *info;
+
+  GST_INFO_OBJECT (self, "Recording up to %u frames of %ux%u into %s, %"
+      G_GSIZE_FORMAT " bytes", self->max_frames, header.width, header.height,
+      self->location, self->size);
+
+  return TRUE;
+
+failed:
+  /* Do not leave a preallocated file behind, stop() only trims a mapped
+   * one */
+  if (ftruncate (self->fd, 0) < 0)
+    GST_WARNING_OBJECT (self, "Could not truncate %s: %s", self->location,
+        g_strerror (errno));
+  return FALSE;
+}
+
+static gboolean
+gst_ahc_raw_sink_set_caps (GstBaseSink * bsink, GstCaps * caps)
+{
+  GstAhcRawSink *self = GST_AHC_RAW_SINK (bsink);
+  GstVideoInfo info;
+
+  if (!gst_video_info_from_caps (&info, caps))
+    return FALSE;
+
+  if (!self->data)
+    return prepare_file (self, &info);
+
+  if (!gst_video_info_is_equal (&info, &self->info)) {
+    GST_WARNING_OBJECT (self, "Caps changed, not recording any more");
+    g_mutex_lock (&self->lock);
+    self->caps_changed = TRUE;
+    g_mutex_unlock (&self->lock);
+  }
+
+  return TRUE;
+}
+
+static GstFlowReturn
+gst_ahc_raw_sink_render (GstBaseSink * bsink, GstBuffer * buffer)
+{
+  GstAhcRawSink *self = GST_AHC_RAW_SINK (bsink);
+
+  g_mutex_lock (&self->lock);
+  if (!self->data || self->caps_changed ||
+      self->accepted >= self->max_frames) {
+    self->skipped++;
+  } else if (g_queue_get_length (&self->pending) >= self->max_pending) {
+    self->dropped++;
+  } else {
+    g_queue_push_tail (&self->pending, gst_buffer_ref (buffer));
+    self->accepted++;
+    g_cond_signal (&self->cond);
+  }
+  g_mutex_unlock (&self->lock);
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+gst_ahc_raw_sink_stop (GstBaseSink * bsink)
+{
+  GstAhcRawSink *self = GST_AHC_RAW_SINK (bsink);
+  guint64 used;
+
+  g_mutex_lock (&self->lock);
+  self->stopping = TRUE;
+  g_cond_signal (&self->cond);
+  g_mutex_unlock (&self->lock);
+  if (self->writer)
+    g_thread_join (self->writer);
+  self->writer = NULL;
+
+  GST_INFO_OBJECT (self, "Recorded %" G_GUINT64_FORMAT " frames, dropped %"
+      G_GUINT64_FORMAT ", skipped %" G_GUINT64_FORMAT, self->written,
+      self->dropped, self->skipped);
+
+  if (self->data) {
+    used = self->header->data_offset +
+        (guint64) self->header->n_frames * self->slot_size;
+    munmap (self->data, self->size);
+    self->data = NULL;
+    self->header = NULL;
+    self->index = NULL;
+    if (ftruncate (self->fd, used) < 0)
+      GST_WARNING_OBJECT (self, "Could not truncate %s: %s", self->location,
+          g_strerror (errno));
+  }
+  close (self->fd);
+  self->fd = -1;
+
+  return TRUE;
+}
+
+static void
+gst_ahc_raw_sink_get_stats (GstAhcRawSink * self,
+    GstAhcRawCaptureStats * stats)
+{
+  g_mutex_lock (&self->lock);
+  stats->written = self->written;
+  stats->pending = g_queue_get_length (&self->pending);
+  stats->dropped = self->dropped;
+  stats->skipped = self->skipped;
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gst_ahc_raw_sink_finalize (GObject * object)
+{
+  GstAhcRawSink *self = GST_AHC_RAW_SINK (object);
+
+  g_free (self->location);
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->cond);
+
+  G_OBJECT_CLASS (gst_ahc_raw_sink_parent_class)->finalize (object);
+}
+
+static void
+gst_ahc_raw_sink_class_init (GstAhcRawSinkClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSinkClass *basesink_class = GST_BASE_SINK_CLASS (klass);
+
+  gobject_class->set_property = gst_ahc_raw_sink_set_property;
+  gobject_class->get_property = gst_ahc_raw_sink_get_property;
+  gobject_class->finalize = gst_ahc_raw_sink_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_LOCATION,
+      g_param_spec_string ("location", "Location", "Raw capture file",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_FRAMES,
+      g_param_spec_uint ("max-frames", "Max frames",
+          "Frames the file is allocated for", 1, G_MAXINT32,
+          DEFAULT_MAX_FRAMES, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MAX_PENDING,
+      g_param_spec_uint ("max-pending", "Max pending",
+          "Frames waiting for the writer before new ones are dropped", 1,
+          G_MAXINT32, DEFAULT_MAX_PENDING,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  basesink_class->start = gst_ahc_raw_sink_start;
+  basesink_class->stop = gst_ahc_raw_sink_stop;
+  basesink_class->set_caps = gst_ahc_raw_sink_set_caps;
+  basesink_class->render = gst_ahc_raw_sink_render;
+
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_set_static_metadata (element_class,
+      "Raw capture recorder", "Sink/Video",
+      "Records raw frames into preallocated memory-mapped files",
+      "Justin Kim <justin.kim@collabora.com>");
+}
+
+static void
+gst_ahc_raw_sink_init (GstAhcRawSink * self)
+{
+  self->max_frames = DEFAULT_MAX_FRAMES;
+  self->max_pending = DEFAULT_MAX_PENDING;
+  self->fd = -1;
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_queue_init (&self->pending);
+
+  /* Like the other branch sinks, it must not hold up the preview */
+  gst_base_sink_set_sync (GST_BASE_SINK (self), FALSE);
+  gst_base_sink_set_async_enabled (GST_BASE_SINK (self), FALSE);
+}
+
+void
+gst_ahc_raw_sink_register (void)
+{
+  gst_element_register (NULL, GST_AHC_RAW_SINK_FACTORY, GST_RANK_NONE,
+      GST_TYPE_AHC_RAW_SINK);
+}
+
+/* Records up to max_frames frames of the camera into location, for
+ * ahcreplaysrc. Returns the id of the branch, which stops the capture
+ * with gst_ahc_remove_branch(), or -1 on failure. */
+gint
+gst_ahc_start_raw_capture (GstAhc * ahc, const gchar * location,
+    guint max_frames)
+{
+  gchar *description;
+  gint id;
+
+  g_return_val_if_fail (location != NULL, -1);
+  g_return_val_if_fail (max_frames > 0, -1);
+
+  description = g_strdup_printf ("%s name=%s location=\"%s\" max-frames=%u",
+      GST_AHC_RAW_SINK_FACTORY, RAW_SINK_NAME, location, max_frames);
+  id = gst_ahc_add_branch (ahc, GST_AHC_BRANCH_RECORD, description);
+  g_free (description);
+
+  return id;
+}
+
+/* Returns FALSE once the branch is removed */
+gboolean
+gst_ahc_get_raw_capture_stats (GstAhc * ahc, gint id,
+    GstAhcRawCaptureStats * stats)
+{
+  GstElement *sink = gst_ahc_branch_get_element (ahc, id, RAW_SINK_NAME);
+  gboolean found;
+
+  if (!sink)
+    return FALSE;
+
+  found = GST_IS_AHC_RAW_SINK (sink);
+  if (found)
+    gst_ahc_raw_sink_get_stats (GST_AHC_RAW_SINK (sink), stats);
+  gst_object_unref (sink);
+
+  return found;
+}
@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * Trace recorder.
+ *
+ * Records what the pipeline threads do as Chrome trace events, the JSON
+ * format Perfetto and chrome://tracing load, to line up the camera,
+ * display and encoder threads when looking for jank:
+ *
+ *  - buffers pushed or pulled through the src pads of every element, with
+ *    their PTS, as instant events
+ *  - state changes of every element, on the thread posting them
+ *  - JNI entry points and bus message dispatch, as spans
+ *
+ * The recorder is process-wide, like the tracks of a trace. Each thread
+ * writes into a ring of its own without locking and only the last events
+ * of each thread are kept. gst_ahc_recorder_stop() waits for writers to
+ * leave their ring and writes all of them to a file. While stopped,
+ * recording costs one atomic read per event.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define DEFAULT_EVENTS_PER_THREAD 8192
+
+typedef enum
+{
+  ARGS_NONE,
+  /* arg0 is the PTS in microseconds, -1 if none */
+  ARGS_PTS,
+  /* arg0 and arg1 are the old and new GstState */
+  ARGS_STATE,
+} ArgsKind;
+
+typedef struct
+{
+  /* Static or interned strings */
+  const gchar *name;
+  const gchar *category;
+  gint64 ts;
+  gint64 dur;
+  gint64 arg0;
+  gint64 arg1;
+  gchar phase;
+  guint8 args;
+} RecordEvent;
+
+typedef struct
+{
+  gint tid;
+  gchar thread_name[17];
+  RecordEvent *events;
+  guint capacity;
+  /* Only written by the owning thread */
+  guint64 written;
+  /* Set while the owning thread writes an event */
+  gint writing;
+  /* The thread is gone, the ring goes after the next stop */
+  gboolean orphaned;
+} ThreadRing;
+
+static void ring_orphan (gpointer data);
+
+/* rings, and the capacity of new ones, are protected by recorder_lock */
+static GMutex recorder_lock;
+static GPtrArray *rings;
+static guint ring_capacity = DEFAULT_EVENTS_PER_THREAD;
+static gint recording;
+static GPrivate current_ring = G_PRIVATE_INIT (ring_orphan);
+
+static void
+ring_free (ThreadRing * ring)
+{
+  g_free (ring->events);
+  g_free (ring);
+}
+
+/* Called when a thread that recorded exits */
+static void
+ring_orphan (gpointer data)
+{
+  ThreadRing *ring = data;
+
+  g_mutex_lock (&recorder_lock);
+  if (g_atomic_int_get (&recording)) {
+    ring->orphaned = TRUE;
+  } else {
+    g_ptr_array_remove_fast (rings, ring);
+    ring_free (ring);
+  }
+  g_mutex_unlock (&recorder_lock);
+}
+
+static ThreadRing *
+get_ring (void)
+{
+  ThreadRing *ring = g_private_get (&current_ring);
+
+  if (G_LIKELY (ring))
+    return ring;
+
+  ring = g_new0 (ThreadRing, 1);
+  ring->tid = syscall (SYS_gettid);
+  prctl (PR_GET_NAME, ring->thread_name, 0, 0, 0);
+
+  g_mutex_lock (&recorder_lock);
+  ring->capacity = ring_capacity;
+  ring->events = g_new0 (RecordEvent, ring->capacity);
+  g_ptr_array_add (rings, ring);
+  g_mutex_unlock (&recorder_lock);
+
+  g_private_set (&current_ring, ring);
+
+  return ring;
+}
+
+static void
+record (const gchar * name, const gchar * category, gchar phase, gint64 ts,
+    gint64 dur, ArgsKind args, gint64 arg0, gint64 arg1)
+{
+  ThreadRing *ring;
+  RecordEvent *event;
+
+  if (!g_atomic_int_get (&recording))
+    return;
+
+  ring = get_ring ();
+  g_atomic_int_set (&ring->writing, 1);
+  /* Checked again, gst_ahc_recorder_stop() may have looked at writing
+   * before it was set */
+  if (g_atomic_int_get (&recording)) {
+    event = &ring->events[ring->written % ring->capacity];
+    event->name = name;
+    event->category = category;
+    event->ts = ts;
+    event->dur = dur;
+    event->arg0 = arg0;
+    event->arg1 = arg1;
+    event->phase = phase;
+    event->args = args;
+    ring->written++;
+  }
+  g_atomic_int_set (&ring->writing, 0);
+}
+
+GstAhcRecordScope
+gst_ahc_record_scope_begin (const gchar * name, const gchar * category)
+{
+  GstAhcRecordScope scope = { name, category, 0 };
+
+  if (g_atomic_int_get (&recording))
+    scope.start = g_get_monotonic_time ();
+
+  return scope;
+}
+
+void
+gst_ahc_record_scope_end (GstAhcRecordScope * scope)
+{
+  if (scope->start)
+    record (scope->name, scope->category, 'X', scope->start,
+        g_get_monotonic_time () - scope->start, ARGS_NONE, 0, 0);
+}
+
+/* Called from the thread posting the message */
+void
+gst_ahc_recorder_state_changed (GstMessage * message)
+{
+  GstState old_state, new_state;
+
+  if (!g_atomic_int_get (&recording))
+    return;
+
+  gst_message_parse_state_changed (message, &old_state, &new_state, NULL);
+  record (g_intern_string (GST_MESSAGE_SRC_NAME (message)), "state", 'i',
+      g_get_monotonic_time (), 0, ARGS_STATE, old_state, new_state);
+}
+
+static GstPadProbeReturn
+buffer_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstBuffer *buffer;
+
+  if (!g_atomic_int_get (&recording))
+    return GST_PAD_PROBE_OK;
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  record (user_data, GST_PAD_MODE (pad) == GST_PAD_MODE_PULL ? "pull" :
+      "push", 'i', g_get_monotonic_time (), 0, ARGS_PTS,
+      GST_BUFFER_PTS_IS_VALID (buffer) ?
+      (gint64) GST_TIME_AS_USECONDS (GST_BUFFER_PTS (buffer)) : -1, 0);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+probe_pad (GstPad * pad)
+{
+  gchar *name;
+
+  if (!GST_PAD_IS_SRC (pad))
+    return;
+
+  name = g_strdup_printf ("%s:%s", GST_DEBUG_PAD_NAME (pad));
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, buffer_probe,
+      (gpointer) g_intern_string (name), NULL);
+  g_free (name);
+}
+
+static void
+pad_added_cb (GstElement * element, GstPad * pad, gpointer user_data)
+{
+  probe_pad (pad);
+}
+
+static void
+element_added_cb (GstBin * bin, GstBin * sub_bin, GstElement * element,
+    gpointer user_data)
+{
+  GstIterator *it;
+  GValue item = G_VALUE_INIT;
+
+  /* Ghost pads of bins proxy the pads of the elements inside */
+  if (GST_IS_BIN (element))
+    return;
+
+  g_signal_connect (element, "pad-added", G_CALLBACK (pad_added_cb), NULL);
+
+  it = gst_element_iterate_src_pads (element);
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    probe_pad (g_value_get_object (&item));
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+}
+
+/* Called while the pipeline is built, before any element is added. The
+ * probes stay in place and only record while the recorder runs. */
+void
+gst_ahc_recorder_attach (GstAhc * ahc)
+{
+  g_signal_connect (ahc->pipeline, "deep-element-added",
+      G_CALLBACK (element_added_cb), NULL);
+}
+
+/* Starts recording, keeping the last events_per_thread events of each
+ * thread, 0 for the default */
+void
+gst_ahc_recorder_start (guint events_per_thread)
+{
+  guint i;
+
+  if (!events_per_thread)
+    events_per_thread = DEFAULT_EVENTS_PER_THREAD;
+
+  g_mutex_lock (&recorder_lock);
+  if (!rings)
+    rings = g_ptr_array_new ();
+
+  /* Nothing writes while stopped */
+  ring_capacity = events_per_thread;
+  for (i = 0; i < rings->len; i++) {
+    ThreadRing *ring = g_ptr_array_index (rings, i);
+
+    ring->written = 0;
+    if (ring->capacity != ring_capacity) {
+      ring->capacity = ring_capacity;
+      g_free (ring->events);
+      ring->events = g_new0 (RecordEvent, ring->capacity);
+    }
+  }
+  g_atomic_int_set (&recording, 1);
+  g_mutex_unlock (&recorder_lock);
+
+  GST_INFO ("Recording up to %u events per thread", events_per_thread);
+}
+
+static void
+append_json_string (GString * json, const gchar * str)
+{
+  g_string_append_c (json, '"');
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\')
+      g_string_append_c (json, '\\');
+    if ((guchar) * str >= 0x20)
+      g_string_append_c (json, *str);
+  }
+  g_string_append_c (json, '"');
+}
+
+static void
+append_event (GString * json, gint pid, gint tid, const RecordEvent * e)
+{
+  g_string_append (json, ",\n{\"name\":");
+  append_json_string (json, e->name);
+  g_string_append_printf (json, ",\"cat\":\"%s\",\"ph\":\"%c\","
+      "\"ts\":%" G_GINT64_FORMAT ",\"pid\":%d,\"tid\":%d", e->category,
+      e->phase, e->ts, pid, tid);
+
+  switch (e->phase) {
+    case 'X':
+      g_string_append_printf (json, ",\"dur\":%" G_GINT64_FORMAT, e->dur);
+      break;
+    case 'i':
+      g_string_append (json, ",\"s\":\"t\"");
+      break;
+  }
+
+  switch (e->args) {
+    case ARGS_PTS:
+      g_string_append_printf (json, ",\"args\":{\"pts\":%" G_GINT64_FORMAT
+          "}", e->arg0);
+      break;
+    case ARGS_STATE:
+      g_string_append_printf (json, ",\"args\":{\"from\":\"%s\","
+          "\"to\":\"%s\"}", gst_element_state_get_name (e->arg0),
+          gst_element_state_get_name (e->arg1));
+      break;
+    default:
+      break;
+  }
+  g_string_append_c (json, '}');
+}
+
+static void
+append_ring (GString * json, gint pid, const ThreadRing * ring)
+{
+  guint64 first = ring->written > ring->capacity ?
+      ring->written - ring->capacity : 0;
+  guint64 i;
+
+  if (!ring->written)
+    return;
+
+  g_string_append_printf (json, ",\n{\"name\":\"thread_name\",\"ph\":\"M\","
+      "\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", pid, ring->tid);
+  append_json_string (json, ring->thread_name);
+  g_string_append (json, "}}");
+
+  for (i = first; i < ring->written; i++)
+    append_event (json, pid, ring->tid, &ring->events[i % ring->capacity]);
+}
+
+/* Stops recording and writes what the rings hold to path */
+gboolean
+gst_ahc_recorder_stop (const gchar * path, GError ** error)
+{
+  GString *json;
+  gint pid = getpid ();
+  guint i;
+  gboolean ret;
+
+  g_mutex_lock (&recorder_lock);
+  if (!g_atomic_int_get (&recording)) {
+    g_mutex_unlock (&recorder_lock);
+    g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_FAILED,
+        "The recorder is not running");
+    return FALSE;
+  }
+  g_atomic_int_set (&recording, 0);
+
+  /* Writers check recording after setting writing, so once it is seen
+   * cleared here they leave the ring alone */
+  for (i = 0; i < rings->len; i++) {
+    ThreadRing *ring = g_ptr_array_index (rings, i);
+
+    while (g_atomic_int_get (&ring->writing))
+      g_thread_yield ();
+  }
+
+  json = g_string_new ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+      "{\"name\":\"process_name\",\"ph\":\"M\"");
+  g_string_append_printf (json, ",\"pid\":%d,\"args\":{\"name\":"
+      "\"android_camera\"}}", pid);
+
+  for (i = 0; i < rings->len;) {
+    ThreadRing *ring = g_ptr_array_index (rings, i);
+
+    append_ring (json, pid, ring);
+    if (ring->orphaned) {
+      g_ptr_array_remove_index_fast (rings, i);
+      ring_free (ring);
+    } else {
+      i++;
+    }
+  }
+  g_mutex_unlock (&recorder_lock);
+
+  g_string_append (json, "\n]}\n");
+  ret = g_file_set_contents (path, json->str, json->len, error);
+  GST_INFO ("Wrote %" G_GSIZE_FORMAT " bytes of trace events to %s",
+      json->len, path);
+  g_string_free (json, TRUE);
+
+  return ret;
+}
@@ -0,0 +1,446 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * "ahcreplaysrc", replays a raw capture file in place of ahcsrc.
+ *
+ * The file, see GstAhcRawHeader, is mapped read-only once and every frame
+ * is pushed as a buffer wrapping its part of the mapping, without a copy.
+ * Buffers keep the mapping alive, so it goes away with the last of them,
+ * even after the element stopped. The kernel reads ahead of the frame
+ * being pushed.
+ *
+ * With sync the frames come at their original pace, as from a live
+ * camera. Without it they come as fast as downstream takes them, which
+ * needs a sink that does not sync either. Timestamps are the original
+ * ones either way, starting at 0, so runs are reproducible.
+ *
+ * Usable from the core as "ahcreplaysrc location=capture.raw", see
+ * make_source().
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+#include <gst/video/video.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define GST_TYPE_AHC_REPLAY_SRC (gst_ahc_replay_src_get_type ())
+#define GST_AHC_REPLAY_SRC(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), GST_TYPE_AHC_REPLAY_SRC, \
+        GstAhcReplaySrc))
+
+#define DEFAULT_SYNC TRUE
+#define DEFAULT_LOOP FALSE
+
+/* Frames the kernel is asked to read ahead */
+#define READAHEAD_FRAMES 4
+
+typedef struct
+{
+  gint ref_count;
+  guint8 *data;
+  gsize size;
+} Mapping;
+
+typedef struct _GstAhcReplaySrc
+{
+  GstPushSrc parent;
+
+  gchar *location;
+  gboolean sync;
+  gboolean loop;
+
+  /* Valid between start and stop */
+  Mapping *mapping;
+  const GstAhcRawHeader *header;
+  const GstAhcRawIndexEntry *index;
+  GstVideoInfo info;
+  guint64 page_size;
+  guint next_frame;
+  /* Added to the timestamps of each pass when looping */
+  GstClockTime pass_offset;
+} GstAhcReplaySrc;
+
+typedef struct _GstAhcReplaySrcClass
+{
+  GstPushSrcClass parent_class;
+} GstAhcReplaySrcClass;
+
+enum
+{
+  PROP_0,
+  PROP_LOCATION,
+  PROP_SYNC,
+  PROP_LOOP,
+};
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC, GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE ("{ NV21, NV12, I420 }")));
+
+GType gst_ahc_replay_src_get_type (void);
+G_DEFINE_TYPE (GstAhcReplaySrc, gst_ahc_replay_src, GST_TYPE_PUSH_SRC);
+
+static Mapping *
+mapping_ref (Mapping * mapping)
+{
+  g_atomic_int_inc (&mapping->ref_count);
+  return mapping;
+}
+
+static void
+mapping_unref (gpointer data)
+{
+  Mapping *mapping = data;
+
+  if (!g_atomic_int_dec_and_test (&mapping->ref_count))
+    return;
+
+  munmap (mapping->data, mapping->size);
+  g_free (mapping);
+}
+
+static void
+gst_ahc_replay_src_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstAhcReplaySrc *self = GST_AHC_REPLAY_SRC (object);
+
+  switch (prop_id) {
+    case PROP_LOCATION:
+      g_free (self->location);
+      self->location = g_value_dup_string (value);
+      break;
+    case PROP_SYNC:
+      self->sync = g_value_get_boolean (value);
+      gst_base_src_set_live (GST_BASE_SRC (self), self->sync);
+      break;
+    case PROP_LOOP:
+      self->loop = g_value_get_boolean (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_ahc_replay_src_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstAhcReplaySrc *self = GST_AHC_REPLAY_SRC (object);
+
+  switch (prop_id) {
+    case PROP_LOCATION:
+      g_value_set_string (value, self->location);
+      break;
+    case PROP_SYNC:
+      g_value_set_boolean (value, self->sync);
+      break;
+    case PROP_LOOP:
+      g_value_set_boolean (value, self->loop);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+/* Checks everything the streaming thread relies on later */
+static gboolean
+check_file (GstAhcReplaySrc * self, gsize size)
+{
+  const GstAhcRawHeader *h = self->header;
+  GstVideoFormat format;
+  guint64 index_end;
+  guint i;
+
+  if (size < sizeof (GstAhcRawHeader) ||
+      memcmp (h->magic, GST_AHC_RAW_MAGIC, sizeof (h->magic)))
+    return FALSE;
+
+  format = gst_video_format_from_fourcc (h->fourcc);
+  if (format != GST_VIDEO_FORMAT_NV21 && format != GST_VIDEO_FORMAT_NV12 &&
+      format != GST_VIDEO_FORMAT_I420)
+    return FALSE;
+  if (!h->width || !h->height || !h->fps_n || !h->fps_d ||
+      h->n_frames > h->max_frames)
+    return FALSE;
+
+  gst_video_info_set_format (&self->info, format, h->width, h->height);
+  self->info.fps_n = h->fps_n;
+  self->info.fps_d = h->fps_d;
+  if (h->frame_size != GST_VIDEO_INFO_SIZE (&self->info))
+    return FALSE;
+
+  index_end = sizeof (GstAhcRawHeader) +
+      (guint64) h->max_frames * sizeof (GstAhcRawIndexEntry);
+  if (index_end > size || h->data_offset < index_end)
+    return FALSE;
+
+  for (i = 0; i < h->n_frames; i++) {
+    if (self->index[i].offset < h->data_offset ||
+        self->index[i].offset + h->frame_size > size)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gst_ahc_replay_src_start (GstBaseSrc * bsrc)
+{
+  GstAhcReplaySrc *self = GST_AHC_REPLAY_SRC (bsrc);
+  struct stat st;
+  gpointer data;
+  gint fd;
+
+  if (!self->location) {
+    GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND, (NULL),
+        ("No file to replay"));
+    return FALSE;
+  }
+
+  fd = open (self->location, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 || fstat (fd, &st) < 0) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+        ("Could not open %s: %s", self->location, g_strerror (errno)));
+    if (fd >= 0)
+      close (fd);
+    return FALSE;
+  }
+
+  if ((guint64) st.st_size > G_MAXSSIZE) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+        ("%s is too large to be mapped here", self->location));
+    close (fd);
+    return FALSE;
+  }
+
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ, (NULL),
+        ("Could not map %s: %s", self->location, g_strerror (errno)));
+    return FALSE;
+  }
+  madvise (data, st.st_size, MADV_SEQUENTIAL);
+
+  self->mapping = g_new0 (Mapping, 1);
+  self->mapping->ref_count = 1;
+  self->mapping->data = data;
+  self->mapping->size = st.st_size;
+  self->header = data;
+  self->index = (const GstAhcRawIndexEntry *) (self->header + 1);
+
+  if (!check_file (self, st.st_size)) {
+    GST_ELEMENT_ERROR (self, STREAM, WRONG_TYPE, (NULL),
+        ("%s is not a valid raw capture file", self->location));
+    g_clear_pointer (&self->mapping, mapping_unref);
+    return FALSE;
+  }
+
+  GST_INFO_OBJECT (self, "Replaying %u frames of %ux%u from %s",
+      self->header->n_frames, self->header->width, self->header->height,
+      self->location);
+  self->page_size = sysconf (_SC_PAGESIZE);
+  self->next_frame = 0;
+  self->pass_offset = 0;
+
+  return TRUE;
+}
+
+static gboolean
+gst_ahc_replay_src_stop (GstBaseSrc * bsrc)
+{
+  GstAhcReplaySrc *self = GST_AHC_REPLAY_SRC (bsrc);
+
+  /* Pushed buffers hold their own references */
+  g_clear_pointer (&self->mapping, mapping_unref);
+  self->header = NULL;
+  self->index = NULL;
+
+  return TRUE;
+}
+
+static GstCaps *
+gst_ahc_replay_src_get_caps (GstBaseSrc * bsrc, GstCaps * filter)
+{
+  GstAhcReplaySrc *self = GST_AHC_REPLAY_SRC (bsrc);
+  GstCaps *caps;
+
+  if (self->mapping)
+    caps = gst_video_info_to_caps (&self->info);
+  else
+    caps = gst_pad_get_pad_template_caps (GST_BASE_SRC_PAD (bsrc));
+
+  if (filter) {
+    GstCaps *tmp = gst_caps_intersect_full (filter, caps,
+        GST_CAPS_INTERSECT_FIRST);
+
+    gst_caps_unref (caps);
+    caps = tmp;
+  }
+
+  return caps;
+}
+
+static void
+gst_ahc_replay_src_get_times (GstBaseSrc * bsrc, GstBuffer * buffer,
+    GstClockTime * start, GstClockTime * end)
+{
+  *start = *end = GST_CLOCK_TIME_NONE;
+
+  if (gst_base_src_is_live (bsrc) && GST_BUFFER_PTS_IS_VALID (buffer)) {
+    *start = GST_BUFFER_PTS (buffer);
+    *end = *start + GST_BUFFER_DURATION (buffer);
+  }
+}
+
+static GstClockTime
+frame_duration (GstAhcReplaySrc * self, guint frame)
+{
+  if (frame + 1 < self->header->n_frames &&
+      self->index[frame + 1].pts > self->index[frame].pts)
+    return self->index[frame + 1].pts - self->index[frame].pts;
+
+  return gst_util_uint64_scale (GST_SECOND, self->header->fps_d,
+      self->header->fps_n);
+}
+
+static GstFlowReturn
+gst_ahc_replay_src_create (GstPushSrc * psrc, GstBuffer ** buf)
+{
+  GstAhcReplaySrc *self = GST_AHC_REPLAY_SRC (psrc);
+  const GstAhcRawHeader *h = self->header;
+  const GstAhcRawIndexEntry *entry;
+  GstBuffer *buffer;
+  guint frame;
+
+  if (self->next_frame >= h->n_frames) {
+    if (!self->loop || !h->n_frames)
+      return GST_FLOW_EOS;
+    /* The next pass starts one frame after the last one of this pass */
+    self->pass_offset += self->index[h->n_frames - 1].pts -
+        self->index[0].pts + frame_duration (self, h->n_frames - 1);
+    self->next_frame = 0;
+  }
+
+  frame = self->next_frame++;
+  entry = &self->index[frame];
+
+  buffer = gst_buffer_new_wrapped_full (GST_MEMORY_FLAG_READONLY,
+      self->mapping->data + entry->offset, h->frame_size, 0, h->frame_size,
+      mapping_ref (self->mapping), mapping_unref);
+  GST_BUFFER_PTS (buffer) = self->pass_offset + entry->pts -
+      self->index[0].pts;
+  GST_BUFFER_DURATION (buffer) = frame_duration (self, frame);
+  GST_BUFFER_OFFSET (buffer) = frame;
+  GST_BUFFER_OFFSET_END (buffer) = frame + 1;
+
+  /* Have the following frames in memory by the time they are pushed */
+  if (frame + READAHEAD_FRAMES < h->n_frames) {
+    guint64 offset = self->index[frame + READAHEAD_FRAMES].offset;
+    guint64 aligned = offset & ~(self->page_size - 1);
+
+    madvise (self->mapping->data + aligned,
+        MIN (offset + h->frame_size, self->mapping->size) - aligned,
+        MADV_WILLNEED);
+  }
+
+  *buf = buffer;
+
+  return GST_FLOW_OK;
+}
+
+static void
+gst_ahc_replay_src_finalize (GObject * object)
+{
+  GstAhcReplaySrc *self = GST_AHC_REPLAY_SRC (object);
+
+  g_free (self->location);
+
+  G_OBJECT_CLASS (gst_ahc_replay_src_parent_class)->finalize (object);
+}
+
+static void
+gst_ahc_replay_src_class_init (GstAhcReplaySrcClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseSrcClass *basesrc_class = GST_BASE_SRC_CLASS (klass);
+  GstPushSrcClass *pushsrc_class = GST_PUSH_SRC_CLASS (klass);
+
+  gobject_class->set_property = gst_ahc_replay_src_set_property;
+  gobject_class->get_property = gst_ahc_replay_src_get_property;
+  gobject_class->finalize = gst_ahc_replay_src_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_LOCATION,
+      g_param_spec_string ("location", "Location", "Raw capture file",
+          NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SYNC,
+      g_param_spec_boolean ("sync", "Sync",
+          "Push frames at their original pace instead of as fast as possible",
+          DEFAULT_SYNC, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LOOP,
+      g_param_spec_boolean ("loop", "Loop",
+          "Start over at the end instead of ending the stream",
+          DEFAULT_LOOP, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  basesrc_class->start = gst_ahc_replay_src_start;
+  basesrc_class->stop = gst_ahc_replay_src_stop;
+  basesrc_class->get_caps = gst_ahc_replay_src_get_caps;
+  basesrc_class->get_times = gst_ahc_replay_src_get_times;
+  pushsrc_class->create = gst_ahc_replay_src_create;
+
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_set_static_metadata (element_class,
+      "Raw capture replay", "Source/Video",
+      "Replays raw capture files from memory-mapped storage",
+      "Justin Kim <justin.kim@collabora.com>");
+}
+
+static void
+gst_ahc_replay_src_init (GstAhcReplaySrc * self)
+{
+  self->sync = DEFAULT_SYNC;
+  self->loop = DEFAULT_LOOP;
+
+  gst_base_src_set_format (GST_BASE_SRC (self), GST_FORMAT_TIME);
+  gst_base_src_set_live (GST_BASE_SRC (self), self->sync);
+}
+
+void
+gst_ahc_replay_src_register (void)
+{
+  gst_element_register (NULL, GST_AHC_REPLAY_SRC_FACTORY, GST_RANK_NONE,
+      GST_TYPE_AHC_REPLAY_SRC);
+}
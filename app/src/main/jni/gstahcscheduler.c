@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Every thread owns a contiguous range of job indices. It takes jobs from
+ * the front of its own range, and when that is empty it cuts the back half
+ * off the range of another thread. Ranges are protected by a lock per
+ * thread which is only contended while stealing.
+ *
+ * A run only returns once every worker thread has left it, not only once
+ * all jobs are done. A worker still stealing from the previous run would
+ * otherwise overwrite the range it was given for the next one.
+ */
+
+#include "gstahcscheduler.h"
+
+/* Rows per tile for gst_ahc_scheduler_run_rows() when not given */
+#define DEFAULT_TILE_ROWS 16
+
+typedef struct
+{
+  GstAhcScheduler *sched;
+  guint index;
+  GThread *thread;
+
+  GMutex lock;
+  guint begin;
+  guint end;
+} Worker;
+
+struct _GstAhcScheduler
+{
+  guint n_workers;
+  Worker *workers;
+
+  /* One run at a time */
+  GMutex run_lock;
+
+  /* Wakes up the workers for a new run and waits for its end */
+  GMutex lock;
+  GCond wake;
+  GCond done;
+  guint generation;
+  gboolean quit;
+  /* Worker threads that did not leave the current run yet */
+  guint running;
+
+  GstAhcJobFunc func;
+  gpointer user_data;
+  gint pending;
+};
+
+static gboolean
+take_job (Worker * worker, guint * job)
+{
+  gboolean ret = FALSE;
+
+  g_mutex_lock (&worker->lock);
+  if (worker->begin < worker->end) {
+    *job = worker->begin++;
+    ret = TRUE;
+  }
+  g_mutex_unlock (&worker->lock);
+
+  return ret;
+}
+
+static gboolean
+steal_job (Worker * worker, guint * job)
+{
+  GstAhcScheduler *sched = worker->sched;
+  guint i;
+
+  for (i = 1; i < sched->n_workers; i++) {
+    Worker *victim = &sched->workers[(worker->index + i) % sched->n_workers];
+    guint begin, end;
+
+    g_mutex_lock (&victim->lock);
+    end = victim->end;
+    begin = end - (end - victim->begin) / 2;
+    if (begin == end && victim->begin < end)
+      begin = victim->begin;
+    victim->end = begin;
+    g_mutex_unlock (&victim->lock);
+
+    if (begin == end)
+      continue;
+
+    g_mutex_lock (&worker->lock);
+    *job = begin;
+    worker->begin = begin + 1;
+    worker->end = end;
+    g_mutex_unlock (&worker->lock);
+
+    return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+run_jobs (Worker * worker)
+{
+  GstAhcScheduler *sched = worker->sched;
+  guint job;
+
+  while (take_job (worker, &job) || steal_job (worker, &job)) {
+    sched->func (job, sched->user_data);
+
+    if (g_atomic_int_dec_and_test (&sched->pending)) {
+      g_mutex_lock (&sched->lock);
+      g_cond_signal (&sched->done);
+      g_mutex_unlock (&sched->lock);
+    }
+  }
+}
+
+static gpointer
+worker_thread (gpointer user_data)
+{
+  Worker *worker = user_data;
+  GstAhcScheduler *sched = worker->sched;
+  guint generation = 0;
+
+  g_mutex_lock (&sched->lock);
+  while (TRUE) {
+    while (sched->generation == generation && !sched->quit)
+      g_cond_wait (&sched->wake, &sched->lock);
+    if (sched->quit)
+      break;
+    generation = sched->generation;
+
+    g_mutex_unlock (&sched->lock);
+    run_jobs (worker);
+    g_mutex_lock (&sched->lock);
+
+    if (--sched->running == 0)
+      g_cond_signal (&sched->done);
+  }
+  g_mutex_unlock (&sched->lock);
+
+  return NULL;
+}
+
+/* n_threads includes the thread calling gst_ahc_scheduler_run(), 0 means
+ * one per core */
+GstAhcScheduler *
+gst_ahc_scheduler_new (guint n_threads)
+{
+  GstAhcScheduler *sched = g_new0 (GstAhcScheduler, 1);
+  guint i;
+
+  if (n_threads == 0)
+    n_threads = MAX (g_get_num_processors (), 1);
+
+  g_mutex_init (&sched->run_lock);
+  g_mutex_init (&sched->lock);
+  g_cond_init (&sched->wake);
+  g_cond_init (&sched->done);
+
+  sched->n_workers = n_threads;
+  sched->workers = g_new0 (Worker, n_threads);
+  for (i = 0; i < n_threads; i++) {
+    Worker *worker = &sched->workers[i];
+
+    worker->sched = sched;
+    worker->index = i;
+    g_mutex_init (&worker->lock);
+    /* Worker 0 is the calling thread */
+    if (i > 0)
+      worker->thread = g_thread_new ("ahc-tiles", worker_thread, worker);
+  }
+
+  return sched;
+}
+
+void
+gst_ahc_scheduler_free (GstAhcScheduler * sched)
+{
+  guint i;
+
+  g_mutex_lock (&sched->lock);
+  sched->quit = TRUE;
+  g_cond_broadcast (&sched->wake);
+  g_mutex_unlock (&sched->lock);
+
+  for (i = 0; i < sched->n_workers; i++) {
+    if (sched->workers[i].thread)
+      g_thread_join (sched->workers[i].thread);
+    g_mutex_clear (&sched->workers[i].lock);
+  }
+  g_free (sched->workers);
+
+  g_mutex_clear (&sched->run_lock);
+  g_mutex_clear (&sched->lock);
+  g_cond_clear (&sched->wake);
+  g_cond_clear (&sched->done);
+  g_free (sched);
+}
+
+/* Scheduler with a thread per core shared by all kernels of the process */
+GstAhcScheduler *
+gst_ahc_scheduler_get_default (void)
+{
+  static GstAhcScheduler *sched = NULL;
+
+  if (g_once_init_enter (&sched))
+    g_once_init_leave (&sched, gst_ahc_scheduler_new (0));
+
+  return sched;
+}
+
+guint
+gst_ahc_scheduler_get_n_threads (GstAhcScheduler * sched)
+{
+  return sched->n_workers;
+}
+
+/* Calls func for every job in [0, n_jobs) and returns when all are done */
+void
+gst_ahc_scheduler_run (GstAhcScheduler * sched, guint n_jobs,
+    GstAhcJobFunc func, gpointer user_data)
+{
+  guint i;
+
+  if (n_jobs == 0)
+    return;
+
+  if (sched->n_workers == 1 || n_jobs == 1) {
+    for (i = 0; i < n_jobs; i++)
+      func (i, user_data);
+    return;
+  }
+
+  g_mutex_lock (&sched->run_lock);
+
+  sched->func = func;
+  sched->user_data = user_data;
+  g_atomic_int_set (&sched->pending, n_jobs);
+
+  for (i = 0; i < sched->n_workers; i++) {
+    Worker *worker = &sched->workers[i];
+
+    g_mutex_lock (&worker->lock);
+    worker->begin = (guint64) n_jobs * i / sched->n_workers;
+    worker->end = (guint64) n_jobs * (i + 1) / sched->n_workers;
+    g_mutex_unlock (&worker->lock);
+  }
+
+  g_mutex_lock (&sched->lock);
+  sched->generation++;
+  sched->running = sched->n_workers - 1;
+  g_cond_broadcast (&sched->wake);
+  g_mutex_unlock (&sched->lock);
+
+  run_jobs (&sched->workers[0]);
+
+  g_mutex_lock (&sched->lock);
+  while (g_atomic_int_get (&sched->pending) > 0 || sched->running > 0)
+    g_cond_wait (&sched->done, &sched->lock);
+  g_mutex_unlock (&sched->lock);
+
+  g_mutex_unlock (&sched->run_lock);
+}
+
+typedef struct
+{
+  guint height;
+  guint tile_rows;
+  GstAhcRowsFunc func;
+  gpointer user_data;
+} RowsJob;
+
+static void
+run_rows (guint job, gpointer user_data)
+{
+  RowsJob *rows = user_data;
+  guint first = job * rows->tile_rows;
+
+  rows->func (first, MIN (rows->tile_rows, rows->height - first),
+      rows->user_data);
+}
+
+/* Splits height rows into tiles of tile_rows rows, 0 for the default */
+void
+gst_ahc_scheduler_run_rows (GstAhcScheduler * sched, guint height,
+    guint tile_rows, GstAhcRowsFunc func, gpointer user_data)
+{
+  RowsJob rows;
+
+  rows.height = height;
+  rows.tile_rows = tile_rows ? tile_rows : DEFAULT_TILE_ROWS;
+  rows.func = func;
+  rows.user_data = user_data;
+
+  gst_ahc_scheduler_run (sched, (height + rows.tile_rows - 1) /
+      rows.tile_rows, run_rows, &rows);
+}
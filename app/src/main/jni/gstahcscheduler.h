@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+#ifndef __GST_AHC_SCHEDULER_H__
+#define __GST_AHC_SCHEDULER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*
+ * Work-stealing scheduler for data parallel image kernels.
+ *
+ * gst_ahc_scheduler_run() splits n_jobs jobs, e.g. the tiles of a frame,
+ * evenly over the threads and returns once all of them are done, so a
+ * kernel can push its buffer downstream right after. A thread which runs
+ * out of jobs steals half of the remaining jobs of another one, so uneven
+ * tiles or a preempted core do not hold the frame back.
+ *
+ * The calling thread works as one of the threads. Jobs must not call
+ * gst_ahc_scheduler_run() themselves.
+ */
+
+typedef struct _GstAhcScheduler GstAhcScheduler;
+
+typedef void (*GstAhcJobFunc) (guint job, gpointer user_data);
+/* Processes rows [first_row, first_row + n_rows) */
+typedef void (*GstAhcRowsFunc) (guint first_row, guint n_rows,
+    gpointer user_data);
+
+GstAhcScheduler *gst_ahc_scheduler_new (guint n_threads);
+void gst_ahc_scheduler_free (GstAhcScheduler * sched);
+GstAhcScheduler *gst_ahc_scheduler_get_default (void);
+guint gst_ahc_scheduler_get_n_threads (GstAhcScheduler * sched);
+
+void gst_ahc_scheduler_run (GstAhcScheduler * sched, guint n_jobs,
+    GstAhcJobFunc func, gpointer user_data);
+void gst_ahc_scheduler_run_rows (GstAhcScheduler * sched, guint height,
+    guint tile_rows, GstAhcRowsFunc func, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* __GST_AHC_SCHEDULER_H__ */
@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Settings batches applied at a frame boundary.
+ *
+ * gst_ahc_apply_settings() only stages the batch. A probe on the source
+ * pad applies everything staged at once, on the streaming thread, right
+ * before the next frame leaves the source, so no frame is pushed with half
+ * of the settings applied.
+ *
+ * That frame was captured before the camera saw the batch, so it is not the
+ * one tagged. White balance and autofocus changes wait for the camera to
+ * acknowledge them: the source reports the new white balance mode, and an
+ * autofocus run posted its autofocus-done message. The first frame leaving
+ * the source after that is tagged with a GstAhcSettingsMeta carrying the id
+ * of the batch. Batches with neither tag the frame they were applied on.
+ *
+ * A rotation is not applied at the boundary but at the sink, when the
+ * tagged frame gets there, so frames still queued in front of it are not
+ * shown rotated.
+ *
+ * Batches staged between two frames, or before an earlier one was
+ * acknowledged, are merged and tag the same frame with the id of the last
+ * one. Resolution changes in a batch always renegotiate, the pipeline can
+ * not be restarted from the streaming thread. Without dataflow, e.g. in
+ * PAUSED, nothing would reach a frame boundary, so the main context
+ * applies the batch instead and no frame is tagged.
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/interfaces/photography.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+static gboolean
+settings_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  GstAhcSettingsMeta *smeta = (GstAhcSettingsMeta *) meta;
+
+  smeta->id = 0;
+  smeta->requested = GST_CLOCK_TIME_NONE;
+  smeta->applied = GST_CLOCK_TIME_NONE;
+
+  return TRUE;
+}
+
+static const GstMetaInfo *settings_meta_get_info (void);
+
+static gboolean
+settings_meta_transform (GstBuffer * dest, GstMeta * meta, GstBuffer * buffer,
+    GQuark type, gpointer data)
+{
+  GstAhcSettingsMeta *smeta = (GstAhcSettingsMeta *) meta;
+  GstAhcSettingsMeta *dmeta;
+
+  dmeta = (GstAhcSettingsMeta *) gst_buffer_add_meta (dest,
+      settings_meta_get_info (), NULL);
+  dmeta->id = smeta->id;
+  dmeta->requested = smeta->requested;
+  dmeta->applied = smeta->applied;
+
+  return TRUE;
+}
+
+GType
+gst_ahc_settings_meta_api_get_type (void)
+{
+  static volatile gsize type = 0;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("GstAhcSettingsMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+
+  return type;
+}
+
+static const GstMetaInfo *
+settings_meta_get_info (void)
+{
+  static const GstMetaInfo *info = NULL;
+
+  if (g_once_init_enter (&info)) {
+    const GstMetaInfo *meta =
+        gst_meta_register (GST_AHC_SETTINGS_META_API_TYPE,
+        "GstAhcSettingsMeta", sizeof (GstAhcSettingsMeta), settings_meta_init,
+        NULL, settings_meta_transform);
+    g_once_init_leave (&info, meta);
+  }
+
+  return info;
+}
+
+static void
+merge_settings (GstAhcSettings * into, const GstAhcSettings * from)
+{
+  if (from->set & GST_AHC_SETTING_WHITE_BALANCE)
+    into->wb_mode = from->wb_mode;
+  if (from->set & GST_AHC_SETTING_AUTO_FOCUS)
+    into->auto_focus = from->auto_focus;
+  if (from->set & GST_AHC_SETTING_ROTATE_METHOD)
+    into->rotate_method = from->rotate_method;
+  if (from->set & GST_AHC_SETTING_RESOLUTION)
+    into->resolution = from->resolution;
+  into->set |= from->set;
+}
+
+/* Everything but the rotation, which is applied at the sink */
+static void
+apply_to_camera (GstAhc * ahc, const GstAhcSettings * settings)
+{
+  if (settings->set & GST_AHC_SETTING_WHITE_BALANCE)
+    gst_ahc_apply_white_balance (ahc, settings->wb_mode);
+  if (settings->set & GST_AHC_SETTING_AUTO_FOCUS) {
+    g_atomic_int_set (&ahc->focus_done, FALSE);
+    gst_ahc_apply_auto_focus (ahc, settings->auto_focus);
+  }
+  /* The scaler picks the reconfigure up before it handles the next frame */
+  if (settings->set & GST_AHC_SETTING_RESOLUTION)
+    gst_ahc_renegotiate (ahc, settings->resolution.width,
+        settings->resolution.height);
+}
+
+/* Moves the staged batch over to the one waiting for the camera */
+static gboolean
+take_pending (GstAhc * ahc, GstAhcSettings * settings)
+{
+  g_mutex_lock (&ahc->lock);
+  /* The main context is applying a batch, see
+   * gst_ahc_settings_apply_staged() */
+  while (ahc->settings_applying)
+    g_cond_wait (&ahc->cond, &ahc->lock);
+  if (!ahc->settings_pending) {
+    g_mutex_unlock (&ahc->lock);
+    return FALSE;
+  }
+
+  *settings = ahc->pending_settings;
+  merge_settings (&ahc->awaiting_settings, settings);
+  if (!ahc->settings_awaiting)
+    ahc->awaiting_requested = ahc->settings_requested;
+  ahc->awaiting_settings_id = ahc->pending_settings_id;
+  memset (&ahc->pending_settings, 0, sizeof (GstAhcSettings));
+  g_atomic_int_set (&ahc->settings_awaiting, TRUE);
+  g_atomic_int_set (&ahc->settings_pending, FALSE);
+  g_mutex_unlock (&ahc->lock);
+
+  return TRUE;
+}
+
+/* Called with the lock held. Sources without GstPhotography have nothing
+ * to acknowledge. */
+static gboolean
+is_acknowledged (GstAhc * ahc, gboolean applied_now)
+{
+  GstAhcSettings *settings = &ahc->awaiting_settings;
+  GstPhotographyWhiteBalanceMode wb_mode;
+
+  if (!(settings->set & (GST_AHC_SETTING_WHITE_BALANCE |
+              GST_AHC_SETTING_AUTO_FOCUS)) || !GST_IS_PHOTOGRAPHY (ahc->ahcsrc))
+    return TRUE;
+
+  /* This frame was captured before the camera saw the change */
+  if (applied_now)
+    return FALSE;
+
+  if ((settings->set & GST_AHC_SETTING_WHITE_BALANCE) &&
+      gst_photography_get_white_balance_mode (GST_PHOTOGRAPHY (ahc->ahcsrc),
+          &wb_mode) && wb_mode != settings->wb_mode)
+    return FALSE;
+
+  /* Turning autofocus off does not start a run */
+  if ((settings->set & GST_AHC_SETTING_AUTO_FOCUS) && settings->auto_focus &&
+      !g_atomic_int_get (&ahc->focus_done))
+    return FALSE;
+
+  return TRUE;
+}
+
+static GstPadProbeReturn
+settings_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+  GstAhcSettings settings;
+  GstAhcSettingsMeta *meta;
+  GstClockTime requested;
+  GstBuffer *buffer;
+  gboolean applied_now;
+  guint id;
+
+  if (!g_atomic_int_get (&ahc->settings_pending) &&
+      !g_atomic_int_get (&ahc->settings_awaiting) &&
+      !g_atomic_int_get (&ahc->settings_applying))
+    return GST_PAD_PROBE_OK;
+
+  applied_now = take_pending (ahc, &settings);
+  if (applied_now) {
+    GST_DEBUG ("Applying settings (0x%x)", settings.set);
+    apply_to_camera (ahc, &settings);
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  g_mutex_lock (&ahc->lock);
+  if (!ahc->settings_awaiting || !is_acknowledged (ahc, applied_now)) {
+    g_mutex_unlock (&ahc->lock);
+    return GST_PAD_PROBE_OK;
+  }
+
+  settings = ahc->awaiting_settings;
+  id = ahc->awaiting_settings_id;
+  requested = ahc->awaiting_requested;
+  memset (&ahc->awaiting_settings, 0, sizeof (GstAhcSettings));
+  g_atomic_int_set (&ahc->settings_awaiting, FALSE);
+  if (settings.set & GST_AHC_SETTING_ROTATE_METHOD) {
+    ahc->rotate_method = settings.rotate_method;
+    ahc->rotate_pts = GST_BUFFER_PTS (buffer);
+    g_atomic_int_set (&ahc->rotate_pending, TRUE);
+  }
+  ahc->applied_settings_id = id;
+  g_mutex_unlock (&ahc->lock);
+
+  GST_DEBUG ("Settings %u acknowledged (0x%x)", id, settings.set);
+
+  buffer = gst_buffer_make_writable (buffer);
+  meta = (GstAhcSettingsMeta *) gst_buffer_add_meta (buffer,
+      settings_meta_get_info (), NULL);
+  meta->id = id;
+  meta->requested = requested;
+  meta->applied = gst_util_get_timestamp ();
+  GST_PAD_PROBE_INFO_DATA (info) = buffer;
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Applies the rotation of the tagged frame right before the sink renders
+ * it. Frames are matched by timestamp, the tagged one itself may have been
+ * dropped by a leaky queue on the way. */
+static GstPadProbeReturn
+rotate_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gint method;
+
+  if (!g_atomic_int_get (&ahc->rotate_pending))
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&ahc->lock);
+  if (GST_BUFFER_PTS_IS_VALID (buffer) &&
+      GST_CLOCK_TIME_IS_VALID (ahc->rotate_pts) &&
+      GST_BUFFER_PTS (buffer) < ahc->rotate_pts) {
+    g_mutex_unlock (&ahc->lock);
+    return GST_PAD_PROBE_OK;
+  }
+  method = ahc->rotate_method;
+  g_atomic_int_set (&ahc->rotate_pending, FALSE);
+  g_mutex_unlock (&ahc->lock);
+
+  gst_ahc_apply_rotate_method (ahc, method);
+
+  return GST_PAD_PROBE_OK;
+}
+
+void
+gst_ahc_settings_attach (GstAhc * ahc)
+{
+  GstPad *pad;
+
+  pad = gst_element_get_static_pad (ahc->ahcsrc, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, settings_probe, ahc,
+      NULL);
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (ahc->vsink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, rotate_probe, ahc, NULL);
+  gst_object_unref (pad);
+}
+
+/* Called from the bus sync handler for the autofocus-done message of the
+ * source */
+void
+gst_ahc_settings_focus_done (GstAhc * ahc)
+{
+  g_atomic_int_set (&ahc->focus_done, TRUE);
+}
+
+/* Stages settings to be applied together before the next frame. Returns
+ * the id the tagged frame will carry. Can be called from any thread. */
+guint
+gst_ahc_apply_settings (GstAhc * ahc, const GstAhcSettings * settings)
+{
+  guint id;
+
+  if (settings->set & GST_AHC_SETTING_RESOLUTION)
+    gst_ahc_begin_resolution_switch (ahc, settings->resolution.width,
+        settings->resolution.height);
+
+  g_mutex_lock (&ahc->lock);
+  id = ++ahc->next_settings_id;
+  if (!ahc->settings_pending)
+    ahc->settings_requested = gst_util_get_timestamp ();
+  merge_settings (&ahc->pending_settings, settings);
+  ahc->pending_settings_id = id;
+  g_atomic_int_set (&ahc->settings_pending, TRUE);
+  g_mutex_unlock (&ahc->lock);
+
+  /* In case no frame comes to take it */
+  gst_ahc_control_push (ahc, GST_AHC_COMMAND_SETTINGS, 0, 0);
+
+  return id;
+}
+
+/* Applies a staged batch right away when no frame would reach the boundary,
+ * e.g. in PAUSED. Runs on the main context, after every batch and when the
+ * pipeline changed state. In case the pipeline is just starting, the probe
+ * holds the next frame back until the whole batch is applied. */
+void
+gst_ahc_settings_apply_staged (GstAhc * ahc)
+{
+  GstAhcSettings now;
+  GstState state;
+  guint id;
+
+  if (!g_atomic_int_get (&ahc->settings_pending))
+    return;
+
+  GST_OBJECT_LOCK (ahc->pipeline);
+  state = GST_STATE (ahc->pipeline);
+  GST_OBJECT_UNLOCK (ahc->pipeline);
+  /* The probe takes it with the next frame */
+  if (state == GST_STATE_PLAYING)
+    return;
+
+  g_mutex_lock (&ahc->lock);
+  if (!ahc->settings_pending) {
+    g_mutex_unlock (&ahc->lock);
+    return;
+  }
+
+  /* Of a batch waiting to be acknowledged, only the rotation was not
+   * applied yet */
+  now = ahc->pending_settings;
+  id = ahc->pending_settings_id;
+  if ((ahc->awaiting_settings.set & GST_AHC_SETTING_ROTATE_METHOD) &&
+      !(now.set & GST_AHC_SETTING_ROTATE_METHOD)) {
+    now.rotate_method = ahc->awaiting_settings.rotate_method;
+    now.set |= GST_AHC_SETTING_ROTATE_METHOD;
+  }
+  memset (&ahc->pending_settings, 0, sizeof (GstAhcSettings));
+  memset (&ahc->awaiting_settings, 0, sizeof (GstAhcSettings));
+  g_atomic_int_set (&ahc->settings_pending, FALSE);
+  g_atomic_int_set (&ahc->settings_awaiting, FALSE);
+  if (now.set & GST_AHC_SETTING_ROTATE_METHOD)
+    g_atomic_int_set (&ahc->rotate_pending, FALSE);
+  ahc->applied_settings_id = id;
+  g_atomic_int_set (&ahc->settings_applying, TRUE);
+  g_mutex_unlock (&ahc->lock);
+
+  GST_DEBUG ("No dataflow, applying settings %u (0x%x) now", id, now.set);
+
+  apply_to_camera (ahc, &now);
+  if (now.set & GST_AHC_SETTING_ROTATE_METHOD)
+    gst_ahc_apply_rotate_method (ahc, now.rotate_method);
+
+  g_mutex_lock (&ahc->lock);
+  g_atomic_int_set (&ahc->settings_applying, FALSE);
+  g_cond_broadcast (&ahc->cond);
+  g_mutex_unlock (&ahc->lock);
+}
+
+/* Returns the id of the last batch which took effect, 0 if none did */
+guint
+gst_ahc_get_applied_settings (GstAhc * ahc)
+{
+  guint id;
+
+  g_mutex_lock (&ahc->lock);
+  id = ahc->applied_settings_id;
+  g_mutex_unlock (&ahc->lock);
+
+  return id;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * Startup timeline.
+ *
+ * Records when an instance passed each point between GstAhc.init() and
+ * the first frame on screen, see GstAhcStartupMark, on the monotonic
+ * clock. The Java side takes its points with System.nanoTime(), the same
+ * CLOCK_MONOTONIC as g_get_monotonic_time(), and passes them in once the
+ * instance exists. Every mark keeps the first time it was reached, so
+ * restarts and later play() calls leave the timeline alone.
+ *
+ * The report lists the marks in the order they were reached with the time
+ * since the previous one, which is not always the order of the enum: the
+ * surface may well arrive before the pipeline is attached.
+ */
+
+#include <stdlib.h>
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+static const gchar *mark_names[] = {
+  "init",
+  "libraries-loaded",
+  "gstreamer-init",
+  "class-init",
+  "native-init",
+  "start",
+  "pipeline-attached",
+  "surface",
+  "initialized",
+  "play",
+  "playing",
+  "first-frame"
+};
+
+G_STATIC_ASSERT (G_N_ELEMENTS (mark_names) == GST_AHC_N_STARTUP_MARKS);
+
+/* time is in microseconds of g_get_monotonic_time() */
+void
+gst_ahc_mark_startup (GstAhc * ahc, GstAhcStartupMark mark, gint64 time)
+{
+  g_return_if_fail ((guint) mark < GST_AHC_N_STARTUP_MARKS);
+
+  g_mutex_lock (&ahc->lock);
+  if (!ahc->startup[mark]) {
+    ahc->startup[mark] = time;
+    GST_DEBUG ("Startup mark %s at %" G_GINT64_FORMAT " us",
+        mark_names[mark], time);
+  }
+  g_mutex_unlock (&ahc->lock);
+}
+
+static GstPadProbeReturn
+first_frame_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  gst_ahc_mark_startup (user_data, GST_AHC_STARTUP_FIRST_FRAME,
+      g_get_monotonic_time ());
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Called while the pipeline is built */
+void
+gst_ahc_startup_attach (GstAhc * ahc)
+{
+  GstPad *pad = gst_element_get_static_pad (ahc->vsink, "sink");
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, first_frame_probe, ahc,
+      NULL);
+  gst_object_unref (pad);
+}
+
+static gint
+compare_phase (gconstpointer a, gconstpointer b)
+{
+  const GstAhcStartupPhase *pa = a;
+  const GstAhcStartupPhase *pb = b;
+
+  if (pa->offset != pb->offset)
+    return pa->offset < pb->offset ? -1 : 1;
+  return pa->mark - pb->mark;
+}
+
+/* The marks reached so far, in the order they were reached */
+GArray *
+gst_ahc_get_startup_timeline (GstAhc * ahc)
+{
+  GArray *timeline = g_array_new (FALSE, TRUE, sizeof (GstAhcStartupPhase));
+  gint64 first = G_MAXINT64;
+  gint64 times[GST_AHC_N_STARTUP_MARKS];
+  guint i;
+
+  g_mutex_lock (&ahc->lock);
+  for (i = 0; i < GST_AHC_N_STARTUP_MARKS; i++) {
+    times[i] = ahc->startup[i];
+    if (times[i])
+      first = MIN (first, times[i]);
+  }
+  g_mutex_unlock (&ahc->lock);
+
+  for (i = 0; i < GST_AHC_N_STARTUP_MARKS; i++) {
+    GstAhcStartupPhase phase = { 0, };
+
+    if (!times[i])
+      continue;
+    phase.mark = i;
+    phase.name = mark_names[i];
+    phase.offset = times[i] - first;
+    g_array_append_val (timeline, phase);
+  }
+  g_array_sort (timeline, compare_phase);
+
+  for (i = 1; i < timeline->len; i++)
+    g_array_index (timeline, GstAhcStartupPhase, i).duration =
+        g_array_index (timeline, GstAhcStartupPhase, i).offset -
+        g_array_index (timeline, GstAhcStartupPhase, i - 1).offset;
+
+  return timeline;
+}
+
+/* Human readable timeline, the longest phase marked, also logged */
+gchar *
+gst_ahc_dump_startup_timeline (GstAhc * ahc)
+{
+  GArray *timeline = gst_ahc_get_startup_timeline (ahc);
+  GString *dump = g_string_new (NULL);
+  gint64 longest = 0;
+  guint i;
+
+  for (i = 0; i < timeline->len; i++)
+    longest = MAX (longest,
+        g_array_index (timeline, GstAhcStartupPhase, i).duration);
+
+  g_string_append_printf (dump, "%-20s %10s %10s\n", "# startup", "at ms",
+      "phase ms");
+  for (i = 0; i < timeline->len; i++) {
+    GstAhcStartupPhase *p = &g_array_index (timeline, GstAhcStartupPhase, i);
+
+    g_string_append_printf (dump, "%-20s %10.2f %10.2f%s\n", p->name,
+        p->offset / 1000.0, p->duration / 1000.0,
+        p->duration && p->duration == longest ? " <- longest" : "");
+  }
+  g_array_unref (timeline);
+
+  GST_INFO ("Startup timeline:\n%s", dump->str);
+
+  return g_string_free (dump, FALSE);
+}
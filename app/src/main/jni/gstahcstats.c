@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * Stats block.
+ *
+ * A fixed array of 32 bit counters, see GstAhcStat, which the application
+ * polls as often as it likes without calling into the core: the Java side
+ * passes a direct ByteBuffer and reads it with getInt(). The block starts
+ * out in the instance itself and can be moved into such a buffer with
+ * gst_ahc_set_stats_block() before the pipeline is started.
+ *
+ * Frame counters, frame rate, renegotiations and latency are written by
+ * probes on the camera source and the preview sink from their streaming
+ * threads. Queue levels and drops are only known to the queues, so they are
+ * sampled from the main context a few times per second.
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define STATS_SAMPLE_INTERVAL_MS 250
+
+static inline void
+stat_set (GstAhc * ahc, GstAhcStat stat, gint32 value)
+{
+  g_atomic_int_set (&ahc->stats[stat], value);
+}
+
+static inline void
+stat_inc (GstAhc * ahc, GstAhcStat stat)
+{
+  g_atomic_int_inc (&ahc->stats[stat]);
+}
+
+void
+gst_ahc_stats_init (GstAhc * ahc)
+{
+  ahc->stats = ahc->stats_storage;
+  stat_set (ahc, GST_AHC_STAT_VERSION, GST_AHC_STATS_VERSION);
+}
+
+/* Moves the stats into size bytes of memory owned by the caller, which
+ * must stay valid until gst_ahc_free(). Only before gst_ahc_start(). */
+gboolean
+gst_ahc_set_stats_block (GstAhc * ahc, gpointer memory, gsize size)
+{
+  g_return_val_if_fail (ahc->pipeline == NULL, FALSE);
+
+  if (size < GST_AHC_STATS_SIZE || ((guintptr) memory & 3)) {
+    GST_WARNING ("Stats block at %p of %" G_GSIZE_FORMAT " bytes unusable",
+        memory, size);
+    return FALSE;
+  }
+
+  memcpy (memory, ahc->stats, GST_AHC_STATS_SIZE);
+  ahc->stats = memory;
+
+  return TRUE;
+}
+
+const gint32 *
+gst_ahc_get_stats_block (GstAhc * ahc)
+{
+  return ahc->stats;
+}
+
+static GstPadProbeReturn
+capture_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  stat_inc (user_data, GST_AHC_STAT_CAPTURED);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+update_latency (GstAhc * ahc, GstElement * sink, GstBuffer * buffer)
+{
+  GstClockTime now;
+  GstClock *clock;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return;
+
+  clock = gst_element_get_clock (sink);
+  if (!clock)
+    return;
+  now = gst_clock_get_time (clock) - gst_element_get_base_time (sink);
+  gst_object_unref (clock);
+
+  /* Live sources start their segment at 0, so PTS is the capture running
+   * time */
+  if (now >= GST_BUFFER_PTS (buffer))
+    stat_set (ahc, GST_AHC_STAT_LATENCY_US,
+        MIN (GST_TIME_AS_USECONDS (now - GST_BUFFER_PTS (buffer)), G_MAXINT32));
+}
+
+static void
+update_fps (GstAhc * ahc)
+{
+  GstClockTime now = gst_util_get_timestamp ();
+  GstClockTime elapsed;
+
+  if (!GST_CLOCK_TIME_IS_VALID (ahc->stats_window_start)) {
+    ahc->stats_window_start = now;
+    ahc->stats_window_frames = 0;
+    return;
+  }
+
+  ahc->stats_window_frames++;
+  elapsed = now - ahc->stats_window_start;
+  if (elapsed < GST_SECOND)
+    return;
+
+  stat_set (ahc, GST_AHC_STAT_FPS_MILLI,
+      gst_util_uint64_scale (ahc->stats_window_frames, 1000 * GST_SECOND,
+          elapsed));
+  ahc->stats_window_start = now;
+  ahc->stats_window_frames = 0;
+}
+
+static GstPadProbeReturn
+render_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+
+  if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) == GST_EVENT_CAPS) {
+      if (ahc->stats_caps_seen)
+        stat_inc (ahc, GST_AHC_STAT_RENEGOTIATIONS);
+      ahc->stats_caps_seen = TRUE;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  stat_inc (ahc, GST_AHC_STAT_RENDERED);
+  update_latency (ahc, GST_ELEMENT (GST_PAD_PARENT (pad)),
+      GST_PAD_PROBE_INFO_BUFFER (info));
+  update_fps (ahc);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Called while the pipeline is built */
+void
+gst_ahc_stats_attach (GstAhc * ahc)
+{
+  GstPad *pad;
+
+  ahc->stats_caps_seen = FALSE;
+  ahc->stats_window_start = GST_CLOCK_TIME_NONE;
+
+  pad = gst_element_get_static_pad (ahc->ahcsrc, "src");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, capture_probe, ahc,
+      NULL);
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (ahc->vsink, "sink");
+  gst_pad_add_probe (pad,
+      GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+      render_probe, ahc, NULL);
+  gst_object_unref (pad);
+}
+
+static gboolean
+sample_queues (gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+  GArray *queues = gst_ahc_get_queue_stats (ahc);
+  guint64 dropped = 0;
+  guint preview = 0, branch = 0;
+  guint i;
+
+  for (i = 0; i < queues->len; i++) {
+    GstAhcQueueStats *q = &g_array_index (queues, GstAhcQueueStats, i);
+
+    dropped += q->dropped;
+    if (q->type == GST_AHC_BRANCH_PREVIEW)
+      preview = q->level;
+    else
+      branch = MAX (branch, q->level);
+  }
+  g_array_unref (queues);
+
+  stat_set (ahc, GST_AHC_STAT_DROPPED, MIN (dropped, G_MAXINT32));
+  stat_set (ahc, GST_AHC_STAT_PREVIEW_QUEUE_LEVEL, preview);
+  stat_set (ahc, GST_AHC_STAT_BRANCH_QUEUE_LEVEL, branch);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Starts sampling the queues on the main context */
+void
+gst_ahc_stats_start (GstAhc * ahc)
+{
+  ahc->stats_source = g_timeout_source_new (STATS_SAMPLE_INTERVAL_MS);
+  g_source_set_callback (ahc->stats_source, sample_queues, ahc, NULL);
+  g_source_attach (ahc->stats_source, ahc->context);
+}
+
+void
+gst_ahc_stats_stop (GstAhc * ahc)
+{
+  if (!ahc->stats_source)
+    return;
+
+  g_source_destroy (ahc->stats_source);
+  g_clear_pointer (&ahc->stats_source, g_source_unref);
+}
@@ -0,0 +1,392 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * Streaming thread placement.
+ *
+ * Every task of the pipeline gets started by one of our task pools instead
+ * of the default one, picked by a sync bus handler when the task is created
+ * (GST_STREAM_STATUS_TYPE_CREATE):
+ *
+ *  - CAPTURE: the task of the camera source, which pushes every frame
+ *  - DISPLAY: the preview queue thread, which renders into the sink
+ *  - ENCODE:  queue threads of RECORD branches
+ *  - OTHER:   anything else, e.g. ANALYSIS branches
+ *
+ * Each thread applies the GstAhcThreadConfig of its role to itself when it
+ * starts: CPU affinity, then either SCHED_FIFO or a nice value. Threads
+ * started before a configuration change keep the old one until the
+ * pipeline goes through READY. Threads which are not GstTasks, like the GL
+ * thread of glimagesink, are not covered.
+ *
+ * gst_ahc_get_thread_stats() lists the live threads with the number of
+ * times the kernel moved them between CPUs, from /proc/self/task.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+typedef struct _GstAhcTaskPool
+{
+  GstTaskPool parent;
+
+  GstAhc *ahc;
+  GstAhcThreadRole role;
+} GstAhcTaskPool;
+
+typedef struct _GstAhcTaskPoolClass
+{
+  GstTaskPoolClass parent_class;
+} GstAhcTaskPoolClass;
+
+typedef struct
+{
+  GstAhc *ahc;
+  GstAhcThreadRole role;
+  GThread *thread;
+  GstTaskPoolFunction func;
+  gpointer data;
+
+  /* Protected by ahc->lock */
+  gint tid;
+  gboolean configured;
+} StreamingThread;
+
+static const gchar *role_names[GST_AHC_N_THREAD_ROLES] = {
+  "ahc-capture",
+  "ahc-display",
+  "ahc-encode",
+  "ahc-other",
+};
+
+GType gst_ahc_task_pool_get_type (void);
+G_DEFINE_TYPE (GstAhcTaskPool, gst_ahc_task_pool, GST_TYPE_TASK_POOL);
+
+static gboolean
+apply_config (const GstAhcThreadConfig * config, gint tid)
+{
+  gboolean ok = TRUE;
+
+  if (config->cpus) {
+    cpu_set_t set;
+    gint cpu;
+
+    CPU_ZERO (&set);
+    for (cpu = 0; cpu < 64 && cpu < CPU_SETSIZE; cpu++)
+      if (config->cpus & (G_GUINT64_CONSTANT (1) << cpu))
+        CPU_SET (cpu, &set);
+
+    if (sched_setaffinity (0, sizeof (set), &set) != 0) {
+      GST_WARNING ("Can not pin thread %d to 0x%" G_GINT64_MODIFIER "x: %s",
+          tid, config->cpus, g_strerror (errno));
+      ok = FALSE;
+    }
+  }
+
+  if (config->rt_priority > 0) {
+    struct sched_param param;
+    gint err;
+
+    memset (&param, 0, sizeof (param));
+    param.sched_priority = config->rt_priority;
+    err = pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+    if (err != 0) {
+      GST_WARNING ("Can not run thread %d under SCHED_FIFO %d: %s", tid,
+          config->rt_priority, g_strerror (err));
+      ok = FALSE;
+    }
+  } else if (config->nice) {
+    /* On Linux the nice value is per thread */
+    if (setpriority (PRIO_PROCESS, tid, config->nice) != 0) {
+      GST_WARNING ("Can not set nice %d on thread %d: %s", config->nice, tid,
+          g_strerror (errno));
+      ok = FALSE;
+    }
+  }
+
+  return ok;
+}
+
+static gpointer
+streaming_thread_func (gpointer user_data)
+{
+  StreamingThread *st = user_data;
+  GstAhc *ahc = st->ahc;
+  GstAhcThreadConfig config;
+  gint tid = syscall (SYS_gettid);
+  gboolean configured;
+
+  g_mutex_lock (&ahc->lock);
+  config = ahc->thread_configs[st->role];
+  g_mutex_unlock (&ahc->lock);
+
+  configured = apply_config (&config, tid);
+  GST_DEBUG ("Started %s thread %d", role_names[st->role], tid);
+
+  g_mutex_lock (&ahc->lock);
+  st->tid = tid;
+  st->configured = configured;
+  g_mutex_unlock (&ahc->lock);
+
+  st->func (st->data);
+
+  return NULL;
+}
+
+static gpointer
+gst_ahc_task_pool_push (GstTaskPool * pool, GstTaskPoolFunction func,
+    gpointer data, GError ** error)
+{
+  GstAhcTaskPool *self = (GstAhcTaskPool *) pool;
+  GstAhc *ahc = self->ahc;
+  StreamingThread *st = g_new0 (StreamingThread, 1);
+
+  st->ahc = ahc;
+  st->role = self->role;
+  st->func = func;
+  st->data = data;
+
+  g_mutex_lock (&ahc->lock);
+  ahc->streaming_threads = g_list_prepend (ahc->streaming_threads, st);
+  g_mutex_unlock (&ahc->lock);
+
+  st->thread = g_thread_try_new (role_names[self->role],
+      streaming_thread_func, st, error);
+  if (!st->thread) {
+    g_mutex_lock (&ahc->lock);
+    ahc->streaming_threads = g_list_remove (ahc->streaming_threads, st);
+    g_mutex_unlock (&ahc->lock);
+    g_free (st);
+    return NULL;
+  }
+
+  return st;
+}
+
+static void
+gst_ahc_task_pool_join (GstTaskPool * pool, gpointer id)
+{
+  GstAhcTaskPool *self = (GstAhcTaskPool *) pool;
+  StreamingThread *st = id;
+
+  g_thread_join (st->thread);
+
+  g_mutex_lock (&self->ahc->lock);
+  self->ahc->streaming_threads =
+      g_list_remove (self->ahc->streaming_threads, st);
+  g_mutex_unlock (&self->ahc->lock);
+  g_free (st);
+}
+
+/* Threads are started on demand, there is nothing to set up */
+static void
+gst_ahc_task_pool_prepare (GstTaskPool * pool, GError ** error)
+{
+}
+
+static void
+gst_ahc_task_pool_cleanup (GstTaskPool * pool)
+{
+}
+
+static void
+gst_ahc_task_pool_class_init (GstAhcTaskPoolClass * klass)
+{
+  GstTaskPoolClass *pool_class = GST_TASK_POOL_CLASS (klass);
+
+  pool_class->prepare = gst_ahc_task_pool_prepare;
+  pool_class->cleanup = gst_ahc_task_pool_cleanup;
+  pool_class->push = gst_ahc_task_pool_push;
+  pool_class->join = gst_ahc_task_pool_join;
+}
+
+static void
+gst_ahc_task_pool_init (GstAhcTaskPool * self)
+{
+}
+
+void
+gst_ahc_threads_init (GstAhc * ahc)
+{
+  gint role;
+
+  for (role = 0; role < GST_AHC_N_THREAD_ROLES; role++) {
+    GstAhcTaskPool *pool = g_object_new (gst_ahc_task_pool_get_type (), NULL);
+
+    gst_object_ref_sink (pool);
+    pool->ahc = ahc;
+    pool->role = role;
+    ahc->task_pools[role] = GST_TASK_POOL (pool);
+  }
+}
+
+/* The pipeline is gone, and with it all streaming threads */
+void
+gst_ahc_threads_free (GstAhc * ahc)
+{
+  gint role;
+
+  g_warn_if_fail (ahc->streaming_threads == NULL);
+
+  for (role = 0; role < GST_AHC_N_THREAD_ROLES; role++)
+    gst_clear_object (&ahc->task_pools[role]);
+}
+
+static GstAhcThreadRole
+role_of (GstAhc * ahc, GstElement * owner)
+{
+  GstAhcBranchType type;
+
+  if (owner == ahc->ahcsrc)
+    return GST_AHC_THREAD_CAPTURE;
+
+  if (gst_ahc_branch_type_of (owner, &type))
+    return type == GST_AHC_BRANCH_RECORD ?
+        GST_AHC_THREAD_ENCODE : GST_AHC_THREAD_OTHER;
+
+  /* Outside of any branch, only the preview queues have tasks */
+  return GST_AHC_THREAD_DISPLAY;
+}
+
+/* Called from the sync bus handler, in the thread creating the task */
+void
+gst_ahc_threads_handle_stream_status (GstAhc * ahc, GstMessage * message)
+{
+  GstStreamStatusType type;
+  GstElement *owner;
+  const GValue *value;
+  GstAhcThreadRole role;
+
+  gst_message_parse_stream_status (message, &type, &owner);
+  if (type != GST_STREAM_STATUS_TYPE_CREATE)
+    return;
+
+  value = gst_message_get_stream_status_object (message);
+  if (!value || !G_VALUE_HOLDS (value, GST_TYPE_TASK))
+    return;
+
+  role = role_of (ahc, owner);
+  GST_DEBUG ("Task of %s runs as %s", GST_ELEMENT_NAME (owner),
+      role_names[role]);
+  gst_task_set_pool (GST_TASK (g_value_get_object (value)),
+      ahc->task_pools[role]);
+}
+
+/* Sets CPU affinity and priority of the streaming threads of role. Takes
+ * effect for threads started from now on. */
+void
+gst_ahc_set_thread_config (GstAhc * ahc, GstAhcThreadRole role,
+    const GstAhcThreadConfig * config)
+{
+  g_return_if_fail (role < GST_AHC_N_THREAD_ROLES);
+
+  g_mutex_lock (&ahc->lock);
+  ahc->thread_configs[role] = *config;
+  g_mutex_unlock (&ahc->lock);
+}
+
+static gint64
+read_migrations (gint tid)
+{
+  gchar *path, *contents = NULL;
+  gint64 migrations = -1;
+  gchar *line;
+
+  /* Only there with CONFIG_SCHED_DEBUG */
+  path = g_strdup_printf ("/proc/self/task/%d/sched", tid);
+  if (g_file_get_contents (path, &contents, NULL, NULL) &&
+      (line = strstr (contents, "se.nr_migrations")) &&
+      (line = strchr (line, ':')))
+    migrations = g_ascii_strtoll (line + 1, NULL, 10);
+  g_free (contents);
+  g_free (path);
+
+  return migrations;
+}
+
+static gint
+read_cpu (gint tid)
+{
+  gchar *path, *contents = NULL;
+  gchar **fields = NULL;
+  gchar *rest;
+  gint cpu = -1;
+
+  /* Field 39 of stat, the fields after the command name start at 3 */
+  path = g_strdup_printf ("/proc/self/task/%d/stat", tid);
+  if (g_file_get_contents (path, &contents, NULL, NULL) &&
+      (rest = strrchr (contents, ')'))) {
+    fields = g_strsplit (g_strstrip (rest + 1), " ", -1);
+    if (g_strv_length (fields) > 39 - 3)
+      cpu = atoi (fields[39 - 3]);
+  }
+  g_strfreev (fields);
+  g_free (contents);
+  g_free (path);
+
+  return cpu;
+}
+
+/* Returns the live streaming threads as an array of GstAhcThreadStats */
+GArray *
+gst_ahc_get_thread_stats (GstAhc * ahc)
+{
+  GArray *stats = g_array_new (FALSE, TRUE, sizeof (GstAhcThreadStats));
+  GList *l;
+  guint i;
+
+  g_mutex_lock (&ahc->lock);
+  for (l = ahc->streaming_threads; l; l = l->next) {
+    StreamingThread *st = l->data;
+    GstAhcThreadStats s = { 0, };
+
+    /* Not running yet */
+    if (!st->tid)
+      continue;
+    s.role = st->role;
+    s.tid = st->tid;
+    s.configured = st->configured;
+    g_array_append_val (stats, s);
+  }
+  g_mutex_unlock (&ahc->lock);
+
+  for (i = 0; i < stats->len; i++) {
+    GstAhcThreadStats *s = &g_array_index (stats, GstAhcThreadStats, i);
+
+    s->cpu = read_cpu (s->tid);
+    s->migrations = read_migrations (s->tid);
+  }
+
+  return stats;
+}
@@ -0,0 +1,329 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * In-process tracer.
+ *
+ * Every element added to the pipeline, including those of branches added
+ * later, gets buffer probes on its pads. The sink pad probe notes when a
+ * buffer came in and on which thread; the first src pad probe on the same
+ * thread takes the time since then as the processing time of the element.
+ * Elements handing buffers to another thread, i.e. queues, sources and
+ * sinks have no processing time of their own in this model and stay
+ * empty. Capture to preview sink latency is taken at the preview sink.
+ *
+ * Times go into histograms of power of two microsecond buckets. Each
+ * element has a slot, which its streaming thread updates with atomic
+ * increments only, so readers never block the pipeline. The cost is two
+ * clock reads per element and buffer, cheap enough to stay on; it can
+ * still be turned off with gst_ahc_set_tracing() before the start.
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+GST_DEBUG_CATEGORY_EXTERN (gst_ahc_debug);
+#define GST_CAT_DEFAULT gst_ahc_debug
+
+#define TRACE_MAX_SLOTS 64
+#define TRACE_NAME_LEN 32
+#define TRACE_N_BUCKETS 32
+
+struct _GstAhcTraceSlot
+{
+  gchar name[TRACE_NAME_LEN];
+  GstAhcTraceKind kind;
+
+  /* Written by the thread that pushed the last buffer into the element */
+  GstClockTime entered;
+  gpointer entered_thread;
+
+  gint count;
+  gint max_us;
+  /* Bucket 0 counts times under 1 us, bucket n times under 2^n us */
+  gint buckets[TRACE_N_BUCKETS];
+};
+
+void
+gst_ahc_trace_init (GstAhc * ahc)
+{
+  ahc->tracing = TRUE;
+  ahc->trace_slots = g_new0 (GstAhcTraceSlot, TRACE_MAX_SLOTS);
+  g_mutex_init (&ahc->trace_lock);
+}
+
+void
+gst_ahc_trace_free (GstAhc * ahc)
+{
+  g_mutex_clear (&ahc->trace_lock);
+  g_free (ahc->trace_slots);
+}
+
+/* Only before gst_ahc_start() */
+void
+gst_ahc_set_tracing (GstAhc * ahc, gboolean enabled)
+{
+  g_return_if_fail (ahc->pipeline == NULL);
+
+  ahc->tracing = enabled;
+}
+
+/* Elements of the same name share a slot, so a pipeline rebuilt after a
+ * resolution change keeps adding to the same histograms */
+static GstAhcTraceSlot *
+get_slot (GstAhc * ahc, const gchar * name, GstAhcTraceKind kind)
+{
+  GstAhcTraceSlot *slot = NULL;
+  gint i, n;
+
+  g_mutex_lock (&ahc->trace_lock);
+  n = ahc->n_trace_slots;
+  for (i = 0; i < n; i++) {
+    if (ahc->trace_slots[i].kind == kind &&
+        !strncmp (ahc->trace_slots[i].name, name, TRACE_NAME_LEN - 1)) {
+      slot = &ahc->trace_slots[i];
+      break;
+    }
+  }
+
+  if (!slot && n < TRACE_MAX_SLOTS) {
+    slot = &ahc->trace_slots[n];
+    g_strlcpy (slot->name, name, TRACE_NAME_LEN);
+    slot->kind = kind;
+    /* Publish the slot after it is filled in */
+    g_atomic_int_set (&ahc->n_trace_slots, n + 1);
+  } else if (!slot) {
+    GST_WARNING ("No trace slot left for %s", name);
+  }
+  g_mutex_unlock (&ahc->trace_lock);
+
+  return slot;
+}
+
+static void
+record (GstAhcTraceSlot * slot, GstClockTime time)
+{
+  guint us = MIN (GST_TIME_AS_USECONDS (time), G_MAXINT32);
+  guint bucket = us ? MIN (g_bit_storage (us), TRACE_N_BUCKETS - 1) : 0;
+  gint max;
+
+  g_atomic_int_inc (&slot->buckets[bucket]);
+  g_atomic_int_inc (&slot->count);
+
+  do {
+    max = g_atomic_int_get (&slot->max_us);
+  } while ((gint) us > max &&
+      !g_atomic_int_compare_and_exchange (&slot->max_us, max, us));
+}
+
+static GstPadProbeReturn
+enter_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstAhcTraceSlot *slot = user_data;
+
+  slot->entered = gst_util_get_timestamp ();
+  g_atomic_pointer_set (&slot->entered_thread, g_thread_self ());
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+leave_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstAhcTraceSlot *slot = user_data;
+
+  /* Only the thread that brought the buffer in, and only once for
+   * elements like tee pushing it to several pads */
+  if (g_atomic_pointer_compare_and_exchange (&slot->entered_thread,
+          g_thread_self (), NULL))
+    record (slot, gst_util_get_timestamp () - slot->entered);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static GstPadProbeReturn
+latency_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  GstAhcTraceSlot *slot = user_data;
+  GstElement *sink = GST_ELEMENT (GST_PAD_PARENT (pad));
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstClockTime now;
+  GstClock *clock;
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  clock = gst_element_get_clock (sink);
+  if (!clock)
+    return GST_PAD_PROBE_OK;
+  now = gst_clock_get_time (clock) - gst_element_get_base_time (sink);
+  gst_object_unref (clock);
+
+  if (now >= GST_BUFFER_PTS (buffer))
+    record (slot, now - GST_BUFFER_PTS (buffer));
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+probe_pad (GstPad * pad, GstAhcTraceSlot * slot)
+{
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      GST_PAD_IS_SINK (pad) ? enter_probe : leave_probe, slot, NULL);
+}
+
+static void
+pad_added_cb (GstElement * element, GstPad * pad, gpointer user_data)
+{
+  probe_pad (pad, user_data);
+}
+
+static void
+element_added_cb (GstBin * bin, GstBin * sub_bin, GstElement * element,
+    gpointer user_data)
+{
+  GstAhc *ahc = user_data;
+  GstAhcTraceSlot *slot;
+  GstIterator *it;
+  GValue item = G_VALUE_INIT;
+
+  /* The elements inside are traced one by one */
+  if (GST_IS_BIN (element))
+    return;
+
+  slot = get_slot (ahc, GST_OBJECT_NAME (element), GST_AHC_TRACE_PROCESSING);
+  if (!slot)
+    return;
+
+  /* Request pads, e.g. of the tee, come later */
+  g_signal_connect (element, "pad-added", G_CALLBACK (pad_added_cb), slot);
+
+  it = gst_element_iterate_pads (element);
+  while (gst_iterator_next (it, &item) == GST_ITERATOR_OK) {
+    probe_pad (g_value_get_object (&item), slot);
+    g_value_reset (&item);
+  }
+  g_value_unset (&item);
+  gst_iterator_free (it);
+}
+
+/* Called while the pipeline is built, before any element is added */
+void
+gst_ahc_trace_attach (GstAhc * ahc)
+{
+  GstAhcTraceSlot *slot;
+  GstPad *pad;
+
+  if (!ahc->tracing)
+    return;
+
+  g_signal_connect (ahc->pipeline, "deep-element-added",
+      G_CALLBACK (element_added_cb), ahc);
+
+  slot = get_slot (ahc, "end-to-end", GST_AHC_TRACE_LATENCY);
+  if (!slot)
+    return;
+
+  pad = gst_element_get_static_pad (ahc->vsink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, latency_probe, slot,
+      NULL);
+  gst_object_unref (pad);
+}
+
+/* Upper bound of the bucket holding the given fraction of the samples */
+static guint
+percentile (const gint * buckets, guint64 total, gdouble fraction, guint max)
+{
+  guint64 wanted = MAX (1, (guint64) (total * fraction + 0.5));
+  guint64 seen = 0;
+  guint i;
+
+  for (i = 0; i < TRACE_N_BUCKETS; i++) {
+    seen += buckets[i];
+    if (seen >= wanted)
+      return MIN (i ? 1u << i : 1u, max);
+  }
+
+  return max;
+}
+
+/* One entry per slot, in the order they were created. Slots never saw a
+ * buffer have a count of 0. */
+GArray *
+gst_ahc_get_trace_stats (GstAhc * ahc)
+{
+  GArray *stats = g_array_new (FALSE, TRUE, sizeof (GstAhcTraceStats));
+  gint n = g_atomic_int_get (&ahc->n_trace_slots);
+  gint i, b;
+
+  for (i = 0; i < n; i++) {
+    GstAhcTraceSlot *slot = &ahc->trace_slots[i];
+    gint buckets[TRACE_N_BUCKETS];
+    GstAhcTraceStats s = { 0, };
+
+    /* The buckets of a snapshot may be a few samples apart, the
+     * percentiles are taken from their sum rather than from count */
+    for (b = 0; b < TRACE_N_BUCKETS; b++) {
+      buckets[b] = g_atomic_int_get (&slot->buckets[b]);
+      s.count += buckets[b];
+    }
+
+    s.name = slot->name;
+    s.kind = slot->kind;
+    s.max_us = g_atomic_int_get (&slot->max_us);
+    if (s.count) {
+      s.p50_us = percentile (buckets, s.count, 0.50, s.max_us);
+      s.p90_us = percentile (buckets, s.count, 0.90, s.max_us);
+      s.p99_us = percentile (buckets, s.count, 0.99, s.max_us);
+    }
+    g_array_append_val (stats, s);
+  }
+
+  return stats;
+}
+
+/* Human readable table of the slots that saw buffers, also logged */
+gchar *
+gst_ahc_dump_trace (GstAhc * ahc)
+{
+  GArray *stats = gst_ahc_get_trace_stats (ahc);
+  GString *dump = g_string_new (NULL);
+  guint i;
+
+  g_string_append_printf (dump, "%-24s %10s %8s %8s %8s %8s\n",
+      "# element", "buffers", "p50 us", "p90 us", "p99 us", "max us");
+  for (i = 0; i < stats->len; i++) {
+    GstAhcTraceStats *s = &g_array_index (stats, GstAhcTraceStats, i);
+
+    if (!s->count)
+      continue;
+    g_string_append_printf (dump, "%-24s %10" G_GUINT64_FORMAT
+        " %8u %8u %8u %8u\n", s->name, s->count, s->p50_us, s->p90_us,
+        s->p99_us, s->max_us);
+  }
+  g_array_unref (stats);
+
+  GST_INFO ("Trace:\n%s", dump->str);
+
+  return g_string_free (dump, FALSE);
+}
@@ -0,0 +1,525 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Frame rate / latency benchmark of the camera pipeline on a Linux host.
+ *
+ * The pipeline is built by the same code as on the device, with stand-in
+ * source and sink elements. For every resolution the pipeline is switched
+ * through gst_ahc_change_resolution(), warmed up, and then measured:
+ *
+ *  - sustained frame rate at the sink
+ *  - latency of each frame at the sink (running time - PTS) as percentiles
+ *  - process CPU time spent per rendered frame
+ *  - time from the resolution change request to the first frame of the new
+ *    size at the sink, for the selected switch mode
+ *
+ * Usage: ahc-bench [--source=videotestsrc] [--sink=fakesink]
+ *                  [--duration=5] [--warmup=1] [--restart] [--standby]
+ *                  [--capture-cpus=MASK] [--display-cpus=MASK]
+ *                  [--queue-buffers=3] [--queue-leak=downstream]
+ *                  [--no-trace] [--record=FILE]
+ *                  [--raw-capture=FILE] [--raw-frames=300] [WxH ...]
+ *
+ * At the end the streaming threads are listed with their CPU migrations,
+ * to compare runs with and without pinning, the branch queues with the
+ * frames they dropped, how many bus messages reached the main context and
+ * the shared stats block, followed by the histograms of the in-process
+ * tracer unless it was turned off, and the startup timeline from
+ * gst_ahc_start() to the first frame. With --raw-capture the camera is
+ * recorded for ahcreplaysrc next to the preview, and the frames the
+ * recorder wrote and dropped are listed too.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+typedef struct _Bench
+{
+  GstAhc *ahc;
+
+  GMutex lock;
+  GCond cond;
+  gboolean initialized;
+  gboolean failed;
+
+  /* Protected by lock, filled by the streaming thread */
+  gboolean recording;
+  guint64 frames;
+  GArray *latencies;
+} Bench;
+
+static gchar *src_factory = "videotestsrc";
+static gchar *sink_factory = "fakesink";
+static gint duration = 5;
+static gint warmup = 1;
+static gboolean restart = FALSE;
+static gboolean standby = FALSE;
+static gchar *capture_cpus = NULL;
+static gchar *display_cpus = NULL;
+static gint queue_buffers = 0;
+static gchar *queue_leak = NULL;
+static gboolean no_trace = FALSE;
+static gchar *record_path = NULL;
+static gchar *raw_capture_path = NULL;
+static gint raw_frames = 300;
+static gchar **resolutions = NULL;
+
+static GOptionEntry entries[] = {
+  {"source", 's', 0, G_OPTION_ARG_STRING, &src_factory,
+      "Source element factory (default: videotestsrc)", "FACTORY"},
+  {"sink", 'k', 0, G_OPTION_ARG_STRING, &sink_factory,
+      "Sink element factory (default: fakesink)", "FACTORY"},
+  {"duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+      "Measured seconds per resolution (default: 5)", "SECONDS"},
+  {"warmup", 'w', 0, G_OPTION_ARG_INT, &warmup,
+      "Seconds to run before measuring (default: 1)", "SECONDS"},
+  {"restart", 'r', 0, G_OPTION_ARG_NONE, &restart,
+      "Switch resolution through READY instead of renegotiating", NULL},
+  {"standby", 'b', 0, G_OPTION_ARG_NONE, &standby,
+      "Keep a hot standby branch per preview resolution", NULL},
+  {"capture-cpus", 'c', 0, G_OPTION_ARG_STRING, &capture_cpus,
+      "Pin the capture thread to a CPU mask, e.g. 0xf0", "MASK"},
+  {"display-cpus", 'p', 0, G_OPTION_ARG_STRING, &display_cpus,
+      "Pin the display thread to a CPU mask", "MASK"},
+  {"queue-buffers", 'q', 0, G_OPTION_ARG_INT, &queue_buffers,
+      "Frames the preview queue holds (default: 3)", "N"},
+  {"queue-leak", 'l', 0, G_OPTION_ARG_STRING, &queue_leak,
+      "none, upstream or downstream (default: downstream)", "POLICY"},
+  {"no-trace", 'n', 0, G_OPTION_ARG_NONE, &no_trace,
+      "Turn the in-process tracer off, to measure its overhead", NULL},
+  {"record", 'o', 0, G_OPTION_ARG_FILENAME, &record_path,
+      "Write a Chrome trace-event JSON file of the whole run", "FILE"},
+  {"raw-capture", 'a', 0, G_OPTION_ARG_FILENAME, &raw_capture_path,
+      "Record the camera into a raw capture file for ahcreplaysrc", "FILE"},
+  {"raw-frames", 'f', 0, G_OPTION_ARG_INT, &raw_frames,
+      "Frames the raw capture file holds (default: 300)", "N"},
+  {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &resolutions,
+      NULL, "[WxH ...]"},
+  {NULL}
+};
+
+static void
+on_error (GstAhc * ahc, const gchar * message, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_printerr ("%s\n", message);
+
+  g_mutex_lock (&bench->lock);
+  bench->failed = TRUE;
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+}
+
+static void
+on_initialized (GstAhc * ahc, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_mutex_lock (&bench->lock);
+  bench->initialized = TRUE;
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+}
+
+static const GstAhcCallbacks bench_callbacks = {
+  on_error,
+  NULL,
+  on_initialized
+};
+
+static GstPadProbeReturn
+buffer_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  Bench *bench = user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  GstElement *sink = GST_ELEMENT (GST_PAD_PARENT (pad));
+  GstClockTime now = GST_CLOCK_TIME_NONE;
+  GstClock *clock;
+
+  clock = gst_element_get_clock (sink);
+  if (clock) {
+    now = gst_clock_get_time (clock) - gst_element_get_base_time (sink);
+    gst_object_unref (clock);
+  }
+
+  g_mutex_lock (&bench->lock);
+  if (bench->recording) {
+    bench->frames++;
+    /* Live sources start their segment at 0, so PTS is the capture running
+     * time */
+    if (GST_CLOCK_TIME_IS_VALID (now) && GST_BUFFER_PTS_IS_VALID (buffer) &&
+        now >= GST_BUFFER_PTS (buffer)) {
+      GstClockTime latency = now - GST_BUFFER_PTS (buffer);
+      g_array_append_val (bench->latencies, latency);
+    }
+  }
+  g_mutex_unlock (&bench->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gint
+compare_clock_time (gconstpointer a, gconstpointer b)
+{
+  GstClockTime ta = *(const GstClockTime *) a;
+  GstClockTime tb = *(const GstClockTime *) b;
+
+  return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+static gdouble
+percentile_ms (GArray * sorted, guint p)
+{
+  if (sorted->len == 0)
+    return 0.0;
+
+  return g_array_index (sorted, GstClockTime,
+      (sorted->len - 1) * p / 100) / (gdouble) GST_MSECOND;
+}
+
+static gint64
+process_cpu_time_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return (gint64) ts.tv_sec * G_GINT64_CONSTANT (1000000000) + ts.tv_nsec;
+}
+
+static gboolean
+run_resolution (Bench * bench, const GstAhcResolution * res)
+{
+  GstAhc *ahc = bench->ahc;
+  GstStateChangeReturn ret;
+  gint64 wall_start, wall_end, cpu_start, cpu_end, deadline;
+  GstClockTime switch_latency;
+  guint64 frames;
+  gdouble seconds;
+
+  gst_ahc_change_resolution (ahc, res->width, res->height);
+  gst_ahc_play (ahc);
+
+  ret = gst_element_get_state (ahc->pipeline, NULL, NULL, 5 * GST_SECOND);
+  if (ret == GST_STATE_CHANGE_FAILURE || ret == GST_STATE_CHANGE_ASYNC) {
+    g_printerr ("%dx%d: pipeline did not reach PLAYING\n", res->width,
+        res->height);
+    return FALSE;
+  }
+
+  deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+  while (!GST_CLOCK_TIME_IS_VALID (switch_latency =
+          gst_ahc_get_resolution_switch_latency (ahc)) &&
+      g_get_monotonic_time () < deadline)
+    g_usleep (1000);
+
+  g_usleep (warmup * G_USEC_PER_SEC);
+
+  g_mutex_lock (&bench->lock);
+  bench->frames = 0;
+  g_array_set_size (bench->latencies, 0);
+  bench->recording = TRUE;
+  g_mutex_unlock (&bench->lock);
+
+  wall_start = g_get_monotonic_time ();
+  cpu_start = process_cpu_time_ns ();
+
+  g_usleep (duration * G_USEC_PER_SEC);
+
+  g_mutex_lock (&bench->lock);
+  bench->recording = FALSE;
+  wall_end = g_get_monotonic_time ();
+  cpu_end = process_cpu_time_ns ();
+  frames = bench->frames;
+  g_array_sort (bench->latencies, compare_clock_time);
+  g_mutex_unlock (&bench->lock);
+
+  seconds = (wall_end - wall_start) / (gdouble) G_USEC_PER_SEC;
+
+  g_print ("%5dx%-5d %8.2f %8.2f %8.2f %8.2f %8.2f %10.3f %10.2f\n",
+      res->width, res->height, frames / seconds,
+      percentile_ms (bench->latencies, 50),
+      percentile_ms (bench->latencies, 90),
+      percentile_ms (bench->latencies, 99),
+      percentile_ms (bench->latencies, 100),
+      frames ? (cpu_end - cpu_start) / (gdouble) frames / GST_MSECOND : 0.0,
+      GST_CLOCK_TIME_IS_VALID (switch_latency) ?
+      switch_latency / (gdouble) GST_MSECOND : -1.0);
+
+  return frames > 0;
+}
+
+static void
+set_cpus (GstAhc * ahc, GstAhcThreadRole role, const gchar * mask)
+{
+  GstAhcThreadConfig config = { 0, };
+
+  if (!mask)
+    return;
+
+  config.cpus = g_ascii_strtoull (mask, NULL, 0);
+  gst_ahc_set_thread_config (ahc, role, &config);
+}
+
+static gboolean
+set_preview_queue (GstAhc * ahc)
+{
+  static const gchar *leaks[] = { "none", "upstream", "downstream" };
+  GstAhcQueueConfig config = { 3, GST_AHC_QUEUE_LEAK_DOWNSTREAM };
+  guint i;
+
+  if (queue_buffers > 0)
+    config.max_buffers = queue_buffers;
+  if (queue_leak) {
+    for (i = 0; i < G_N_ELEMENTS (leaks); i++)
+      if (g_str_equal (queue_leak, leaks[i]))
+        break;
+    if (i == G_N_ELEMENTS (leaks))
+      return FALSE;
+    config.leak = i;
+  }
+  gst_ahc_set_queue_config (ahc, GST_AHC_BRANCH_PREVIEW, &config);
+
+  return TRUE;
+}
+
+static void
+print_queue_stats (GstAhc * ahc)
+{
+  static const gchar *types[] = { "preview", "record", "analysis" };
+  GArray *stats = gst_ahc_get_queue_stats (ahc);
+  guint i;
+
+  g_print ("%-11s %8s %8s %10s %10s\n", "# queue", "branch", "level",
+      "pushed", "dropped");
+  for (i = 0; i < stats->len; i++) {
+    GstAhcQueueStats *s = &g_array_index (stats, GstAhcQueueStats, i);
+
+    g_print ("%-11s %8d %5u/%-2u %10" G_GUINT64_FORMAT " %10"
+        G_GUINT64_FORMAT "\n", types[s->type], s->branch_id, s->level,
+        s->max_buffers, s->pushed, s->dropped);
+  }
+  g_array_unref (stats);
+}
+
+static void
+print_bus_counters (GstAhc * ahc)
+{
+  GstAhcBusCounters counters;
+
+  gst_ahc_get_bus_counters (ahc, &counters);
+  g_print ("# bus messages: %" G_GUINT64_FORMAT " posted, %" G_GUINT64_FORMAT
+      " handled on the main context\n", counters.received, counters.forwarded);
+}
+
+/* The block the Java side reads through GstAhc.getStat() */
+static void
+print_stats_block (GstAhc * ahc)
+{
+  const gint32 *stats = gst_ahc_get_stats_block (ahc);
+
+  g_print ("# stats block: %d captured, %d rendered, %d dropped, "
+      "%d renegotiations, %.1f fps, queues %d/%d, latency %d us\n",
+      stats[GST_AHC_STAT_CAPTURED], stats[GST_AHC_STAT_RENDERED],
+      stats[GST_AHC_STAT_DROPPED], stats[GST_AHC_STAT_RENEGOTIATIONS],
+      stats[GST_AHC_STAT_FPS_MILLI] / 1000.0,
+      stats[GST_AHC_STAT_PREVIEW_QUEUE_LEVEL],
+      stats[GST_AHC_STAT_BRANCH_QUEUE_LEVEL], stats[GST_AHC_STAT_LATENCY_US]);
+}
+
+static void
+print_raw_capture_stats (GstAhc * ahc, gint id)
+{
+  GstAhcRawCaptureStats stats;
+
+  if (!gst_ahc_get_raw_capture_stats (ahc, id, &stats))
+    return;
+
+  g_print ("# raw capture: %" G_GUINT64_FORMAT " written, %u pending, %"
+      G_GUINT64_FORMAT " dropped by the writer, %" G_GUINT64_FORMAT
+      " skipped\n", stats.written, stats.pending, stats.dropped,
+      stats.skipped);
+}
+
+static void
+print_startup_timeline (GstAhc * ahc)
+{
+  gchar *dump = gst_ahc_dump_startup_timeline (ahc);
+
+  g_print ("%s", dump);
+  g_free (dump);
+}
+
+static void
+print_thread_stats (GstAhc * ahc)
+{
+  static const gchar *roles[] = { "capture", "display", "encode", "other" };
+  GArray *stats = gst_ahc_get_thread_stats (ahc);
+  guint i;
+
+  g_print ("%-11s %8s %8s %10s %10s\n", "# thread", "tid", "cpu",
+      "migrated", "config");
+  for (i = 0; i < stats->len; i++) {
+    GstAhcThreadStats *s = &g_array_index (stats, GstAhcThreadStats, i);
+
+    g_print ("%-11s %8d %8d %10" G_GINT64_FORMAT " %10s\n", roles[s->role],
+        s->tid, s->cpu, s->migrations, s->configured ? "ok" : "failed");
+  }
+  g_array_unref (stats);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GArray *targets;
+  Bench bench = { 0, };
+  GstPad *pad;
+  gboolean ok = TRUE;
+  gint raw_capture = -1;
+  guint i;
+
+  ctx = g_option_context_new ("- camera pipeline benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  targets = g_array_new (FALSE, FALSE, sizeof (GstAhcResolution));
+  if (resolutions) {
+    for (i = 0; resolutions[i]; i++) {
+      GstAhcResolution res;
+
+      if (sscanf (resolutions[i], "%dx%d", &res.width, &res.height) != 2) {
+        g_printerr ("Invalid resolution '%s'\n", resolutions[i]);
+        return 1;
+      }
+      g_array_append_val (targets, res);
+    }
+  } else {
+    g_array_append_vals (targets, gst_ahc_preview_resolutions,
+        gst_ahc_n_preview_resolutions);
+  }
+
+  g_mutex_init (&bench.lock);
+  g_cond_init (&bench.cond);
+  bench.latencies = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  if (record_path)
+    gst_ahc_recorder_start (0);
+  bench.ahc = gst_ahc_new (src_factory, sink_factory, &bench_callbacks,
+      &bench);
+  gst_ahc_set_resolution_switch_mode (bench.ahc, restart ?
+      GST_AHC_RESOLUTION_SWITCH_RESTART :
+      GST_AHC_RESOLUTION_SWITCH_RENEGOTIATE);
+  gst_ahc_set_standby (bench.ahc, standby);
+  gst_ahc_set_tracing (bench.ahc, !no_trace);
+  set_cpus (bench.ahc, GST_AHC_THREAD_CAPTURE, capture_cpus);
+  set_cpus (bench.ahc, GST_AHC_THREAD_DISPLAY, display_cpus);
+  if (!set_preview_queue (bench.ahc)) {
+    g_printerr ("Invalid queue leak policy '%s'\n", queue_leak);
+    ok = FALSE;
+    goto done;
+  }
+
+  gst_ahc_start (bench.ahc);
+
+  g_mutex_lock (&bench.lock);
+  while (!bench.initialized && !bench.failed)
+    g_cond_wait (&bench.cond, &bench.lock);
+  g_mutex_unlock (&bench.lock);
+
+  if (bench.failed) {
+    ok = FALSE;
+    goto done;
+  }
+
+  pad = gst_element_get_static_pad (bench.ahc->vsink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, buffer_probe, &bench,
+      NULL);
+  gst_object_unref (pad);
+
+  if (raw_capture_path) {
+    raw_capture = gst_ahc_start_raw_capture (bench.ahc, raw_capture_path,
+        raw_frames);
+    if (raw_capture < 0) {
+      g_printerr ("Could not start the raw capture\n");
+      ok = FALSE;
+      goto done;
+    }
+  }
+
+  g_print ("# %s ! videoscale ! capsfilter ! %s, %d s per resolution, %s\n",
+      src_factory, sink_factory, duration, restart ? "restart" :
+      "renegotiate");
+  g_print ("%-11s %8s %8s %8s %8s %8s %10s %10s\n", "# size", "fps",
+      "p50 ms", "p90 ms", "p99 ms", "max ms", "cpu ms/fr", "switch ms");
+
+  for (i = 0; i < targets->len && !bench.failed; i++)
+    ok &= run_resolution (&bench, &g_array_index (targets, GstAhcResolution,
+            i));
+
+  if (standby)
+    g_print ("# standby branches hold up to %" G_GSIZE_FORMAT " bytes\n",
+        gst_ahc_get_standby_memory (bench.ahc));
+
+  print_thread_stats (bench.ahc);
+  print_queue_stats (bench.ahc);
+  if (raw_capture >= 0)
+    print_raw_capture_stats (bench.ahc, raw_capture);
+  print_bus_counters (bench.ahc);
+  print_stats_block (bench.ahc);
+  if (!no_trace) {
+    gchar *dump = gst_ahc_dump_trace (bench.ahc);
+
+    g_print ("%s", dump);
+    g_free (dump);
+  }
+  print_startup_timeline (bench.ahc);
+
+done:
+  gst_ahc_stop (bench.ahc);
+  /* After the teardown, so it is in the trace too */
+  if (record_path) {
+    GError *err = NULL;
+
+    if (!gst_ahc_recorder_stop (record_path, &err)) {
+      g_printerr ("%s\n", err->message);
+      g_error_free (err);
+      ok = FALSE;
+    }
+  }
+  gst_ahc_free (bench.ahc);
+
+  g_array_unref (bench.latencies);
+  g_array_unref (targets);
+  g_mutex_clear (&bench.lock);
+  g_cond_clear (&bench.cond);
+
+  return ok && !bench.failed ? 0 : 1;
+}
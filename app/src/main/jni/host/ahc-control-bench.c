@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * Control-to-frame latency benchmark.
+ *
+ * Runs the pipeline on the ahcfakesrc stand-in and changes the white
+ * balance mode and starts autofocus through the same calls the Java side
+ * uses, gst_ahc_set_white_balance() and gst_ahc_set_auto_focus(). The
+ * fake source encodes the applied settings in the chroma of its frames
+ * (see gstahcfakesrc.c), so a probe at the sink sees when a change
+ * arrived. Reported are the times from each call to the first frame
+ * showing its effect, which include the emulated settle times.
+ *
+ * Usage: ahc-control-bench [--sink=fakesink] [--rounds=20]
+ *                          [--wb-settle-ms=300] [--af-settle-ms=600]
+ */
+
+#include <gst/gst.h>
+#include <gst/interfaces/photography.h>
+
+#include "gstahc.h"
+
+#define TIMEOUT_US (5 * G_USEC_PER_SEC)
+#define FOCUSING_V 96
+#define FOCUSED_V 128
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  gboolean initialized;
+  gboolean playing;
+  gboolean failed;
+
+  /* Chroma of the last frame at the sink, written by the sink probe */
+  GstVideoInfo info;
+  gboolean have_info;
+  gint u;
+  gint v;
+} Bench;
+
+static gchar *sink_factory = "fakesink";
+static gint rounds = 20;
+static gint wb_settle_ms = 300;
+static gint af_settle_ms = 600;
+
+static GOptionEntry entries[] = {
+  {"sink", 'k', 0, G_OPTION_ARG_STRING, &sink_factory,
+      "Sink element factory (default: fakesink)", "FACTORY"},
+  {"rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+      "Changes of each kind (default: 20)", "N"},
+  {"wb-settle-ms", 'w', 0, G_OPTION_ARG_INT, &wb_settle_ms,
+      "Emulated white balance settle time (default: 300)", "MS"},
+  {"af-settle-ms", 'a', 0, G_OPTION_ARG_INT, &af_settle_ms,
+      "Emulated autofocus time (default: 600)", "MS"},
+  {NULL}
+};
+
+static void
+on_error (GstAhc * ahc, const gchar * message, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_printerr ("%s\n", message);
+
+  g_mutex_lock (&bench->lock);
+  bench->failed = TRUE;
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+}
+
+static void
+on_state_changed (GstAhc * ahc, GstState state, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_mutex_lock (&bench->lock);
+  if (state == GST_STATE_PLAYING)
+    bench->playing = TRUE;
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+}
+
+static void
+on_initialized (GstAhc * ahc, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_mutex_lock (&bench->lock);
+  bench->initialized = TRUE;
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+}
+
+static const GstAhcCallbacks bench_callbacks = {
+  on_error,
+  on_state_changed,
+  on_initialized
+};
+
+static GstPadProbeReturn
+chroma_probe (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  Bench *bench = user_data;
+  GstVideoFrame frame;
+
+  if (!bench->have_info) {
+    GstCaps *caps = gst_pad_get_current_caps (pad);
+
+    bench->have_info = caps && gst_video_info_from_caps (&bench->info, caps);
+    if (caps)
+      gst_caps_unref (caps);
+    if (!bench->have_info)
+      return GST_PAD_PROBE_OK;
+  }
+
+  if (!gst_video_frame_map (&frame, &bench->info,
+          GST_PAD_PROBE_INFO_BUFFER (info), GST_MAP_READ))
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&bench->lock);
+  bench->u = *(guint8 *) GST_VIDEO_FRAME_COMP_DATA (&frame, 1);
+  bench->v = *(guint8 *) GST_VIDEO_FRAME_COMP_DATA (&frame, 2);
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+
+  gst_video_frame_unmap (&frame);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+wait_for_flag (Bench * bench, gboolean * flag)
+{
+  gint64 deadline = g_get_monotonic_time () + TIMEOUT_US;
+  gboolean ret;
+
+  g_mutex_lock (&bench->lock);
+  while (!*flag && !bench->failed)
+    if (!g_cond_wait_until (&bench->cond, &bench->lock, deadline))
+      break;
+  ret = *flag && !bench->failed;
+  g_mutex_unlock (&bench->lock);
+
+  return ret;
+}
+
+/* Waits for a frame whose chroma component (u or v) has the value */
+static gboolean
+wait_for_chroma (Bench * bench, gint * component, gint value)
+{
+  gint64 deadline = g_get_monotonic_time () + TIMEOUT_US;
+  gboolean ret;
+
+  g_mutex_lock (&bench->lock);
+  while (*component != value && !bench->failed)
+    if (!g_cond_wait_until (&bench->cond, &bench->lock, deadline))
+      break;
+  ret = *component == value;
+  g_mutex_unlock (&bench->lock);
+
+  return ret;
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a;
+  gint64 tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+static void
+print_percentiles (const gchar * name, GArray * values)
+{
+  g_array_sort (values, compare_int64);
+
+  if (values->len == 0) {
+    g_print ("%-14s no samples\n", name);
+    return;
+  }
+
+  g_print ("%-14s %8.2f %8.2f %8.2f %8.2f\n", name,
+      g_array_index (values, gint64, (values->len - 1) * 50 / 100) / 1000.0,
+      g_array_index (values, gint64, (values->len - 1) * 90 / 100) / 1000.0,
+      g_array_index (values, gint64, (values->len - 1) * 99 / 100) / 1000.0,
+      g_array_index (values, gint64, values->len - 1) / 1000.0);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GArray *wb_latencies, *af_latencies;
+  Bench bench = { 0, };
+  GstAhc *ahc;
+  GstPad *pad;
+  guint failed = 0;
+  gint i;
+
+  ctx = g_option_context_new ("- control-to-frame latency benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  g_mutex_init (&bench.lock);
+  g_cond_init (&bench.cond);
+  bench.u = bench.v = -1;
+  wb_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  af_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  ahc = gst_ahc_new (GST_AHC_FAKE_SRC_FACTORY, sink_factory,
+      &bench_callbacks, &bench);
+  gst_ahc_start (ahc);
+
+  if (!wait_for_flag (&bench, &bench.initialized)) {
+    g_printerr ("Pipeline did not start\n");
+    failed++;
+    goto done;
+  }
+
+  g_object_set (ahc->ahcsrc, "wb-settle-ms", wb_settle_ms,
+      "af-settle-ms", af_settle_ms, NULL);
+  pad = gst_element_get_static_pad (ahc->vsink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, chroma_probe, &bench,
+      NULL);
+  gst_object_unref (pad);
+
+  gst_ahc_play (ahc);
+  if (!wait_for_flag (&bench, &bench.playing)) {
+    g_printerr ("Pipeline did not reach PLAYING\n");
+    failed++;
+    goto done;
+  }
+
+  /* Every round picks a mode other than the current one */
+  for (i = 0; i < rounds; i++) {
+    gint mode = GST_PHOTOGRAPHY_WB_MODE_DAYLIGHT + i % 7;
+    gint64 start = g_get_monotonic_time ();
+
+    gst_ahc_set_white_balance (ahc, mode);
+    if (wait_for_chroma (&bench, &bench.u, 64 + 8 * mode)) {
+      gint64 latency = g_get_monotonic_time () - start;
+
+      g_array_append_val (wb_latencies, latency);
+    } else {
+      failed++;
+    }
+  }
+
+  for (i = 0; i < rounds; i++) {
+    gint64 start = g_get_monotonic_time ();
+
+    gst_ahc_set_auto_focus (ahc, TRUE);
+    if (wait_for_chroma (&bench, &bench.v, FOCUSING_V) &&
+        wait_for_chroma (&bench, &bench.v, FOCUSED_V)) {
+      gint64 latency = g_get_monotonic_time () - start;
+
+      g_array_append_val (af_latencies, latency);
+    } else {
+      failed++;
+    }
+  }
+
+  g_print ("# %s ! %s, %d rounds, settle wb %d ms, af %d ms\n",
+      GST_AHC_FAKE_SRC_FACTORY, sink_factory, rounds, wb_settle_ms,
+      af_settle_ms);
+  g_print ("%-14s %8s %8s %8s %8s\n", "#", "p50 ms", "p90 ms", "p99 ms",
+      "max ms");
+  print_percentiles ("white balance", wb_latencies);
+  print_percentiles ("autofocus", af_latencies);
+  g_print ("# changes that never showed: %u\n", failed);
+
+done:
+  gst_ahc_stop (ahc);
+  gst_ahc_free (ahc);
+
+  g_array_unref (wb_latencies);
+  g_array_unref (af_latencies);
+  g_mutex_clear (&bench.lock);
+  g_cond_clear (&bench.cond);
+
+  return failed == 0 ? 0 : 1;
+}
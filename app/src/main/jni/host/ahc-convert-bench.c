@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * Conversion benchmark of ahcconvert against videoconvert.
+ *
+ * For every resolution and output format the same NV21 frame is converted
+ * repeatedly by videoconvert, then by ahcconvert with every kernel set
+ * this CPU supports, each in an "appsrc ! converter ! fakesink" pipeline.
+ * Reported are the time per frame, the speedup over videoconvert and the
+ * largest difference of any channel from the videoconvert output. The
+ * SIMD kernels must match the C kernels exactly, any difference fails the
+ * run. The best kernel set runs once more with parallel=false, in the
+ * streaming thread only, to show what splitting the frame over the
+ * scheduler gains.
+ *
+ * The "pyramid" format runs ahcpyramid with chroma on the same frame
+ * instead, with every kernel set and then the best one with
+ * parallel=false, and compares the time per frame and the levels with the
+ * C kernels.
+ *
+ * Usage: ahc-convert-bench [--frames=200] [--format=rgba|i420|pyramid]
+ *            [WxH ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+
+#include "gstahc.h"
+#include "gstahcconvert.h"
+#include "gstahcprocessor.h"
+
+static gint frames = 200;
+static gchar *format = NULL;
+static gchar **resolutions = NULL;
+
+static GOptionEntry entries[] = {
+  {"frames", 'f', 0, G_OPTION_ARG_INT, &frames,
+      "Frames per converter (default: 200)", "N"},
+  {"format", 'o', 0, G_OPTION_ARG_STRING, &format,
+      "Output format, rgba, i420 or pyramid (default: all)", "FORMAT"},
+  {G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_STRING_ARRAY, &resolutions,
+      NULL, "[WxH ...]"},
+  {NULL}
+};
+
+static const GstAhcResolution default_resolutions[] = {
+  {640, 480}, {1280, 720}, {1920, 1080},
+};
+
+/* A gradient with some noise, so no kernel gets away with flat input */
+static GstBuffer *
+make_frame (const GstVideoInfo * info)
+{
+  GstBuffer *buffer = gst_buffer_new_allocate (NULL, info->size, NULL);
+  GstVideoFrame frame;
+  guint32 seed = 1;
+  gint x, y;
+
+  gst_video_frame_map (&frame, info, buffer, GST_MAP_WRITE);
+  for (y = 0; y < GST_VIDEO_FRAME_HEIGHT (&frame); y++) {
+    guint8 *row = GST_VIDEO_FRAME_PLANE_DATA (&frame, 0) +
+        y * GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0);
+
+    for (x = 0; x < GST_VIDEO_FRAME_WIDTH (&frame); x++) {
+      seed = seed * 1103515245 + 12345;
+      row[x] = (x + y + (seed >> 28)) & 0xff;
+    }
+  }
+  for (y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT (&frame, 1); y++) {
+    guint8 *row = GST_VIDEO_FRAME_PLANE_DATA (&frame, 1) +
+        y * GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 1);
+
+    for (x = 0; x < GST_VIDEO_FRAME_COMP_WIDTH (&frame, 1); x++) {
+      row[2 * x] = (2 * x) & 0xff;
+      row[2 * x + 1] = (255 - 2 * y) & 0xff;
+    }
+  }
+  gst_video_frame_unmap (&frame);
+
+  return buffer;
+}
+
+/* Converts the frame frames times, returns the time per frame in ms and
+ * the last output, or a negative time on failure */
+static gdouble
+run (const gchar * converter, GstBuffer * frame, GstCaps * caps,
+    const gchar * out_format, GstBuffer ** last)
+{
+  GstElement *pipeline, *src, *sink;
+  GstSample *sample = NULL;
+  GstMessage *msg;
+  GError *err = NULL;
+  gchar *desc;
+  gint64 start, end;
+  gint i;
+
+  desc = g_strdup_printf ("appsrc name=src format=time ! %s ! "
+      "video/x-raw,format=%s ! fakesink name=sink sync=false", converter,
+      out_format);
+  pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+  if (!pipeline) {
+    g_printerr ("%s\n", err->message);
+    g_error_free (err);
+    return -1;
+  }
+
+  src = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  g_object_set (src, "caps", caps, NULL);
+
+  start = g_get_monotonic_time ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  for (i = 0; i < frames; i++) {
+    GstBuffer *buffer = gst_buffer_copy (frame);
+
+    GST_BUFFER_PTS (buffer) = i * 33 * GST_MSECOND;
+    gst_app_src_push_buffer (GST_APP_SRC (src), buffer);
+  }
+  gst_app_src_end_of_stream (GST_APP_SRC (src));
+
+  msg = gst_bus_timed_pop_filtered (GST_ELEMENT_BUS (pipeline),
+      GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  end = g_get_monotonic_time ();
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error (msg, &err, NULL);
+    g_printerr ("%s: %s\n", converter, err->message);
+    g_error_free (err);
+    start = end + 1;
+  } else {
+    g_object_get (sink, "last-sample", &sample, NULL);
+  }
+  gst_message_unref (msg);
+
+  *last = sample ? gst_buffer_ref (gst_sample_get_buffer (sample)) : NULL;
+  if (sample)
+    gst_sample_unref (sample);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (src);
+  gst_object_unref (sink);
+  gst_object_unref (pipeline);
+
+  return (end - start) / 1000.0 / frames;
+}
+
+/* Largest difference of any byte */
+static gint
+max_diff (GstBuffer * a, GstBuffer * b)
+{
+  GstMapInfo ma, mb;
+  gint diff = 0;
+  gsize i;
+
+  gst_buffer_map (a, &ma, GST_MAP_READ);
+  gst_buffer_map (b, &mb, GST_MAP_READ);
+  if (ma.size != mb.size) {
+    diff = 256;
+  } else {
+    for (i = 0; i < ma.size; i++)
+      diff = MAX (diff, ABS (ma.data[i] - mb.data[i]));
+  }
+  gst_buffer_unmap (a, &ma);
+  gst_buffer_unmap (b, &mb);
+
+  return diff;
+}
+
+/* Largest difference between the levels of two pyramids */
+static gint
+pyramid_diff (GstBuffer * a, GstBuffer * b)
+{
+  GstAhcPyramidMeta *pa = gst_buffer_get_ahc_pyramid_meta (a);
+  GstAhcPyramidMeta *pb = gst_buffer_get_ahc_pyramid_meta (b);
+  gint diff = 0;
+  guint i, p;
+  gint x, y;
+
+  if (!pa || !pb || pa->n_levels != pb->n_levels)
+    return 256;
+
+  for (i = 0; i < pa->n_levels; i++) {
+    const GstVideoInfo *info = &pa->levels[i].info;
+
+    for (p = 0; p < GST_VIDEO_INFO_N_PLANES (info); p++) {
+      gint width = GST_VIDEO_INFO_COMP_WIDTH (info, p) *
+          GST_VIDEO_INFO_COMP_PSTRIDE (info, p);
+      gint stride = GST_VIDEO_INFO_PLANE_STRIDE (info, p);
+      gsize offset = GST_VIDEO_INFO_PLANE_OFFSET (info, p);
+
+      for (y = 0; y < GST_VIDEO_INFO_COMP_HEIGHT (info, p); y++) {
+        const guint8 *ra = pa->levels[i].data + offset + y * stride;
+        const guint8 *rb = pb->levels[i].data + offset + y * stride;
+
+        for (x = 0; x < width; x++)
+          diff = MAX (diff, ABS (ra[x] - rb[x]));
+      }
+    }
+  }
+
+  return diff;
+}
+
+/* Runs the element with the best kernels in the streaming thread only. The
+ * output must match the C kernels like the parallel runs. Without a
+ * reference the difference to the C kernels is printed instead. */
+static gboolean
+run_single_threaded (const gchar * element, const gchar * size,
+    const gchar * label, const gchar * out_format, GstBuffer * frame,
+    GstCaps * caps, GstBuffer * reference, GstBuffer * c_output, gdouble base,
+    gint (*diff_func) (GstBuffer * a, GstBuffer * b))
+{
+  GstBuffer *output;
+  gchar *desc;
+  gdouble ms;
+  gint diff;
+  gboolean ok = TRUE;
+
+  if (!c_output)
+    return FALSE;
+
+  desc = g_strdup_printf ("%s parallel=false", element);
+  ms = run (desc, frame, caps, out_format, &output);
+  if (ms < 0 || !output) {
+    g_free (desc);
+    return FALSE;
+  }
+
+  diff = diff_func (output, reference ? reference : c_output);
+  g_print ("%-11s %7s %-22s %10.3f %7.2fx %8d\n", size, label, desc, ms,
+      base / ms, diff);
+  if (diff_func (output, c_output)) {
+    g_printerr ("%s does not match the C kernels\n", desc);
+    ok = FALSE;
+  }
+
+  gst_buffer_unref (output);
+  g_free (desc);
+
+  return ok;
+}
+
+/* The C kernels are the reference of the pyramid */
+static gboolean
+run_pyramid (const GstAhcResolution * res, GstBuffer * frame, GstCaps * caps)
+{
+  const GstAhcConvertKernels *const *kernels = gst_ahc_convert_list_kernels ();
+  GstBuffer *c_output = NULL;
+  gdouble base = 0;
+  gboolean ok = TRUE;
+  gchar *size;
+  guint i;
+
+  size = g_strdup_printf ("%dx%d", res->width, res->height);
+
+  for (i = 0; kernels[i]; i++);
+  while (i-- > 0) {
+    GstBuffer *output;
+    gchar *element;
+    gdouble ms;
+    gint diff = 0;
+
+    if (!kernels[i]->supported ())
+      continue;
+
+    element = g_strdup_printf ("ahcpyramid chroma=true kernel=%s",
+        kernels[i]->name);
+    ms = run (element, frame, caps, "NV21", &output);
+    if (ms < 0 || !output) {
+      g_free (element);
+      ok = FALSE;
+      continue;
+    }
+
+    if (!c_output) {
+      c_output = output;
+      base = ms;
+    } else {
+      diff = pyramid_diff (output, c_output);
+      gst_buffer_unref (output);
+    }
+
+    g_print ("%-11s %7s ahcpyramid kernel=%-4s %10.3f %7.2fx %8d\n", size,
+        "pyramid", kernels[i]->name, ms, base / ms, diff);
+    if (diff) {
+      g_printerr ("%s does not match the C kernels\n", element);
+      ok = FALSE;
+    }
+    g_free (element);
+  }
+
+  if (!run_single_threaded ("ahcpyramid chroma=true", size, "pyramid", "NV21",
+          frame, caps, NULL, c_output, base, pyramid_diff))
+    ok = FALSE;
+
+  if (c_output)
+    gst_buffer_unref (c_output);
+  g_free (size);
+
+  return ok;
+}
+
+static gboolean
+run_resolution (const GstAhcResolution * res, const gchar * out_format)
+{
+  const GstAhcConvertKernels *const *kernels = gst_ahc_convert_list_kernels ();
+  GstBuffer *frame, *reference, *c_output = NULL;
+  GstVideoInfo info;
+  GstCaps *caps;
+  gdouble base;
+  gboolean ok = TRUE;
+  gchar *size;
+  guint i;
+
+  gst_video_info_set_format (&info, GST_VIDEO_FORMAT_NV21, res->width,
+      res->height);
+  caps = gst_video_info_to_caps (&info);
+  frame = make_frame (&info);
+  size = g_strdup_printf ("%dx%d", res->width, res->height);
+
+  if (g_str_equal (out_format, "pyramid")) {
+    ok = run_pyramid (res, frame, caps);
+    goto done;
+  }
+
+  base = run ("videoconvert", frame, caps, out_format, &reference);
+  if (base < 0 || !reference) {
+    ok = FALSE;
+    goto done;
+  }
+  g_print ("%-11s %7s %-22s %10.3f %8s %8s\n", size, out_format,
+      "videoconvert", base, "1.00x", "-");
+
+  /* Listed best first, the C kernels come last */
+  for (i = 0; kernels[i]; i++);
+  while (i-- > 0) {
+    GstBuffer *output;
+    gchar *converter;
+    gdouble ms;
+    gint diff;
+
+    if (!kernels[i]->supported ())
+      continue;
+
+    converter = g_strdup_printf ("ahcconvert kernel=%s", kernels[i]->name);
+    ms = run (converter, frame, caps, out_format, &output);
+    if (ms < 0 || !output) {
+      g_free (converter);
+      ok = FALSE;
+      continue;
+    }
+
+    diff = max_diff (output, reference);
+    g_print ("%-11s %7s %-22s %10.3f %7.2fx %8d\n", size, out_format,
+        converter, ms, base / ms, diff);
+
+    if (!c_output) {
+      c_output = output;
+    } else {
+      if (max_diff (output, c_output)) {
+        g_printerr ("%s does not match the C kernels\n", converter);
+        ok = FALSE;
+      }
+      gst_buffer_unref (output);
+    }
+    g_free (converter);
+  }
+
+  if (!run_single_threaded ("ahcconvert", size, out_format, out_format, frame,
+          caps, reference, c_output, base, max_diff))
+    ok = FALSE;
+
+  gst_buffer_unref (reference);
+  if (c_output)
+    gst_buffer_unref (c_output);
+
+done:
+  g_free (size);
+  gst_buffer_unref (frame);
+  gst_caps_unref (caps);
+
+  return ok;
+}
+
+int
+main (int argc, char *argv[])
+{
+  static const gchar *formats[] = { "RGBA", "I420", "pyramid" };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GArray *targets;
+  gboolean ok = TRUE;
+  guint i, j;
+
+  ctx = g_option_context_new ("- camera frame conversion benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (format && g_ascii_strcasecmp (format, "rgba") &&
+      g_ascii_strcasecmp (format, "i420") &&
+      g_ascii_strcasecmp (format, "pyramid")) {
+    g_printerr ("Invalid format '%s'\n", format);
+    return 1;
+  }
+
+  targets = g_array_new (FALSE, FALSE, sizeof (GstAhcResolution));
+  if (resolutions) {
+    for (i = 0; resolutions[i]; i++) {
+      GstAhcResolution res;
+
+      if (sscanf (resolutions[i], "%dx%d", &res.width, &res.height) != 2) {
+        g_printerr ("Invalid resolution '%s'\n", resolutions[i]);
+        return 1;
+      }
+      g_array_append_val (targets, res);
+    }
+  } else {
+    g_array_append_vals (targets, default_resolutions,
+        G_N_ELEMENTS (default_resolutions));
+  }
+
+  gst_ahc_convert_register ();
+  gst_ahc_pyramid_register ();
+
+  g_print ("# NV21 to RGBA and I420, %d frames per converter, kernels "
+      "picked by default: %s\n", frames, gst_ahc_convert_get_kernels
+      (NULL)->name);
+  g_print ("%-11s %7s %-22s %10s %8s %8s\n", "# size", "format",
+      "converter", "ms/frame", "speedup", "max diff");
+
+  for (i = 0; i < targets->len; i++) {
+    for (j = 0; j < G_N_ELEMENTS (formats); j++) {
+      if (format && g_ascii_strcasecmp (format, formats[j]))
+        continue;
+      ok &= run_resolution (&g_array_index (targets, GstAhcResolution, i),
+          formats[j]);
+    }
+  }
+
+  g_array_unref (targets);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+
+/*
+ * Bus dispatch benchmark.
+ *
+ * Plays 1, 4 and 16 pipelines at once, first each on its own pipeline
+ * thread, then all on the shared dispatcher thread. While they play, every
+ * pipeline gets a ping posted on its bus at a fixed interval. Reported are
+ * the mean and max time from posting a ping to its dispatch, and the number
+ * of threads in the process.
+ *
+ * Usage: ahc-dispatch-bench [--source=videotestsrc] [--sink=fakesink]
+ *                           [--pipelines=1,4,16] [--duration=2]
+ *                           [--interval-ms=5]
+ */
+
+#include <stdlib.h>
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+#define TIMEOUT_US (5 * G_USEC_PER_SEC)
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  gboolean initialized;
+  gboolean playing;
+  gboolean failed;
+  GstAhc *ahc;
+} Instance;
+
+static gchar *src_factory = "videotestsrc";
+static gchar *sink_factory = "fakesink";
+static gchar *pipelines = "1,4,16";
+static gint duration = 2;
+static gint interval_ms = 5;
+
+static GOptionEntry entries[] = {
+  {"source", 's', 0, G_OPTION_ARG_STRING, &src_factory,
+      "Source element factory (default: videotestsrc)", "FACTORY"},
+  {"sink", 'k', 0, G_OPTION_ARG_STRING, &sink_factory,
+      "Sink element factory (default: fakesink)", "FACTORY"},
+  {"pipelines", 'p', 0, G_OPTION_ARG_STRING, &pipelines,
+      "Comma separated pipeline counts (default: 1,4,16)", "N,N,..."},
+  {"duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+      "Seconds to ping per run (default: 2)", "SECONDS"},
+  {"interval-ms", 'i', 0, G_OPTION_ARG_INT, &interval_ms,
+      "Milliseconds between pings (default: 5)", "MS"},
+  {NULL}
+};
+
+static void
+on_error (GstAhc * ahc, const gchar * message, gpointer user_data)
+{
+  Instance *inst = user_data;
+
+  g_printerr ("%s\n", message);
+
+  g_mutex_lock (&inst->lock);
+  inst->failed = TRUE;
+  g_cond_broadcast (&inst->cond);
+  g_mutex_unlock (&inst->lock);
+}
+
+static void
+on_state_changed (GstAhc * ahc, GstState state, gpointer user_data)
+{
+  Instance *inst = user_data;
+
+  g_mutex_lock (&inst->lock);
+  if (state == GST_STATE_PLAYING)
+    inst->playing = TRUE;
+  g_cond_broadcast (&inst->cond);
+  g_mutex_unlock (&inst->lock);
+}
+
+static void
+on_initialized (GstAhc * ahc, gpointer user_data)
+{
+  Instance *inst = user_data;
+
+  g_mutex_lock (&inst->lock);
+  inst->initialized = TRUE;
+  g_cond_broadcast (&inst->cond);
+  g_mutex_unlock (&inst->lock);
+}
+
+static const GstAhcCallbacks dispatch_callbacks = {
+  on_error,
+  on_state_changed,
+  on_initialized
+};
+
+static gboolean
+wait_for (Instance * inst, gboolean * flag)
+{
+  gint64 deadline = g_get_monotonic_time () + TIMEOUT_US;
+  gboolean ret;
+
+  g_mutex_lock (&inst->lock);
+  while (!*flag && !inst->failed)
+    if (!g_cond_wait_until (&inst->cond, &inst->lock, deadline))
+      break;
+  ret = *flag && !inst->failed;
+  g_mutex_unlock (&inst->lock);
+
+  return ret;
+}
+
+static gint
+count_threads (void)
+{
+  GDir *dir = g_dir_open ("/proc/self/task", 0, NULL);
+  gint n = 0;
+
+  if (!dir)
+    return -1;
+  while (g_dir_read_name (dir))
+    n++;
+  g_dir_close (dir);
+
+  return n;
+}
+
+/* Returns FALSE if a pipeline did not reach PLAYING */
+static gboolean
+run (gint n, gboolean shared, gboolean report)
+{
+  Instance *instances = g_new0 (Instance, n);
+  GstClockTime total = 0, max = 0;
+  guint64 n_pings = 0;
+  gint threads_before, threads = 0;
+  gboolean ok = TRUE;
+  gint64 end;
+  gint i;
+
+  threads_before = count_threads ();
+
+  for (i = 0; i < n; i++) {
+    Instance *inst = &instances[i];
+
+    g_mutex_init (&inst->lock);
+    g_cond_init (&inst->cond);
+    inst->ahc = gst_ahc_new (src_factory, sink_factory, &dispatch_callbacks,
+        inst);
+    gst_ahc_set_shared_dispatcher (inst->ahc, shared);
+    gst_ahc_start (inst->ahc);
+  }
+
+  for (i = 0; i < n; i++) {
+    if (!wait_for (&instances[i], &instances[i].initialized)) {
+      ok = FALSE;
+      break;
+    }
+    gst_ahc_play (instances[i].ahc);
+  }
+
+  for (i = 0; ok && i < n; i++)
+    ok = wait_for (&instances[i], &instances[i].playing);
+
+  if (ok) {
+    end = g_get_monotonic_time () + duration * G_USEC_PER_SEC;
+    while (g_get_monotonic_time () < end) {
+      for (i = 0; i < n; i++)
+        gst_ahc_ping (instances[i].ahc);
+      threads = MAX (threads, count_threads ());
+      g_usleep (interval_ms * 1000);
+    }
+    /* Let the last pings arrive */
+    g_usleep (100 * 1000);
+  }
+
+  for (i = 0; i < n; i++) {
+    Instance *inst = &instances[i];
+    GstAhcDispatchStats stats;
+
+    gst_ahc_get_dispatch_stats (inst->ahc, &stats);
+    n_pings += stats.n_pings;
+    total += stats.mean_latency * stats.n_pings;
+    max = MAX (max, stats.max_latency);
+
+    gst_ahc_stop (inst->ahc);
+    gst_ahc_free (inst->ahc);
+    g_mutex_clear (&inst->lock);
+    g_cond_clear (&inst->cond);
+  }
+  g_free (instances);
+
+  if (!report)
+    return ok;
+
+  if (!ok) {
+    g_print ("%-8s %6d   failed to reach PLAYING\n",
+        shared ? "shared" : "own", n);
+    return FALSE;
+  }
+
+  g_print ("%-8s %6d %8d %10.2f %10" G_GUINT64_FORMAT " %10.1f %10.1f\n",
+      shared ? "shared" : "own", n, threads,
+      (threads - threads_before) / (gdouble) n, n_pings,
+      n_pings ? total / n_pings / 1000.0 : 0.0, max / 1000.0);
+
+  return TRUE;
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  gchar **counts;
+  gboolean ok = TRUE;
+  gint mode, i;
+
+  ctx = g_option_context_new ("- bus dispatch benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (duration < 1 || interval_ms < 1) {
+    g_printerr ("Invalid duration or interval\n");
+    return 1;
+  }
+
+  counts = g_strsplit (pipelines, ",", -1);
+
+  /* Start the threads GStreamer keeps for the whole process first, so they
+   * do not count against the first run */
+  run (1, FALSE, FALSE);
+
+  g_print ("# %s ! %s, ping every %d ms for %d s\n", src_factory,
+      sink_factory, interval_ms, duration);
+  g_print ("%-8s %6s %8s %10s %10s %10s %10s\n", "# mode", "pipes",
+      "threads", "thr/pipe", "pings", "mean us", "max us");
+
+  for (mode = 0; mode < 2; mode++) {
+    for (i = 0; counts[i]; i++) {
+      gint n = atoi (counts[i]);
+
+      if (n < 1)
+        continue;
+      ok &= run (n, mode == 1, TRUE);
+    }
+  }
+
+  g_strfreev (counts);
+
+  return ok ? 0 : 1;
+}
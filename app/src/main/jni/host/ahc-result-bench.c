@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Processor result delivery benchmark.
+ *
+ * Runs the pipeline on the ahcfakesrc stand-in with an ANALYSIS branch and
+ * a registered processor that posts a result for every frame with
+ * gst_ahc_processor_post_message(). Reported are the times from posting a
+ * result to the processor_result callback on the main context. Fails when
+ * a result does not arrive.
+ *
+ * Usage: ahc-result-bench [--sink=fakesink] [--results=200]
+ */
+
+#include <gst/gst.h>
+
+#include "gstahc.h"
+#include "gstahcprocessor.h"
+
+#define TIMEOUT_US (5 * G_USEC_PER_SEC)
+#define RESULT_NAME "ahc-result-bench"
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  gboolean initialized;
+  gboolean playing;
+  gboolean failed;
+
+  guint posted;
+  GArray *latencies;
+} Bench;
+
+static gchar *sink_factory = "fakesink";
+static gint results = 200;
+
+static GOptionEntry entries[] = {
+  {"sink", 'k', 0, G_OPTION_ARG_STRING, &sink_factory,
+      "Sink element factory (default: fakesink)", "FACTORY"},
+  {"results", 'n', 0, G_OPTION_ARG_INT, &results,
+      "Results to wait for (default: 200)", "N"},
+  {NULL}
+};
+
+static void
+on_error (GstAhc * ahc, const gchar * message, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_printerr ("%s\n", message);
+
+  g_mutex_lock (&bench->lock);
+  bench->failed = TRUE;
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+}
+
+static void
+on_state_changed (GstAhc * ahc, GstState state, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_mutex_lock (&bench->lock);
+  if (state == GST_STATE_PLAYING)
+    bench->playing = TRUE;
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+}
+
+static void
+on_initialized (GstAhc * ahc, gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_mutex_lock (&bench->lock);
+  bench->initialized = TRUE;
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+}
+
+static void
+on_processor_result (GstAhc * ahc, const GstStructure * result,
+    gpointer user_data)
+{
+  Bench *bench = user_data;
+  gint64 posted, latency;
+
+  if (!gst_structure_has_name (result, RESULT_NAME) ||
+      !gst_structure_get_int64 (result, "posted", &posted))
+    return;
+
+  latency = g_get_monotonic_time () - posted;
+
+  g_mutex_lock (&bench->lock);
+  g_array_append_val (bench->latencies, latency);
+  g_cond_broadcast (&bench->cond);
+  g_mutex_unlock (&bench->lock);
+}
+
+static const GstAhcCallbacks bench_callbacks = {
+  on_error,
+  on_state_changed,
+  on_initialized,
+  NULL,
+  on_processor_result
+};
+
+/* Posts one result per frame, stamped with the time it was posted */
+static void
+post_result (GstAhcProcessorContext * ctx, const GstVideoFrame * frame,
+    gpointer user_data)
+{
+  Bench *bench = user_data;
+
+  g_mutex_lock (&bench->lock);
+  bench->posted++;
+  g_mutex_unlock (&bench->lock);
+
+  gst_ahc_processor_post_message (ctx, gst_structure_new (RESULT_NAME,
+          "posted", G_TYPE_INT64, g_get_monotonic_time (), NULL));
+}
+
+static gboolean
+wait_for_flag (Bench * bench, gboolean * flag)
+{
+  gint64 deadline = g_get_monotonic_time () + TIMEOUT_US;
+  gboolean ret;
+
+  g_mutex_lock (&bench->lock);
+  while (!*flag && !bench->failed)
+    if (!g_cond_wait_until (&bench->cond, &bench->lock, deadline))
+      break;
+  ret = *flag && !bench->failed;
+  g_mutex_unlock (&bench->lock);
+
+  return ret;
+}
+
+/* Waits until n results arrived, the deadline moves with every one */
+static gboolean
+wait_for_results (Bench * bench, guint n)
+{
+  gint64 deadline = g_get_monotonic_time () + TIMEOUT_US;
+  guint received = 0;
+  gboolean ret;
+
+  g_mutex_lock (&bench->lock);
+  while (bench->latencies->len < n && !bench->failed) {
+    if (bench->latencies->len != received) {
+      received = bench->latencies->len;
+      deadline = g_get_monotonic_time () + TIMEOUT_US;
+    }
+    if (!g_cond_wait_until (&bench->cond, &bench->lock, deadline))
+      break;
+  }
+  ret = bench->latencies->len >= n;
+  g_mutex_unlock (&bench->lock);
+
+  return ret;
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a;
+  gint64 tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+static void
+print_percentiles (const gchar * name, GArray * values)
+{
+  g_array_sort (values, compare_int64);
+
+  if (values->len == 0) {
+    g_print ("%-14s no samples\n", name);
+    return;
+  }
+
+  g_print ("%-14s %8.2f %8.2f %8.2f %8.2f\n", name,
+      g_array_index (values, gint64, (values->len - 1) * 50 / 100) / 1000.0,
+      g_array_index (values, gint64, (values->len - 1) * 90 / 100) / 1000.0,
+      g_array_index (values, gint64, (values->len - 1) * 99 / 100) / 1000.0,
+      g_array_index (values, gint64, values->len - 1) / 1000.0);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  Bench bench = { 0, };
+  GstAhc *ahc;
+  gint processor;
+  gboolean ok = FALSE;
+
+  ctx = g_option_context_new ("- processor result delivery benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  g_mutex_init (&bench.lock);
+  g_cond_init (&bench.cond);
+  bench.latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  processor = gst_ahc_processor_register (RESULT_NAME, post_result, &bench,
+      NULL);
+
+  ahc = gst_ahc_new (GST_AHC_FAKE_SRC_FACTORY, sink_factory,
+      &bench_callbacks, &bench);
+  gst_ahc_start (ahc);
+
+  if (!wait_for_flag (&bench, &bench.initialized)) {
+    g_printerr ("Pipeline did not start\n");
+    goto done;
+  }
+
+  if (gst_ahc_add_branch (ahc, GST_AHC_BRANCH_ANALYSIS, NULL) < 0) {
+    g_printerr ("Failed to add the analysis branch\n");
+    goto done;
+  }
+
+  gst_ahc_play (ahc);
+  if (!wait_for_flag (&bench, &bench.playing)) {
+    g_printerr ("Pipeline did not reach PLAYING\n");
+    goto done;
+  }
+
+  ok = wait_for_results (&bench, results);
+
+  g_print ("# %s ! %s, analysis branch, %d results\n",
+      GST_AHC_FAKE_SRC_FACTORY, sink_factory, results);
+  g_print ("%-14s %8s %8s %8s %8s\n", "#", "p50 ms", "p90 ms", "p99 ms",
+      "max ms");
+  print_percentiles ("delivery", bench.latencies);
+  g_print ("# results posted: %u, delivered: %u\n", bench.posted,
+      bench.latencies->len);
+
+done:
+  gst_ahc_stop (ahc);
+  gst_ahc_free (ahc);
+  gst_ahc_processor_unregister (processor);
+
+  g_array_unref (bench.latencies);
+  g_mutex_clear (&bench.lock);
+  g_cond_clear (&bench.cond);
+
+  return ok ? 0 : 1;
+}
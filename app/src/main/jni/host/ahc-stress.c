@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Multi-instance stress test.
+ *
+ * Every round N threads each create a GstAhc, start it, wait until it is
+ * PLAYING, keep it running for a while and tear it down again, all at the
+ * same time. Reported are the time from gst_ahc_new() to PLAYING and the
+ * teardown time as percentiles, failed instances, and whether threads
+ * leaked across all rounds.
+ *
+ * Usage: ahc-stress [--source=videotestsrc] [--sink=fakesink]
+ *                   [--instances=4] [--rounds=10] [--run-ms=200]
+ */
+
+#include <string.h>
+#include <gst/gst.h>
+
+#include "gstahc.h"
+
+#define TIMEOUT_US (5 * G_USEC_PER_SEC)
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  gboolean initialized;
+  gboolean playing;
+  gboolean failed;
+
+  gint64 start_latency;
+  gint64 stop_latency;
+} Instance;
+
+static gchar *src_factory = "videotestsrc";
+static gchar *sink_factory = "fakesink";
+static gint n_instances = 4;
+static gint rounds = 10;
+static gint run_ms = 200;
+
+static GOptionEntry entries[] = {
+  {"source", 's', 0, G_OPTION_ARG_STRING, &src_factory,
+      "Source element factory (default: videotestsrc)", "FACTORY"},
+  {"sink", 'k', 0, G_OPTION_ARG_STRING, &sink_factory,
+      "Sink element factory (default: fakesink)", "FACTORY"},
+  {"instances", 'n', 0, G_OPTION_ARG_INT, &n_instances,
+      "Instances running in parallel (default: 4)", "N"},
+  {"rounds", 'r', 0, G_OPTION_ARG_INT, &rounds,
+      "Create/teardown rounds (default: 10)", "N"},
+  {"run-ms", 't', 0, G_OPTION_ARG_INT, &run_ms,
+      "Milliseconds each instance plays (default: 200)", "MS"},
+  {NULL}
+};
+
+static void
+on_error (GstAhc * ahc, const gchar * message, gpointer user_data)
+{
+  Instance *inst = user_data;
+
+  g_printerr ("%s\n", message);
+
+  g_mutex_lock (&inst->lock);
+  inst->failed = TRUE;
+  g_cond_broadcast (&inst->cond);
+  g_mutex_unlock (&inst->lock);
+}
+
+static void
+on_state_changed (GstAhc * ahc, GstState state, gpointer user_data)
+{
+  Instance *inst = user_data;
+
+  g_mutex_lock (&inst->lock);
+  if (state == GST_STATE_PLAYING)
+    inst->playing = TRUE;
+  g_cond_broadcast (&inst->cond);
+  g_mutex_unlock (&inst->lock);
+}
+
+static void
+on_initialized (GstAhc * ahc, gpointer user_data)
+{
+  Instance *inst = user_data;
+
+  g_mutex_lock (&inst->lock);
+  inst->initialized = TRUE;
+  g_cond_broadcast (&inst->cond);
+  g_mutex_unlock (&inst->lock);
+}
+
+static const GstAhcCallbacks stress_callbacks = {
+  on_error,
+  on_state_changed,
+  on_initialized
+};
+
+static gboolean
+wait_for (Instance * inst, gboolean * flag)
+{
+  gint64 deadline = g_get_monotonic_time () + TIMEOUT_US;
+  gboolean ret;
+
+  g_mutex_lock (&inst->lock);
+  while (!*flag && !inst->failed)
+    if (!g_cond_wait_until (&inst->cond, &inst->lock, deadline))
+      break;
+  ret = *flag && !inst->failed;
+  g_mutex_unlock (&inst->lock);
+
+  return ret;
+}
+
+static gpointer
+instance_thread (gpointer user_data)
+{
+  Instance *inst = user_data;
+  GstAhc *ahc;
+  gint64 start, stop;
+
+  start = g_get_monotonic_time ();
+  ahc = gst_ahc_new (src_factory, sink_factory, &stress_callbacks, inst);
+  gst_ahc_start (ahc);
+
+  if (wait_for (inst, &inst->initialized)) {
+    gst_ahc_play (ahc);
+    if (wait_for (inst, &inst->playing)) {
+      inst->start_latency = g_get_monotonic_time () - start;
+      g_usleep (run_ms * 1000);
+    }
+  }
+
+  g_mutex_lock (&inst->lock);
+  if (!inst->playing)
+    inst->failed = TRUE;
+  g_mutex_unlock (&inst->lock);
+
+  stop = g_get_monotonic_time ();
+  gst_ahc_stop (ahc);
+  gst_ahc_free (ahc);
+  inst->stop_latency = g_get_monotonic_time () - stop;
+
+  return NULL;
+}
+
+static gint
+count_threads (void)
+{
+  GDir *dir = g_dir_open ("/proc/self/task", 0, NULL);
+  gint n = 0;
+
+  if (!dir)
+    return -1;
+  while (g_dir_read_name (dir))
+    n++;
+  g_dir_close (dir);
+
+  return n;
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 ta = *(const gint64 *) a;
+  gint64 tb = *(const gint64 *) b;
+
+  return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+static void
+print_percentiles (const gchar * name, GArray * values)
+{
+  g_array_sort (values, compare_int64);
+
+  if (values->len == 0) {
+    g_print ("%-12s no samples\n", name);
+    return;
+  }
+
+  g_print ("%-12s %8.2f %8.2f %8.2f %8.2f\n", name,
+      g_array_index (values, gint64, (values->len - 1) * 50 / 100) / 1000.0,
+      g_array_index (values, gint64, (values->len - 1) * 90 / 100) / 1000.0,
+      g_array_index (values, gint64, (values->len - 1) * 99 / 100) / 1000.0,
+      g_array_index (values, gint64, values->len - 1) / 1000.0);
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  GArray *start_latencies, *stop_latencies;
+  Instance *instances;
+  GThread **threads;
+  gint threads_before, threads_after;
+  gint64 wall_start;
+  guint failed = 0;
+  gint round, i;
+
+  ctx = g_option_context_new ("- multi-instance stress test");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (n_instances < 1 || rounds < 1) {
+    g_printerr ("Need at least one instance and one round\n");
+    return 1;
+  }
+
+  start_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  stop_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+  instances = g_new0 (Instance, n_instances);
+  threads = g_new0 (GThread *, n_instances);
+
+  threads_before = -1;
+
+  wall_start = g_get_monotonic_time ();
+
+  for (round = 0; round < rounds; round++) {
+    for (i = 0; i < n_instances; i++) {
+      memset (&instances[i], 0, sizeof (Instance));
+      g_mutex_init (&instances[i].lock);
+      g_cond_init (&instances[i].cond);
+      threads[i] = g_thread_new ("instance", instance_thread, &instances[i]);
+    }
+
+    for (i = 0; i < n_instances; i++) {
+      Instance *inst = &instances[i];
+
+      g_thread_join (threads[i]);
+      if (inst->failed)
+        failed++;
+      else
+        g_array_append_val (start_latencies, inst->start_latency);
+      g_array_append_val (stop_latencies, inst->stop_latency);
+      g_mutex_clear (&inst->lock);
+      g_cond_clear (&inst->cond);
+    }
+
+    /* The first round starts the threads GStreamer keeps for the whole
+     * process, leave them out of the leak check */
+    if (round == 0)
+      threads_before = count_threads ();
+  }
+
+  threads_after = count_threads ();
+
+  g_print ("# %s ! %s, %d instances x %d rounds, %d ms each, %.2f s total\n",
+      src_factory, sink_factory, n_instances, rounds, run_ms,
+      (g_get_monotonic_time () - wall_start) / (gdouble) G_USEC_PER_SEC);
+  g_print ("%-12s %8s %8s %8s %8s\n", "#", "p50 ms", "p90 ms", "p99 ms",
+      "max ms");
+  print_percentiles ("to PLAYING", start_latencies);
+  print_percentiles ("teardown", stop_latencies);
+  g_print ("# failed instances: %u, threads after first round: %d, "
+      "at the end: %d\n", failed, threads_before, threads_after);
+
+  g_array_unref (start_latencies);
+  g_array_unref (stop_latencies);
+  g_free (instances);
+  g_free (threads);
+
+  return failed == 0 && threads_after <= threads_before ? 0 : 1;
+}
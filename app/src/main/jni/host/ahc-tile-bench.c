@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2017, Collabora Ltd.
+ *   Author: Justin Kim <justin.kim@collabora.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation
+ * version 2.1 of the License.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301 USA
+ *
+ */
+
+/*
+ * Scaling benchmark of the tile scheduler.
+ *
+ * A 3x3 box blur runs over the luma plane of a frame, split into tiles of
+ * rows, with 1 to N scheduler threads. For every thread count the time per
+ * frame and the speedup over one thread are reported.
+ *
+ * Before that, every thread count runs many small back to back runs and
+ * checks that each job ran exactly once. A worker left over from one run
+ * must neither lose nor repeat jobs of the next, nor hang it.
+ *
+ * Usage: ahc-tile-bench [--width=1920] [--height=1080] [--frames=200]
+ *                       [--threads=N] [--tile-rows=16]
+ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "gstahcscheduler.h"
+
+typedef struct
+{
+  const guint8 *src;
+  guint8 *dst;
+  guint width;
+  guint height;
+} Blur;
+
+static gint width = 1920;
+static gint height = 1080;
+static gint frames = 200;
+static gint max_threads = 0;
+static gint tile_rows = 16;
+
+static GOptionEntry entries[] = {
+  {"width", 'W', 0, G_OPTION_ARG_INT, &width,
+      "Frame width (default: 1920)", "PIXELS"},
+  {"height", 'H', 0, G_OPTION_ARG_INT, &height,
+      "Frame height (default: 1080)", "PIXELS"},
+  {"frames", 'f', 0, G_OPTION_ARG_INT, &frames,
+      "Frames per thread count (default: 200)", "N"},
+  {"threads", 't', 0, G_OPTION_ARG_INT, &max_threads,
+      "Highest thread count (default: one per core)", "N"},
+  {"tile-rows", 'r', 0, G_OPTION_ARG_INT, &tile_rows,
+      "Rows per tile (default: 16)", "ROWS"},
+  {NULL}
+};
+
+/* Back to back runs with fewer jobs than threads up to a few per thread */
+#define CHECK_RUNS 10000
+
+static void
+count_job (guint job, gpointer user_data)
+{
+  gint *counts = user_data;
+
+  g_atomic_int_inc (&counts[job]);
+}
+
+static gboolean
+check_runs (GstAhcScheduler * sched)
+{
+  guint n_threads = gst_ahc_scheduler_get_n_threads (sched);
+  gint *counts = g_new (gint, 4 * n_threads);
+  gboolean ok = TRUE;
+  guint run, n_jobs, i;
+
+  for (run = 0; run < CHECK_RUNS && ok; run++) {
+    n_jobs = 1 + run % (4 * n_threads);
+    memset (counts, 0, n_jobs * sizeof (gint));
+    gst_ahc_scheduler_run (sched, n_jobs, count_job, counts);
+
+    for (i = 0; i < n_jobs; i++) {
+      if (counts[i] != 1) {
+        g_printerr ("%u threads, run %u: job %u of %u ran %d times\n",
+            n_threads, run, i, n_jobs, counts[i]);
+        ok = FALSE;
+      }
+    }
+  }
+  g_free (counts);
+
+  return ok;
+}
+
+static void
+blur_rows (guint first_row, guint n_rows, gpointer user_data)
+{
+  Blur *blur = user_data;
+  guint x, y;
+
+  for (y = first_row; y < first_row + n_rows; y++) {
+    const guint8 *above = blur->src + (y ? y - 1 : y) * blur->width;
+    const guint8 *row = blur->src + y * blur->width;
+    const guint8 *below = blur->src +
+        (y + 1 < blur->height ? y + 1 : y) * blur->width;
+    guint8 *out = blur->dst + y * blur->width;
+
+    out[0] = row[0];
+    for (x = 1; x + 1 < blur->width; x++)
+      out[x] = (above[x - 1] + above[x] + above[x + 1] +
+          row[x - 1] + row[x] + row[x + 1] +
+          below[x - 1] + below[x] + below[x + 1]) / 9;
+    out[blur->width - 1] = row[blur->width - 1];
+  }
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  Blur blur;
+  guint8 *src;
+  gdouble base_ms = 0.0;
+  gboolean ok = TRUE;
+  gint threads, i;
+
+  ctx = g_option_context_new ("- tile scheduler benchmark");
+  g_option_context_add_main_entries (ctx, entries, NULL);
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return 1;
+  }
+  g_option_context_free (ctx);
+
+  if (width < 3 || height < 1 || frames < 1 || tile_rows < 1) {
+    g_printerr ("Invalid frame size, frame count or tile size\n");
+    return 1;
+  }
+  if (max_threads <= 0)
+    max_threads = MAX (g_get_num_processors (), 1);
+
+  src = g_malloc (width * height);
+  for (i = 0; i < width * height; i++)
+    src[i] = g_random_int_range (0, 256);
+
+  blur.src = src;
+  blur.dst = g_malloc (width * height);
+  blur.width = width;
+  blur.height = height;
+
+  g_print ("# 3x3 blur of %dx%d luma, %d rows per tile, %d frames\n",
+      width, height, tile_rows, frames);
+  g_print ("%-8s %10s %10s %10s %10s\n", "# thr", "ms/frame", "fps",
+      "speedup", "effic.");
+
+  for (threads = 1; threads <= max_threads; threads++) {
+    GstAhcScheduler *sched = gst_ahc_scheduler_new (threads);
+    gint64 start, end;
+    gdouble ms;
+
+    if (!check_runs (sched)) {
+      ok = FALSE;
+      gst_ahc_scheduler_free (sched);
+      continue;
+    }
+
+    /* Warm up caches and wake up the threads once */
+    gst_ahc_scheduler_run_rows (sched, height, tile_rows, blur_rows, &blur);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < frames; i++)
+      gst_ahc_scheduler_run_rows (sched, height, tile_rows, blur_rows, &blur);
+    end = g_get_monotonic_time ();
+
+    ms = (end - start) / 1000.0 / frames;
+    if (threads == 1)
+      base_ms = ms;
+
+    g_print ("%-8d %10.3f %10.1f %10.2f %9.0f%%\n", threads, ms, 1000.0 / ms,
+        base_ms / ms, 100.0 * base_ms / ms / threads);
+
+    gst_ahc_scheduler_free (sched);
+  }
+
+  g_free (src);
+  g_free (blur.dst);
+
+  return ok ? 0 : 1;
+}